@@ -0,0 +1,109 @@
+/*!
+**  @file AT24C02.c
+**
+**  @brief Behavioural model of an AT24C02 2-kbit I2C EEPROM for the Linux host build.
+**         Byte write, page write within its 8-byte page, current address read, random read and sequential
+**         read, with the address counter rolling over at the end of the array. It starts with each byte
+**         holding its own address, so a read can be checked. The write cycle time is not modelled - a write
+**         is done, and the EEPROM answers its address again, as soon as the STOP is sent.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE AT24C02 */
+
+#include "AT24C02.h"
+
+#include <stdlib.h>
+
+// Bytes in the array, and in a page write
+#define NB_BYTES      256
+#define NB_PAGE_BYTES 8
+
+static bool Present;               // SIM_I2C_EEPROM is set
+static uint8_t Memory[NB_BYTES];
+static uint8_t Address;            // The address counter - the next byte read or written
+static bool AddressNext;           // The next byte written is the word address
+static TAT24C02Stats Stats;
+
+
+
+bool AT24C02_Init(void)
+{
+  Present = (getenv("SIM_I2C_EEPROM") != NULL);
+
+  for (uint16_t i = 0; i < NB_BYTES; i++)
+    Memory[i] = (uint8_t)i;
+
+  return true;
+}
+
+
+
+bool AT24C02_Start(const uint8_t address, const bool read)
+{
+  if (!Present || (address != AT24C02_ADDRESS))
+    return false;
+
+  // A read carries on from the address counter, which a write sets first for a random read
+  if (read)
+    Stats.nbReads++;
+  else
+    AddressNext = true;
+
+  return true;
+}
+
+
+
+bool AT24C02_Write(const uint8_t data)
+{
+  if (AddressNext)
+  {
+    Address = data;
+    AddressNext = false;
+  }
+  else
+  {
+    Memory[Address] = data;
+
+    // A page write wraps within its page
+    Address = (Address & ~(NB_PAGE_BYTES - 1)) | ((Address + 1) & (NB_PAGE_BYTES - 1));
+  }
+
+  return true;
+}
+
+
+
+uint8_t AT24C02_Read(const bool ack)
+{
+  uint8_t data = Memory[Address++];
+
+  Stats.nbBytes++;
+  return data;
+}
+
+
+
+void AT24C02_Stop(void)
+{
+  AddressNext = false;
+}
+
+
+
+const TAT24C02Stats* AT24C02_Stats(void)
+{
+  return Present ? &Stats : NULL;
+}
+
+
+
+/* END AT24C02 */
+/*!
+** @}
+*/
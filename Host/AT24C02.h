@@ -0,0 +1,66 @@
+/*! @file
+ *
+ *  @brief Behavioural model of an AT24C02 2-kbit I2C EEPROM for the Linux host build.
+ *
+ *  This contains the functions the simulated I2C0 bus uses to talk to the EEPROM as a slave. It is only on
+ *  the bus when SIM_I2C_EEPROM is set, as a second device for the I2C0 scheduler to share the bus with.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-20
+ */
+
+#ifndef AT24C02_H
+#define AT24C02_H
+
+// new types
+#include <stdint.h>
+#include <stdbool.h>
+
+// 7-bit slave address with A0-A2 low
+#define AT24C02_ADDRESS 0x50
+
+typedef struct
+{
+  uint32_t nbReads;    /*!< Reads by the master - one per address byte with the read bit set. */
+  uint32_t nbBytes;    /*!< Bytes read. */
+} TAT24C02Stats;
+
+/*! @brief Puts the EEPROM on the bus if SIM_I2C_EEPROM is set, holding each byte's own address.
+ *
+ *  @return bool - TRUE if the model was successfully initialized.
+ */
+bool AT24C02_Init(void);
+
+/*! @brief Handles a START or repeated START followed by an address byte.
+ *
+ *  @param address The 7-bit slave address.
+ *  @param read TRUE if the master is reading.
+ *  @return bool - TRUE if the EEPROM acknowledged.
+ */
+bool AT24C02_Start(const uint8_t address, const bool read);
+
+/*! @brief Handles a byte written by the master - the word address, then data for successive bytes.
+ *
+ *  @param data The byte.
+ *  @return bool - TRUE if the EEPROM acknowledged.
+ */
+bool AT24C02_Write(const uint8_t data);
+
+/*! @brief Handles a byte read by the master from successive addresses.
+ *
+ *  @param ack TRUE if the master acknowledges the byte and will read another.
+ *  @return uint8_t - the byte.
+ */
+uint8_t AT24C02_Read(const bool ack);
+
+/*! @brief Handles a STOP.
+ */
+void AT24C02_Stop(void);
+
+/*! @brief Gets what the EEPROM has done so far.
+ *
+ *  @return const TAT24C02Stats* - the counters, or NULL if it is not on the bus.
+ */
+const TAT24C02Stats* AT24C02_Stats(void);
+
+#endif
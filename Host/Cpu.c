@@ -0,0 +1,56 @@
+/*!
+**  @file Cpu.c
+**
+**  @brief Host build replacement for the Processor Expert CPU component.
+**         Low level initialization brings up the simulated tower instead of the clocks and vector table.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Cpu */
+
+#include "Cpu.h"
+#include "Sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Unused on the host - critical sections are tracked by the simulator
+volatile uint8_t SR_reg;
+volatile uint8_t SR_lock;
+
+// Referenced by the vector table - the host process has its own stack and entry point
+uint32_t __SP_INIT;
+
+void __thumb_startup(void)
+{
+}
+
+
+
+PE_ISR(Cpu_Interrupt)
+{
+  fprintf(stderr, "Cpu: unhandled interrupt\n");
+  abort();
+}
+
+
+
+void PE_low_level_init(void)
+{
+  if (!Sim_Init())
+  {
+    fprintf(stderr, "Cpu: the simulated tower could not be started\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+
+
+/* END Cpu */
+/*!
+** @}
+*/
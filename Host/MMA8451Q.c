@@ -0,0 +1,530 @@
+/*!
+**  @file MMA8451Q.c
+**
+**  @brief Behavioural model of the MMA8451Q accelerometer for the Linux host build.
+**         Covers the parts of the register map the firmware can reach - STATUS and F_STATUS, the
+**         output registers with their auto-increment rules for F_READ and the FIFO, F_SETUP, SYSMOD,
+**         INT_SOURCE, WHO_AM_I, XYZ_DATA_CFG, CTRL_REG1 to CTRL_REG5 and the offset registers.
+**         Samples are taken at the output data rate while ACTIVE. Motion detection, orientation,
+**         pulse detection and auto-SLEEP are not modelled.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE MMA8451Q */
+
+#include "MMA8451Q.h"
+#include "Sim.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Register addresses
+#define ADDRESS_STATUS       0x00 /*!< F_STATUS while the FIFO is enabled */
+#define ADDRESS_OUT_X_MSB    0x01
+#define ADDRESS_OUT_Z_MSB    0x05
+#define ADDRESS_OUT_Z_LSB    0x06
+#define ADDRESS_F_SETUP      0x09
+#define ADDRESS_SYSMOD       0x0B
+#define ADDRESS_INT_SOURCE   0x0C
+#define ADDRESS_WHO_AM_I     0x0D
+#define ADDRESS_XYZ_DATA_CFG 0x0E
+#define ADDRESS_CTRL_REG1    0x2A
+#define ADDRESS_CTRL_REG2    0x2B
+#define ADDRESS_CTRL_REG3    0x2C
+#define ADDRESS_CTRL_REG4    0x2D
+#define ADDRESS_CTRL_REG5    0x2E
+#define ADDRESS_OFF_X        0x2F
+#define NB_REGISTERS         0x32
+
+// Register bits
+#define STATUS_ZYXDR      0x0F /*!< X, Y, Z and any axis data ready */
+#define STATUS_ZYXOW      0xF0 /*!< X, Y, Z and any axis data overwritten */
+#define F_STATUS_F_OVF    0x80
+#define F_STATUS_F_WMRK   0x40
+#define F_SETUP_F_MODE    0xC0
+#define F_SETUP_F_WMRK    0x3F
+#define F_MODE_FILL       0x80 /*!< Stop accepting samples once the FIFO is full */
+#define INT_SOURCE_DRDY   0x01
+#define INT_SOURCE_FIFO   0x40
+#define CTRL_REG1_ACTIVE  0x01
+#define CTRL_REG1_F_READ  0x02
+#define CTRL_REG1_LNOISE  0x04
+#define CTRL_REG1_DR      0x38
+#define CTRL_REG1_DR_SHIFT 3
+#define CTRL_REG2_RST     0x40
+#define CTRL_REG3_IPOL    0x02
+#define XYZ_DATA_CFG_FS   0x03
+
+#define WHO_AM_I_VALUE 0x1A
+
+#define FIFO_SIZE 32
+
+// Output is 14 bits, 4096 counts per g at +/-2g
+#define COUNTS_PER_G 4096
+#define COUNTS_MAX   8191
+#define COUNTS_MIN   -8192
+
+// Noise on each axis in counts, with and without LNOISE
+#define NOISE_COUNTS        8
+#define NOISE_COUNTS_LNOISE 4
+
+// One line of recorded motion
+typedef struct
+{
+  uint64_t time;
+  double g[3];
+} TMotion;
+
+// Sample period for each DR setting - 800Hz down to 1.56Hz
+static const uint64_t SamplePeriod[8] =
+{
+  1250000u, 2500000u, 5000000u, 10000000u, 20000000u, 80000000u, 160000000u, 640000000u
+};
+
+static uint8_t Registers[NB_REGISTERS];
+static uint8_t Pointer;           // Register the next byte is read from or written to
+static bool PointerNext;          // The next byte written is the register address
+
+static int16_t Latest[3];         // Sample in the output registers while the FIFO is disabled
+static bool Fresh;                // Latest has not been read yet
+static bool ReadingFresh;         // The read in progress started on a fresh sample
+static int16_t FIFO[FIFO_SIZE][3];
+static uint8_t FIFOStart, FIFOCount;
+static bool FIFOOverflow;
+static bool FIFOEvent;            // SRC_FIFO - cleared by reading F_STATUS
+
+static uint64_t NextSample;       // When the next sample is due - 0 in STANDBY
+static uint64_t LastTime;         // Time the model was last brought up to
+static uint32_t Noise = 1;        // Noise generator state - fixed so runs repeat
+
+static TMotion* Motion;           // Recorded motion, or NULL for synthetic motion
+static size_t NbMotions, MotionIndex;
+
+static TMMA8451QStats Stats;
+
+
+
+/*! @brief Applies the power-on values of the registers
+ */
+static void Reset(void)
+{
+  memset(Registers, 0, sizeof(Registers));
+  Registers[ADDRESS_WHO_AM_I] = WHO_AM_I_VALUE;
+
+  Fresh = false;
+  FIFOStart = FIFOCount = 0;
+  FIFOOverflow = FIFOEvent = false;
+  NextSample = 0;
+}
+
+
+
+/*! @brief Loads recorded motion
+ *
+ *  @param path The file - each line is a time in milliseconds then X, Y and Z in g
+ *  @return bool - TRUE if the file was read
+ */
+static bool LoadMotion(const char* const path)
+{
+  FILE* file = fopen(path, "r");
+  char line[256];
+  size_t size = 0;
+
+  if (!file)
+  {
+    fprintf(stderr, "Sim: cannot open %s - %s\n", path, strerror(errno));
+    return false;
+  }
+
+  while (fgets(line, sizeof(line), file))
+  {
+    double ms, x, y, z;
+
+    // Blank lines and comments
+    if (sscanf(line, "%lf %lf %lf %lf", &ms, &x, &y, &z) != 4)
+      continue;
+
+    if (NbMotions == size)
+    {
+      size = size ? (size * 2) : 256;
+      TMotion* motion = realloc(Motion, size * sizeof(TMotion));
+
+      if (!motion)
+      {
+        fclose(file);
+        return false;
+      }
+
+      Motion = motion;
+    }
+
+    Motion[NbMotions].time = (uint64_t)(ms * 1000000.0);
+    Motion[NbMotions].g[0] = x;
+    Motion[NbMotions].g[1] = y;
+    Motion[NbMotions].g[2] = z;
+    NbMotions++;
+  }
+
+  fclose(file);
+  return true;
+}
+
+
+
+/*! @brief Gets the acceleration the accelerometer is subject to
+ *
+ *  @param time The simulated time in nanoseconds
+ *  @param g Where to store X, Y and Z in g
+ */
+static void GetMotion(const uint64_t time, double g[3])
+{
+  if (NbMotions > 0)
+  {
+    // Each line holds until the next one's time
+    while ((MotionIndex + 1 < NbMotions) && (Motion[MotionIndex + 1].time <= time))
+      MotionIndex++;
+
+    memcpy(g, Motion[MotionIndex].g, sizeof(Motion[MotionIndex].g));
+    return;
+  }
+
+  // The tower being slowly tilted about both horizontal axes
+  double seconds = time / 1e9;
+
+  g[0] = 0.30 * sin(2 * M_PI * seconds / 5.0);
+  g[1] = 0.20 * sin((2 * M_PI * seconds / 7.0) + 1.0);
+  g[2] = sqrt(1.0 - (g[0] * g[0]) - (g[1] * g[1]));
+}
+
+
+
+/*! @brief Takes one sample into the output registers or the FIFO
+ *
+ *  @param time When the sample is taken
+ */
+static void TakeSample(const uint64_t time)
+{
+  double g[3];
+  int16_t sample[3];
+  uint8_t fullScale = Registers[ADDRESS_XYZ_DATA_CFG] & XYZ_DATA_CFG_FS;
+  int32_t noise = (Registers[ADDRESS_CTRL_REG1] & CTRL_REG1_LNOISE) ? NOISE_COUNTS_LNOISE : NOISE_COUNTS;
+
+  GetMotion(time, g);
+
+  for (uint8_t axis = 0; axis < 3; axis++)
+  {
+    // Offsets are 2mg per count, which is 8 counts at +/-2g
+    int32_t counts = (int32_t)lround(g[axis] * COUNTS_PER_G) + ((int8_t)Registers[ADDRESS_OFF_X + axis] * 8);
+
+    Noise = (Noise * 1664525u) + 1013904223u;
+    counts += (int32_t)((Noise >> 16) % (uint32_t)((2 * noise) + 1)) - noise;
+    counts >>= fullScale;
+
+    sample[axis] = (counts > COUNTS_MAX) ? COUNTS_MAX : (counts < COUNTS_MIN) ? COUNTS_MIN : counts;
+  }
+
+  Stats.nbSamples++;
+
+  if (!(Registers[ADDRESS_F_SETUP] & F_SETUP_F_MODE))
+  {
+    if (Fresh)
+    {
+      Registers[ADDRESS_STATUS] |= STATUS_ZYXOW;
+      Stats.nbOverwritten++;
+    }
+
+    memcpy(Latest, sample, sizeof(Latest));
+    Fresh = true;
+    Registers[ADDRESS_STATUS] |= STATUS_ZYXDR;
+    return;
+  }
+
+  if (FIFOCount == FIFO_SIZE)
+  {
+    FIFOOverflow = FIFOEvent = true;
+    Stats.nbOverwritten++;
+
+    // Fill mode keeps the oldest samples, circular and trigger modes the newest
+    if ((Registers[ADDRESS_F_SETUP] & F_SETUP_F_MODE) == F_MODE_FILL)
+      return;
+
+    FIFOStart = (FIFOStart + 1) % FIFO_SIZE;
+    FIFOCount--;
+  }
+
+  memcpy(FIFO[(FIFOStart + FIFOCount) % FIFO_SIZE], sample, sizeof(sample));
+  FIFOCount++;
+
+  uint8_t watermark = Registers[ADDRESS_F_SETUP] & F_SETUP_F_WMRK;
+
+  if (watermark && (FIFOCount >= watermark))
+    FIFOEvent = true;
+}
+
+
+
+/*! @brief Gets the register after one in a read
+ *
+ *  @param address The register just read
+ *  @return uint8_t - the next register
+ */
+static uint8_t NextRegister(const uint8_t address)
+{
+  bool fastRead = Registers[ADDRESS_CTRL_REG1] & CTRL_REG1_F_READ;
+  uint8_t last = fastRead ? ADDRESS_OUT_Z_MSB : ADDRESS_OUT_Z_LSB;
+
+  // Reads past the last axis go back to the status register, or to X for the next sample in the FIFO
+  if (address == last)
+    return (Registers[ADDRESS_F_SETUP] & F_SETUP_F_MODE) ? ADDRESS_OUT_X_MSB : ADDRESS_STATUS;
+
+  // Fast reads skip the LSB registers
+  if (fastRead && (address >= ADDRESS_OUT_X_MSB) && (address < last))
+    return address + 2;
+
+  return (address + 1) % NB_REGISTERS;
+}
+
+
+
+/*! @brief Reads one of the output registers
+ *
+ *  @param address OUT_X_MSB to OUT_Z_LSB
+ *  @return uint8_t - the register
+ */
+static uint8_t ReadOutput(const uint8_t address)
+{
+  bool fifo = Registers[ADDRESS_F_SETUP] & F_SETUP_F_MODE;
+  bool fastRead = Registers[ADDRESS_CTRL_REG1] & CTRL_REG1_F_READ;
+  uint8_t axis = (address - ADDRESS_OUT_X_MSB) / 2;
+  int16_t counts = 0;
+
+  if (!fifo)
+    counts = Latest[axis];
+  else if (FIFOCount > 0)
+    counts = FIFO[FIFOStart][axis];
+
+  if (address == ADDRESS_OUT_X_MSB)
+    ReadingFresh = fifo ? (FIFOCount > 0) : Fresh;
+
+  // The last axis completes the sample - DRDY clears, or the FIFO moves on
+  if (address == (fastRead ? ADDRESS_OUT_Z_MSB : ADDRESS_OUT_Z_LSB))
+  {
+    Stats.nbReads++;
+    if (ReadingFresh)
+      Stats.nbFreshReads++;
+
+    if (!fifo)
+    {
+      Fresh = false;
+      Registers[ADDRESS_STATUS] = 0;
+    }
+    else if (FIFOCount > 0)
+    {
+      FIFOStart = (FIFOStart + 1) % FIFO_SIZE;
+      FIFOCount--;
+    }
+  }
+
+  // 14-bit data is left justified across the MSB and LSB registers
+  return ((address - ADDRESS_OUT_X_MSB) % 2) ? (uint8_t)((uint16_t)counts << 2) : (uint8_t)(counts >> 6);
+}
+
+
+
+/*! @brief Reads a register, with any side effects of reading it
+ *
+ *  @param address The register
+ *  @return uint8_t - the register
+ */
+static uint8_t ReadRegister(const uint8_t address)
+{
+  switch (address)
+  {
+    case ADDRESS_STATUS:
+      if (!(Registers[ADDRESS_F_SETUP] & F_SETUP_F_MODE))
+        return Registers[ADDRESS_STATUS];
+      else
+      {
+        uint8_t watermark = Registers[ADDRESS_F_SETUP] & F_SETUP_F_WMRK;
+        uint8_t status = FIFOCount;
+
+        if (FIFOOverflow)
+          status |= F_STATUS_F_OVF;
+        if (watermark && (FIFOCount >= watermark))
+          status |= F_STATUS_F_WMRK;
+
+        FIFOOverflow = false;
+        FIFOEvent = false;
+        return status;
+      }
+
+    case ADDRESS_INT_SOURCE:
+      return ((Fresh && !(Registers[ADDRESS_F_SETUP] & F_SETUP_F_MODE)) ? INT_SOURCE_DRDY : 0) |
+             (FIFOEvent ? INT_SOURCE_FIFO : 0);
+
+    default:
+      if ((address >= ADDRESS_OUT_X_MSB) && (address <= ADDRESS_OUT_Z_LSB))
+        return ReadOutput(address);
+
+      return (address < NB_REGISTERS) ? Registers[address] : 0;
+  }
+}
+
+
+
+/*! @brief Writes a register, with any side effects of writing it
+ *
+ *  @param address The register
+ *  @param data The value
+ */
+static void WriteRegister(const uint8_t address, const uint8_t data)
+{
+  switch (address)
+  {
+    case ADDRESS_F_SETUP:
+      // Disabling the FIFO empties it
+      if (!(data & F_SETUP_F_MODE))
+      {
+        FIFOStart = FIFOCount = 0;
+        FIFOOverflow = FIFOEvent = false;
+      }
+      Registers[address] = data;
+      break;
+
+    case ADDRESS_CTRL_REG1:
+      Registers[address] = data;
+
+      if (!(data & CTRL_REG1_ACTIVE))
+        NextSample = 0;
+      else if (NextSample == 0)
+        NextSample = LastTime + SamplePeriod[(data & CTRL_REG1_DR) >> CTRL_REG1_DR_SHIFT];
+
+      Registers[ADDRESS_SYSMOD] = (data & CTRL_REG1_ACTIVE) ? 1 : 0;
+      break;
+
+    case ADDRESS_CTRL_REG2:
+      if (data & CTRL_REG2_RST)
+        Reset();
+      else
+        Registers[address] = data;
+      break;
+
+    // Read-only
+    case ADDRESS_STATUS:
+    case ADDRESS_SYSMOD:
+    case ADDRESS_INT_SOURCE:
+    case ADDRESS_WHO_AM_I:
+      break;
+
+    default:
+      if ((address > ADDRESS_OUT_Z_LSB) && (address < NB_REGISTERS))
+        Registers[address] = data;
+      break;
+  }
+}
+
+
+
+bool MMA8451Q_Init(void)
+{
+  const char* path = getenv("SIM_ACCEL_DATA");
+
+  Reset();
+
+  return (!path || LoadMotion(path));
+}
+
+
+
+bool MMA8451Q_Start(const uint8_t address, const bool read)
+{
+  if (address != MMA8451Q_ADDRESS)
+    return false;
+
+  // A read carries on from the register address written before the repeated START
+  if (!read)
+    PointerNext = true;
+
+  return true;
+}
+
+
+
+bool MMA8451Q_Write(const uint8_t data)
+{
+  if (PointerNext)
+  {
+    Pointer = data;
+    PointerNext = false;
+  }
+  else
+  {
+    WriteRegister(Pointer, data);
+    Pointer = (Pointer + 1) % NB_REGISTERS;
+  }
+
+  return true;
+}
+
+
+
+uint8_t MMA8451Q_Read(const bool ack)
+{
+  uint8_t data = ReadRegister(Pointer);
+
+  Pointer = NextRegister(Pointer);
+  return data;
+}
+
+
+
+void MMA8451Q_Stop(void)
+{
+  PointerNext = false;
+}
+
+
+
+uint64_t MMA8451Q_Update(const uint64_t time)
+{
+  while (NextSample && (NextSample <= time))
+  {
+    TakeSample(NextSample);
+    NextSample += SamplePeriod[(Registers[ADDRESS_CTRL_REG1] & CTRL_REG1_DR) >> CTRL_REG1_DR_SHIFT];
+  }
+
+  LastTime = time;
+  return NextSample ? NextSample : SIM_NEVER;
+}
+
+
+
+bool MMA8451Q_INT1(void)
+{
+  // Each enabled source goes to INT1 if its CTRL_REG5 bit is set, or INT2 otherwise
+  bool active = ReadRegister(ADDRESS_INT_SOURCE) & Registers[ADDRESS_CTRL_REG4] & Registers[ADDRESS_CTRL_REG5];
+
+  // Active low unless IPOL is set
+  return (Registers[ADDRESS_CTRL_REG3] & CTRL_REG3_IPOL) ? active : !active;
+}
+
+
+
+const TMMA8451QStats* MMA8451Q_Stats(void)
+{
+  return &Stats;
+}
+
+
+
+/* END MMA8451Q */
+/*!
+** @}
+*/
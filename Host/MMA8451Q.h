@@ -0,0 +1,83 @@
+/*! @file
+ *
+ *  @brief Behavioural model of the MMA8451Q accelerometer for the Linux host build.
+ *
+ *  This contains the functions the simulated I2C0 bus uses to talk to the accelerometer as a slave,
+ *  and the functions the simulator uses to run its sampling clock and read its INT1 pin.
+ *  The motion it measures is synthetic unless SIM_ACCEL_DATA names a file of
+ *  "<time in ms> <x in g> <y in g> <z in g>" lines, which are held until the next line's time.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-31
+ */
+
+#ifndef MMA8451Q_H
+#define MMA8451Q_H
+
+// new types
+#include <stdint.h>
+#include <stdbool.h>
+
+// 7-bit slave address with SA0 high, as wired on the tower
+#define MMA8451Q_ADDRESS 0x1D
+
+typedef struct
+{
+  uint32_t nbSamples;      /*!< Samples taken while ACTIVE. */
+  uint32_t nbReads;        /*!< Complete X, Y and Z reads by the master. */
+  uint32_t nbFreshReads;   /*!< Reads that returned a sample not read before. */
+  uint32_t nbOverwritten;  /*!< Samples lost because the master had not read them in time. */
+} TMMA8451QStats;
+
+/*! @brief Resets the accelerometer and loads the motion it measures.
+ *
+ *  @return bool - TRUE if the model was successfully initialized.
+ */
+bool MMA8451Q_Init(void);
+
+/*! @brief Handles a START or repeated START followed by an address byte.
+ *
+ *  @param address The 7-bit slave address.
+ *  @param read TRUE if the master is reading.
+ *  @return bool - TRUE if the accelerometer acknowledged.
+ */
+bool MMA8451Q_Start(const uint8_t address, const bool read);
+
+/*! @brief Handles a byte written by the master - the register address, then data for successive registers.
+ *
+ *  @param data The byte.
+ *  @return bool - TRUE if the accelerometer acknowledged.
+ */
+bool MMA8451Q_Write(const uint8_t data);
+
+/*! @brief Handles a byte read by the master from successive registers.
+ *
+ *  @param ack TRUE if the master acknowledges the byte and will read another.
+ *  @return uint8_t - the byte.
+ */
+uint8_t MMA8451Q_Read(const bool ack);
+
+/*! @brief Handles a STOP.
+ */
+void MMA8451Q_Stop(void);
+
+/*! @brief Takes every sample due up to a time.
+ *
+ *  @param time The simulated time in nanoseconds.
+ *  @return uint64_t - when the next sample is due, or SIM_NEVER while in STANDBY.
+ */
+uint64_t MMA8451Q_Update(const uint64_t time);
+
+/*! @brief Gets the level of the INT1 pin.
+ *
+ *  @return bool - TRUE if the pin is high.
+ */
+bool MMA8451Q_INT1(void);
+
+/*! @brief Gets what the accelerometer has done so far.
+ *
+ *  @return const TMMA8451QStats* - the counters.
+ */
+const TMMA8451QStats* MMA8451Q_Stats(void);
+
+#endif
@@ -0,0 +1,491 @@
+/*!
+**  @file OS.c
+**
+**  @brief Host implementation of the RTOS in OS.h, for the Linux host build.
+**         Each thread is a pthread, but only the thread the scheduler has picked runs at any one time,
+**         so the firmware sees the same single-core, strict-priority behaviour as on the tower.
+**         Threads made ready by an ISR are dispatched when the outermost ISR exits. One that should preempt
+**         the running thread does so once that thread next unmasks interrupts, rather than at an arbitrary
+**         instruction.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE OS */
+
+#include "OS.h"
+#include "Sim.h"
+#include "Threads.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Priority of the running thread when every thread is blocked
+#define NO_THREAD 0xFF
+
+typedef struct
+{
+  pthread_t thread;
+  pthread_cond_t resume;        // Signalled when the scheduler picks this thread
+  void (*code)(void* pd);
+  void* pData;
+  void* stack;                  // Top of the tower stack - only used to tell Threads_Account whose time it is
+  OS_STATE state;
+  OS_ECB* event;                // Semaphore being waited on
+  uint32_t delay;               // Ticks left before a delay or timeout ends - 0 waits forever
+  OS_ERROR result;              // Why the last wait ended
+} TTCB;
+
+static TTCB TCB[OS_LOWEST_PRIORITY];
+static OS_ECB ECB[OS_MAX_EVENTS];
+static uint8_t NbECBs;
+
+static pthread_mutex_t KernelLock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t Running = NO_THREAD;
+static bool Started;
+static volatile bool PreemptPending; // A higher priority thread was made ready while the running thread could not be stopped
+static uint32_t Time;
+
+static __thread uint8_t Self = NO_THREAD; // Priority of the calling thread
+static __thread uint8_t ISRNesting;
+
+
+
+/*! @brief Finds the highest priority thread that is ready to run
+ *
+ *  @return uint8_t - its priority, or NO_THREAD
+ *  @note Must be called with the kernel locked
+ */
+static uint8_t HighestReady(void)
+{
+  for (uint8_t priority = 0; priority < OS_LOWEST_PRIORITY; priority++)
+    if (TCB[priority].state == OS_STATE_READY)
+      return priority;
+
+  return NO_THREAD;
+}
+
+
+
+/*! @brief Hands the CPU to a thread
+ *
+ *  @param priority The thread to run, or NO_THREAD
+ *  @note Must be called with the kernel locked
+ */
+static void SwitchTo(const uint8_t priority)
+{
+  Threads_Account((Running == NO_THREAD) ? NULL : TCB[Running].stack);
+
+  Running = priority;
+  PreemptPending = false;
+  Sim_CPUIdle(priority == NO_THREAD);
+
+  if (priority != NO_THREAD)
+    pthread_cond_signal(&TCB[priority].resume);
+}
+
+
+
+/*! @brief Parks the calling thread until the scheduler picks it
+ *
+ *  @note Must be called with the kernel locked
+ */
+static void Suspend(void)
+{
+  while (Running != Self)
+  {
+    pthread_cond_wait(&TCB[Self].resume, &KernelLock);
+
+    // A thread picked by an ISR waits for the simulator to finish with the other models
+    if (Running == Self)
+    {
+      pthread_mutex_unlock(&KernelLock);
+      Sim_WaitForCPU();
+      pthread_mutex_lock(&KernelLock);
+    }
+  }
+}
+
+
+
+/*! @brief Blocks the calling thread and runs the next one
+ *
+ *  @note Must be called with the kernel locked, after the caller's state has been changed
+ */
+static void Block(void)
+{
+  SwitchTo(HighestReady());
+  Suspend();
+}
+
+
+
+/*! @brief Runs a thread that has just been made ready, if it should preempt the caller
+ *
+ *  @param priority The thread that was made ready
+ *  @note Must be called with the kernel locked
+ */
+static void MadeReady(const uint8_t priority)
+{
+  // ISRs leave the scheduling to OS_ISRExit
+  if (!Started || (ISRNesting > 0))
+    return;
+
+  if (Running == NO_THREAD)
+    SwitchTo(priority);
+  else if (priority < Running)
+  {
+    // A thread can only be stopped by itself, and not while it has interrupts masked
+    if ((Self != Running) || Sim_InterruptsMasked())
+      PreemptPending = true;
+    else
+    {
+      SwitchTo(priority);
+      Suspend();
+    }
+  }
+}
+
+
+
+/*! @brief Entry point of every thread's pthread - waits to be scheduled, then runs the thread's code
+ *
+ *  @param arg The thread's priority
+ */
+static void* ThreadEntry(void* arg)
+{
+  Self = (uint8_t)(uintptr_t)arg;
+
+  pthread_mutex_lock(&KernelLock);
+  Suspend();
+  pthread_mutex_unlock(&KernelLock);
+
+  (*TCB[Self].code)(TCB[Self].pData);
+
+  // Threads should never return, but one that does is treated as deleted
+  OS_ThreadDelete(OS_PRIORITY_SELF);
+  return NULL;
+}
+
+
+
+void OS_HostPreempt(void)
+{
+  if (!PreemptPending || (Self == NO_THREAD) || (ISRNesting > 0))
+    return;
+
+  pthread_mutex_lock(&KernelLock);
+
+  uint8_t priority = HighestReady();
+
+  if ((Running == Self) && (priority < Self))
+  {
+    SwitchTo(priority);
+    Suspend();
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+}
+
+
+
+void OS_Init(const uint32_t cpuCoreClk, const bool toggleLED)
+{
+  for (uint8_t priority = 0; priority < OS_LOWEST_PRIORITY; priority++)
+  {
+    TCB[priority].state = OS_STATE_DORMANT;
+    pthread_cond_init(&TCB[priority].resume, NULL);
+  }
+}
+
+
+
+void OS_ISREnter(void)
+{
+  ISRNesting++;
+}
+
+
+
+void OS_ISRExit(void)
+{
+  if (--ISRNesting > 0)
+    return;
+
+  pthread_mutex_lock(&KernelLock);
+
+  uint8_t priority = HighestReady();
+
+  if (Started && (priority != NO_THREAD))
+  {
+    if (Running == NO_THREAD)
+      SwitchTo(priority);
+    else if (priority < Running)
+      PreemptPending = true;
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+}
+
+
+
+OS_ECB* OS_SemaphoreCreate(const uint32_t value)
+{
+  OS_ECB* pEvent = NULL;
+
+  pthread_mutex_lock(&KernelLock);
+
+  if (NbECBs < OS_MAX_EVENTS)
+  {
+    pEvent = &ECB[NbECBs++];
+    pEvent->count    = value;
+    pEvent->waitList = 0;
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+
+  return pEvent;
+}
+
+
+
+OS_ERROR OS_SemaphoreSignal(OS_ECB* const pEvent)
+{
+  OS_ERROR error = OS_NO_ERROR;
+
+  pthread_mutex_lock(&KernelLock);
+
+  // The highest priority waiting thread takes the signal directly
+  uint8_t priority;
+
+  for (priority = 0; priority < OS_LOWEST_PRIORITY; priority++)
+    if ((TCB[priority].state == OS_STATE_SEMAPHORE) && (TCB[priority].event == pEvent))
+      break;
+
+  if (priority < OS_LOWEST_PRIORITY)
+  {
+    TCB[priority].state  = OS_STATE_READY;
+    TCB[priority].event  = NULL;
+    TCB[priority].delay  = 0;
+    TCB[priority].result = OS_NO_ERROR;
+    pEvent->waitList &= ~(1u << priority);
+    MadeReady(priority);
+  }
+  else if (pEvent->count == UINT32_MAX)
+    error = OS_SEMAPHORE_OVERFLOW;
+  else
+    pEvent->count++;
+
+  pthread_mutex_unlock(&KernelLock);
+
+  return error;
+}
+
+
+
+OS_ERROR OS_SemaphoreWait(OS_ECB* const pEvent, const uint32_t timeout)
+{
+  OS_ERROR error = OS_NO_ERROR;
+
+  pthread_mutex_lock(&KernelLock);
+
+  if (pEvent->count > 0)
+    pEvent->count--;
+  else
+  {
+    TCB[Self].state = OS_STATE_SEMAPHORE;
+    TCB[Self].event = pEvent;
+    TCB[Self].delay = timeout;
+    pEvent->waitList |= (1u << Self);
+    Block();
+    error = TCB[Self].result;
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+
+  return error;
+}
+
+
+
+void OS_Start(void)
+{
+  pthread_mutex_lock(&KernelLock);
+
+  if (!Started)
+  {
+    Started = true;
+    SwitchTo(HighestReady());
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+
+  // The simulator thread and the RTOS threads carry on from here
+  for (;;)
+    pause();
+}
+
+
+
+OS_ERROR OS_ThreadCreate(void (*thread)(void* pd), void* pData, void* pStack, const uint8_t priority)
+{
+  OS_ERROR error = OS_NO_ERROR;
+
+  if (priority >= OS_LOWEST_PRIORITY)
+    return OS_PRIORITY_INVALID;
+
+  pthread_mutex_lock(&KernelLock);
+
+  if (TCB[priority].state != OS_STATE_DORMANT)
+    error = OS_PRIORITY_EXISTS;
+  else
+  {
+    // The tower stack is not used - each pthread has its own
+    TCB[priority].code  = thread;
+    TCB[priority].pData = pData;
+    TCB[priority].stack = pStack;
+    TCB[priority].state = OS_STATE_READY;
+    TCB[priority].event = NULL;
+    TCB[priority].delay = 0;
+
+    if (pthread_create(&TCB[priority].thread, NULL, ThreadEntry, (void*)(uintptr_t)priority) != 0)
+    {
+      TCB[priority].state = OS_STATE_DORMANT;
+      error = OS_NO_MORE_TCBS;
+    }
+    else
+      MadeReady(priority);
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+
+  return error;
+}
+
+
+
+OS_ERROR OS_ThreadDelete(uint8_t priority)
+{
+  if (ISRNesting > 0)
+    return OS_THREAD_DELETE_ISR;
+
+  if (priority == OS_PRIORITY_SELF)
+    priority = Self;
+
+  if (priority == OS_LOWEST_PRIORITY)
+    return OS_THREAD_DELETE_IDLE;
+
+  if (priority > OS_LOWEST_PRIORITY)
+    return OS_PRIORITY_INVALID;
+
+  pthread_mutex_lock(&KernelLock);
+
+  if (TCB[priority].state == OS_STATE_DORMANT)
+  {
+    pthread_mutex_unlock(&KernelLock);
+    return OS_THREAD_DELETE_ERROR;
+  }
+
+  TCB[priority].state = OS_STATE_DORMANT;
+
+  if (TCB[priority].event)
+    TCB[priority].event->waitList &= ~(1u << priority);
+
+  if (priority != Self)
+  {
+    pthread_cancel(TCB[priority].thread);
+    pthread_detach(TCB[priority].thread);
+    pthread_mutex_unlock(&KernelLock);
+    return OS_NO_ERROR;
+  }
+
+  SwitchTo(HighestReady());
+  pthread_mutex_unlock(&KernelLock);
+
+  pthread_detach(pthread_self());
+  pthread_exit(NULL);
+}
+
+
+
+void OS_TimeDelay(const uint32_t ticks)
+{
+  if (ticks == 0)
+    return;
+
+  pthread_mutex_lock(&KernelLock);
+
+  TCB[Self].state = OS_STATE_DELAYED;
+  TCB[Self].delay = ticks;
+  Block();
+
+  pthread_mutex_unlock(&KernelLock);
+}
+
+
+
+uint32_t OS_TimeGet(void)
+{
+  return Time;
+}
+
+
+
+void OS_TimeSet(const uint32_t ticks)
+{
+  Time = ticks;
+}
+
+
+
+void OS_ContextSwitchISR(void)
+{
+  // Context switches happen in the scheduler itself on the host
+}
+
+
+
+void OS_SysTickISR(void)
+{
+  OS_ISREnter();
+
+  pthread_mutex_lock(&KernelLock);
+
+  Time++;
+
+  for (uint8_t priority = 0; priority < OS_LOWEST_PRIORITY; priority++)
+  {
+    TTCB* tcb = &TCB[priority];
+
+    if (((tcb->state != OS_STATE_DELAYED) && (tcb->state != OS_STATE_SEMAPHORE)) || (tcb->delay == 0))
+      continue;
+
+    if (--tcb->delay > 0)
+      continue;
+
+    if (tcb->state == OS_STATE_SEMAPHORE)
+    {
+      tcb->event->waitList &= ~(1u << priority);
+      tcb->event  = NULL;
+      tcb->result = OS_TIMEOUT;
+    }
+
+    tcb->state = OS_STATE_READY;
+    MadeReady(priority);
+  }
+
+  pthread_mutex_unlock(&KernelLock);
+
+  OS_ISRExit();
+}
+
+
+
+/* END OS */
+/*!
+** @}
+*/
@@ -0,0 +1,1537 @@
+/*!
+**  @file Sim.c
+**
+**  @brief Simulated TWR-K70F120M for the Linux host build.
+**         The register file is anonymous memory mapped at the MK70F12 addresses, so the firmware's
+**         register accesses compile unchanged. A simulator thread works out when each peripheral model
+**         next has something to do, moves data for the peripherals at that time and takes their interrupts
+**         through the vector table under the emulated interrupt masks.
+**         In virtual time the clock jumps straight from one event to the next, but only once the firmware
+**         has finished reacting to the last one - thread and ISR code take no simulated time at all.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Sim */
+
+#define _GNU_SOURCE
+
+#include "Sim.h"
+#include "SimI2C.h"
+#include "SimFlash.h"
+#include "MK70F12.h"
+#include "Cpu.h"
+#include "OS.h"
+#include "DMA.h"
+#include "packet.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+// Period of the simulator thread in wall-clock time
+#define STEP_NS 100000u
+
+// eDMA request registers read as this when nothing has been written since the simulator last looked
+#define DMA_REQUEST_NONE DMA_SERQ_NOP_MASK
+
+// Debug Exception and Monitor Control Register trace enable, and DWT cycle counter enable
+#define DEMCR_TRCENA_MASK       0x01000000u
+#define DWT_CTRL_CYCCNTENA_MASK 0x1u
+
+// Size of a trapped page of the register file
+#define TRAP_PAGE_SIZE 0x1000u
+
+// Most pages that can be trapped
+#define NB_TRAPS 4
+
+// x86-64 trap flag, and the page fault error code bit set by a write
+#define EFLAGS_TF_MASK   0x100
+#define PF_ERR_WRITE_MASK 0x2
+
+// Bits on the wire per UART character - start, 8 data and stop
+#define UART_BITS_PER_BYTE 10
+
+// Most bytes read from the pseudo-terminal in one step
+#define UART_NB_BYTES_PER_STEP 64
+
+// Deepest UART2 receive FIFO SIM_UART_FIFO can ask for - PFIFO can describe up to 128 entries
+#define UART_FIFO_MAX 128
+
+// A byte on its way to the UART2 receiver, and when the PC starts sending it
+typedef struct
+{
+  uint64_t time;
+  uint8_t data;
+} TRxByte;
+
+// A page of the register file whose accesses are passed to a model
+typedef struct
+{
+  uint32_t base;
+  volatile uint8_t* alias;    // The same memory, mapped where the model can use it without trapping
+  TSimAccess access;
+} TTrap;
+
+// Interrupt masks - one lock stands for both, as either stops the simulator taking an interrupt
+static pthread_mutex_t InterruptLock;
+static __thread uint32_t MaskDepth;    // Critical sections and masks held by this thread
+static __thread bool MaskHeld[2];      // PRIMASK and FAULTMASK held by this thread
+
+// What the CPU is doing - WFI sleeps until NbInterrupts changes
+static pthread_mutex_t CPULock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t CPUCond  = PTHREAD_COND_INITIALIZER;
+static uint32_t NbInterrupts;
+static bool CPUStarted;       // The RTOS has started scheduling threads
+static bool CPUIdle;          // Every thread is blocked
+static bool CPUAsleep;        // A thread is waiting in WFI
+static bool CPUSpinning;      // A thread is polling a register that will not change until SpinUntil
+static uint64_t SpinUntil;
+static bool SimActive;        // The simulator is stepping the models, so threads it wakes must wait
+
+// Trapped pages - TrapLock is held from the fault until the model has seen the access
+static pthread_mutex_t TrapLock = PTHREAD_MUTEX_INITIALIZER;
+static TTrap Traps[NB_TRAPS];
+static uint8_t NbTraps;
+static __thread TTrap* Trapped;        // Page whose access the calling thread is single-stepping
+static __thread uint32_t TrappedOffset;
+static __thread uint8_t TrappedBefore;
+static __thread bool TrappedWrite;
+
+// Configuration from the environment
+static bool Virtual;          // Time is simulated rather than taken from the wall clock
+static uint64_t Duration;     // How long to run for - 0 runs forever
+static FILE* UARTLog;
+
+// UART2 pseudo-terminal
+static int UARTMaster = -1;
+static int UARTSlave  = -1;
+static char UARTName[64];
+
+// Simulated time in nanoseconds since the simulator was started
+static uint64_t Time;
+static uint64_t StartTime;    // Wall-clock time the simulator was started
+static bool Taken;            // An interrupt has been taken since the models were last stepped
+
+// Peripheral model state
+static uint64_t NextTick;     // When the RTOS tick is next due
+static uint64_t NextPIT;      // When PIT channel 0 next expires - 0 while it is stopped
+static uint32_t PITLoad;      // Load value of the current PIT period
+static uint64_t NextRTC;      // When the RTC seconds counter next increments - 0 while it is stopped
+static uint64_t FTMCount;     // FTM0 counter at the previous step, without wrapping
+
+// UART2 receiver - bytes queued by the script or the pseudo-terminal
+static TRxByte* RxQueue;
+static size_t RxStart, RxEnd, RxSize;
+static uint64_t RxLineFree;   // When the receiver finishes the byte it is taking in
+static bool RxScripted;       // The script supplies all the input
+static bool RxIdlePending;    // Bytes have been received since the line was last idle
+static UART_MemMapPtr UART;   // UART2's registers, seen without trapping
+static uint8_t RxFIFO[UART_FIFO_MAX]; // Hardware receive FIFO - the oldest byte is also in D
+static uint8_t RxFIFODepth = 1;       // Entries, from SIM_UART_FIFO - the K70's UART2 has 1
+static uint8_t RxFIFOStart, RxFIFOCount;
+static uint8_t TxData;        // Last byte written to D, which the transmitter takes - reads of D see the receiver
+
+// UART2 transmitter, fed either by TDRE interrupts or by an eDMA channel
+static uint64_t TxLineFree;   // When the transmitter finishes the byte it is sending
+static bool TxEnabled;        // Transmit interrupts or DMA requests were enabled at the previous step
+static int8_t TxChannel = -1; // eDMA channel moving bytes to the transmitter, or -1
+static bool TxBuffered;       // D holds a byte the transmitter has not taken yet
+
+// eDMA channels whose major loop a peripheral model finished inside a trapped access, still to be taken
+static uint32_t DMAInterrupts;
+
+// Measurements
+static uint32_t NbTxBytes, NbRxBytes;
+static uint32_t NbRxInterrupts;                  // UART2 interrupts taken for RDRF, IDLE or OR
+static uint64_t TxDigest = 0xCBF29CE484222325u;  // FNV-1a of every byte sent and when it was sent
+static uint8_t TxFrameLeft;                      // Bytes left in the packet being sent
+static bool TxFrameLength;                       // The next byte sent is an extended frame's length
+static uint8_t TxFrameCommand;                   // Command of the packet being sent, without the ACK bit
+static uint32_t NbAccelSamples, NbAccelBytes;    // Accelerometer samples sent, and the bytes of the packets carrying them
+static uint64_t LastPIT;                         // When the PIT last expired
+static bool PITPending;                          // The PIT has expired since the last accelerometer packet
+static uint32_t NbLatencies;
+static uint64_t LatencyMin = SIM_NEVER, LatencyMax, LatencyTotal;
+
+static pthread_t SimThread;
+
+
+
+/*! @brief Gets the time from the monotonic clock
+ *
+ *  @return uint64_t - nanoseconds
+ */
+static uint64_t Now(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000u) + now.tv_nsec;
+}
+
+
+
+/*! @brief Gets the earlier of two times
+ */
+static uint64_t Earliest(const uint64_t time1, const uint64_t time2)
+{
+  return (time1 < time2) ? time1 : time2;
+}
+
+
+
+/*! @brief Maps one block of the register file at its hardware address
+ *
+ *  @param base The hardware address of the block
+ *  @param size The size of the block in bytes
+ *  @return bool - TRUE if the block was mapped
+ */
+static bool MapRegion(const uint32_t base, const uint32_t size)
+{
+  void* region = mmap((void*)(uintptr_t)base, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+  if (region != (void*)(uintptr_t)base)
+  {
+    fprintf(stderr, "Sim: cannot map 0x%08X - %s\n", (unsigned)base, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+
+
+/*! @brief Applies the reset values of the registers the firmware waits on
+ */
+static void Reset(void)
+{
+  // Erased flash reads as all 1s
+  memset((void*)(uintptr_t)SIM_FLASH_BASE, 0xFF, SIM_FLASH_SIZE);
+
+  // Transmitter empty
+  UART2_S1 = UART_S1_TDRE_MASK | UART_S1_TC_MASK;
+
+  DMA_SERQ = DMA_REQUEST_NONE;
+  DMA_CERQ = DMA_REQUEST_NONE;
+  DMA_CINT = DMA_REQUEST_NONE;
+}
+
+
+
+/*! @brief Opens the pseudo-terminal that stands in for UART2's RS232 port
+ *
+ *  @return bool - TRUE if the pseudo-terminal was opened
+ */
+static bool OpenUART(void)
+{
+  struct termios settings;
+
+  UARTMaster = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if ((UARTMaster < 0) || (grantpt(UARTMaster) < 0) || (unlockpt(UARTMaster) < 0) ||
+      (ptsname_r(UARTMaster, UARTName, sizeof(UARTName)) != 0))
+    return false;
+
+  // Holding the slave open stops reads failing while no PC software is connected
+  UARTSlave = open(UARTName, O_RDWR | O_NOCTTY);
+
+  if ((UARTSlave < 0) || (tcgetattr(UARTSlave, &settings) < 0))
+    return false;
+
+  cfmakeraw(&settings);
+  tcsetattr(UARTSlave, TCSANOW, &settings);
+  fcntl(UARTMaster, F_SETFL, O_NONBLOCK);
+
+  // Scripts can find the port by a fixed name
+  const char* link = getenv("SIM_UART_LINK");
+
+  if (link)
+  {
+    unlink(link);
+    if (symlink(UARTName, link) < 0)
+      fprintf(stderr, "Sim: cannot link %s - %s\n", link, strerror(errno));
+  }
+
+  fprintf(stderr, "Sim: UART2 is %s\n", UARTName);
+  return true;
+}
+
+
+
+/*! @brief Queues a byte for the PC to send to UART2
+ *
+ *  @param time When the PC starts sending it
+ *  @param data The byte
+ *  @return bool - TRUE if there was memory for it
+ */
+static bool RxPut(const uint64_t time, const uint8_t data)
+{
+  if (RxEnd == RxSize)
+  {
+    size_t size = RxSize ? (RxSize * 2) : 256;
+    TRxByte* queue = realloc(RxQueue, size * sizeof(TRxByte));
+
+    if (!queue)
+      return false;
+
+    RxQueue = queue;
+    RxSize  = size;
+  }
+
+  RxQueue[RxEnd].time = time;
+  RxQueue[RxEnd].data = data;
+  RxEnd++;
+  return true;
+}
+
+
+
+/*! @brief Queues everything in the UART script
+ *
+ *  @param path The script - each line is a time in milliseconds followed by the bytes to send then, in hex
+ *  @return bool - TRUE if the script was read
+ */
+static bool LoadUARTScript(const char* const path)
+{
+  FILE* script = fopen(path, "r");
+  char* line = NULL; // Read whole however long it is - a line split in two would take its second half's first byte as a time
+  size_t size = 0;
+
+  if (!script)
+  {
+    fprintf(stderr, "Sim: cannot open %s - %s\n", path, strerror(errno));
+    return false;
+  }
+
+  while (getline(&line, &size, script) != -1)
+  {
+    char* next;
+    double ms = strtod(line, &next);
+
+    // Blank lines and comments
+    if (next == line)
+      continue;
+
+    for (;;)
+    {
+      char* end;
+      unsigned long data = strtoul(next, &end, 16);
+
+      if (end == next)
+        break;
+
+      if ((data > 0xFF) || !RxPut((uint64_t)(ms * 1000000.0), (uint8_t)data))
+      {
+        fprintf(stderr, "Sim: bad line in %s - %s", path, line);
+        free(line);
+        fclose(script);
+        return false;
+      }
+
+      next = end;
+    }
+  }
+
+  free(line);
+  fclose(script);
+  RxScripted = true;
+  return true;
+}
+
+
+
+/*! @brief Reads the simulator's settings from the environment
+ *
+ *  @return bool - TRUE if they are all usable
+ */
+static bool Configure(void)
+{
+  const char* setting = getenv("SIM_TIME");
+
+  if (setting && (strcmp(setting, "virtual") == 0))
+    Virtual = true;
+  else if (setting && (strcmp(setting, "real") != 0))
+  {
+    fprintf(stderr, "Sim: SIM_TIME must be real or virtual\n");
+    return false;
+  }
+
+  setting = getenv("SIM_DURATION");
+
+  if (setting)
+    Duration = (uint64_t)(strtod(setting, NULL) * 1000000000.0);
+
+  setting = getenv("SIM_UART_SCRIPT");
+
+  if (setting && !LoadUARTScript(setting))
+    return false;
+
+  setting = getenv("SIM_UART_FIFO");
+
+  if (setting)
+  {
+    unsigned long depth = strtoul(setting, NULL, 10);
+
+    // PFIFO can only describe 1 entry, or 4 to 128 in powers of two
+    if ((depth > UART_FIFO_MAX) || ((depth != 1) && ((depth < 4) || (depth & (depth - 1)))))
+    {
+      fprintf(stderr, "Sim: SIM_UART_FIFO must be 1, or a power of two from 4 to %u\n", (unsigned)UART_FIFO_MAX);
+      return false;
+    }
+
+    RxFIFODepth = (uint8_t)depth;
+  }
+
+  setting = getenv("SIM_UART_LOG");
+
+  if (setting && !(UARTLog = fopen(setting, "w")))
+  {
+    fprintf(stderr, "Sim: cannot open %s - %s\n", setting, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+
+
+/*! @brief Waits, in virtual time, until the firmware has finished with everything that has happened so far
+ *
+ *  @note Registers are only looked at and interrupts only taken once the CPU has nothing to do, so where the
+ *  firmware gets to between events never depends on how the host schedules its threads.
+ */
+static void Settle(void)
+{
+  if (!Virtual)
+    return;
+
+  pthread_mutex_lock(&CPULock);
+  SimActive = false;
+  pthread_cond_broadcast(&CPUCond);
+
+  while (!CPUSpinning && !(CPUStarted && (CPUIdle || CPUAsleep)))
+    pthread_cond_wait(&CPUCond, &CPULock);
+
+  SimActive = true;
+  pthread_mutex_unlock(&CPULock);
+}
+
+
+
+/*! @brief Models the free-running DWT cycle counter at the core clock
+ */
+static void StepCycleCounter(void)
+{
+  if ((CoreDebug_base_DEMCR_REG(CoreDebug_BASE_PTR) & DEMCR_TRCENA_MASK) && (DWT_CTRL & DWT_CTRL_CYCCNTENA_MASK))
+    DWT_CYCCNT = (uint32_t)(Time * (CPU_CORE_CLK_HZ / 1000000u) / 1000u);
+}
+
+
+
+/*! @brief Holds a thread polling a trapped register until the model could have changed it
+ *
+ *  @param until When the register could next read differently
+ *  @note Against the wall clock the thread just polls again. In virtual time the clock moves on to the
+ *  time asked for, but a thread that has interrupts masked - or an ISR - cannot let the simulator take
+ *  anything else in the meantime, so it moves the clock and DWT_CYCCNT on itself.
+ */
+static void BusyWait(const uint64_t until)
+{
+  if (!Virtual)
+    return;
+
+  pthread_mutex_lock(&CPULock);
+
+  if ((MaskDepth > 0) || pthread_equal(pthread_self(), SimThread))
+  {
+    if (until > Time)
+      Time = until;
+
+    StepCycleCounter(); // so the wait shows in the cycles the firmware measures
+  }
+  else
+  {
+    CPUSpinning = true;
+    SpinUntil = until;
+    pthread_cond_broadcast(&CPUCond);
+
+    while (CPUSpinning || SimActive)
+      pthread_cond_wait(&CPUCond, &CPULock);
+  }
+
+  pthread_mutex_unlock(&CPULock);
+}
+
+
+
+/*! @brief Finds the trapped page holding an address
+ *
+ *  @param address The address
+ *  @return TTrap* - the page, or NULL if it is not trapped
+ */
+static TTrap* FindTrap(const uintptr_t address)
+{
+  for (uint8_t i = 0; i < NbTraps; i++)
+    if ((address >= Traps[i].base) && (address < Traps[i].base + TRAP_PAGE_SIZE))
+      return &Traps[i];
+
+  return NULL;
+}
+
+
+
+/*! @brief Catches an access to a trapped page, and lets the instruction run one step with the page unprotected
+ */
+static void TrapFault(int signal, siginfo_t* info, void* context)
+{
+  ucontext_t* ucontext = context;
+  TTrap* trap = FindTrap((uintptr_t)info->si_addr);
+
+  // Any other fault is a bug in the firmware - it faults again, this time fatally
+  if (!trap)
+  {
+    sigaction(SIGSEGV, &(struct sigaction){.sa_handler = SIG_DFL}, NULL);
+    return;
+  }
+
+  pthread_mutex_lock(&TrapLock);
+  Trapped       = trap;
+  TrappedOffset = (uintptr_t)info->si_addr - trap->base;
+  TrappedBefore = trap->alias[TrappedOffset];
+  TrappedWrite  = (ucontext->uc_mcontext.gregs[REG_ERR] & PF_ERR_WRITE_MASK);
+
+  mprotect((void*)(uintptr_t)trap->base, TRAP_PAGE_SIZE, PROT_READ | PROT_WRITE);
+  ucontext->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF_MASK;
+}
+
+
+
+/*! @brief Protects the page again once the trapped instruction has run, and passes the access to the model
+ */
+static void TrapStep(int signal, siginfo_t* info, void* context)
+{
+  ucontext_t* ucontext = context;
+  TTrap* trap = Trapped;
+
+  ucontext->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF_MASK;
+
+  if (!trap)
+    return;
+
+  Trapped = NULL;
+  mprotect((void*)(uintptr_t)trap->base, TRAP_PAGE_SIZE, PROT_NONE);
+
+  // A read-modify-write instruction may fault as a read, but the model needs to know it wrote
+  bool write = TrappedWrite || (trap->alias[TrappedOffset] != TrappedBefore);
+  uint64_t until = trap->access(TrappedOffset, write, TrappedBefore);
+
+  pthread_mutex_unlock(&TrapLock);
+
+  if (!write && (until != SIM_NEVER))
+    BusyWait(until);
+}
+
+
+
+/*! @brief Releases a thread polling a register once the time it was waiting for has come
+ *
+ *  @return uint64_t - when the thread is to be released
+ */
+static uint64_t StepSpin(void)
+{
+  uint64_t next = SIM_NEVER;
+
+  pthread_mutex_lock(&CPULock);
+
+  if (CPUSpinning)
+  {
+    if (Time >= SpinUntil)
+    {
+      CPUSpinning = false;
+      Taken = true;
+      pthread_cond_broadcast(&CPUCond);
+    }
+    else
+      next = SpinUntil;
+  }
+
+  pthread_mutex_unlock(&CPULock);
+  return next;
+}
+
+
+
+/*! @brief Gets how long UART2 takes to send or receive a byte at its current baud rate
+ *
+ *  @return uint64_t - nanoseconds
+ */
+static uint64_t UARTByteTime(void)
+{
+  // baud = bus clock / (16 * (SBR + BRFA / 32))
+  uint64_t divisor = ((((uint64_t)(UART_BDH_REG(UART) & UART_BDH_SBR_MASK) << 8) | UART_BDL_REG(UART)) * 32) +
+                     (UART_C4_REG(UART) & UART_C4_BRFA_MASK);
+
+  if (divisor == 0)
+    divisor = 32;
+
+  return (UART_BITS_PER_BYTE * 16 * divisor * 1000000000u) / (32 * (uint64_t)CPU_BUS_CLK_HZ);
+}
+
+
+
+/*! @brief Updates the latency measurement with a byte leaving UART2
+ *
+ *  @param data The byte
+ *  @param time When its last bit left the wire
+ *  @note The command byte of a CMD_ACCEL packet or stream frame ends the measurement started by the PIT.
+ *  Accelerometer samples are also counted here, from each packet's command or each stream frame's length.
+ */
+static void MeasureLatency(const uint8_t data, const uint64_t time)
+{
+  if (TxFrameLength)
+  {
+    // Payload and checksum
+    TxFrameLength = false;
+    TxFrameLeft   = data + 1;
+
+    uint32_t nbSamples = 0;
+
+    if ((TxFrameCommand == CMD_ACCEL_STREAM) && (data >= 3))
+      nbSamples = (data - 3) / 3;
+    else if ((TxFrameCommand == CMD_ACCEL_STREAM14) && (data >= 3))
+      nbSamples = (data - 3) / 6;
+    else if ((TxFrameCommand == CMD_ACCEL_DELTA) && (data >= 6))
+      nbSamples = 1 + (((data - 6) * 2) / 3); // The first sample, then three 4-bit deltas per sample
+
+    if (nbSamples > 0)
+    {
+      NbAccelSamples += nbSamples;
+      NbAccelBytes   += PACKET_FRAME_NB_BYTES(data);
+    }
+    return;
+  }
+
+  if (TxFrameLeft > 0)
+  {
+    TxFrameLeft--;
+    return;
+  }
+
+  uint8_t command = data & ~PACKET_ACK_MASK;
+
+  TxFrameCommand = command;
+
+  if (command == CMD_ACCEL)
+  {
+    NbAccelSamples++;
+    NbAccelBytes += PACKET_NB_BYTES;
+  }
+
+  if ((command == CMD_ACCEL_STREAM) || (command == CMD_ACCEL_STREAM14) || (command == CMD_ACCEL_DELTA) ||
+      (command == CMD_ACCEL_STATS) || (command == CMD_I2C_STATS) || (command == CMD_I2C_ERRORS) ||
+      (command == CMD_I2C_BUS) || (command == CMD_BENCH) || (command == CMD_ISRSTATS) ||
+      (command == CMD_THREADS) || (command == CMD_TRACE) || (command == CMD_I2C_LOAD) ||
+      (command == CMD_UART_STATS))
+    TxFrameLength = true;
+  else
+    TxFrameLeft = 4;
+
+  if (((command == CMD_ACCEL) || (command == CMD_ACCEL_STREAM) || (command == CMD_ACCEL_STREAM14) ||
+       (command == CMD_ACCEL_DELTA)) && PITPending)
+  {
+    uint64_t latency = time - LastPIT;
+
+    PITPending = false;
+    NbLatencies++;
+    LatencyTotal += latency;
+    LatencyMin = Earliest(LatencyMin, latency);
+    if (latency > LatencyMax)
+      LatencyMax = latency;
+  }
+}
+
+
+
+/*! @brief Sends a byte from UART2 to the PC
+ *
+ *  @param data The byte
+ *  @param time When its last bit leaves the wire
+ */
+static void UARTSend(const uint8_t data, const uint64_t time)
+{
+  // Bytes are lost if the PC is not reading, as they would be on the serial line
+  (void)!write(UARTMaster, &data, 1);
+
+  if (UARTLog)
+    fprintf(UARTLog, "%.3f %02X\n", time / 1000.0, data);
+
+  // FNV-1a over the byte and its time, so a run can be checked against another with one number
+  for (uint8_t i = 0; i < sizeof(time); i++)
+    TxDigest = (TxDigest ^ (uint8_t)(time >> (8 * i))) * 0x100000001B3u;
+  TxDigest = (TxDigest ^ data) * 0x100000001B3u;
+
+  NbTxBytes++;
+  MeasureLatency(data, time);
+}
+
+
+
+/*! @brief Takes a UART2 interrupt, and notes whether it loaded the transmit data register
+ */
+static void UARTInterrupt(void)
+{
+  // Without the DMA, any UART2 interrupt taken while TDRE and TIE are set refills D from the TxFIFO,
+  // or clears TIE when the TxFIFO is empty
+  bool txInterrupt = !(UART_C5_REG(UART) & UART_C5_TDMAS_MASK) && (UART_C2_REG(UART) & UART_C2_TIE_MASK) &&
+                     (UART_S1_REG(UART) & UART_S1_TDRE_MASK);
+
+  Sim_Interrupt(SIM_VECTOR_UART2);
+
+  if (txInterrupt && (UART_C2_REG(UART) & UART_C2_TIE_MASK))
+  {
+    TxBuffered = true;
+    UART_S1_REG(UART) &= ~UART_S1_TDRE_MASK;
+  }
+}
+
+
+
+/*! @brief Takes a UART2 interrupt for the receiver
+ */
+static void UARTReceiveInterrupt(void)
+{
+  NbRxInterrupts++;
+  UARTInterrupt();
+}
+
+
+
+/*! @brief Gets how many bytes the UART2 receive FIFO holds with RXFE as the firmware has set it
+ *
+ *  @return uint8_t - the depth
+ */
+static uint8_t RxFIFOSize(void)
+{
+  return (UART_PFIFO_REG(UART) & UART_PFIFO_RXFE_MASK) ? RxFIFODepth : 1;
+}
+
+
+
+/*! @brief Shows the firmware the oldest byte in the receive FIFO, the count and whether the watermark is reached
+ *
+ *  @note Called with the traps locked.
+ */
+static void RxFIFOUpdate(void)
+{
+  uint8_t watermark = UART_RWFIFO_REG(UART) ? UART_RWFIFO_REG(UART) : 1;
+
+  UART_RCFIFO_REG(UART) = RxFIFOCount;
+
+  if (RxFIFOCount > 0)
+    UART_D_REG(UART) = RxFIFO[RxFIFOStart];
+
+  if (RxFIFOCount >= watermark)
+    UART_S1_REG(UART) |= UART_S1_RDRF_MASK;
+  else
+    UART_S1_REG(UART) &= ~UART_S1_RDRF_MASK;
+}
+
+
+
+/*! @brief Handles the firmware accessing UART2 - reading D takes a byte from the receive FIFO
+ */
+static uint64_t UARTAccess(const uint32_t offset, const bool write, const uint8_t before)
+{
+  volatile uint8_t* registers = (volatile uint8_t*)UART;
+
+  switch (offset)
+  {
+    case offsetof(struct UART_MemMap, D):
+      if (write)
+      {
+        // The transmitter has its own data register - reads still see the receiver's
+        TxData = registers[offset];
+        registers[offset] = before;
+      }
+      else if (RxFIFOCount > 0)
+      {
+        RxFIFOStart = (RxFIFOStart + 1) % UART_FIFO_MAX;
+        RxFIFOCount--;
+        RxFIFOUpdate();
+      }
+      else
+        UART_SFIFO_REG(UART) |= UART_SFIFO_RXUF_MASK;
+      break;
+
+    case offsetof(struct UART_MemMap, CFIFO):
+      if (write && (registers[offset] & UART_CFIFO_RXFLUSH_MASK))
+      {
+        RxFIFOCount = 0;
+        RxFIFOUpdate();
+      }
+
+      // The flush bits always read as 0
+      registers[offset] &= ~(UART_CFIFO_RXFLUSH_MASK | UART_CFIFO_TXFLUSH_MASK);
+      break;
+
+    case offsetof(struct UART_MemMap, SFIFO):
+      // Status flags are cleared by writing 1s
+      if (write)
+        registers[offset] = before & ~registers[offset];
+      break;
+
+    case offsetof(struct UART_MemMap, RWFIFO):
+      if (write)
+        RxFIFOUpdate();
+      break;
+  }
+
+  return SIM_NEVER;
+}
+
+
+
+/*! @brief Models the UART2 receiver - bytes queue in the receive FIFO until the watermark raises RDRF, and IDLE
+ *  is raised once the PC stops sending
+ *
+ *  @return uint64_t - when the receiver next has something to do
+ */
+static uint64_t StepUARTReceive(void)
+{
+  uint8_t data[UART_NB_BYTES_PER_STEP];
+
+  // Whatever the PC software writes to the pseudo-terminal goes out now, unless a script is feeding the port
+  ssize_t nbBytes = read(UARTMaster, data, sizeof(data));
+
+  for (ssize_t i = 0; (i < nbBytes) && !RxScripted; i++)
+    RxPut(Time, data[i]);
+
+  if (!(UART_C2_REG(UART) & UART_C2_RE_MASK))
+    return SIM_NEVER;
+
+  uint64_t byteTime = UARTByteTime();
+
+  while (RxStart < RxEnd)
+  {
+    uint64_t received = RxQueue[RxStart].time;
+
+    if (received < RxLineFree)
+      received = RxLineFree;
+    received += byteTime;
+
+    if (received > Time)
+      return received;
+
+    RxLineFree = received;
+    RxIdlePending = true;
+    NbRxBytes++;
+
+    Sim_LockTraps();
+
+    bool overrun = (RxFIFOCount >= RxFIFOSize());
+
+    // A byte arriving at a full FIFO is lost
+    if (overrun)
+      UART_S1_REG(UART) |= UART_S1_OR_MASK;
+    else
+    {
+      RxFIFO[(RxFIFOStart + RxFIFOCount) % UART_FIFO_MAX] = RxQueue[RxStart].data;
+      RxFIFOCount++;
+      RxFIFOUpdate();
+    }
+
+    bool interrupt = (overrun && (UART_C3_REG(UART) & UART_C3_ORIE_MASK)) ||
+                     ((UART_S1_REG(UART) & UART_S1_RDRF_MASK) && (UART_C2_REG(UART) & UART_C2_RIE_MASK));
+
+    Sim_UnlockTraps();
+    RxStart++;
+
+    if (interrupt)
+      UARTReceiveInterrupt();
+
+    // Reading S1 then D clears OR - the ISR always does both
+    UART_S1_REG(UART) &= ~UART_S1_OR_MASK;
+  }
+
+  RxStart = RxEnd = 0;
+
+  if (!RxIdlePending)
+    return SIM_NEVER;
+
+  // The line goes idle a character time after the last stop bit
+  if (RxLineFree + byteTime > Time)
+    return RxLineFree + byteTime;
+
+  RxIdlePending = false;
+  UART_S1_REG(UART) |= UART_S1_IDLE_MASK;
+
+  if (UART_C2_REG(UART) & UART_C2_ILIE_MASK)
+    UARTReceiveInterrupt();
+
+  UART_S1_REG(UART) &= ~UART_S1_IDLE_MASK;
+  return SIM_NEVER;
+}
+
+
+
+/*! @brief Models the eDMA request registers - picks up whatever was written to SERQ, CERQ and CINT
+ */
+static void StepDMARequests(void)
+{
+  // SERQ, CERQ and CINT are write-only on the hardware - take whatever was written since the last step
+  uint8_t set   = __atomic_exchange_n(&DMA_SERQ, DMA_REQUEST_NONE, __ATOMIC_SEQ_CST);
+  uint8_t clear = __atomic_exchange_n(&DMA_CERQ, DMA_REQUEST_NONE, __ATOMIC_SEQ_CST);
+  uint8_t interrupt = __atomic_exchange_n(&DMA_CINT, DMA_REQUEST_NONE, __ATOMIC_SEQ_CST);
+
+  // Models on the firmware's threads serve requests too, so the enables are changed atomically
+  if (!(clear & DMA_REQUEST_NONE))
+    __atomic_fetch_and(&DMA_ERQ, ~(1u << (clear & DMA_CERQ_CERQ_MASK)), __ATOMIC_SEQ_CST);
+  if (!(interrupt & DMA_REQUEST_NONE))
+    __atomic_fetch_and(&DMA_INT, ~(1u << (interrupt & DMA_CINT_CINT_MASK)), __ATOMIC_SEQ_CST);
+  if (!(set & DMA_REQUEST_NONE))
+    __atomic_fetch_or(&DMA_ERQ, (1u << (set & DMA_SERQ_SERQ_MASK)), __ATOMIC_SEQ_CST);
+}
+
+
+
+/*! @brief Finds the eDMA channel serving a peripheral's requests
+ *
+ *  @param source The DMAMUX request source
+ *  @return int8_t - the channel, or -1 if none is enabled
+ */
+static int8_t DMAChannel(const uint8_t source)
+{
+  for (uint8_t channelNb = 0; channelNb < DMA_NB_CHANNELS; channelNb++)
+    if ((DMA_ERQ & (1u << channelNb)) && (DMAMUX0_CHCFG(channelNb) & DMAMUX_CHCFG_ENBL_MASK) &&
+        ((DMAMUX0_CHCFG(channelNb) & DMAMUX_CHCFG_SOURCE_MASK) == source))
+      return channelNb;
+
+  return -1;
+}
+
+
+
+/*! @brief Completes an eDMA channel's major loop
+ *
+ *  @param channelNb The channel
+ *  @return bool - TRUE if the channel's interrupt is to be taken
+ */
+static bool DMAMajorLoopDone(const uint8_t channelNb)
+{
+  DMA_SADDR(channelNb) += DMA_SLAST(channelNb);
+  DMA_DADDR(channelNb) += DMA_DLAST_SGA(channelNb);
+  DMA_CITER_ELINKNO(channelNb) = DMA_BITER_ELINKNO(channelNb);
+  DMA_CSR(channelNb) |= DMA_CSR_DONE_MASK;
+
+  if (DMA_CSR(channelNb) & DMA_CSR_DREQ_MASK)
+    __atomic_fetch_and(&DMA_ERQ, ~(1u << channelNb), __ATOMIC_SEQ_CST);
+
+  if (!(DMA_CSR(channelNb) & DMA_CSR_INTMAJOR_MASK))
+    return false;
+
+  __atomic_fetch_or(&DMA_INT, (1u << channelNb), __ATOMIC_SEQ_CST);
+  return true;
+}
+
+
+
+bool Sim_DMARequest(const uint8_t source, const uint8_t data)
+{
+  StepDMARequests();
+
+  int8_t channelNb = DMAChannel(source);
+
+  if (channelNb < 0)
+    return false;
+
+  *(volatile uint8_t*)(uintptr_t)DMA_DADDR(channelNb) = data;
+  DMA_DADDR(channelNb) += (int16_t)DMA_DOFF(channelNb);
+  DMA_CITER_ELINKNO(channelNb)--;
+
+  if (((DMA_CITER_ELINKNO(channelNb) & DMA_CITER_ELINKNO_CITER_MASK) == 0) && DMAMajorLoopDone(channelNb))
+    __atomic_fetch_or(&DMAInterrupts, (1u << channelNb), __ATOMIC_SEQ_CST);
+
+  return true;
+}
+
+
+
+/*! @brief Takes the interrupts of the eDMA channels Sim_DMARequest finished
+ *
+ *  @return uint64_t - SIM_NEVER, as the channels only move on when a peripheral asks
+ */
+static uint64_t StepDMA(void)
+{
+  uint32_t pending = __atomic_exchange_n(&DMAInterrupts, 0, __ATOMIC_SEQ_CST);
+
+  for (uint8_t channelNb = 0; channelNb < DMA_NB_CHANNELS; channelNb++)
+    if (pending & (1u << channelNb))
+      Sim_Interrupt(SIM_VECTOR_DMA0 + (channelNb & 0x0F));
+
+  return SIM_NEVER;
+}
+
+
+
+/*! @brief Models the UART2 transmitter, fed either by TDRE interrupts or by the eDMA
+ *
+ *  @return uint64_t - when the transmitter next wants a byte
+ *  @note A byte is taken as soon as the one before it has left the wire.
+ */
+static uint64_t StepUARTTransmit(void)
+{
+  StepDMARequests();
+
+  for (;;)
+  {
+    bool enabled = (UART_C2_REG(UART) & UART_C2_TE_MASK) && (UART_C2_REG(UART) & UART_C2_TIE_MASK);
+    bool dma = UART_C5_REG(UART) & UART_C5_TDMAS_MASK;
+    int8_t channelNb = dma ? DMAChannel(DMA_SOURCE_UART2_TX) : -1;
+
+    if (!enabled || (dma && (channelNb < 0)))
+    {
+      TxEnabled = false;
+      return SIM_NEVER;
+    }
+
+    // Requests that start while the line is idle are served straight away
+    if (!TxEnabled || (channelNb != TxChannel))
+    {
+      TxEnabled = true;
+      TxChannel = channelNb;
+
+      if (TxLineFree < Time)
+        TxLineFree = Time;
+    }
+
+    if (TxLineFree > Time)
+      return TxLineFree;
+
+    uint64_t byteTime = UARTByteTime();
+    uint64_t start = TxLineFree;
+
+    if (dma)
+    {
+      TxData = *(volatile uint8_t*)(uintptr_t)DMA_SADDR(channelNb);
+      DMA_SADDR(channelNb) += (int16_t)DMA_SOFF(channelNb);
+      DMA_CITER_ELINKNO(channelNb)--;
+      TxLineFree = start + byteTime;
+      UARTSend(TxData, TxLineFree);
+
+      if (((DMA_CITER_ELINKNO(channelNb) & DMA_CITER_ELINKNO_CITER_MASK) == 0) && DMAMajorLoopDone(channelNb))
+        Sim_Interrupt(SIM_VECTOR_DMA0 + (channelNb & 0x0F));
+    }
+    else
+    {
+      // D may already have been loaded by a receive interrupt
+      if (!TxBuffered)
+        UARTInterrupt();
+
+      if (TxBuffered)
+      {
+        TxBuffered = false;
+        UART_S1_REG(UART) |= UART_S1_TDRE_MASK;
+        TxLineFree = start + byteTime;
+        UARTSend(TxData, TxLineFree);
+      }
+    }
+
+    StepDMARequests();
+  }
+}
+
+
+
+/*! @brief Models PIT channel 0
+ *
+ *  @return uint64_t - when it next expires
+ */
+static uint64_t StepPIT(void)
+{
+  if ((PIT_MCR & PIT_MCR_MDIS_MASK) || !(PIT_TCTRL0 & PIT_TCTRL_TEN_MASK))
+  {
+    NextPIT = 0;
+    return SIM_NEVER;
+  }
+
+  uint64_t period = ((uint64_t)PIT_LDVAL0 + 1) * 1000000000u / CPU_BUS_CLK_HZ;
+
+  // A new load value restarts the count - the firmware stops and starts the timer around writing it
+  if ((NextPIT == 0) || (PIT_LDVAL0 != PITLoad))
+  {
+    NextPIT = Time + period;
+    PITLoad = PIT_LDVAL0;
+  }
+
+  if (Time < NextPIT)
+    return NextPIT;
+
+  // Periods missed while the host was busy are dropped rather than delivered as a burst
+  NextPIT = (Time - NextPIT > period) ? (Time + period) : (NextPIT + period);
+  PIT_TFLG0 |= PIT_TFLG_TIF_MASK;
+  LastPIT    = Time;
+  PITPending = true;
+
+  if (PIT_TCTRL0 & PIT_TCTRL_TIE_MASK)
+    Sim_Interrupt(SIM_VECTOR_PIT0);
+
+  return NextPIT;
+}
+
+
+
+/*! @brief Models FTM0 counting the fixed frequency clock, with output compare on each channel
+ *
+ *  @return uint64_t - when a channel next matches
+ */
+static uint64_t StepFTM(void)
+{
+  if (!(FTM0_SC & FTM_SC_CLKS_MASK))
+    return SIM_NEVER;
+
+  uint64_t count = Time * CPU_MCGFF_CLK_HZ_CONFIG_0 / 1000000000u;
+  uint64_t next = SIM_NEVER;
+  bool interrupt = false;
+
+  for (uint8_t channelNb = 0; channelNb < 8; channelNb++)
+  {
+    // Output compare is MSnB:MSnA = 01 - the flag sets when the counter reaches CnV
+    if ((FTM0_CnSC(channelNb) & (FTM_CnSC_MSB_MASK | FTM_CnSC_MSA_MASK)) != FTM_CnSC_MSA_MASK)
+      continue;
+
+    // The first count after the previous step with CnV in its low 16 bits
+    uint64_t match = FTMCount + (uint16_t)(FTM0_CnV(channelNb) - (uint16_t)FTMCount);
+
+    if (match <= FTMCount)
+      match += 0x10000;
+
+    if (match <= count)
+    {
+      FTM0_CnSC(channelNb) |= FTM_CnSC_CHF_MASK;
+
+      if (FTM0_CnSC(channelNb) & FTM_CnSC_CHIE_MASK)
+        interrupt = true;
+
+      match += 0x10000;
+    }
+
+    // Rounded up to the first nanosecond the counter has reached it
+    next = Earliest(next, (match * 1000000000u + CPU_MCGFF_CLK_HZ_CONFIG_0 - 1) / CPU_MCGFF_CLK_HZ_CONFIG_0);
+  }
+
+  FTMCount = count;
+  FTM0_CNT = (uint16_t)count;
+
+  if (interrupt)
+    Sim_Interrupt(SIM_VECTOR_FTM0);
+
+  return next;
+}
+
+
+
+/*! @brief Models the RTC seconds counter
+ *
+ *  @return uint64_t - when it next increments
+ */
+static uint64_t StepRTC(void)
+{
+  if (!(RTC_SR & RTC_SR_TCE_MASK))
+  {
+    NextRTC = 0;
+    return SIM_NEVER;
+  }
+
+  if (NextRTC == 0)
+    NextRTC = Time + 1000000000u;
+
+  if (Time < NextRTC)
+    return NextRTC;
+
+  NextRTC += 1000000000u;
+  RTC_TSR++;
+
+  if (RTC_IER & RTC_IER_TSIE_MASK)
+    Sim_Interrupt(SIM_VECTOR_RTC);
+
+  return NextRTC;
+}
+
+
+
+/*! @brief Models the RTOS tick
+ *
+ *  @return uint64_t - when it is next due
+ */
+static uint64_t StepTick(void)
+{
+  if (Time >= NextTick)
+  {
+    NextTick += SIM_TICK_US * 1000u;
+    Sim_Interrupt(SIM_VECTOR_SYSTICK);
+  }
+
+  return NextTick;
+}
+
+
+
+/*! @brief Prints what happened over the run, then ends the program
+ */
+static void Finish(void)
+{
+  double wall = (Now() - StartTime) / 1e9;
+
+  fprintf(stderr, "Sim: %.3f s simulated in %.3f s of wall-clock time (%.0fx)\n",
+          Time / 1e9, wall, (wall > 0) ? (Time / 1e9 / wall) : 0.0);
+  fprintf(stderr, "Sim: UART2 received %u bytes and sent %u bytes - digest %016llX\n",
+          (unsigned)NbRxBytes, (unsigned)NbTxBytes, (unsigned long long)TxDigest);
+
+  if (NbRxBytes > 0)
+    fprintf(stderr, "Sim: UART2 took %u receive interrupts with a %u-byte FIFO - %.0f per KB received\n",
+            (unsigned)NbRxInterrupts, (unsigned)RxFIFODepth, (1024.0 * NbRxInterrupts) / NbRxBytes);
+
+  if (NbLatencies > 0)
+    fprintf(stderr, "Sim: PIT to CMD_ACCEL latency over %u packets - min %.1f us, mean %.1f us, max %.1f us\n",
+            (unsigned)NbLatencies, LatencyMin / 1000.0, LatencyTotal / 1000.0 / NbLatencies, LatencyMax / 1000.0);
+  else
+    fprintf(stderr, "Sim: no accelerometer packets followed a PIT period\n");
+
+  if (NbAccelSamples > 0)
+    fprintf(stderr, "Sim: UART2 sent %u accelerometer samples in %u bytes - %.2f bytes per sample\n",
+            (unsigned)NbAccelSamples, (unsigned)NbAccelBytes, (double)NbAccelBytes / NbAccelSamples);
+
+  SimI2C_Report();
+  SimFlash_Report();
+
+  if (UARTLog)
+    fclose(UARTLog);
+
+  exit(EXIT_SUCCESS);
+}
+
+
+
+/*! @brief Simulator thread - steps every peripheral model, then waits for the next event
+ */
+static void* Run(void* arg)
+{
+  for (;;)
+  {
+    if (!Virtual)
+      Time = Now() - StartTime;
+
+    if (Duration && (Time >= Duration))
+    {
+      Settle();
+      Finish();
+    }
+
+    uint64_t next = SIM_NEVER;
+
+    // Anything the firmware does in response to an interrupt happens at the same time, so the models are
+    // stepped again until they have all caught up before time moves on
+    do
+    {
+      Taken = false;
+      Settle();
+      StepCycleCounter();
+      next = StepTick();
+      next = Earliest(next, StepUARTReceive());
+      next = Earliest(next, StepUARTTransmit());
+      next = Earliest(next, StepPIT());
+      next = Earliest(next, StepFTM());
+      next = Earliest(next, StepRTC());
+      next = Earliest(next, SimI2C_Step());
+      next = Earliest(next, StepDMA());
+      next = Earliest(next, SimFlash_Step());
+      next = Earliest(next, StepSpin());
+    } while (Virtual && Taken);
+
+    if (Virtual)
+    {
+      if (Duration)
+        next = Earliest(next, Duration);
+
+      // A thread that polled with interrupts masked may already have moved the clock on
+      pthread_mutex_lock(&CPULock);
+      if (next > Time)
+        Time = next;
+      pthread_mutex_unlock(&CPULock);
+    }
+    else
+    {
+      struct timespec step = {0, STEP_NS};
+      nanosleep(&step, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+
+
+bool Sim_Init(void)
+{
+  pthread_mutexattr_t attributes;
+
+  // Critical sections nest, so the lock must be recursive
+  pthread_mutexattr_init(&attributes);
+  pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&InterruptLock, &attributes);
+
+  if (!Configure())
+    return false;
+
+  if (!MapRegion(SIM_PERIPHERAL_BASE, SIM_PERIPHERAL_SIZE) ||
+      !MapRegion(SIM_PPB_BASE, SIM_PPB_SIZE) ||
+      !MapRegion(SIM_FLASH_BASE, SIM_FLASH_SIZE))
+    return false;
+
+  Reset();
+
+  struct sigaction fault = {.sa_sigaction = TrapFault, .sa_flags = SA_SIGINFO};
+  struct sigaction step  = {.sa_sigaction = TrapStep,  .sa_flags = SA_SIGINFO};
+
+  if ((sigaction(SIGSEGV, &fault, NULL) < 0) || (sigaction(SIGTRAP, &step, NULL) < 0) || !SimI2C_Init() || !SimFlash_Init())
+    return false;
+
+  // UART2 is trapped so reading D can take bytes from the receive FIFO
+  if (!(UART = (UART_MemMapPtr)Sim_Trap((uint32_t)UART2_BASE_PTR, UARTAccess)))
+    return false;
+
+  // RXFIFOSIZE encodes the depth as 0 for 1 entry, otherwise 2^(RXFIFOSIZE + 1)
+  if (RxFIFODepth > 1)
+    UART_PFIFO_REG(UART) |= UART_PFIFO_RXFIFOSIZE(__builtin_ctz(RxFIFODepth) - 1);
+
+  if (!OpenUART())
+    return false;
+
+  StartTime = Now();
+  NextTick  = SIM_TICK_US * 1000u;
+
+  return (pthread_create(&SimThread, NULL, Run, NULL) == 0);
+}
+
+
+
+void Sim_MaskInterrupts(const TSimMask mask)
+{
+  if (MaskHeld[mask])
+    return;
+
+  pthread_mutex_lock(&InterruptLock);
+  MaskHeld[mask] = true;
+  MaskDepth++;
+}
+
+
+
+void Sim_UnmaskInterrupts(const TSimMask mask)
+{
+  if (!MaskHeld[mask])
+    return;
+
+  MaskHeld[mask] = false;
+  MaskDepth--;
+  pthread_mutex_unlock(&InterruptLock);
+
+  // A thread made ready by an interrupt taken while masked can run now
+  if (MaskDepth == 0)
+    OS_HostPreempt();
+}
+
+
+
+void Sim_EnterCritical(void)
+{
+  pthread_mutex_lock(&InterruptLock);
+  MaskDepth++;
+}
+
+
+
+void Sim_ExitCritical(void)
+{
+  MaskDepth--;
+  pthread_mutex_unlock(&InterruptLock);
+
+  if (MaskDepth == 0)
+    OS_HostPreempt();
+}
+
+
+
+bool Sim_InterruptsMasked(void)
+{
+  return (MaskDepth > 0);
+}
+
+
+
+void Sim_WaitForInterrupt(void)
+{
+  uint32_t depth = MaskDepth;
+
+  // Nothing can be taken while the caller holds the lock, so the count read here is the one to wait past
+  pthread_mutex_lock(&CPULock);
+  uint32_t nbInterrupts = NbInterrupts;
+  CPUAsleep = true;
+  pthread_cond_broadcast(&CPUCond);
+  pthread_mutex_unlock(&CPULock);
+
+  for (uint32_t i = 0; i < depth; i++)
+    pthread_mutex_unlock(&InterruptLock);
+
+  pthread_mutex_lock(&CPULock);
+  while ((NbInterrupts == nbInterrupts) || SimActive)
+    pthread_cond_wait(&CPUCond, &CPULock);
+  pthread_mutex_unlock(&CPULock);
+
+  for (uint32_t i = 0; i < depth; i++)
+    pthread_mutex_lock(&InterruptLock);
+
+  if (depth == 0)
+    OS_HostPreempt();
+}
+
+
+
+void Sim_Interrupt(const uint8_t vector)
+{
+  pthread_mutex_lock(&InterruptLock);
+
+  // Exception numbers start at the initial program counter - the stack pointer is not a vector
+  OS_ISREnter();
+  (*__vect_table.__fun[vector - 1])();
+  OS_ISRExit();
+
+  pthread_mutex_unlock(&InterruptLock);
+
+  // The interrupt wakes the CPU from WFI
+  pthread_mutex_lock(&CPULock);
+  NbInterrupts++;
+  CPUAsleep = false;
+  pthread_cond_broadcast(&CPUCond);
+  pthread_mutex_unlock(&CPULock);
+
+  Taken = true;
+}
+
+
+
+void Sim_CPUIdle(const bool idle)
+{
+  pthread_mutex_lock(&CPULock);
+  CPUStarted = true;
+  CPUIdle = idle;
+  pthread_cond_broadcast(&CPUCond);
+  pthread_mutex_unlock(&CPULock);
+}
+
+
+
+volatile uint8_t* Sim_Trap(const uint32_t base, const TSimAccess access)
+{
+#if defined(__x86_64__)
+  int file = memfd_create("Sim", 0);
+
+  if ((NbTraps == NB_TRAPS) || (file < 0) || (ftruncate(file, TRAP_PAGE_SIZE) < 0))
+  {
+    fprintf(stderr, "Sim: cannot trap 0x%08X - %s\n", (unsigned)base, strerror(errno));
+    return NULL;
+  }
+
+  // The page keeps its contents, but is now shared with an alias the model can use
+  volatile uint8_t* alias = mmap(NULL, TRAP_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+
+  if (alias != MAP_FAILED)
+  {
+    memcpy((void*)alias, (void*)(uintptr_t)base, TRAP_PAGE_SIZE);
+
+    if (mmap((void*)(uintptr_t)base, TRAP_PAGE_SIZE, PROT_NONE, MAP_SHARED | MAP_FIXED, file, 0) == MAP_FAILED)
+      alias = MAP_FAILED;
+  }
+
+  close(file);
+
+  if (alias == MAP_FAILED)
+  {
+    fprintf(stderr, "Sim: cannot trap 0x%08X - %s\n", (unsigned)base, strerror(errno));
+    return NULL;
+  }
+
+  Traps[NbTraps].base   = base;
+  Traps[NbTraps].alias  = alias;
+  Traps[NbTraps].access = access;
+  NbTraps++;
+  return alias;
+#else
+  fprintf(stderr, "Sim: register traps are only supported on x86-64\n");
+  return NULL;
+#endif
+}
+
+
+
+void Sim_LockTraps(void)
+{
+  pthread_mutex_lock(&TrapLock);
+}
+
+
+
+void Sim_UnlockTraps(void)
+{
+  pthread_mutex_unlock(&TrapLock);
+}
+
+
+
+uint64_t Sim_Time(void)
+{
+  return Virtual ? Time : (Now() - StartTime);
+}
+
+
+
+void Sim_WaitForCPU(void)
+{
+  // Nothing can be taken while the caller has interrupts masked, so there is nothing to wait for
+  if (MaskDepth > 0)
+    return;
+
+  pthread_mutex_lock(&CPULock);
+  while (SimActive)
+    pthread_cond_wait(&CPUCond, &CPULock);
+  pthread_mutex_unlock(&CPULock);
+}
+
+
+
+const char* Sim_UARTName(void)
+{
+  return UARTName;
+}
+
+
+
+/* END Sim */
+/*!
+** @}
+*/
@@ -0,0 +1,176 @@
+/*! @file
+ *
+ *  @brief Simulated TWR-K70F120M for the Linux host build.
+ *
+ *  This contains the functions for mapping a simulated MK70F12 register file at the addresses
+ *  used by MK70F12.h, emulating the Cortex-M4 interrupt masks, and running the peripheral models
+ *  that raise the firmware's interrupts. UART2 is exposed as a pseudo-terminal, and I2C0 has the
+ *  MMA8451Q on it (SimI2C.c).
+ *
+ *  The models run against the wall clock by default. With SIM_TIME=virtual they run against a
+ *  virtual clock instead, which only moves on once every thread is blocked or asleep in WFI, so a
+ *  run is repeatable and as fast as the host allows. A thread that polls a trapped register for
+ *  something the model has not finished yet is held until the model's time catches up. The environment
+ *  also sets:
+ *    SIM_DURATION     seconds to run for before printing a report and exiting
+ *    SIM_UART_SCRIPT  file of "<time in ms> <bytes in hex>" lines for the PC to send to UART2
+ *    SIM_UART_LOG     file to log every byte UART2 sends, with the time it left the wire
+ *    SIM_UART_LINK    symbolic link to create to the UART2 pseudo-terminal
+ *    SIM_UART_FIFO    depth of the UART2 receive FIFO - 1 as on the K70, or a power of two from 4 to 128
+ *    SIM_I2C_HANG     time in ms after which the accelerometer holds SCL low until I2C0 is disabled
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-24
+ */
+
+#ifndef SIM_H
+#define SIM_H
+
+// new types
+#include <stdint.h>
+#include <stdbool.h>
+
+// Address ranges backed by the simulated register file
+#define SIM_PERIPHERAL_BASE 0x40000000u /*!< AIPS0, AIPS1 and GPIO */
+#define SIM_PERIPHERAL_SIZE 0x00100000u
+#define SIM_PPB_BASE        0xE0000000u /*!< Private peripheral bus - NVIC, SysTick, DWT and CoreDebug */
+#define SIM_PPB_SIZE        0x00100000u
+#define SIM_FLASH_BASE      0x00080000u /*!< Flash sector holding the non-volatile data */
+#define SIM_FLASH_SIZE      0x00001000u
+
+// Time that never comes - returned by a model with nothing scheduled
+#define SIM_NEVER UINT64_MAX
+
+// Period of the RTOS tick
+#define SIM_TICK_US 1000
+
+// Exception numbers of the vectors the peripheral models raise - see Generated_Code/Vectors.c
+#define SIM_VECTOR_SYSTICK 0x0F
+#define SIM_VECTOR_DMA0    0x10 /*!< Channels 0 to 15 follow in order */
+#define SIM_VECTOR_I2C0    0x28
+#define SIM_VECTOR_UART2   0x41
+#define SIM_VECTOR_FTM0    0x4E
+#define SIM_VECTOR_RTC     0x53
+#define SIM_VECTOR_PIT0    0x54
+#define SIM_VECTOR_PORTB   0x68
+
+// Cortex-M4 interrupt masks
+typedef enum
+{
+  SIM_MASK_PRIMASK,   /*!< Set by CPSID i - OS_DisableInterrupts */
+  SIM_MASK_FAULTMASK  /*!< Set by CPSID f - __DI */
+} TSimMask;
+
+/*! @brief Handles the firmware accessing a trapped register.
+ *
+ *  @param offset The register's offset from the base of the trapped page.
+ *  @param write TRUE if it was written. The new value is already in the model's view of the page.
+ *  @param before The register before the access.
+ *  @return uint64_t - for a read, the time the firmware must wait until before it could read something
+ *  different, or SIM_NEVER to carry on at once.
+ *  @note Called on the firmware's thread with the traps locked.
+ */
+typedef uint64_t (*TSimAccess)(const uint32_t offset, const bool write, const uint8_t before);
+
+/*! @brief Maps the simulated register file, applies the reset values and starts the peripheral models.
+ *
+ *  @return bool - TRUE if the simulator was successfully initialized.
+ *  @note Called from PE_low_level_init, before any register is touched.
+ */
+bool Sim_Init(void);
+
+/*! @brief Sets one of the interrupt masks for the calling thread.
+ *
+ *  @param mask The mask to set. Setting a mask that is already set has no effect.
+ */
+void Sim_MaskInterrupts(const TSimMask mask);
+
+/*! @brief Clears one of the interrupt masks for the calling thread.
+ *
+ *  @param mask The mask to clear. Clearing a mask that is not set has no effect.
+ */
+void Sim_UnmaskInterrupts(const TSimMask mask);
+
+/*! @brief Nesting-compatible interrupt disable - the host equivalent of EnterCritical.
+ */
+void Sim_EnterCritical(void);
+
+/*! @brief Nesting-compatible interrupt enable - the host equivalent of ExitCritical.
+ */
+void Sim_ExitCritical(void);
+
+/*! @brief Checks whether the calling thread has interrupts masked.
+ *
+ *  @return bool - TRUE if an interrupt mask or critical section is held.
+ */
+bool Sim_InterruptsMasked(void);
+
+/*! @brief Sleeps until the next interrupt has been taken - the host equivalent of WFI.
+ *
+ *  @note Interrupts that arrive while the caller has them masked are still taken while it sleeps.
+ */
+void Sim_WaitForInterrupt(void);
+
+/*! @brief Takes an interrupt - runs the handler in the vector table between OS_ISREnter and OS_ISRExit.
+ *
+ *  @param vector The exception number, one of the SIM_VECTOR_ values.
+ *  @note Waits until no thread has interrupts masked.
+ */
+void Sim_Interrupt(const uint8_t vector);
+
+/*! @brief Tells the simulator whether the CPU has anything to run.
+ *
+ *  @param idle TRUE when every thread is blocked, FALSE once one is running.
+ *  @note Called by the RTOS whenever it switches threads. The virtual clock only moves on while the
+ *  CPU is idle or asleep in WFI.
+ */
+void Sim_CPUIdle(const bool idle);
+
+/*! @brief Traps every access the firmware makes to a page of the register file.
+ *
+ *  @param base The hardware address of the page.
+ *  @param access Called after each access.
+ *  @return volatile uint8_t* - the model's own view of the page, which it reads and writes without trapping,
+ *  or NULL if the page could not be trapped.
+ *  @note Accesses are caught by single-stepping the faulting instruction, so only x86-64 Linux is supported.
+ *  The page is unprotected while the instruction steps, so firmware threads must not access it concurrently.
+ */
+volatile uint8_t* Sim_Trap(const uint32_t base, const TSimAccess access);
+
+/*! @brief Stops the firmware's threads accessing trapped registers until Sim_UnlockTraps.
+ */
+void Sim_LockTraps(void);
+
+/*! @brief Lets the firmware's threads access trapped registers again.
+ */
+void Sim_UnlockTraps(void);
+
+/*! @brief Serves a peripheral's eDMA request - moves one byte to the next address of the channel routed to it.
+ *
+ *  @param source The DMAMUX request source.
+ *  @param data The byte the channel reads from the peripheral.
+ *  @return bool - TRUE if an enabled channel took the byte, FALSE if no channel is serving the source.
+ *  @note May be called from a TSimAccess handler. The channel's interrupt is taken at the next step.
+ */
+bool Sim_DMARequest(const uint8_t source, const uint8_t data);
+
+/*! @brief Gets the simulated time.
+ *
+ *  @return uint64_t - nanoseconds since the simulator was started.
+ */
+uint64_t Sim_Time(void);
+
+/*! @brief Waits until the simulator is not stepping the peripheral models.
+ *
+ *  @note Called by the RTOS before a thread it has woken runs, so in virtual time a thread made ready by an
+ *  interrupt only runs once the simulator has finished with everything that happened at the same time.
+ */
+void Sim_WaitForCPU(void);
+
+/*! @brief Gets the path of the pseudo-terminal connected to UART2.
+ *
+ *  @return const char* - the path of the slave side, for the PC software to open.
+ */
+const char* Sim_UARTName(void);
+
+#endif
@@ -0,0 +1,292 @@
+/*!
+**  @file SimFlash.c
+**
+**  @brief Simulated FTFE flash controller for the Linux host build.
+**         Clearing CCIF launches the command in FCCOB0, and CCIF stays clear for the command's busy time
+**         before the flash array changes. Program Phrase ANDs the new data into the phrase, so bits can
+**         only go from 1 to 0 until the sector is erased again. Commands other than Program Phrase and
+**         Erase Sector, misaligned addresses and addresses outside the simulated flash set ACCERR.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE SimFlash */
+
+#include "SimFlash.h"
+#include "Sim.h"
+#include "MK70F12.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+// FTFE commands
+#define COMMAND_PROGRAM_PHRASE 0x07
+#define COMMAND_ERASE_SECTOR   0x09
+
+#define PHRASE_SIZE 8
+#define SECTOR_SIZE 0x1000u
+#define NB_SECTORS  (SIM_FLASH_SIZE / SECTOR_SIZE)
+
+// Typical busy times from the K70 datasheet - tpgm8 and tersscr
+#define PROGRAM_PHRASE_NS 50000u
+#define ERASE_SECTOR_NS   13000000u
+
+// Commands launched within this long of the last one completing are counted as one operation
+#define OPERATION_GAP_NS 1000000u
+
+// Flags cleared by writing 1
+#define FSTAT_W1C_MASK (FTFE_FSTAT_CCIF_MASK | FTFE_FSTAT_RDCOLERR_MASK | FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK)
+
+static FTFE_MemMapPtr Registers;  // The model's own view of the FTFE registers
+
+static uint8_t Command;           // Command running, and its parameters
+static uint32_t Address;
+static uint8_t Data[PHRASE_SIZE];
+static uint64_t Due = SIM_NEVER;  // When it completes
+
+// Measurements
+static uint32_t NbPrograms, NbErases;
+static uint32_t NbOverprograms;   // Phrases programmed while not erased
+static uint32_t EraseCount[NB_SECTORS];
+static uint64_t BusyTime;
+static uint32_t NbOperations;     // Runs of back-to-back commands, such as one Flash_Write
+static uint64_t OperationStart, OperationEnd;
+static uint64_t OperationTotal, OperationMax;
+static uint32_t OperationErases, OperationErasesMax;
+
+
+
+/*! @brief Ends the operation in progress, if there is one
+ */
+static void EndOperation(void)
+{
+  if (OperationEnd == 0)
+    return;
+
+  uint64_t latency = OperationEnd - OperationStart;
+
+  NbOperations++;
+  OperationTotal += latency;
+  if (latency > OperationMax)
+    OperationMax = latency;
+  if (OperationErases > OperationErasesMax)
+    OperationErasesMax = OperationErases;
+
+  OperationEnd = 0;
+  OperationErases = 0;
+}
+
+
+
+/*! @brief Makes the change to the flash array once the running command completes
+ */
+static void Complete(void)
+{
+  volatile uint8_t* flash = (volatile uint8_t*)(uintptr_t)Address;
+
+  switch (Command)
+  {
+    case COMMAND_PROGRAM_PHRASE:
+    {
+      bool erased = true;
+
+      for (uint8_t i = 0; i < PHRASE_SIZE; i++)
+      {
+        if (flash[i] != 0xFF)
+          erased = false;
+        flash[i] &= Data[i];
+      }
+
+      if (!erased)
+        NbOverprograms++;
+
+      NbPrograms++;
+      break;
+    }
+
+    case COMMAND_ERASE_SECTOR:
+      for (uint32_t i = 0; i < SECTOR_SIZE; i++)
+        flash[i] = 0xFF;
+
+      EraseCount[(Address - SIM_FLASH_BASE) / SECTOR_SIZE]++;
+      NbErases++;
+      OperationErases++;
+      break;
+  }
+
+  OperationEnd = Due;
+  Due = SIM_NEVER;
+  FTFE_FSTAT_REG(Registers) |= FTFE_FSTAT_CCIF_MASK;
+}
+
+
+
+/*! @brief Checks the command in FCCOB and starts it
+ *
+ *  @param now The time it was launched
+ */
+static void Launch(const uint64_t now)
+{
+  uint64_t busy = 0;
+
+  Command = FTFE_FCCOB0_REG(Registers);
+  Address = ((uint32_t)FTFE_FCCOB1_REG(Registers) << 16) | ((uint32_t)FTFE_FCCOB2_REG(Registers) << 8) | FTFE_FCCOB3_REG(Registers);
+
+  if ((Address & (PHRASE_SIZE - 1)) || (Address < SIM_FLASH_BASE) || (Address >= SIM_FLASH_BASE + SIM_FLASH_SIZE))
+    Command = 0;
+
+  switch (Command)
+  {
+    case COMMAND_PROGRAM_PHRASE:
+      // Each longword is sent most significant byte first (see K70 manual pg. 797)
+      Data[0] = FTFE_FCCOB7_REG(Registers);
+      Data[1] = FTFE_FCCOB6_REG(Registers);
+      Data[2] = FTFE_FCCOB5_REG(Registers);
+      Data[3] = FTFE_FCCOB4_REG(Registers);
+      Data[4] = FTFE_FCCOBB_REG(Registers);
+      Data[5] = FTFE_FCCOBA_REG(Registers);
+      Data[6] = FTFE_FCCOB9_REG(Registers);
+      Data[7] = FTFE_FCCOB8_REG(Registers);
+      busy = PROGRAM_PHRASE_NS;
+      break;
+
+    case COMMAND_ERASE_SECTOR:
+      Address &= ~(SECTOR_SIZE - 1);
+      busy = ERASE_SECTOR_NS;
+      break;
+
+    default:
+      FTFE_FSTAT_REG(Registers) |= FTFE_FSTAT_ACCERR_MASK;
+      return;
+  }
+
+  if ((OperationEnd != 0) && (now - OperationEnd > OPERATION_GAP_NS))
+    EndOperation();
+  if (OperationEnd == 0)
+    OperationStart = now;
+
+  FTFE_FSTAT_REG(Registers) &= ~FTFE_FSTAT_CCIF_MASK;
+  Due = now + busy;
+  BusyTime += busy;
+}
+
+
+
+/*! @brief Handles the firmware accessing an FTFE register
+ *
+ *  @param offset The register's offset from FTFE_BASE_PTR
+ *  @param write TRUE if it was written
+ *  @param before The register before the access
+ *  @return uint64_t - when a read of FSTAT could next see CCIF set, or SIM_NEVER
+ */
+static uint64_t Access(const uint32_t offset, const bool write, const uint8_t before)
+{
+  uint64_t now = Sim_Time();
+  volatile uint8_t* registers = (volatile uint8_t*)Registers;
+
+  if (Due <= now)
+    Complete();
+
+  bool busy = !(FTFE_FSTAT_REG(Registers) & FTFE_FSTAT_CCIF_MASK);
+
+  if (offset == offsetof(struct FTFE_MemMap, FSTAT))
+  {
+    if (!write)
+      return busy ? Due : SIM_NEVER;
+
+    uint8_t clear = FTFE_FSTAT_REG(Registers) & FSTAT_W1C_MASK;
+
+    FTFE_FSTAT_REG(Registers) = before & ~(clear & ~FTFE_FSTAT_CCIF_MASK);
+
+    // Clearing CCIF launches the command, unless an error from the last one is still flagged
+    if ((clear & FTFE_FSTAT_CCIF_MASK) && !busy &&
+        !(FTFE_FSTAT_REG(Registers) & (FTFE_FSTAT_ACCERR_MASK | FTFE_FSTAT_FPVIOL_MASK)))
+      Launch(now);
+  }
+  else if (write && busy && (offset >= offsetof(struct FTFE_MemMap, FCCOB3)) && (offset <= offsetof(struct FTFE_MemMap, FCCOB8)))
+  {
+    // FCCOB cannot be changed while a command is running
+    registers[offset] = before;
+  }
+
+  return SIM_NEVER;
+}
+
+
+
+bool SimFlash_Init(void)
+{
+  Registers = (FTFE_MemMapPtr)Sim_Trap((uint32_t)FTFE_BASE_PTR, Access);
+
+  if (!Registers)
+    return false;
+
+  FTFE_FSTAT_REG(Registers) = FTFE_FSTAT_CCIF_MASK;
+  return true;
+}
+
+
+
+uint64_t SimFlash_Step(void)
+{
+  Sim_LockTraps();
+
+  if (Due <= Sim_Time())
+    Complete();
+
+  uint64_t next = Due;
+
+  Sim_UnlockTraps();
+  return next;
+}
+
+
+
+void SimFlash_Report(void)
+{
+  EndOperation();
+
+  fprintf(stderr, "Sim: flash ran %u Program Phrase and %u Erase Sector commands - busy %.3f ms",
+          (unsigned)NbPrograms, (unsigned)NbErases, BusyTime / 1e6);
+
+  if (NbOverprograms > 0)
+    fprintf(stderr, ", %u phrases programmed without an erase", (unsigned)NbOverprograms);
+
+  fprintf(stderr, "\n");
+
+  if (NbOperations > 0)
+    fprintf(stderr, "Sim: flash ran %u operations - mean %.3f ms, max %.3f ms, at most %u erases each\n",
+            (unsigned)NbOperations, OperationTotal / 1e6 / NbOperations, OperationMax / 1e6, (unsigned)OperationErasesMax);
+
+  for (uint32_t i = 0; i < NB_SECTORS; i++)
+    if (EraseCount[i] > 0)
+      fprintf(stderr, "Sim: flash sector 0x%08X erased %u times\n", (unsigned)(SIM_FLASH_BASE + (i * SECTOR_SIZE)), (unsigned)EraseCount[i]);
+
+  // Phrases holding data, lowest address first
+  for (uint32_t address = SIM_FLASH_BASE; address < SIM_FLASH_BASE + SIM_FLASH_SIZE; address += PHRASE_SIZE)
+  {
+    const volatile uint8_t* const phrase = (const volatile uint8_t*)(uintptr_t)address;
+    bool blank = true;
+
+    for (uint8_t i = 0; i < PHRASE_SIZE; i++)
+      blank = blank && (phrase[i] == 0xFF);
+
+    if (!blank)
+    {
+      fprintf(stderr, "Sim: flash phrase 0x%08X holds", (unsigned)address);
+      for (uint8_t i = 0; i < PHRASE_SIZE; i++)
+        fprintf(stderr, " %02X", (unsigned)phrase[i]);
+      fprintf(stderr, "\n");
+    }
+  }
+}
+
+
+
+/* END SimFlash */
+/*!
+** @}
+*/
@@ -0,0 +1,36 @@
+/*! @file
+ *
+ *  @brief Simulated FTFE flash controller for the Linux host build.
+ *
+ *  This contains the functions for the FTFE model, which runs Program Phrase and Erase Sector
+ *  on the simulated flash with the datasheet's typical busy times. Programming can only clear bits,
+ *  as on the real array, and every sector erase is counted so the wear a command costs can be measured.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-02
+ */
+
+#ifndef SIMFLASH_H
+#define SIMFLASH_H
+
+// new types
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! @brief Traps the FTFE registers and puts the controller in its idle state.
+ *
+ *  @return bool - TRUE if the controller was successfully initialized.
+ */
+bool SimFlash_Init(void);
+
+/*! @brief Completes a command once its busy time is over.
+ *
+ *  @return uint64_t - when the command running now completes, or SIM_NEVER.
+ */
+uint64_t SimFlash_Step(void);
+
+/*! @brief Prints how many commands ran, how long the flash was busy and how often each sector was erased.
+ */
+void SimFlash_Report(void);
+
+#endif
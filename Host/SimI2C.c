@@ -0,0 +1,673 @@
+/*!
+**  @file SimI2C.c
+**
+**  @brief Simulated I2C0 bus for the Linux host build.
+**         The controller follows the K70 master flow - setting MST sends START, clearing it sends STOP,
+**         RSTA sends a repeated START, writing D in transmit mode sends a byte and reading D in receive
+**         mode clocks in the next one, acknowledged according to TXAK. TCF, IICIF, RXAK and BUSY are
+**         updated as each transfer finishes. With DMAEN set each byte received is a request to the eDMA
+**         channel routed to I2C0, which reads D and so clocks in the next byte straight away.
+**         SIM_I2C_HANG=<ms> has the accelerometer hold SCL low from the first byte started after that time,
+**         until the firmware disables I2C0 to clear the bus. SIM_I2C_EEPROM puts an AT24C02 on the bus as
+**         well, so the firmware has a second device to share it with. SIM_I2C_COST has the report count the host
+**         instructions the driver runs per read. Arbitration, slave mode and SMBus are not modelled.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE SimI2C */
+
+#define _GNU_SOURCE
+
+#include "SimI2C.h"
+#include "Sim.h"
+#include "MMA8451Q.h"
+#include "AT24C02.h"
+#include "MK70F12.h"
+#include "Cpu.h"
+#include "DMA.h"
+#include "I2C.h"
+#include "OS.h"
+#include "PE_Types.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+
+// The accelerometer's INT1 pin
+#define INT1_PIN 4
+
+// I2C0_SDA is PTE18 - read as GPIO while the firmware clears the bus
+#define SDA_PIN 18
+
+// IRQC settings for PTB4
+#define IRQC_LOGIC_ZERO   0x8
+#define IRQC_RISING_EDGE  0x9
+#define IRQC_FALLING_EDGE 0xA
+#define IRQC_EITHER_EDGE  0xB
+#define IRQC_LOGIC_ONE    0xC
+
+// SCL periods per byte - 8 data bits and the acknowledge
+#define BITS_PER_BYTE 9
+
+// The driver's own cost is counted over a few 8-bit XYZ reads, so the last starts with nothing else queued
+#define COST_NB_READS      4
+#define COST_READ_ADDRESS  0x01 // OUT_X_MSB
+#define COST_READ_BYTES    3
+#define COST_NB_INTERRUPTS 64   // Most interrupts a read may take before it is given up on
+#define COST_PAGE_SIZE     0x1000u
+
+// x86-64 trap flag
+#define EFLAGS_TF_MASK 0x100
+
+typedef enum
+{
+  OPERATION_NONE,
+  OPERATION_SEND,
+  OPERATION_RECEIVE,
+  OPERATION_STOP
+} TOperation;
+
+typedef enum
+{
+  PHASE_IDLE,
+  PHASE_ADDRESS,  /*!< The next byte sent is a slave address */
+  PHASE_WRITE,    /*!< A slave has been addressed for writing */
+  PHASE_READ,     /*!< A slave has been addressed for reading */
+  PHASE_NAK       /*!< No slave answered */
+} TPhase;
+
+typedef enum
+{
+  SLAVE_NONE,
+  SLAVE_MMA8451Q,
+  SLAVE_AT24C02,
+  NB_SLAVES
+} TSlave;
+
+// SCL divider for each ICR value (see K70 manual pg. 1885)
+static const uint16_t SclDivider[64] =
+{
+  20,22,24,26,28,32,36,40,28,32,26,40,44,48,56,68,
+  48,56,64,72,80,88,104,128,80,96,112,128,144,160,192,204,
+  160,192,224,256,288,320,384,480,320,384,448,512,576,640,768,960,
+  640,768,896,1024,1152,1280,1536,1920,1280,1536,1792,2048,2304,2560,3072,3840
+};
+
+static I2C_MemMapPtr Registers;   // The model's own view of the I2C0 registers
+
+static TOperation Operation;      // Transfer on the bus
+static uint64_t Due;              // When it finishes
+static uint8_t TxData;            // Byte being sent
+static TPhase Phase;
+static TSlave Slave;              // The slave that answered the last address byte
+static uint64_t TransferStart;    // When the transfer on the bus started
+static bool StartPending;         // A START or repeated START goes out before the next byte
+static bool StopPending;          // A STOP goes out once the transfer on the bus finishes
+static uint64_t BusStart;         // When the bus was last taken
+static uint64_t HangTime = SIM_NEVER; // When the accelerometer starts holding SCL low
+static bool Hung;                 // It is holding SCL low, so the transfer on the bus never finishes
+
+static bool INT1Level = true;     // Level of PTB4 when the model last looked
+static bool PortPending;          // PTB4 has flagged an interrupt
+
+// Measurements
+static uint32_t NbTransactions, NbBytes;
+static uint32_t NbInterrupts, NbDMARequests;
+static uint32_t NbResets;
+static uint64_t BusyTime;
+static uint32_t SlaveBytes[NB_SLAVES]; // Bytes moved for each slave, counting the address byte it answered
+static uint64_t SlaveTime[NB_SLAVES];  // Time they took on the bus
+
+
+
+/*! @brief Gets the SCL period at the programmed baud rate
+ *
+ *  @return uint64_t - nanoseconds
+ */
+static uint64_t BitTime(void)
+{
+  uint8_t f = I2C_F_REG(Registers);
+  uint32_t mult = 1u << ((f & I2C_F_MULT_MASK) >> I2C_F_MULT_SHIFT);
+
+  return ((uint64_t)mult * SclDivider[f & I2C_F_ICR_MASK] * 1000000000u) / CPU_BUS_CLK_HZ;
+}
+
+
+
+/*! @brief Watches PTB4 for the interrupt its IRQC setting asks for
+ */
+static void UpdatePort(void)
+{
+  bool level = MMA8451Q_INT1();
+  bool flag = false;
+
+  if (!(SIM_SCGC5 & SIM_SCGC5_PORTB_MASK))
+    return;
+
+  switch ((PORTB_PCR4 & PORT_PCR_IRQC_MASK) >> PORT_PCR_IRQC_SHIFT)
+  {
+    case IRQC_LOGIC_ZERO:   flag = !level; break;
+    case IRQC_RISING_EDGE:  flag = level && !INT1Level; break;
+    case IRQC_FALLING_EDGE: flag = !level && INT1Level; break;
+    case IRQC_EITHER_EDGE:  flag = (level != INT1Level); break;
+    case IRQC_LOGIC_ONE:    flag = level; break;
+  }
+
+  INT1Level = level;
+
+  if (flag)
+  {
+    PORTB_PCR4 |= PORT_PCR_ISF_MASK;
+    PORTB_ISFR |= (1u << INT1_PIN);
+    PortPending = true;
+  }
+}
+
+
+
+/*! @brief Finishes the transfer on the bus
+ */
+static void Complete(void)
+{
+  uint64_t finished = Due;
+
+  MMA8451Q_Update(finished);
+
+  switch (Operation)
+  {
+    case OPERATION_SEND:
+    {
+      bool ack = false;
+
+      if (Phase == PHASE_ADDRESS)
+      {
+        if (MMA8451Q_Start(TxData >> 1, TxData & 0x01))
+          Slave = SLAVE_MMA8451Q;
+        else if (AT24C02_Start(TxData >> 1, TxData & 0x01))
+          Slave = SLAVE_AT24C02;
+        else
+          Slave = SLAVE_NONE;
+
+        ack = (Slave != SLAVE_NONE);
+        Phase = !ack ? PHASE_NAK : (TxData & 0x01) ? PHASE_READ : PHASE_WRITE;
+
+        if (TxData & 0x01)
+          I2C_S_REG(Registers) |= I2C_S_SRW_MASK;
+        else
+          I2C_S_REG(Registers) &= ~I2C_S_SRW_MASK;
+      }
+      else if (Phase == PHASE_WRITE)
+        ack = (Slave == SLAVE_MMA8451Q) ? MMA8451Q_Write(TxData) : AT24C02_Write(TxData);
+
+      if (ack)
+        I2C_S_REG(Registers) &= ~I2C_S_RXAK_MASK;
+      else
+        I2C_S_REG(Registers) |= I2C_S_RXAK_MASK;
+      break;
+    }
+
+    case OPERATION_RECEIVE:
+    {
+      bool ack = !(I2C_C1_REG(Registers) & I2C_C1_TXAK_MASK);
+
+      // Nothing drives SDA for a read nobody was addressed for, so it floats high
+      if (Slave == SLAVE_MMA8451Q)
+        I2C_D_REG(Registers) = MMA8451Q_Read(ack);
+      else if (Slave == SLAVE_AT24C02)
+        I2C_D_REG(Registers) = AT24C02_Read(ack);
+      else
+        I2C_D_REG(Registers) = 0xFF;
+      break;
+    }
+
+    case OPERATION_STOP:
+      I2C_S_REG(Registers) &= ~I2C_S_BUSY_MASK;
+      MMA8451Q_Stop();
+      AT24C02_Stop();
+      BusyTime += finished - BusStart;
+      break;
+
+    case OPERATION_NONE:
+      break;
+  }
+
+  Operation = OPERATION_NONE;
+  Due = SIM_NEVER;
+  UpdatePort();
+}
+
+
+
+/*! @brief Starts a transfer
+ *
+ *  @param operation Sending or receiving
+ *  @param time When it starts
+ */
+static void StartTransfer(const TOperation operation, const uint64_t time)
+{
+  uint64_t bitTime = BitTime();
+
+  Operation = operation;
+  TransferStart = time;
+  Due = time + (BITS_PER_BYTE * bitTime) + (StartPending ? bitTime : 0);
+  StartPending = false;
+  TxData = I2C_D_REG(Registers);
+  I2C_S_REG(Registers) &= ~I2C_S_TCF_MASK;
+
+  if (time >= HangTime)
+  {
+    HangTime = SIM_NEVER;
+    Hung = true;
+    Due = SIM_NEVER;
+  }
+}
+
+
+
+/*! @brief Brings the bus and the accelerometer up to the current time
+ *
+ *  @return uint64_t - when either next has something to do
+ */
+static uint64_t Update(void)
+{
+  uint64_t now = Sim_Time();
+
+  while (Due <= now)
+  {
+    TOperation operation = Operation;
+    uint64_t finished = Due;
+
+    Complete();
+
+    if ((operation == OPERATION_SEND) || (operation == OPERATION_RECEIVE))
+    {
+      NbBytes++;
+      SlaveBytes[Slave]++;
+      SlaveTime[Slave] += finished - TransferStart;
+      I2C_S_REG(Registers) |= I2C_S_TCF_MASK | I2C_S_IICIF_MASK;
+
+      if (StopPending)
+      {
+        StopPending = false;
+        Operation = OPERATION_STOP;
+        Due = finished + BitTime();
+      }
+      else if ((operation == OPERATION_RECEIVE) && (I2C_C1_REG(Registers) & I2C_C1_DMAEN_MASK) &&
+               Sim_DMARequest(DMA_SOURCE_I2C0, I2C_D_REG(Registers)))
+      {
+        NbDMARequests++;
+        StartTransfer(OPERATION_RECEIVE, finished);
+      }
+    }
+  }
+
+  uint64_t nextSample = MMA8451Q_Update(now);
+
+  UpdatePort();
+  return (Due < nextSample) ? Due : nextSample;
+}
+
+
+
+/*! @brief Handles a write to C1
+ *
+ *  @param before C1 before the write
+ */
+static void WriteC1(const uint8_t before)
+{
+  uint8_t c1 = I2C_C1_REG(Registers);
+
+  // Disabling I2C0 resets it, and the clocks the firmware then sends by hand get the accelerometer to let go
+  if ((before & I2C_C1_IICEN_MASK) && !(c1 & I2C_C1_IICEN_MASK))
+  {
+    if (I2C_S_REG(Registers) & I2C_S_BUSY_MASK)
+      BusyTime += Sim_Time() - BusStart;
+
+    Operation = OPERATION_NONE;
+    Due = SIM_NEVER;
+    Phase = PHASE_IDLE;
+    StartPending = StopPending = Hung = false;
+    I2C_S_REG(Registers) = I2C_S_TCF_MASK;
+    MMA8451Q_Stop();
+    AT24C02_Stop();
+    NbResets++;
+    return;
+  }
+
+  // RSTA always reads as 0
+  if (c1 & I2C_C1_RSTA_MASK)
+  {
+    I2C_C1_REG(Registers) = c1 & ~I2C_C1_RSTA_MASK;
+
+    if (before & I2C_C1_MST_MASK)
+    {
+      Phase = PHASE_ADDRESS;
+      StartPending = true;
+    }
+  }
+
+  if (!(before & I2C_C1_MST_MASK) && (c1 & I2C_C1_MST_MASK))
+  {
+    I2C_S_REG(Registers) |= I2C_S_BUSY_MASK;
+    Phase = PHASE_ADDRESS;
+    StartPending = true;
+    BusStart = Sim_Time();
+    NbTransactions++;
+  }
+  else if ((before & I2C_C1_MST_MASK) && !(c1 & I2C_C1_MST_MASK))
+  {
+    Phase = PHASE_IDLE;
+
+    // A STOP asked for mid-byte goes out once the byte has finished
+    if (Operation != OPERATION_NONE)
+      StopPending = true;
+    else
+    {
+      Operation = OPERATION_STOP;
+      Due = Sim_Time() + BitTime();
+    }
+  }
+}
+
+
+
+/*! @brief Handles the firmware accessing an I2C0 register
+ *
+ *  @param offset The register's offset from I2C0_BASE_PTR
+ *  @param write TRUE if it was written
+ *  @param before The register before the access
+ *  @return uint64_t - when a read of S could next see something change, or SIM_NEVER
+ */
+static uint64_t Access(const uint32_t offset, const bool write, const uint8_t before)
+{
+  uint8_t written = I2C_S_REG(Registers);
+
+  // A transfer that finished before a write to S sets its flags first, so the write only clears what it wrote 1s to
+  if (write && (offset == offsetof(struct I2C_MemMap, S)))
+    I2C_S_REG(Registers) = before;
+
+  Update();
+
+  switch (offset)
+  {
+    case offsetof(struct I2C_MemMap, C1):
+      if (write)
+        WriteC1(before);
+      break;
+
+    case offsetof(struct I2C_MemMap, S):
+      if (write)
+      {
+        // IICIF and ARBL are write-1-to-clear, the rest are read-only
+        I2C_S_REG(Registers) &= ~(written & (I2C_S_IICIF_MASK | I2C_S_ARBL_MASK));
+      }
+      else if (Operation != OPERATION_NONE)
+        return Hung ? (Sim_Time() + BitTime()) : Due; // a poller held by SCL sees time pass a clock at a time
+      break;
+
+    case offsetof(struct I2C_MemMap, D):
+      if (!(I2C_C1_REG(Registers) & I2C_C1_MST_MASK) || (Operation != OPERATION_NONE))
+        break;
+
+      // Writing D sends a byte in transmit mode, reading D clocks in the next byte in receive mode
+      if (write && (I2C_C1_REG(Registers) & I2C_C1_TX_MASK))
+        StartTransfer(OPERATION_SEND, Sim_Time());
+      else if (!write && !(I2C_C1_REG(Registers) & I2C_C1_TX_MASK) && (Phase == PHASE_READ))
+        StartTransfer(OPERATION_RECEIVE, Sim_Time());
+      break;
+  }
+
+  return SIM_NEVER;
+}
+
+
+
+bool SimI2C_Init(void)
+{
+  Registers = (I2C_MemMapPtr)Sim_Trap((uint32_t)I2C0_BASE_PTR, Access);
+
+  if (!Registers)
+    return false;
+
+  I2C_S_REG(Registers) = I2C_S_TCF_MASK;
+  Operation = OPERATION_NONE;
+  Due = SIM_NEVER;
+
+  // SDA is pulled up
+  GPIOE_PDIR |= (1u << SDA_PIN);
+
+  const char* setting = getenv("SIM_I2C_HANG");
+
+  if (setting)
+    HangTime = (uint64_t)(strtod(setting, NULL) * 1000000.0);
+
+  return MMA8451Q_Init() && AT24C02_Init();
+}
+
+
+
+uint64_t SimI2C_Step(void)
+{
+  Sim_LockTraps();
+
+  uint64_t next = Update();
+  bool interrupt = (I2C_C1_REG(Registers) & I2C_C1_IICIE_MASK) && (I2C_S_REG(Registers) & I2C_S_IICIF_MASK);
+  bool portInterrupt = PortPending;
+
+  PortPending = false;
+  Sim_UnlockTraps();
+
+  // The I2C interrupt is level sensitive - it is taken for as long as IICIF is left set
+  if (interrupt)
+  {
+    NbInterrupts++;
+    Sim_Interrupt(SIM_VECTOR_I2C0);
+  }
+
+  // ISF is write-1-to-clear, which plain memory cannot do, so it is cleared once the ISR has run
+  if (portInterrupt)
+  {
+    Sim_Interrupt(SIM_VECTOR_PORTB);
+    PORTB_PCR4 &= ~PORT_PCR_ISF_MASK;
+    PORTB_ISFR &= ~(1u << INT1_PIN);
+  }
+
+  return next;
+}
+
+
+
+#if defined(__x86_64__)
+
+static volatile bool Stepping;       // Instructions are being counted
+static volatile uint64_t NbSteps;    // Instructions counted
+
+/*! @brief Counts one instruction of the driver, and has the byte on the bus done at once
+ *
+ *  @note TCF is set again after every instruction, so the interrupt still finds it set after its own write to I2C0_S.
+ */
+static void CostStep(int signal, siginfo_t* info, void* context)
+{
+  ucontext_t* ucontext = context;
+
+  if (!Stepping)
+  {
+    ucontext->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF_MASK;
+    return;
+  }
+
+  NbSteps++;
+  I2C_S_REG(I2C0_BASE_PTR) |= I2C_S_TCF_MASK;
+}
+
+
+
+/*! @brief Starts counting instructions - the trap flag traps after every instruction from here on
+ */
+static inline __attribute__((always_inline)) void StepOn(void)
+{
+  NbSteps = 0;
+  Stepping = true;
+  __asm__ volatile ("pushfq\n\torq %0, (%%rsp)\n\tpopfq" : : "i" (EFLAGS_TF_MASK) : "memory", "cc");
+}
+
+
+
+/*! @brief Stops counting instructions - the next trap clears the trap flag
+ *
+ *  @return uint64_t - the instructions counted
+ */
+static inline __attribute__((always_inline)) uint64_t StepOff(void)
+{
+  Stepping = false;
+  return NbSteps;
+}
+
+
+
+/*! @brief Counts the host instructions the driver runs for an 8-bit XYZ read - I2C_IntRead and the I2C interrupts
+ *         that run it - with the I2C0 registers as plain memory and every byte done and acknowledged at once
+ *
+ *  @param result Where to put the last read's instructions, then its I2C interrupts
+ *  @return bool - TRUE if every read went through
+ *  @note Must be called with interrupts masked, the traps locked and in an ISR, once the firmware has stopped.
+ *        It is not run again, so the driver is left as the reads leave it.
+ */
+static bool CountReads(uint64_t result[2])
+{
+  static TI2CDevice device;
+  uint8_t data[COST_READ_BYTES];
+  struct sigaction step = {.sa_sigaction = CostStep, .sa_flags = SA_SIGINFO};
+  struct sigaction trap;
+
+  device.slaveAddress = MMA8451Q_ADDRESS;
+  device.baudRate     = 100000;
+  device.priority     = I2C_PRIORITY_HIGH;
+
+  if (!I2C_AddDevice(&device) ||
+      (mprotect((void*)I2C0_BASE_PTR, COST_PAGE_SIZE, PROT_READ | PROT_WRITE) < 0) ||
+      (sigaction(SIGTRAP, &step, &trap) < 0))
+    return false;
+
+  // Starting and stopping take a few instructions of their own, which are taken off each count
+  StepOn();
+  uint64_t overhead = StepOff();
+  bool ok = true;
+
+  for (uint8_t read = 0; ok && (read < COST_NB_READS); read++)
+  {
+    uint64_t nbInterrupts = 0;
+
+    // A read the firmware left going is finished first
+    while ((I2C_IntReadStatus() == I2C_PENDING) && (nbInterrupts++ < COST_NB_INTERRUPTS))
+    {
+      I2C_S_REG(I2C0_BASE_PTR) |= I2C_S_IICIF_MASK;
+      StepOn();
+      I2C_ISR();
+      (void)StepOff();
+    }
+
+    StepOn();
+    ok = I2C_IntRead(&device, COST_READ_ADDRESS, data, COST_READ_BYTES);
+    uint64_t nbInstructions = StepOff() - overhead;
+
+    for (nbInterrupts = 0; ok && (I2C_IntReadStatus() == I2C_PENDING) && (nbInterrupts < COST_NB_INTERRUPTS); nbInterrupts++)
+    {
+      I2C_S_REG(I2C0_BASE_PTR) |= I2C_S_IICIF_MASK; // the byte is done, and was ACKed
+      StepOn();
+      I2C_ISR();
+      nbInstructions += StepOff() - overhead;
+    }
+
+    ok = ok && (I2C_IntReadStatus() == I2C_OK);
+    result[0] = nbInstructions;
+    result[1] = nbInterrupts;
+  }
+
+  sigaction(SIGTRAP, &trap, NULL);
+  mprotect((void*)I2C0_BASE_PTR, COST_PAGE_SIZE, PROT_NONE);
+  return ok;
+}
+
+
+
+/*! @brief Prints the host instructions the driver runs per 8-bit XYZ read
+ *
+ *  @note Register accesses trap, and ISR code takes no virtual time, so neither the host clock nor DWT_CYCCNT can
+ *        time the driver here - its instructions are counted by single-stepping it instead.
+ */
+static void ReportReadCost(void)
+{
+  uint64_t result[2];
+
+  // As Sim_Interrupt runs an ISR - the firmware's threads stay parked from here on
+  EnterCritical();
+  OS_ISREnter();
+  Sim_LockTraps();
+
+  bool counted = CountReads(result);
+
+  Sim_UnlockTraps();
+
+  if (counted)
+    fprintf(stderr, "Sim: I2C driver ran %llu host instructions in %llu interrupts per 8-bit XYZ read\n",
+            (unsigned long long)result[0], (unsigned long long)result[1]);
+  else
+    fprintf(stderr, "Sim: I2C driver instructions per read could not be counted\n");
+}
+
+#endif
+
+
+
+void SimI2C_Report(void)
+{
+  const TMMA8451QStats* stats = MMA8451Q_Stats();
+  uint64_t time = Sim_Time();
+
+  fprintf(stderr, "Sim: I2C0 ran %u transactions moving %u bytes, and was busy %.2f%% of the time\n",
+          (unsigned)NbTransactions, (unsigned)NbBytes, time ? (100.0 * BusyTime / time) : 0.0);
+  fprintf(stderr, "Sim: MMA8451Q took %u samples - %u reads, %u of them fresh, and %u samples overwritten\n",
+          (unsigned)stats->nbSamples, (unsigned)stats->nbReads, (unsigned)stats->nbFreshReads, (unsigned)stats->nbOverwritten);
+
+  if (stats->nbReads > 0)
+  {
+    fprintf(stderr, "Sim: I2C0 moved %.1f bytes and was busy %.1f us per read, counting configuration writes\n",
+            (double)NbBytes / stats->nbReads, BusyTime / 1000.0 / stats->nbReads);
+    fprintf(stderr, "Sim: I2C0 raised %u interrupts and %u eDMA requests - %.1f interrupts per read\n",
+            (unsigned)NbInterrupts, (unsigned)NbDMARequests, (double)NbInterrupts / stats->nbReads);
+  }
+
+  if (NbResets > 0)
+    fprintf(stderr, "Sim: I2C0 was disabled %u times, and the accelerometer let go of SCL\n", (unsigned)NbResets);
+
+  const TAT24C02Stats* eeprom = AT24C02_Stats();
+
+  if (eeprom)
+  {
+    fprintf(stderr, "Sim: AT24C02 served %u reads of %u bytes\n", (unsigned)eeprom->nbReads, (unsigned)eeprom->nbBytes);
+
+    for (TSlave slave = SLAVE_MMA8451Q; slave < NB_SLAVES; slave++)
+      fprintf(stderr, "Sim: I2C0 moved %u bytes for the %s, taking %.2f%% of the time\n", (unsigned)SlaveBytes[slave],
+              (slave == SLAVE_MMA8451Q) ? "MMA8451Q" : "AT24C02", time ? (100.0 * SlaveTime[slave] / time) : 0.0);
+  }
+
+#if defined(__x86_64__)
+  if (getenv("SIM_I2C_COST"))
+    ReportReadCost();
+#endif
+}
+
+
+
+/* END SimI2C */
+/*!
+** @}
+*/
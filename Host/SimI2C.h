@@ -0,0 +1,37 @@
+/*! @file
+ *
+ *  @brief Simulated I2C0 bus for the Linux host build.
+ *
+ *  This contains the functions for the I2C0 controller model, with the MMA8451Q on the bus and its
+ *  INT1 pin wired to PTB4. Every access the firmware makes to the I2C0 registers is seen by the model,
+ *  so START, repeated START, STOP, TXAK and the transfer started by reading D behave as on the K70,
+ *  and each byte takes nine SCL periods at the programmed baud rate.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-31
+ */
+
+#ifndef SIMI2C_H
+#define SIMI2C_H
+
+// new types
+#include <stdint.h>
+#include <stdbool.h>
+
+/*! @brief Traps the I2C0 registers and resets the controller and the accelerometer.
+ *
+ *  @return bool - TRUE if the bus was successfully initialized.
+ */
+bool SimI2C_Init(void);
+
+/*! @brief Completes any transfer that is due, and takes the I2C0 and PORTB interrupts.
+ *
+ *  @return uint64_t - when the bus or the accelerometer next has something to do.
+ */
+uint64_t SimI2C_Step(void);
+
+/*! @brief Prints the bus occupancy and how many bytes each sample cost.
+ */
+void SimI2C_Report(void);
+
+#endif
@@ -0,0 +1,347 @@
+/*!
+**  @file TraceDecode.cpp
+**
+**  @brief Turns a capture of the tower's serial output into a Chrome trace / Perfetto timeline.
+**         The capture is scanned for packets and extended frames the same way the PC software reads them,
+**         and the events in every CMD_TRACE frame are unwrapped onto a 64-bit clock and written out as
+**         trace event JSON - ISRs and I2C and flash commands as spans, semaphore signals as flows into the
+**         thread they wake, and packets as instants. Open the output in chrome://tracing or ui.perfetto.dev.
+**
+**         tracedecode [-l] [-m MHz] [capture] > trace.json
+**
+**         The capture is raw bytes, such as the output of cat on the serial port, or with -l a SIM_UART_LOG.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE TraceDecode */
+
+extern "C"
+{
+#include "packet.h"
+#include "Trace.h"
+}
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Tracks in the timeline
+static const int TID_ISR     = 1;   // One per ISR, in TISRStatsSource order
+static const int TID_THREAD  = 11;  // One per thread an ISR wakes, in the same order
+static const int TID_PACKETS = 21;
+static const int TID_I2C     = 22;
+static const int TID_FLASH   = 23;
+
+// In TISRStatsSource order
+static const char* const ISR_NAMES[]    = {"UART_ISR", "PIT_ISR", "FTM0_ISR", "RTC_ISR", "I2C_ISR", "AccelDataReady_ISR"};
+static const char* const THREAD_NAMES[] = {"PacketThread", "PITHandler", "FTM0Handler", "RTCHandler", "I2CHandler", "AccelHandler"};
+static const unsigned NB_SOURCES = sizeof(ISR_NAMES) / sizeof(ISR_NAMES[0]);
+
+static std::vector<std::string> Output;  // JSON objects, one per event
+static double MHz = 50.0;                // Cycle counter rate - TRACE_CLOCK events override it
+static uint64_t Cycles;                  // Unwrapped cycle counter of the last event
+static uint32_t LastCycles;
+static bool First = true;
+static std::map<unsigned, std::vector<unsigned> > Flows;  // Signals not yet matched with a wake, per ISR
+static unsigned NbFlows;
+
+
+
+/*! @brief Adds an event to the output
+ *
+ *  @param ph The event phase - B, E, i, s or f
+ *  @param name What to call it
+ *  @param tid Which track it goes on
+ *  @param extra Any other fields, each starting with a comma
+ */
+static void Emit(const char* ph, const std::string& name, const int tid, const std::string& extra = "")
+{
+  char line[256];
+
+  snprintf(line, sizeof(line), "{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f%s}",
+           ph, name.c_str(), tid, Cycles / MHz, extra.c_str());
+  Output.push_back(line);
+}
+
+
+
+/*! @brief Names a track
+ *
+ *  @param tid The track
+ *  @param name Its name
+ */
+static void NameTrack(const int tid, const std::string& name)
+{
+  char line[160];
+
+  snprintf(line, sizeof(line), "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+           tid, name.c_str());
+  Output.push_back(line);
+}
+
+
+
+/*! @brief Formats a value as hex
+ *
+ *  @param format The printf format
+ *  @param value The value
+ *  @return std::string - the text
+ */
+static std::string Hex(const char* format, const unsigned value)
+{
+  char text[32];
+
+  snprintf(text, sizeof(text), format, value);
+  return text;
+}
+
+
+
+/*! @brief Adds one trace event to the timeline
+ *
+ *  @param event The event's TRACE_EVENT_NB_BYTES bytes
+ */
+static void Decode(const uint8_t* const event)
+{
+  uint32_t cycles = event[0] | (event[1] << 8) | (event[2] << 16) | ((uint32_t)event[3] << 24);
+  uint8_t type = event[4];
+  uint8_t id = event[5];
+  uint16_t arg = event[6] | (event[7] << 8);
+
+  // Events can be recorded slightly out of order, so the difference is taken as signed
+  if (First)
+    Cycles = cycles;
+  else
+    Cycles += (int64_t)(int32_t)(cycles - LastCycles);
+
+  First = false;
+  LastCycles = cycles;
+
+  bool isr = (id < NB_SOURCES);
+
+  switch (type)
+  {
+    case TRACE_CLOCK:
+      if (arg > 0)
+        MHz = arg;
+      break;
+
+    case TRACE_LOST:
+      Emit("i", "lost " + std::to_string(arg) + " events", TID_PACKETS, ",\"s\":\"g\"");
+      break;
+
+    case TRACE_ISR_ENTER:
+    case TRACE_ISR_EXIT:
+      if (isr)
+        Emit((type == TRACE_ISR_ENTER) ? "B" : "E", ISR_NAMES[id], TID_ISR + id);
+      break;
+
+    case TRACE_SEM_SIGNAL:
+      if (isr)
+      {
+        Flows[id].push_back(++NbFlows);
+        Emit("i", "signal", TID_ISR + id, ",\"s\":\"t\"");
+        Emit("s", "wake", TID_ISR + id, ",\"cat\":\"semaphore\",\"id\":" + std::to_string(NbFlows));
+      }
+      break;
+
+    case TRACE_SEM_WAKE:
+      if (isr)
+      {
+        Emit("i", "woken", TID_THREAD + id, ",\"s\":\"t\"");
+
+        // A thread woken several times by one signal is only joined to it once
+        if (!Flows[id].empty())
+        {
+          Emit("f", "wake", TID_THREAD + id, ",\"cat\":\"semaphore\",\"bp\":\"e\",\"id\":" + std::to_string(Flows[id].front()));
+          Flows[id].erase(Flows[id].begin());
+        }
+      }
+      break;
+
+    case TRACE_PACKET_RX:
+      Emit("i", Hex("RX 0x%02X", id), TID_PACKETS, ",\"s\":\"t\",\"args\":{\"parameters\":\"" + Hex("0x%04X", arg) + "\"}");
+      break;
+
+    case TRACE_PACKET_TX:
+      Emit("i", Hex("TX 0x%02X", id), TID_PACKETS, ",\"s\":\"t\",\"args\":{\"bytes\":" + std::to_string(arg) + "}");
+      break;
+
+    case TRACE_I2C_START:
+      Emit("B", std::string(id ? "read " : "write ") + Hex("0x%02X", arg), TID_I2C);
+      break;
+
+    case TRACE_I2C_STOP:
+      Emit("E", "", TID_I2C);
+      break;
+
+    case TRACE_FLASH_LAUNCH:
+      Emit("B", (id == 0x07) ? "Program Phrase" : (id == 0x09) ? "Erase Sector" : Hex("command 0x%02X", id), TID_FLASH,
+           ",\"args\":{\"address_low\":\"" + Hex("0x%04X", arg) + "\"}");
+      break;
+
+    case TRACE_FLASH_COMPLETE:
+      Emit("E", "", TID_FLASH, ",\"args\":{\"FSTAT\":\"" + Hex("0x%02X", arg) + "\"}");
+      break;
+  }
+}
+
+
+
+/*! @brief Checks whether a command's replies are extended frames rather than 5-byte packets
+ *
+ *  @param command The command byte
+ *  @return bool - TRUE if it is sent as frames
+ */
+static bool IsFrame(const uint8_t command)
+{
+  switch (command & ~0x80)
+  {
+    case CMD_ACCEL_STREAM:
+    case CMD_ACCEL_STREAM14:
+    case CMD_ACCEL_DELTA:
+    case CMD_ACCEL_STATS:
+    case CMD_I2C_STATS:
+    case CMD_I2C_ERRORS:
+    case CMD_I2C_BUS:
+    case CMD_BENCH:
+    case CMD_ISRSTATS:
+    case CMD_THREADS:
+    case CMD_TRACE:
+      return true;
+  }
+
+  return false;
+}
+
+
+
+/*! @brief Reads the capture
+ *
+ *  @param file The capture
+ *  @param log TRUE if it is a SIM_UART_LOG, with a time and one byte in hex on each line
+ *  @return std::vector<uint8_t> - the bytes
+ */
+static std::vector<uint8_t> ReadCapture(FILE* const file, const bool log)
+{
+  std::vector<uint8_t> bytes;
+
+  if (log)
+  {
+    double time;
+    unsigned byte;
+
+    while (fscanf(file, "%lf %x", &time, &byte) == 2)
+      bytes.push_back(byte);
+  }
+  else
+  {
+    int byte;
+
+    while ((byte = fgetc(file)) != EOF)
+      bytes.push_back(byte);
+  }
+
+  return bytes;
+}
+
+
+
+int main(int argc, char* argv[])
+{
+  bool log = false;
+  const char* path = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-l"))
+      log = true;
+    else if (!strcmp(argv[i], "-m") && (i + 1 < argc))
+      MHz = atof(argv[++i]);
+    else
+      path = argv[i];
+  }
+
+  FILE* file = path ? fopen(path, log ? "r" : "rb") : stdin;
+
+  if (!file)
+  {
+    perror(path);
+    return 1;
+  }
+
+  std::vector<uint8_t> bytes = ReadCapture(file, log);
+  unsigned nbEvents = 0, nbSkipped = 0;
+
+  for (unsigned i = 0; i < NB_SOURCES; i++)
+  {
+    NameTrack(TID_ISR + i, ISR_NAMES[i]);
+    NameTrack(TID_THREAD + i, THREAD_NAMES[i]);
+  }
+  NameTrack(TID_PACKETS, "Packets");
+  NameTrack(TID_I2C, "I2C0");
+  NameTrack(TID_FLASH, "Flash");
+
+  // Walk the stream, re-synchronizing a byte at a time on a bad checksum
+  size_t i = 0;
+
+  while (i < bytes.size())
+  {
+    uint8_t checksum = 0;
+
+    if (IsFrame(bytes[i]) && (i + 1 < bytes.size()) && (bytes[i + 1] <= PACKET_FRAME_MAX_PAYLOAD) &&
+        (i + PACKET_FRAME_NB_BYTES(bytes[i + 1]) <= bytes.size()))
+    {
+      size_t nbBytes = PACKET_FRAME_NB_BYTES(bytes[i + 1]);
+
+      for (size_t j = 0; j < nbBytes; j++)
+        checksum ^= bytes[i + j];
+
+      if (checksum == 0)
+      {
+        if (bytes[i] == CMD_TRACE)
+          for (size_t j = 0; j + TRACE_EVENT_NB_BYTES <= bytes[i + 1]; j += TRACE_EVENT_NB_BYTES, nbEvents++)
+            Decode(&bytes[i + 2 + j]);
+
+        i += nbBytes;
+        continue;
+      }
+    }
+    else if (i + PACKET_NB_BYTES <= bytes.size())
+    {
+      for (size_t j = 0; j < PACKET_NB_BYTES; j++)
+        checksum ^= bytes[i + j];
+
+      if (checksum == 0)
+      {
+        i += PACKET_NB_BYTES;
+        continue;
+      }
+    }
+
+    i++;
+    nbSkipped++;
+  }
+
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for (size_t j = 0; j < Output.size(); j++)
+    printf("%s%s\n", Output[j].c_str(), (j + 1 < Output.size()) ? "," : "");
+  printf("]}\n");
+
+  fprintf(stderr, "TraceDecode: %u events at %.0f MHz, %u bytes skipped\n", nbEvents, MHz, nbSkipped);
+  return 0;
+}
+
+
+
+/* END TraceDecode */
+/*!
+** @}
+*/
@@ -0,0 +1,54 @@
+/*! @file
+ *
+ *  @brief Host build replacement for the Processor Expert CPU component.
+ *
+ *  Carries the clock configuration and vector table declarations from Generated_Code/Cpu.h.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-24
+ */
+
+#ifndef __Cpu_H
+#define __Cpu_H
+
+#include "PE_Types.h"
+#include "PE_Error.h"
+#include "PE_Const.h"
+#include "IO_Map.h"
+
+// Clock configuration 0 - must match Generated_Code/Cpu.h
+#define CPU_BUS_CLK_HZ                  25000000U
+#define CPU_CORE_CLK_HZ                 50000000U
+#define CPU_XTAL_CLK_HZ                 50000000U
+#define CPU_INT_SLOW_CLK_HZ             32768U
+#define CPU_INT_FAST_CLK_HZ             4000000U
+#define CPU_CORE_CLK_HZ_CONFIG_0        50000000UL
+#define CPU_BUS_CLK_HZ_CONFIG_0         25000000UL
+#define CPU_FLASH_CLK_HZ_CONFIG_0       12500000UL
+#define CPU_MCGFF_CLK_HZ_CONFIG_0       24414UL
+
+// Generated_Code/Vectors.c is compiled unchanged - the simulator raises interrupts through its table
+typedef void (*const tIsrFunc)(void);
+typedef struct {
+  void * __ptr;
+  tIsrFunc __fun[0x79];
+} tVectorTable;
+
+extern const tVectorTable __vect_table;
+
+extern volatile uint8_t SR_reg;
+extern volatile uint8_t SR_lock;
+
+#if !defined(PE_ISR)
+  #define PE_ISR(ISR_name) void __attribute__ ((interrupt)) ISR_name(void)
+#endif
+
+/*! @brief Services an interrupt the firmware has no handler for - reports the vector and stops.
+ */
+PE_ISR(Cpu_Interrupt);
+
+/*! @brief Brings up the simulated tower in place of the Processor Expert low level initialization.
+ */
+void PE_low_level_init(void);
+
+#endif
@@ -0,0 +1,30 @@
+/*! @file
+ *
+ *  @brief Host build wrapper for the RTOS interface.
+ *
+ *  Pulls in Library/OS.h unchanged and replaces its Cortex-M4 interrupt masking with the simulator's.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-24
+ */
+
+#ifndef HOST_OS_H
+#define HOST_OS_H
+
+#include_next "OS.h"
+#include "Sim.h"
+
+#undef OS_DisableInterrupts
+#undef OS_EnableInterrupts
+
+#define OS_DisableInterrupts() Sim_MaskInterrupts(SIM_MASK_PRIMASK)
+#define OS_EnableInterrupts()  Sim_UnmaskInterrupts(SIM_MASK_PRIMASK)
+
+/*! @brief Lets a higher priority thread made ready by an ISR take over from the calling thread.
+ *
+ *  @note Called by the simulator whenever a thread unmasks interrupts - the host cannot stop a thread
+ *  at an arbitrary instruction, so this is where an ISR's context switch takes effect.
+ */
+void OS_HostPreempt(void);
+
+#endif
@@ -0,0 +1,38 @@
+/*! @file
+ *
+ *  @brief Host build wrapper for the Processor Expert types.
+ *
+ *  Pulls in Generated_Code/PE_Types.h unchanged and replaces its Cortex-M4 inline assembly
+ *  with the simulator's interrupt masking.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-24
+ */
+
+#ifndef HOST_PE_TYPES_H
+#define HOST_PE_TYPES_H
+
+// bool must come from stdbool.h before PE_Types.h looks for it
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include_next "PE_Types.h"
+#include "Sim.h"
+
+#undef __EI
+#undef __DI
+#undef EnterCritical
+#undef ExitCritical
+#undef PE_DEBUGHALT
+#undef PE_NOP
+#undef PE_WFI
+
+#define __EI()          Sim_UnmaskInterrupts(SIM_MASK_FAULTMASK)
+#define __DI()          Sim_MaskInterrupts(SIM_MASK_FAULTMASK)
+#define EnterCritical() Sim_EnterCritical()
+#define ExitCritical()  Sim_ExitCritical()
+#define PE_DEBUGHALT()  abort()
+#define PE_NOP()        do {} while (0)
+#define PE_WFI()        Sim_WaitForInterrupt()
+
+#endif
@@ -0,0 +1,51 @@
+#!/bin/sh
+# Runs each scenario in tests/ through the simulator in virtual time and compares its report with the
+# recorded one.
+#
+#   tests/<name>.txt       a SIM_UART_SCRIPT, whose "#@ NAME=value" lines set the environment for the run.
+#                          "#@ CPPFLAGS=..." runs it on a build of the firmware with those flags instead.
+#   tests/<name>.expected  the simulator's report, less the lines that depend on the host
+#
+# Run from Host/ (make check does). UPDATE=1 records the reports instead of comparing them.
+
+MAKE=${MAKE:-make}
+BUILD=${BUILD:-build}
+failed=0
+
+for script in tests/*.txt; do
+  name=$(basename "$script" .txt)
+  expected=tests/$name.expected
+  actual=$BUILD/tests/$name.report
+  flags=$(sed -n 's/^#@ CPPFLAGS=//p' "$script")
+  tower=$BUILD/tower
+
+  mkdir -p "$BUILD/tests"
+
+  if [ -n "$flags" ]; then
+    variant=$BUILD/variants/$(printf '%s' "$flags" | tr -c 'A-Za-z0-9_\n' '_')
+    $MAKE --no-print-directory -s BUILD="$variant" CPPFLAGS="$flags" "$variant/tower" || exit 1
+    tower=$variant/tower
+  fi
+
+  # The settings go through env so a scenario cannot run anything
+  set -- SIM_TIME=virtual SIM_DURATION=30 SIM_UART_SCRIPT="$script" SIM_UART_LOG="$BUILD/tests/$name.log"
+  while IFS= read -r setting; do
+    [ -n "$setting" ] && set -- "$@" "$setting"
+  done <<END
+$(sed -n '/^#@ CPPFLAGS=/d; s/^#@ //p' "$script")
+END
+
+  env "$@" "./$tower" 2>&1 >/dev/null | grep '^Sim: ' | grep -v -e 'wall-clock' -e 'UART2 is' > "$actual"
+
+  if [ -n "$UPDATE" ]; then
+    cp "$actual" "$expected"
+    echo "recorded $name"
+  elif diff -u "$expected" "$actual"; then
+    echo "passed $name"
+  else
+    echo "FAILED $name"
+    failed=1
+  fi
+done
+
+exit $failed
@@ -0,0 +1,390 @@
+/*!
+**  @file Bench.c
+**
+**  @brief Microbenchmarks for the firmware's hot paths.
+**         Each case is a function running one iteration of the code being timed. It is called for a batch
+**         of iterations with interrupts disabled, several batches are timed, and the cost of calling an
+**         empty case the same number of times is taken off. Modules with private code worth timing
+**         register their own cases with BENCH_REGISTER in their Init functions.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Bench */
+
+#include "Bench.h"
+#include "FIFO.h"
+#include "median.h"
+#include "packet.h"
+#include "OS.h"
+#include "RTC.h"
+#include "MK70F12.h"
+#include "Cpu.h"
+
+#include <string.h>
+
+#if defined(__linux__)
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#endif
+
+// Debug Exception and Monitor Control Register trace enable - needed for the DWT to run
+#define DEMCR_TRCENA_MASK 0x01000000u
+// DWT cycle counter enable
+#define DWT_CTRL_CYCCNTENA_MASK 0x1u
+
+// Parameter1 asking for every case
+#define BENCH_ALL_CASES 0xFF
+
+// Bytes of the reply frame before the name
+#define BENCH_FRAME_HEADER 15
+
+typedef struct
+{
+  const char* name;
+  TBenchCase benchCase;
+  uint16_t nbIterations;
+} TBenchEntry;
+
+static TBenchEntry Cases[BENCH_MAX_CASES];
+static uint8_t NbCases;
+
+// Inputs and outputs for the cases - volatile so the work cannot be optimised away
+static volatile uint8_t Sink;
+static uint8_t Input;
+static TFIFO BenchFIFO;
+static TPacketParser BenchParser;
+
+// The semaphore-guarded FIFO that the lock-free ring replaced, kept to time the ring against
+static OS_ECB* SemaphoreFIFOAccess;
+static OS_ECB* SemaphoreFIFOUsed;
+static OS_ECB* SemaphoreFIFOFree;
+static uint16_t SemaphoreFIFOStart;
+static uint16_t SemaphoreFIFOEnd;
+static uint8_t SemaphoreFIFOBuffer[FIFO_SIZE];
+
+
+
+#if defined(__linux__)
+
+/*! @brief Gets the time from the monotonic clock
+ *
+ *  @return uint64_t - nanoseconds
+ */
+static uint64_t Nanoseconds(void)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t)now.tv_sec * 1000000000u) + now.tv_nsec;
+}
+
+#endif
+
+
+
+/*! @brief Reads the benchmark clock
+ *
+ *  @return uint32_t - ticks, which wrap
+ */
+static uint32_t Ticks(void)
+{
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+  return (uint32_t)__rdtsc();
+#elif defined(__linux__)
+  return (uint32_t)Nanoseconds();
+#else
+  return DWT_CYCCNT;
+#endif
+}
+
+
+
+/*! @brief Gets the rate of the benchmark clock
+ *
+ *  @return uint32_t - kHz
+ */
+static uint32_t TickKHz(void)
+{
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+  static uint32_t tickKHz;
+
+  // The TSC rate is measured against the monotonic clock over 10ms the first time it is needed
+  if (tickKHz == 0)
+  {
+    uint64_t start = Nanoseconds();
+    uint64_t startTicks = __rdtsc();
+
+    while (Nanoseconds() - start < 10000000u)
+    {
+    }
+
+    tickKHz = (uint32_t)((__rdtsc() - startTicks) * 1000000u / (Nanoseconds() - start));
+  }
+
+  return tickKHz;
+#elif defined(__linux__)
+  return 1000000;
+#else
+  return CPU_CORE_CLK_HZ / 1000;
+#endif
+}
+
+
+
+/*! @brief Times one batch of a case
+ *
+ *  @param benchCase The case
+ *  @param nbIterations Iterations in the batch
+ *  @return uint32_t - ticks taken
+ */
+static uint32_t TimeBatch(const TBenchCase benchCase, const uint16_t nbIterations)
+{
+  EnterCritical(); // Interrupts would be counted against the case
+
+  uint32_t start = Ticks();
+
+  for (uint16_t i = 0; i < nbIterations; i++)
+    benchCase();
+
+  uint32_t ticks = Ticks() - start;
+
+  ExitCritical();
+
+  return ticks;
+}
+
+
+
+/*! @brief Case with nothing to do - its cost is taken off every other case
+ */
+static void BenchEmpty(void)
+{
+}
+
+
+
+/*! @brief Median of three bytes
+ */
+static void BenchMedian3(void)
+{
+  Input += 37;
+  Sink = Median_Filter3(Input, Input ^ 0x5A, Input + 91);
+}
+
+
+
+/*! @brief Checksum and parse of one packet, a byte at a time as Packet_Get does
+ */
+static void BenchPacketParse(void)
+{
+  static const uint8_t bytes[PACKET_NB_BYTES] = {CMD_VERSION, 'v', 0x01, 0x00, CMD_VERSION ^ 'v' ^ 0x01};
+  TPacket packet;
+
+  for (uint8_t i = 0; i < PACKET_NB_BYTES; i++)
+    if (Packet_ParserPutByte(&BenchParser, bytes[i], &packet))
+      Sink = Packet_Command(&packet);
+}
+
+
+
+/*! @brief One byte into a FIFO and back out
+ */
+static void BenchFIFOPutGet(void)
+{
+  uint8_t data;
+
+  (void)FIFO_Put(&BenchFIFO, Input++);
+  (void)FIFO_Get(&BenchFIFO, &data);
+  Sink = data;
+}
+
+
+
+/*! @brief One byte into and back out of the FIFO as it was before the lock-free ring - each way takes the access
+ *         semaphore, waits on one count and signals the other, then gives the access semaphore back
+ */
+static void BenchSemFIFOPutGet(void)
+{
+  (void)OS_SemaphoreWait(SemaphoreFIFOAccess, 0);
+  (void)OS_SemaphoreWait(SemaphoreFIFOFree, 0);
+  (void)OS_SemaphoreSignal(SemaphoreFIFOUsed);
+
+  SemaphoreFIFOBuffer[SemaphoreFIFOEnd] = Input++;
+  if (++SemaphoreFIFOEnd >= FIFO_SIZE)
+    SemaphoreFIFOEnd = 0;
+
+  (void)OS_SemaphoreSignal(SemaphoreFIFOAccess);
+
+  (void)OS_SemaphoreWait(SemaphoreFIFOAccess, 0);
+  (void)OS_SemaphoreWait(SemaphoreFIFOUsed, 0);
+  (void)OS_SemaphoreSignal(SemaphoreFIFOFree);
+
+  Sink = SemaphoreFIFOBuffer[SemaphoreFIFOStart];
+  if (++SemaphoreFIFOStart >= FIFO_SIZE)
+    SemaphoreFIFOStart = 0;
+
+  (void)OS_SemaphoreSignal(SemaphoreFIFOAccess);
+}
+
+
+
+/*! @brief Splitting a time in seconds into hours, minutes and seconds, as RTC_Get does - without reading RTC_TSR,
+ *         which bus-faults unless the RTC's clock gate is on
+ */
+static void BenchRTCSplit(void)
+{
+  static uint32_t secondsTotal;
+  uint8_t hours, minutes, seconds;
+
+  secondsTotal = (secondsTotal + 3701) % (24 * 3600);
+  RTC_Split(secondsTotal, &hours, &minutes, &seconds);
+  Sink = hours ^ minutes ^ seconds;
+}
+
+
+
+/*!
+ * @brief Handles a Benchmark packet - times one case, or every case in turn
+ *
+ * Parameter1 = case number, or 0xFF for every case, Parameter2 = 0, Parameter3 = 0
+ * Reply: one extended frame per case - the case number, iterations per batch, clock rate in kHz,
+ *        fastest and mean batch in ticks (all LSB first), then the case's name
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if there is no such case.
+ */
+static bool HandleBenchPacket(const TPacket* const packet)
+{
+  uint8_t first = Packet_Parameter1(packet);
+  uint8_t last  = first;
+
+  if (first == BENCH_ALL_CASES)
+  {
+    first = 0;
+    last  = NbCases - 1;
+  }
+
+  if ((NbCases == 0) || (last >= NbCases))
+    return false;
+
+  for (uint8_t caseNb = first; caseNb <= last; caseNb++)
+  {
+    uint8_t payload[PACKET_FRAME_MAX_PAYLOAD];
+    TBenchResult result;
+    uint8_t nbName = strlen(Cases[caseNb].name);
+
+    (void)Bench_Run(caseNb, &result);
+
+    if (nbName > PACKET_FRAME_MAX_PAYLOAD - BENCH_FRAME_HEADER)
+      nbName = PACKET_FRAME_MAX_PAYLOAD - BENCH_FRAME_HEADER;
+
+    payload[0] = caseNb;
+    for (uint8_t i = 0; i < 2; i++)
+      payload[1 + i] = (uint8_t)(result.nbIterations >> (8 * i));
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      payload[3 + i]  = (uint8_t)(result.tickKHz >> (8 * i));
+      payload[7 + i]  = (uint8_t)(result.minTicks >> (8 * i));
+      payload[11 + i] = (uint8_t)(result.meanTicks >> (8 * i));
+    }
+    memcpy(&payload[BENCH_FRAME_HEADER], Cases[caseNb].name, nbName);
+
+    // Running all the cases can fill the transmit ring, so wait for room
+    while (!Packet_PutFrame(CMD_BENCH, payload, BENCH_FRAME_HEADER + nbName))
+      OS_TimeDelay(1);
+  }
+
+  return true;
+}
+
+
+
+bool Bench_Init(void)
+{
+#if !defined(__linux__)
+  // Start the cycle counter - Idle_Init may already have
+  CoreDebug_base_DEMCR_REG(CoreDebug_BASE_PTR) |= DEMCR_TRCENA_MASK;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+#endif
+
+  FIFO_Init(&BenchFIFO);
+  Packet_ParserInit(&BenchParser);
+
+  SemaphoreFIFOAccess = OS_SemaphoreCreate(1);
+  SemaphoreFIFOUsed   = OS_SemaphoreCreate(0);
+  SemaphoreFIFOFree   = OS_SemaphoreCreate(FIFO_SIZE);
+
+  return (BENCH_REGISTER(BenchMedian3, 256) &&
+          BENCH_REGISTER(BenchPacketParse, 64) &&
+          BENCH_REGISTER(BenchFIFOPutGet, 256) &&
+          BENCH_REGISTER(BenchSemFIFOPutGet, 256) &&
+          BENCH_REGISTER(BenchRTCSplit, 64) &&
+          Packet_RegisterHandler(CMD_BENCH, HandleBenchPacket, PACKET_FLAG_NO_ACK));
+}
+
+
+
+bool Bench_Register(const char* const name, const TBenchCase benchCase, const uint16_t nbIterations)
+{
+  if (NbCases == BENCH_MAX_CASES)
+    return false;
+
+  Cases[NbCases].name = name;
+  Cases[NbCases].benchCase = benchCase;
+  Cases[NbCases].nbIterations = nbIterations;
+  NbCases++;
+
+  return true;
+}
+
+
+
+bool Bench_Run(const uint8_t caseNb, TBenchResult* const result)
+{
+  if (caseNb >= NbCases)
+    return false;
+
+  uint16_t nbIterations = Cases[caseNb].nbIterations;
+  uint32_t overhead = UINT32_MAX;
+  uint32_t total = 0;
+
+  result->nbIterations = nbIterations;
+  result->tickKHz = TickKHz();
+  result->minTicks = UINT32_MAX;
+
+  // The loop and call cost is the fastest an empty case runs
+  for (uint8_t batch = 0; batch < BENCH_NB_BATCHES; batch++)
+  {
+    uint32_t ticks = TimeBatch(BenchEmpty, nbIterations);
+
+    if (ticks < overhead)
+      overhead = ticks;
+  }
+
+  for (uint8_t batch = 0; batch < BENCH_NB_BATCHES; batch++)
+  {
+    uint32_t ticks = TimeBatch(Cases[caseNb].benchCase, nbIterations);
+
+    ticks = (ticks > overhead) ? (ticks - overhead) : 0;
+    total += ticks;
+
+    if (ticks < result->minTicks)
+      result->minTicks = ticks;
+  }
+
+  result->meanTicks = total / BENCH_NB_BATCHES;
+  return true;
+}
+
+
+
+/* END Bench */
+/*!
+** @}
+*/
@@ -0,0 +1,68 @@
+/*! @file
+ *
+ *  @brief Microbenchmarks for the firmware's hot paths.
+ *
+ *  This contains the functions for registering benchmark cases and timing them. On the tower the
+ *  DWT cycle counter is the clock; in the Linux host build it is the TSC, or clock_gettime where
+ *  there is no TSC. Results are reported over the serial port with CMD_BENCH.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-05
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+// new types
+#include "types.h"
+
+// Most cases that can be registered
+#define BENCH_MAX_CASES 16
+
+// Batches each case is timed over - the fastest is taken as the result
+#define BENCH_NB_BATCHES 8
+
+/*! @brief A benchmark case - one iteration of the code being timed.
+ */
+typedef void (*TBenchCase)(void);
+
+typedef struct
+{
+  uint16_t nbIterations;  /*!< Iterations in each batch. */
+  uint32_t tickKHz;       /*!< Rate of the clock the batches were timed with, in kHz. */
+  uint32_t minTicks;      /*!< Ticks taken by the fastest batch, less the cost of calling an empty case. */
+  uint32_t meanTicks;     /*!< Mean ticks taken by a batch, less the cost of calling an empty case. */
+} TBenchResult;
+
+/*! @brief Registers a case under its function's name.
+ *
+ *  @param benchCase The function running one iteration.
+ *  @param nbIterations Iterations in each timed batch.
+ */
+#define BENCH_REGISTER(benchCase, nbIterations) Bench_Register(#benchCase, (benchCase), (nbIterations))
+
+/*! @brief Starts the benchmark clock, registers the cases for the library modules and the CMD_BENCH handler.
+ *
+ *  @return bool - TRUE if the benchmarks were successfully initialized.
+ */
+bool Bench_Init(void);
+
+/*! @brief Adds a case to the end of the list - use BENCH_REGISTER.
+ *
+ *  @param name The case's name, reported with its results.
+ *  @param benchCase The function running one iteration.
+ *  @param nbIterations Iterations in each timed batch.
+ *  @return bool - TRUE if there was room for the case.
+ */
+bool Bench_Register(const char* const name, const TBenchCase benchCase, const uint16_t nbIterations);
+
+/*! @brief Times a case.
+ *
+ *  @param caseNb The case's position in the list.
+ *  @param result Where to put the timings.
+ *  @return bool - TRUE if the case exists.
+ *  @note Each batch runs with interrupts disabled.
+ */
+bool Bench_Run(const uint8_t caseNb, TBenchResult* const result);
+
+#endif
@@ -0,0 +1,150 @@
+/*!
+**  @file DMA.c
+**
+**  @brief Routines for setting up the enhanced DMA (eDMA) controller on the TWR-K70F120M.
+**         Peripheral requests are routed to a channel through the DMAMUX, and each transfer
+**         moves one byte per request until the major loop completes, at which point the
+**         channel's callback is run from the DMA ISR.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE DMA */
+
+#include "DMA.h"
+#include "MK70F12.h"
+#include "PE_Types.h"
+#include "OS.h"
+
+// Private global copies of each channel's callback
+static void (*ChannelCallback[DMA_NB_CHANNELS])(void*);
+static void* ChannelCallbackArguments[DMA_NB_CHANNELS];
+
+
+
+bool DMA_Init(void)
+{
+  // Enabling clock gates for the DMAMUX and the eDMA controller
+  SIM_SCGC6 |= SIM_SCGC6_DMAMUX0_MASK;
+  SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
+
+  // Default control settings - fixed priority arbitration, no minor loop mapping
+  DMA_CR = 0;
+
+  // Setting up NVIC for DMA channels 0 and 1 see K70 manual pg 97
+  // Vector=16, IRQ=0 and Vector=17, IRQ=1
+  // NVIC non-IPR=0 IPR=0
+  // Clear any pending interrupts on DMA channels 0 and 1
+  NVICICPR0 = (1 << 0) | (1 << 1); // 0mod32 = 0, 1mod32 = 1
+  // Enable interrupts from DMA channels 0 and 1
+  NVICISER0 = (1 << 0) | (1 << 1);
+
+  return true;
+}
+
+
+
+bool DMA_Set(const TDMAChannel* const aDMAChannel)
+{
+  uint8_t channelNb = aDMAChannel->channelNb;
+
+  if (channelNb >= DMA_NB_CHANNELS)
+    return false;
+
+  // Saving callback for this channel
+  ChannelCallback[channelNb]          = aDMAChannel->callback;
+  ChannelCallbackArguments[channelNb] = aDMAChannel->callbackArguments;
+
+  // Stop requests while the channel is being routed
+  DMA_CERQ = DMA_CERQ_CERQ(channelNb);
+
+  // Route the peripheral request to this channel
+  DMAMUX0_CHCFG(channelNb) = 0;
+  DMAMUX0_CHCFG(channelNb) = DMAMUX_CHCFG_ENBL_MASK | DMAMUX_CHCFG_SOURCE(aDMAChannel->source);
+
+  return true;
+}
+
+
+
+bool DMA_StartTransfer(const uint8_t channelNb, const volatile void* const source, const int16_t sourceOffset,
+                       volatile void* const destination, const int16_t destinationOffset, const uint16_t nbBytes)
+{
+  if ((channelNb >= DMA_NB_CHANNELS) || (nbBytes == 0))
+    return false;
+
+  // If requests are still enabled the previous major loop has not completed
+  if (DMA_ERQ & (1 << channelNb))
+    return false;
+
+  // Transfer control descriptor - see K70 manual pg 531
+  DMA_SADDR(channelNb)         = (uint32_t)source;
+  DMA_SOFF(channelNb)          = sourceOffset;
+  DMA_ATTR(channelNb)          = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0); // 8-bit source and destination
+  DMA_NBYTES_MLNO(channelNb)   = 1; // One byte per peripheral request
+  DMA_SLAST(channelNb)         = 0;
+  DMA_DADDR(channelNb)         = (uint32_t)destination;
+  DMA_DOFF(channelNb)          = destinationOffset;
+  DMA_CITER_ELINKNO(channelNb) = DMA_CITER_ELINKNO_CITER(nbBytes);
+  DMA_BITER_ELINKNO(channelNb) = DMA_BITER_ELINKNO_BITER(nbBytes);
+  DMA_DLAST_SGA(channelNb)     = 0;
+
+  // Interrupt at the end of the major loop, and stop taking requests once it is done
+  DMA_CSR(channelNb) = DMA_CSR_INTMAJOR_MASK | DMA_CSR_DREQ_MASK;
+
+  // Enable requests - the peripheral now paces the transfer
+  DMA_SERQ = DMA_SERQ_SERQ(channelNb);
+
+  return true;
+}
+
+
+
+void DMA_Cancel(const uint8_t channelNb)
+{
+  if (channelNb < DMA_NB_CHANNELS)
+    DMA_CERQ = DMA_CERQ_CERQ(channelNb);
+}
+
+
+
+/*! @brief Clears a channel's interrupt flag and runs its callback
+ *
+ *  @param channelNb The channel whose major loop has completed
+ */
+static void ChannelComplete(const uint8_t channelNb)
+{
+  // Clear the interrupt flag
+  DMA_CINT = DMA_CINT_CINT(channelNb);
+
+  if (ChannelCallback[channelNb])
+    (*ChannelCallback[channelNb])(ChannelCallbackArguments[channelNb]);
+}
+
+
+
+void __attribute__ ((interrupt)) DMA0_ISR(void)
+{
+  OS_ISREnter();
+  ChannelComplete(0);
+  OS_ISRExit();
+}
+
+
+
+void __attribute__ ((interrupt)) DMA1_ISR(void)
+{
+  OS_ISREnter();
+  ChannelComplete(1);
+  OS_ISRExit();
+}
+
+
+
+/* END DMA */
+/*!
+** @}
+*/
@@ -0,0 +1,85 @@
+/*! @file
+ *
+ *  @brief Routines for setting up the enhanced DMA (eDMA) controller on the TWR-K70F120M.
+ *
+ *  This contains the functions for routing peripheral requests to eDMA channels and
+ *  starting byte-wide transfers on them.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-23
+ */
+
+#ifndef DMA_H
+#define DMA_H
+
+// new types
+#include "types.h"
+
+// Number of eDMA channels that have an ISR wired into the vector table
+#define DMA_NB_CHANNELS 2
+
+// DMAMUX request sources (see K70 manual table 3-24)
+#define DMA_SOURCE_UART2_RX 6
+#define DMA_SOURCE_UART2_TX 7
+#define DMA_SOURCE_I2C0     22
+
+typedef struct
+{
+  uint8_t channelNb;		/*!< The eDMA channel to use. */
+  uint8_t source;		/*!< The DMAMUX request source that triggers the channel. */
+  void (*callback)(void* arguments);	/*!< Called from the DMA ISR when a transfer has completed. */
+  void* callbackArguments;	/*!< Passed to the callback. */
+} TDMAChannel;
+
+/*! @brief Sets up the eDMA controller and DMAMUX before first use.
+ *
+ *  @return bool - TRUE if the DMA was successfully initialized.
+ */
+bool DMA_Init(void);
+
+/*! @brief Sets up a DMA channel.
+ *
+ *  @param aDMAChannel is a structure containing the parameters to be used in setting up the channel.
+ *  @return bool - TRUE if the channel was set up successfully.
+ *  @note Assumes the DMA has been initialized.
+ */
+bool DMA_Set(const TDMAChannel* const aDMAChannel);
+
+/*! @brief Starts a byte-wide transfer on a channel, one byte per peripheral request.
+ *
+ *  @param channelNb The channel to start.
+ *  @param source The address of the first byte to read.
+ *  @param sourceOffset The amount to add to the source address after each byte (0 for a peripheral register).
+ *  @param destination The address of the first byte to write.
+ *  @param destinationOffset The amount to add to the destination address after each byte (0 for a peripheral register).
+ *  @param nbBytes The number of bytes to transfer.
+ *  @return bool - TRUE if the transfer was started, FALSE if the channel is invalid or still busy.
+ *  @note Assumes the channel has been set up. The callback is called when the last byte has been moved.
+ */
+bool DMA_StartTransfer(const uint8_t channelNb, const volatile void* const source, const int16_t sourceOffset,
+                       volatile void* const destination, const int16_t destinationOffset, const uint16_t nbBytes);
+
+/*! @brief Stops a channel taking any more requests, abandoning the rest of its transfer.
+ *
+ *  @param channelNb The channel to stop.
+ *  @note The callback is not called.
+ */
+void DMA_Cancel(const uint8_t channelNb);
+
+/*! @brief Interrupt service routine for DMA channel 0.
+ *
+ *  The major loop of channel 0 has completed.
+ *  The user callback function will be called.
+ *  @note Assumes the DMA has been initialized.
+ */
+void __attribute__ ((interrupt)) DMA0_ISR(void);
+
+/*! @brief Interrupt service routine for DMA channel 1.
+ *
+ *  The major loop of channel 1 has completed.
+ *  The user callback function will be called.
+ *  @note Assumes the DMA has been initialized.
+ */
+void __attribute__ ((interrupt)) DMA1_ISR(void);
+
+#endif
@@ -0,0 +1,144 @@
+/*!
+**  @file Dispatch.c
+**
+**  @brief Event dispatcher for the peripheral handlers.
+**         An ISR posts an event by setting its bit in the pending word, and signals the worker only when
+**         the word was empty, so the worker's semaphore never counts more than one wake per batch of events.
+**         The worker takes the lowest set bit - the highest priority event - clears it and runs its
+**         handler, then looks again, so an event posted while a handler runs is next if it outranks the
+**         rest. The handlers share the worker's stack and run without a context switch between them.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Dispatch */
+
+#include "Dispatch.h"
+#include "Threads.h"
+
+#include <stddef.h>
+
+#define THREAD_STACK_SIZE 1024
+
+static TDispatchHandler Handlers[DISPATCH_NB_EVENTS];
+
+#if DISPATCH_THREADS
+
+static OS_ECB* Semaphores[DISPATCH_NB_EVENTS];
+
+static uint32_t EventThreadStacks[DISPATCH_NB_EVENTS][THREAD_STACK_SIZE] __attribute__ ((aligned(0x08)));
+
+
+
+/*! @brief Thread running one event's handler each time its semaphore is signalled
+ *
+ *  @param pData The event
+ */
+static void EventThread(void* pData)
+{
+  TDispatchEvent event = (TDispatchEvent)(uintptr_t)pData;
+
+  for (;;)
+  {
+    (void)OS_SemaphoreWait(Semaphores[event], 0);
+    (*Handlers[event])();
+  }
+}
+
+#else
+
+OS_THREAD_STACK(DispatchThreadStack, THREAD_STACK_SIZE);
+
+static OS_ECB* WorkerSemaphore;
+static uint32_t Pending;  // Bit n set if event n has been posted and its handler has not yet run
+
+
+
+/*! @brief Thread running the handlers of the pending events, highest priority first
+ */
+static void DispatchThread(void* pData)
+{
+  for (;;)
+  {
+    (void)OS_SemaphoreWait(WorkerSemaphore, 0);
+
+    uint32_t pending;
+
+    while ((pending = __atomic_load_n(&Pending, __ATOMIC_ACQUIRE)) != 0)
+    {
+      uint8_t event = __builtin_ctz(pending);
+
+      __atomic_fetch_and(&Pending, ~(1u << event), __ATOMIC_ACQ_REL);
+
+      if (Handlers[event])
+        (*Handlers[event])();
+    }
+  }
+}
+
+#endif
+
+
+
+bool Dispatch_Init(void)
+{
+#if DISPATCH_THREADS
+  return true;
+#else
+  WorkerSemaphore = OS_SemaphoreCreate(0);
+
+  return (WorkerSemaphore &&
+          (THREADS_CREATE(DispatchThread, NULL, DispatchThreadStack, DISPATCH_PRIORITY) == OS_NO_ERROR));
+#endif
+}
+
+
+
+bool Dispatch_Register(const TDispatchEvent event, const TDispatchHandler handler, const char* const name)
+{
+  if ((event >= DISPATCH_NB_EVENTS) || Handlers[event])
+    return false;
+
+  Handlers[event] = handler;
+
+#if DISPATCH_THREADS
+  Semaphores[event] = OS_SemaphoreCreate(0);
+
+  return (Semaphores[event] &&
+          (Threads_Create(name, EventThread, (void*)(uintptr_t)event, EventThreadStacks[event], THREAD_STACK_SIZE,
+                          DISPATCH_PRIORITY + event) == OS_NO_ERROR));
+#else
+  return true;
+#endif
+}
+
+
+
+OS_ECB* Dispatch_Semaphore(const TDispatchEvent event)
+{
+#if DISPATCH_THREADS
+  return Semaphores[event];
+#else
+  return NULL;
+#endif
+}
+
+
+
+void Dispatch_Post(const TDispatchEvent event)
+{
+#if !DISPATCH_THREADS
+  if (__atomic_fetch_or(&Pending, 1u << event, __ATOMIC_ACQ_REL) == 0)
+    (void)OS_SemaphoreSignal(WorkerSemaphore);
+#endif
+}
+
+
+
+/* END Dispatch */
+/*!
+** @}
+*/
@@ -0,0 +1,90 @@
+/*! @file
+ *
+ *  @brief Event dispatcher for the peripheral handlers.
+ *
+ *  This contains the functions for posting events from ISRs and running their handlers. By default the
+ *  events are flags in one word and a single worker thread runs the handlers of the pending events,
+ *  highest priority first. Building with DISPATCH_THREADS 1 gives each handler its own thread and
+ *  semaphore instead, as before, so the two can be compared.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-10
+ */
+
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// new types
+#include "types.h"
+#include "OS.h"
+
+// Set to 1 for a thread per handler
+#ifndef DISPATCH_THREADS
+#define DISPATCH_THREADS 0
+#endif
+
+// Priority of the worker, or of the first handler's thread - each later event's thread is one lower
+#define DISPATCH_PRIORITY 1
+
+/*! @brief The events - in priority order, highest first.
+ */
+typedef enum
+{
+  DISPATCH_RTC,
+  DISPATCH_FTM0,
+  DISPATCH_PIT,
+  DISPATCH_ACCEL,
+  DISPATCH_I2C,
+  DISPATCH_NB_EVENTS
+} TDispatchEvent;
+
+/*! @brief Handles an event - runs in a thread, not the ISR.
+ */
+typedef void (*TDispatchHandler)(void);
+
+/*! @brief Posts an event from an ISR - the semaphore is the one Dispatch_Semaphore gave the module.
+ */
+#if DISPATCH_THREADS
+#define DISPATCH_POST(event, semaphore) (void)OS_SemaphoreSignal(semaphore)
+#else
+#define DISPATCH_POST(event, semaphore) Dispatch_Post(event)
+#endif
+
+/*! @brief Registers an event's handler under its function's name.
+ *
+ *  @param event The event.
+ *  @param handler The function to run each time it is posted.
+ */
+#define DISPATCH_REGISTER(event, handler) Dispatch_Register((event), (handler), #handler)
+
+/*! @brief Creates the worker thread.
+ *
+ *  @return bool - TRUE if the dispatcher was successfully initialized.
+ *  @note Must be called after OS_Init() and before any handler is registered.
+ */
+bool Dispatch_Init(void);
+
+/*! @brief Sets the handler of an event - use DISPATCH_REGISTER.
+ *
+ *  @param event The event.
+ *  @param handler The function to run each time it is posted.
+ *  @param name The handler's name, given to its thread with DISPATCH_THREADS.
+ *  @return bool - TRUE if the handler was registered.
+ */
+bool Dispatch_Register(const TDispatchEvent event, const TDispatchHandler handler, const char* const name);
+
+/*! @brief Gets the semaphore a module should be given for an event.
+ *
+ *  @param event The event.
+ *  @return OS_ECB* - the semaphore its thread waits on with DISPATCH_THREADS, otherwise NULL.
+ */
+OS_ECB* Dispatch_Semaphore(const TDispatchEvent event);
+
+/*! @brief Marks an event pending and wakes the worker - use DISPATCH_POST.
+ *
+ *  @param event The event.
+ *  @note Posting an event that is already pending has no further effect.
+ */
+void Dispatch_Post(const TDispatchEvent event);
+
+#endif
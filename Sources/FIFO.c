@@ -3,7 +3,9 @@
 **
 **  @brief Contains functions for initializing and manipulating data in FIFO arrays
 **         Initializes a FIFO by resetting values to 0 and also allows for the input and output
-**         of data to the UART module using a 256 bit shifting array.
+**         of data to the UART module using a 256 byte circular buffer.
+**         Each FIFO has exactly one producer and one consumer, which only ever write their own
+**         index, so no semaphores or critical sections are needed to access it.
 */
 /*!
 **  @addtogroup main_module main module documentation
@@ -14,11 +16,12 @@
 /* MODULE FIFO */
 
 #include "FIFO.h"
-#include "Cpu.h"
-#include "OS.h"
+#include <string.h>
+
+// Stops the compiler from moving buffer accesses across an index update
+// A single-core Cortex-M4 needs no hardware barrier for this
+#define FIFO_BARRIER() __asm volatile ("" ::: "memory")
 
-// Binary semaphore ensuring only one thread accesses the semaphore at a time
-static ECB* FIFOAccess = OS_SemaphoreCreate(1);
 
 
 /*!
@@ -26,62 +29,101 @@ static ECB* FIFOAccess = OS_SemaphoreCreate(1);
  */
 void FIFO_Init(TFIFO * const FIFO)
 {
-  FIFO->Start     = 0;
-  FIFO->End       = 0;
-  FIFO->UsedBytes = OS_SemaphoreCreate(0);
-  FIFO->FreeBytes = OS_SemaphoreCreate(FIFO_SIZE);
+  FIFO->Start = 0;
+  FIFO->End   = 0;
 }
 
 
 
 bool FIFO_Put(TFIFO * const FIFO, const uint8_t data)
 {
-  // If the FIFO has room, it places some data in to it and returns true.
-  OS_SemaphoreWait(FIFOAccess,0); // wait to get exclusive access
+  uint16_t end = FIFO->End;
+
+  // Indices are free-running so the difference is the number of used bytes, even across wraparound
+  if ((uint16_t)(end - FIFO->Start) >= FIFO_SIZE)
+    return false; // FIFO is full
 
-  // Increments the number of bytes
-  OS_SemaphoreWait(FIFO->FreeBytes,0);
-  OS_SemaphoreSignal(FIFO->UsedBytes);
+  // Put data in, then publish it to the consumer by incrementing the end index
+  FIFO->Buffer[end & FIFO_MASK] = data;
+  FIFO_BARRIER();
+  FIFO->End = end + 1;
 
-  // Put data in and increment end index
-  FIFO->Buffer[FIFO->End] = data;
-  FIFO->End++;
+  return true;
+}
 
-  if (FIFO->End >= FIFO_SIZE) // If the FIFO is full, it loops back around
-    FIFO->End = 0;
 
-  // Relinquish exclusive access
-  OS_SemaphoreSignal(FIFOAccess);
+
+bool FIFO_Get(TFIFO * const FIFO, uint8_t * const dataPtr)
+{
+  uint16_t start = FIFO->Start;
+
+  if (start == FIFO->End)
+    return false; // FIFO is empty
+
+  // Take data out, then hand the slot back to the producer by incrementing the start index
+  *dataPtr = FIFO->Buffer[start & FIFO_MASK];
+  FIFO_BARRIER();
+  FIFO->Start = start + 1;
 
   return true;
 }
 
 
 
-bool FIFO_Get(TFIFO * const FIFO, uint8_t * const dataPtr)
+bool FIFO_PutBlock(TFIFO * const FIFO, const uint8_t * const data, const uint16_t nbBytes)
 {
-  OS_SemaphoreWait(FIFOAccess,0); // wait to get exclusive access
+  uint16_t end = FIFO->End;
+
+  if ((uint16_t)(FIFO_SIZE - (uint16_t)(end - FIFO->Start)) < nbBytes)
+    return false; // Not enough room for the whole block
 
-  // Decrements the number of bytes
-  OS_SemaphoreWait(FIFO->UsedBytes,0);
-  OS_SemaphoreSignal(FIFO->FreeBytes);
+  // Copy up to the end of the buffer, then whatever is left from the start of the buffer
+  uint16_t index = end & FIFO_MASK;
+  uint16_t firstPart = FIFO_SIZE - index;
 
-  // Take data out and increment start index
-  *dataPtr = FIFO->Buffer[FIFO->Start];
-  FIFO->Start++;
+  if (firstPart > nbBytes)
+    firstPart = nbBytes;
 
-  // If the FIFO is now full, resets the start position
-  if (FIFO->Start >= FIFO_SIZE)
-    FIFO->Start = 0;
+  memcpy(&FIFO->Buffer[index], data, firstPart);
+  memcpy(&FIFO->Buffer[0], &data[firstPart], nbBytes - firstPart);
 
-  // Relinquish exclusive access
-  OS_SemaphoreSignal(FIFOAccess);
+  // Publish the whole block to the consumer at once
+  FIFO_BARRIER();
+  FIFO->End = end + nbBytes;
 
   return true;
 }
 
 
 
+uint16_t FIFO_GetBlock(TFIFO * const FIFO, uint8_t * const data, const uint16_t nbBytes)
+{
+  uint16_t start = FIFO->Start;
+  uint16_t count = (uint16_t)(FIFO->End - start);
+
+  if (count > nbBytes)
+    count = nbBytes; // Only take as many bytes as were asked for
+
+  // Copy up to the end of the buffer, then whatever is left from the start of the buffer
+  uint16_t index = start & FIFO_MASK;
+  uint16_t firstPart = FIFO_SIZE - index;
+
+  if (firstPart > count)
+    firstPart = count;
+
+  FIFO_BARRIER();
+  memcpy(data, &FIFO->Buffer[index], firstPart);
+  memcpy(&data[firstPart], &FIFO->Buffer[0], count - firstPart);
+
+  // Hand the slots back to the producer
+  FIFO_BARRIER();
+  FIFO->Start = start + count;
+
+  return count;
+}
+
+
+
 /* END FIFO */
 /*!
 ** @}
@@ -3,6 +3,8 @@
  *  @brief Routines to implement a FIFO buffer.
  *
  *  This contains the structure and "methods" for accessing a byte-wide FIFO.
+ *  The FIFO is a lock-free single-producer/single-consumer ring, so one side
+ *  may be an ISR and the other a thread without any RTOS calls.
  *
  *  @author PMcL
  *  @date 2015-07-23
@@ -13,20 +15,18 @@
 
 // new types
 #include "types.h"
-#include "OS.h"
 
-// Number of bytes in a FIFO
+// Number of bytes in a FIFO - must be a power of two so indices can be masked
 #define FIFO_SIZE 256
+#define FIFO_MASK (FIFO_SIZE - 1)
 
 /*!
  * @struct TFIFO
  */
 typedef struct
 {
-  uint16_t Start;		/*!< The index of the position of the oldest data in the FIFO */
-  uint16_t End; 		/*!< The index of the next available empty position in the FIFO */
-  ECB* volatile UsedBytes;	/*!< The number of bytes currently stored in the FIFO in semaphore format */
-  ECB* volatile FreeBytes;	/*!< The number of space available in the FIFO in semaphore format */
+  volatile uint16_t Start;	/*!< Free-running read index, only ever written by the consumer */
+  volatile uint16_t End;	/*!< Free-running write index, only ever written by the producer */
   uint8_t Buffer[FIFO_SIZE];	/*!< The actual array of bytes to store the data */
 } TFIFO;
 
@@ -41,7 +41,8 @@ void FIFO_Init(TFIFO* const FIFO);
  *
  *  @param FIFO A pointer to a FIFO struct where data is to be stored.
  *  @param data A byte of data to store in the FIFO buffer.
- *  @note Assumes that FIFO_Init has been called.
+ *  @return bool - TRUE if the data was placed in the FIFO, FALSE if the FIFO was full.
+ *  @note Assumes that FIFO_Init has been called. Never blocks, so it is safe to call from an ISR.
  */
 bool FIFO_Put(TFIFO* const FIFO, const uint8_t data);
 
@@ -49,8 +50,31 @@ bool FIFO_Put(TFIFO* const FIFO, const uint8_t data);
  *
  *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
  *  @param dataPtr A pointer to a memory location to place the retrieved byte.
- *  @note Assumes that FIFO_Init has been called.
+ *  @return bool - TRUE if a byte was retrieved, FALSE if the FIFO was empty.
+ *  @note Assumes that FIFO_Init has been called. Never blocks, so it is safe to call from an ISR.
  */
 bool FIFO_Get(TFIFO* const FIFO, uint8_t* const dataPtr);
 
+/*! @brief Put a block of characters into the FIFO.
+ *
+ *  The block is copied in at most two pieces (either side of the wraparound) and is only
+ *  made visible to the consumer once all of it is in place.
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data A pointer to the bytes to store in the FIFO buffer.
+ *  @param nbBytes The number of bytes to store.
+ *  @return bool - TRUE if the whole block was placed in the FIFO, FALSE (and nothing stored) if there was not enough room.
+ *  @note Assumes that FIFO_Init has been called. Never blocks, so it is safe to call from an ISR.
+ */
+bool FIFO_PutBlock(TFIFO* const FIFO, const uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Get up to a block of characters from the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data A pointer to a memory location to place the retrieved bytes.
+ *  @param nbBytes The maximum number of bytes to retrieve.
+ *  @return uint16_t - The number of bytes actually retrieved (0 if the FIFO was empty).
+ *  @note Assumes that FIFO_Init has been called. Never blocks, so it is safe to call from an ISR.
+ */
+uint16_t FIFO_GetBlock(TFIFO* const FIFO, uint8_t* const data, const uint16_t nbBytes);
+
 #endif
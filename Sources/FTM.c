@@ -16,9 +16,11 @@
 #include "FTM.h"
 #include "MK70F12.h"
 #include "OS.h"
+#include "ISRStats.h"
+#include "Dispatch.h"
 
 // Private global variable for the FTM thread semaphore for every channel
-static ECB* FTMSemaphore[8];
+static OS_ECB* FTMSemaphore[8];
 
 
 
@@ -134,8 +136,8 @@ bool FTM_StartTimer(const TFTMChannel* const aFTMChannel)
   uint16_t counterValue = FTM0_CNT;
   // 2. Set output compare register to CNT + delay
   FTM0_CnV(channelNb) = counterValue + aFTMChannel->delayCount;
-  // 3. Clear output compare flag
-  FTM0_CnSC(channelNb) = FTM_CnSC_CHF_MASK;
+  // 3. Clear output compare flag - CHF clears by writing 0, and writing the other bits as 0 would disable the channel
+  FTM0_CnSC(channelNb) &= ~FTM_CnSC_CHF_MASK;
   // 4. Output compare flag will now set and trigger an interrupt after the delay
   
   return true;
@@ -145,6 +147,7 @@ bool FTM_StartTimer(const TFTMChannel* const aFTMChannel)
 
 void __attribute__ ((interrupt)) FTM0_ISR(void)
 {
+  ISR_STATS_ENTER(ISR_STATS_FTM0);
   OS_ISREnter();
 	
   // Checks for the interrupt source from each channel - probably only need 1 channel for lab 3 anyway
@@ -156,10 +159,14 @@ void __attribute__ ((interrupt)) FTM0_ISR(void)
     // If channel is set up for output compare (ie. MSnB:MSnA == 01)
     if (!(FTM0_CnSC(channelNb) & FTM_CnSC_MSB_MASK) &&
          (FTM0_CnSC(channelNb) & FTM_CnSC_MSA_MASK))
-      OS_SemaphoreSignal(FTMSemaphore[channelNb]);
+    {
+      DISPATCH_POST(DISPATCH_FTM0, FTMSemaphore[channelNb]); // Every channel posts the one FTM0 event to the dispatcher
+      ISR_STATS_SIGNAL(ISR_STATS_FTM0);
+    }
   }
   
   OS_ISRExit();
+  ISR_STATS_EXIT(ISR_STATS_FTM0);
 }
 
 
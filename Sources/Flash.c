@@ -15,6 +15,9 @@
 /* MODULE Flash */
 
 #include "Flash.h"
+#include "packet.h"
+#include "Bench.h"
+#include "Trace.h"
 #include "MK70F12.h"
 
 typedef struct // Struct containing all the bytes to be written into the FTFE_FFCOB register
@@ -65,7 +68,18 @@ static bool LaunchCommand(TFCCOB* command)
       FTFE_FCCOBB = FTFE_FCCOBB_CCOBn(command->dataByte[4]);
     }
     
+    TRACE_EVENT(TRACE_FLASH_LAUNCH, command->commandByte, ((uint16_t)command->addressMed << 8) | command->addressLo);
     FTFE_FSTAT = FTFE_FSTAT_CCIF_MASK;
+
+    // Wait for the command to complete, so the next one is not refused while this one is running
+    while (!(FTFE_FSTAT & FTFE_FSTAT_CCIF_MASK))
+    {
+    }
+
+    TRACE_EVENT(TRACE_FLASH_COMPLETE, command->commandByte, FTFE_FSTAT);
+
+    if ((FTFE_FSTAT & FTFE_FSTAT_FPVIOL_MASK) || (FTFE_FSTAT & FTFE_FSTAT_ACCERR_MASK))
+      success = false;
   }
   
   return success; // If there was a violation or access error, return false
@@ -94,54 +108,56 @@ static bool EraseSector(const uint32_t address)
 
 
 
-/*! @brief Private function to write a phrase into the flash
+/*! @brief Private function to lay a value over a phrase at the address it is being written to
+ *
+ *  @param 32-bit address the value is being written to
+ *  @param value to write, in its low size bytes
+ *  @param size of the value in bytes (1, 2 or 4)
+ *  @param array holding the phrase, lowest address first - bytes outside the value are left as they are
+ */
+static void PackPhrase(const uint32_t address, const uint32_t data, const uint8_t size, uint8_t flashPhrase[8])
+{
+  uint8_t offset = (uint8_t)(address - FLASH_DATA_START); // Index in the phrase of the value's lowest address
+
+  // The K70 is little-endian, so the LSB goes at the lowest address
+  for (uint8_t i = 0; i < size; i++)
+    flashPhrase[offset + i] = (uint8_t)(data >> (8 * i));
+}
+
+
+
+/*! @brief Benchmark case - packing a 16-bit value as Flash_Write16 does
+ */
+static void BenchPackPhrase(void)
+{
+  static volatile uint8_t sink; // keeps the packing from being optimised away
+  uint8_t packed[8] = {0};
+
+  PackPhrase(FLASH_DATA_START + 2, 0x1234, 2, packed);
+  sink = packed[2];
+}
+
+
+
+/*! @brief Private function to write a value into the flash phrase, keeping the rest of the phrase
  *  
- *  @param 32-bit address for the flash phrase to be written
- *  @param 64-bit union containing the phrase to be written
+ *  @param 32-bit address for the value to be written
+ *  @param value to write, in its low size bytes
+ *  @param size of the value in bytes (1, 2 or 4)
  *  
  *  @return BOOL of the following LaunchCommand call
  */
-static bool WritePhrase(const uint32_t address, const uint64union_t phrase)
+static bool WritePhrase(const uint32_t address, const uint32_t data, const uint8_t size)
 {
-  uint8_t flashPhraseOld[8] = {0}; // Array to save the current phrase data before calling EraseSector or Flash_Erase
-  uint8_t flashPhraseNew[8] = {0}; // Array to hold the new phrase data before sending it to LaunchCommand
-  
-  for (uint8_t i = 0; i < 8; i++)
-    flashPhraseOld[i] = _FB(FLASH_DATA_START + i); // Populating the 'Old' array with the flash phrase data before erasing
-  
-  
-  // Populating the 'New' array using bit masks and shifts
-  // Note that data is written from the highest index down with LSB on a higher index
-  flashPhraseNew[0] = ((phrase.s.Hi & 0xFF000000) >> 24);
-  flashPhraseNew[1] = ((phrase.s.Hi & 0xFF0000) >> 16);
-  flashPhraseNew[2] = ((phrase.s.Hi & 0xFF00) >> 8);
-  flashPhraseNew[3] =  (phrase.s.Hi & 0xFF);
-  flashPhraseNew[4] = ((phrase.s.Lo & 0xFF000000) >> 24);
-  flashPhraseNew[5] = ((phrase.s.Lo & 0xFF0000) >> 16);
-  flashPhraseNew[6] = ((phrase.s.Lo & 0xFF00) >> 8);
-  flashPhraseNew[7] =  (phrase.s.Lo & 0xFF);
-  
-  uint8_t dataStart = 0; // Tracks at which index above in flashPhraseNew the MSB of the data resides
-  while (flashPhraseNew[dataStart] == 0)
-    dataStart++;
-  
-  
-  // Data needs to be written matching the address given in this function's parameters but by default
-  // it resides in the highest indexes, so shuffle the array back until it reaches that address
-  for (uint8_t i = 0; i < (dataStart - (address - FLASH_DATA_START)); i++) // For loop based on how many shuffles are needed
-  {
-    for (uint8_t j = 0; j < 7; j++) // For loop to actually shuffle the array
-    {
-      flashPhraseNew[j] = flashPhraseNew[j+1];
-      if (j == 6)
-        flashPhraseNew[j+1] = 0;
-    }
-  }
-  
-  
   // Declaring a command struct for use in LaunchCommand
   TFCCOB command;
   command.commandByte = 0x07; // Byte for 'Program Phrase' command
+
+  // The sector erase below clears the whole phrase, so start from the data already in it
+  for (uint8_t i = 0; i < 8; i++)
+    command.dataByte[i] = _FB(FLASH_DATA_START + i);
+
+  PackPhrase(address, data, size, command.dataByte);
   
   // Stores the address of the start of the flash phrase using the same method as above
   // Unsure of whether FLASH_DATA_START macro can be bit masked and shifted or not, so put it in a constant
@@ -149,18 +165,6 @@ static bool WritePhrase(const uint32_t address, const uint64union_t phrase)
   command.addressHi  = ((PHRASE_ADDRESS & 0xFF0000) >> 16);
   command.addressMed = ((PHRASE_ADDRESS & 0xFF00) >> 8);
   command.addressLo  =  (PHRASE_ADDRESS & 0xFF);
-  
-  
-  if (_FP(FLASH_DATA_START) == 0xFFFFFFFFFFFFFFFF) // If flash is empty (reset to 0xFFFF), then just copy in the new phrase only
-  {
-    for (uint8_t i = 0; i < 8; i++)
-      command.dataByte[i] = flashPhraseNew[i];
-  }
-  else // Else, combine the old and new phrases
-  {
-    for (uint8_t i = 0; i < 8; i++)
-      command.dataByte[i] = flashPhraseOld[i] | flashPhraseNew[i];
-  }
 
   if (!(EraseSector(FLASH_DATA_START))) // Flash must always be bulk erased before writing
     return false;
@@ -170,10 +174,75 @@ static bool WritePhrase(const uint32_t address, const uint64union_t phrase)
 
 
 
+/*! @brief Private function to check a value of the given size fits in the flash phrase at an address aligned to its size
+ *
+ *  @param 32-bit address the value is being written to
+ *  @param size of the value in bytes (1, 2 or 4)
+ *
+ *  @return TRUE if the value can be written there
+ */
+static bool ValidAddress(const uint32_t address, const uint8_t size)
+{
+  return ((address >= FLASH_DATA_START) &&
+          (address + size - 1 <= FLASH_DATA_END) &&
+          ((address - FLASH_DATA_START) % size == 0));
+}
+
+
+
+/*!
+ * @brief Handles a Flash Program Byte packet as per the Tower Serial Communication Protocol document
+ * by writing the data in parameter3 to the address given in parameter1
+ *
+ * Parameter1 = address offset (0-7), Parameter2 = 0, Parameter3 = data
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully.
+ */
+static bool HandleProgBytePacket(const TPacket* const packet)
+{
+  // Return false if the address is out of range
+  if ((Packet_Parameter1(packet) < 0) || (Packet_Parameter1(packet) > 8))
+    return false;
+	  
+  if (Packet_Parameter1(packet) == 0x08) // 0x08 erases the flash
+    return Flash_Erase();
+	  
+  // Writes the data in parameter3 to the given address starting at FLASH_DATA_START and offsetted according to Parameter1
+  return Flash_Write8((uint8_t *)(FLASH_DATA_START + Packet_Parameter1(packet)), Packet_Parameter3(packet));
+}
+
+
+
+/*!
+ * @brief Handles a Flash Read Byte packet as per the Tower Serial Communication Protocol document
+ * by putting in a packet with the address of the flash byte read and the data contained in that address.
+ *
+ * Parameter1 = address offset (0-7), Parameter2 = 0, Parameter3 = 0
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully.
+ */
+static bool HandleReadBytePacket(const TPacket* const packet)
+{
+  // Return false if the address is out of range
+  if ((Packet_Parameter1(packet) < 0) || (Packet_Parameter1(packet) > 7))
+    return false;
+
+  // Data is accessed using a Flash.h macro by starting at address FLASH_DATA_START and offsetting according to Parameter1
+  return (Packet_Put(CMD_READBYTE, Packet_Parameter1(packet), 0x00, _FB(FLASH_DATA_START + Packet_Parameter1(packet))));
+}
+
+
+
 bool Flash_Init(void)
 {
   // MCG does not require user initialization, this is done automatically
-  return true;
+
+  // Flash owns the program and read byte commands
+  return (Packet_RegisterHandler(CMD_PROGBYTE, HandleProgBytePacket, PACKET_FLAG_NONE) &&
+          Packet_RegisterHandler(CMD_READBYTE, HandleReadBytePacket, PACKET_FLAG_NONE) &&
+          BENCH_REGISTER(BenchPackPhrase, 64));
 }
 
 
@@ -245,41 +314,30 @@ bool Flash_AllocateVar(volatile void** variable, const uint8_t size)
 
 bool Flash_Write32(volatile uint32_t* const address, const uint32_t data)
 {
-  //addressOffset = address - FLASH_DATA_START;
-  //if (addressOffset != 0 &&
-  //    addressOffset != 4) // If address is not aligned to 4-byte boundary
-  //  return false;
-  
-  // 64-bit union to store the data to send along to WritePhrase
-  uint64union_t phrase;
-  phrase.l    = data;
-  phrase.s.Hi = 0;
-  phrase.s.Lo = data;
-  
-  return WritePhrase((uint32_t)address, phrase);
+  if (!ValidAddress((uint32_t)address, 4)) // If address is not aligned to 4-byte boundary
+    return false;
+
+  return WritePhrase((uint32_t)address, data, 4);
 }
 
 
 
 bool Flash_Write16(volatile uint16_t* const address, const uint16_t data)
 {
-  //addressOffset = address - FLASH_DATA_START;
-  //if (addressOffset != 0 &&
-  //    addressOffset != 2 &&
-  //    addressOffset != 4 &&
-  //    addressOffset != 6) // If address is not aligned to 2-byte boundary
-  //  return false;
-  
-  // Typecasts the 16-bit address and data to 32-bit integers to send along to Flash_Write32
-  return Flash_Write32((uint32_t*)address, (uint32_t)data);
+  if (!ValidAddress((uint32_t)address, 2)) // If address is not aligned to 2-byte boundary
+    return false;
+
+  return WritePhrase((uint32_t)address, data, 2);
 }
 
 
 
 bool Flash_Write8(volatile uint8_t* const address, const uint8_t data)
 {
-  // Typecasts the 8-bit address and data to 16-bit integers to send along to Flash_Write16
-  return Flash_Write16((uint16_t*)address, (uint16_t)data);
+  if (!ValidAddress((uint32_t)address, 1))
+    return false;
+
+  return WritePhrase((uint32_t)address, data, 1);
 }
 
 
@@ -27,6 +27,7 @@
 
 /*! @brief Enables the Flash module.
  *
+ *  Also registers the handlers for the program byte and read byte commands.
  *  @return bool - TRUE if the Flash was setup successfully.
  */
 bool Flash_Init(void);
@@ -3,8 +3,14 @@
  *  @brief I/O routines for the K70 I2C interface.
  *
  *  Includes functions to initialise the I2C with appropriate user settings and
- *  perform a single-byte write and multi-byte read to a slave device using both
- *  polling and interrupt methods
+ *  queue single-byte writes and multi-byte reads to the slave devices on the bus. The I2C
+ *  interrupt runs the queues a byte at a time, so no thread waits on the bus - a thread that
+ *  needs the data sleeps on a semaphore, or is signalled when the read is over. Each device
+ *  has its own queue, and the next transaction is taken from the high priority devices first,
+ *  then from each device in turn, so one with a long queue cannot keep the others off the bus.
+ *  The bytes of a longer read are moved by the eDMA engine, and the interrupt only takes the last two.
+ *  No wait on the bus is unbounded - a transaction that stops moving for its time limit is
+ *  abandoned and the bus cleared by clocking SCL by hand, and a lost arbitration ends it.
  *
  *  @author Thanit Tangson
  *  @date 2017-5-9
@@ -18,18 +24,96 @@
 #include "I2C.h"
 #include "MK70F12.h"
 #include "OS.h"
+#include "ISRStats.h"
+#include "Dispatch.h"
+#include "Trace.h"
+#include "Bench.h"
+#include "DMA.h"
+#include "packet.h"
+#include "Threads.h"
+#include "Cpu.h"
+#include "PE_Types.h"
+
+#if I2C_RX_DMA
+// eDMA channel used to empty I2C0_D
+#define RX_DMA_CHANNEL 1
+#endif
+
+// I2C0 pins (see accel.c) - driven as GPIO to clear the bus
+#define SDA_PIN 18 // PTE18
+#define SCL_PIN 19 // PTE19
+
+// A slave part way through sending a byte lets go of SDA within nine clocks
+#define CLEAR_BUS_CLOCKS 9
+
+// SCL periods a STOP may take to free the bus before it is taken to be held
+#define BUS_FREE_BITS 4
+
+// Period of the RTOS tick
+#define OS_TICK_US 1000
+
+#define THREAD_STACK_SIZE 256
+
+OS_THREAD_STACK(WatchdogThreadStack, THREAD_STACK_SIZE);
 
 // Private global variable for the I2C thread semaphore
-ECB* ReadCompleteSemaphore;
+OS_ECB* ReadCompleteSemaphore;
+
+static OS_ECB* WatchdogSemaphore; // signalled to wake the watchdog when the bus starts, or a START is left to it
+
+static uint32_t ModuleClk;
+
+// Devices in the order they were added
+static TI2CDevice* Devices[I2C_MAX_DEVICES];
+static uint8_t NbDevices;
+static uint8_t LastDevice;  // the device whose transaction went on the bus last - the turns start after it
+
+// States of the transaction on the bus - each is the byte that has just been sent or received
+typedef enum
+{
+  STATE_ADDRESS,       // slave address for writing
+  STATE_REGISTER,      // register address
+  STATE_WRITE,         // a data byte
+  STATE_ADDRESS_READ,  // slave address for reading
+  STATE_READ           // a data byte read
+} TState;
+
+static TI2CTransaction* Current; // the transaction on the bus
+static volatile bool Active; // the queues are being run - the I2C interrupt starts each transaction after the first
+static TState State;
+static uint8_t Index;        // next data byte of the transaction on the bus
+static uint32_t OnBus;       // cycle counter when the transaction on the bus was started
+static uint32_t Moved;       // cycle counter when the transaction on the bus was started or last moved on a byte
+static uint32_t BitCycles;   // core clock cycles per SCL period at the speed I2C0_F is set to
+static volatile bool Watching; // the watchdog is awake - it only sleeps once the bus is idle
+static volatile bool StartDeferred; // the current transaction waits for the watchdog to send its START
+
+// Transactions for I2C_Write and I2C_IntRead
+static TI2CTransaction Writes[I2C_WRITE_QUEUE_SIZE];
+static uint8_t WriteData[I2C_WRITE_QUEUE_SIZE];
+static TI2CTransaction IntRead;
 
+// Semaphores for I2C_Read, one per read waiting, so a read that finishes wakes only the thread that asked for it
+static OS_ECB* ReadSemaphores[I2C_MAX_READS];
+static bool ReadSemaphoreTaken[I2C_MAX_READS];
+static OS_ECB* FreeReadSemaphores; // counts the semaphores not taken
 
-static uint8_t PrimarySlaveAddress = 0; // private global variable to track accelerometer slave address
-static uint8_t SlaveAddressWrite   = 0; // write mode address has first bit set
-static uint8_t SlaveAddressRead    = 0; // read mode address has first bit cleared
+// Counters reported by CMD_I2C_STATS - index 0 for writes, 1 for reads
+static uint32_t NbDone[2];
+static uint64_t CPUCycles[2]; // cycles spent queuing and running them, in the caller and the I2C interrupt
+static uint32_t NbNAKs;
+static uint32_t NbBytes;
+static uint32_t NbDMABytes;   // bytes read by the eDMA engine rather than the I2C interrupt
 
-// private globals used in I2C_ISR which are copies of parameters sent to I2C_IntRead()
-static uint8_t IsrNbBytes;
-static uint8_t *IsrData;
+// Counters reported by CMD_I2C_ERRORS
+static uint32_t NbArbitrationLost;
+static uint32_t NbTimeouts;
+static uint32_t NbBusClears;
+static uint32_t NbBusClearFailures; // SDA was still low afterwards
+static uint32_t MaxLatency;         // longest a transaction took from being queued to finishing, in cycles
+
+// Tick when the CMD_I2C_BUS counters were last cleared
+static uint32_t BusStatsStart;
 
 // icr determines SCL divider (see K70 manual pg. 1885)
 // use icr register value as the index to get the SCL divider value used in the baud rate formula
@@ -40,28 +124,19 @@ static const uint16_t SclDivider[64] = {
 640,768,896,1024,1152,1280,1536,1920,1280,1536,1792,2048,2304,2560,3072,3840};
 
 	
-bool I2C_Init(const TI2CModule* const aI2CModule, const uint32_t moduleClk)
+/*! @brief Searches every MULT and ICR setting for the SCL divider closest to a baud rate
+ *
+ *  @param baudRate The desired baud rate in bits/sec
+ *  @param moduleClk The module clock rate in Hz
+ *  @param multSave Where to put the best value for the MULT register
+ *  @param icrSave Where to put the best value for the ICR register
+ */
+static void FindDivider(const uint32_t baudRate, const uint32_t moduleClk, uint8_t* const multSave, uint8_t* const icrSave)
 {
-  // System clock gate enable
-  SIM_SCGC4 |= SIM_SCGC4_IIC0_MASK;
-	
-  // I2C enable
-  I2C0_C1 |= I2C_C1_IICEN_MASK;
-
-  // AK signal - SCL is held low until this is written (ie. STOP signal can't happen)
-  I2C0_C1 &= ~I2C_C1_TXAK_MASK;
-	
-  // Saving semaphore into global variable
-  I2C_SelectSlaveDevice(aI2CModule->primarySlaveAddress);
-  ReadCompleteSemaphore = aI2CModule->readCompleteSemaphore;
-	
-
   uint8_t mult; // value to use in baud rate formula
-  uint8_t multSave; // saves the best value for the mult register
-  uint8_t icrSave; // saves the best value for the icr register
   uint32_t baudRateActual; // actual baud rate calculated using the current mult and icr combination
   uint32_t baudRateError; // current error range calculated using baudRateActual
-  uint32_t baudRateErrorMin = aI2CModule->baudRate; // current lowest value for baud rate error range
+  uint32_t baudRateErrorMin = baudRate; // current lowest value for baud rate error range
   
 
   for (uint8_t multReg = 0; multReg < 3; multReg++)
@@ -83,221 +158,953 @@ bool I2C_Init(const TI2CModule* const aI2CModule, const uint32_t moduleClk)
     {
       baudRateActual = (moduleClk/(mult*SclDivider[icr]));
 
-      if (baudRateActual < aI2CModule->baudRate)
-        baudRateError = aI2CModule->baudRate - baudRateActual; // positive error
+      if (baudRateActual < baudRate)
+        baudRateError = baudRate - baudRateActual; // positive error
       else
-        baudRateError = baudRateActual - aI2CModule->baudRate; // negative error
+        baudRateError = baudRateActual - baudRate; // negative error
 
       if (baudRateError < baudRateErrorMin)
       {
         baudRateErrorMin = baudRateError;
-        multSave = multReg;
-        icrSave = icr;
+        *multSave = multReg;
+        *icrSave = icr;
       }
     }
   }
-  // Write in register values for the most accurate baud rate
-  I2C0_F |= I2C_F_MULT(multSave);
-  I2C0_F |= I2C_F_ICR(icrSave);
-  
-  // Setting up NVIC for I2C0 see K70 manual pg 97
-  // Vector=40, IRQ=24
-  // NVIC non-IPR=0 IPR=6
-  // Clear any pending interrupts on I2C0
-  NVICICPR0 = (1 << 24); // 24mod32 = 24
-  // Enable interrupts from the I2C0
-  NVICISER0 = (1 << 24);
-  
-  return true;
 }
 
 
 
-void I2C_SelectSlaveDevice(const uint8_t slaveAddress)
+/*! @brief Benchmark case - the divider search I2C_AddDevice runs for the accelerometer's 100 kbit/s
+ */
+static void BenchFindDivider(void)
 {
-  PrimarySlaveAddress = slaveAddress; 
-  
-  SlaveAddressWrite = (slaveAddress << 1);
-  SlaveAddressWrite &= ~0x1; // write mode address has first bit cleared
+  static volatile uint8_t sink; // keeps the search from being optimised away
+  uint8_t mult, icr;
 
-  SlaveAddressRead = (slaveAddress << 1);
-  SlaveAddressRead |= 0x1; // read mode address has first bit set
+  FindDivider(100000, CPU_BUS_CLK_HZ, &mult, &icr);
+  sink = mult ^ icr;
 }
 
 
 
-// follows pg. 19 of accelerometer manual - single-byte write
-void I2C_Write(const uint8_t registerAddress, const uint8_t data)
+/*! @brief Sends 32-bit values in an extended frame, LSB first
+ *
+ *  @param command The frame's command
+ *  @param values The values
+ *  @param nbValues How many there are
+ *  @return bool - TRUE if the frame was queued
+ */
+static bool PutValues(const uint8_t command, const uint32_t* const values, const uint8_t nbValues)
 {
+  uint8_t payload[PACKET_FRAME_MAX_PAYLOAD];
 
-  while (I2C0_S & I2C_S_BUSY_MASK)
+  for (uint8_t i = 0; i < nbValues; i++)
+    for (uint8_t j = 0; j < 4; j++)
+      payload[(4 * i) + j] = (uint8_t)(values[i] >> (8 * j));
+
+  return Packet_PutFrame(command, payload, 4 * nbValues);
+}
+
+
+
+/*!
+ * @brief Handles an I2C Statistics packet - reports the transactions run and the CPU time they took
+ *
+ * Parameter1 = 1 for GET, 2 for GET and clear the counters
+ * Parameter2 = 0, Parameter3 = 0
+ * Reply: an extended frame of 32-bit values, LSB first - writes and reads finished, transactions the slave
+ *        did not acknowledge, bytes moved including addresses, the mean CPU cycles spent on each write
+ *        and each read, queuing it and in the I2C and DMA interrupts, then the bytes the eDMA engine read.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleStatsPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  uint32_t values[7];
+
+  EnterCritical(); // the I2C interrupt updates the counters
+
+  values[0] = NbDone[0];
+  values[1] = NbDone[1];
+  values[2] = NbNAKs;
+  values[3] = NbBytes;
+  values[4] = NbDone[0] ? (uint32_t)(CPUCycles[0] / NbDone[0]) : 0;
+  values[5] = NbDone[1] ? (uint32_t)(CPUCycles[1] / NbDone[1]) : 0;
+  values[6] = NbDMABytes;
+
+  if (Packet_Parameter1(packet) == 0x02)
   {
-  }  // wait until bus is idle
+    NbDone[0] = NbDone[1] = NbNAKs = NbBytes = NbDMABytes = 0;
+    CPUCycles[0] = CPUCycles[1] = 0;
+  }
 
+  ExitCritical();
 
-  I2C0_C1 |= I2C_C1_MST_MASK; // START signal
-  I2C0_C1 |= I2C_C1_TX_MASK; // I2C is in Tx mode (write)
+  return PutValues(CMD_I2C_STATS, values, 7);
+}
+
+
+
+/*!
+ * @brief Handles an I2C Errors packet - reports what went wrong on the bus
+ *
+ * Parameter1 = 1 for GET, 2 for GET and clear the counters
+ * Parameter2 = 0, Parameter3 = 0
+ * Reply: an extended frame of 32-bit values, LSB first - transactions the slave did not acknowledge, lost
+ *        arbitrations, transactions that timed out, times the bus was cleared and times SDA was still held low
+ *        after it, then the longest any transaction took from being queued to finishing, in CPU cycles.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleErrorsPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  uint32_t values[6];
+
+  EnterCritical(); // the I2C interrupt updates the counters
+
+  values[0] = NbNAKs;
+  values[1] = NbArbitrationLost;
+  values[2] = NbTimeouts;
+  values[3] = NbBusClears;
+  values[4] = NbBusClearFailures;
+  values[5] = MaxLatency;
+
+  if (Packet_Parameter1(packet) == 0x02)
+    NbNAKs = NbArbitrationLost = NbTimeouts = NbBusClears = NbBusClearFailures = MaxLatency = 0;
+
+  ExitCritical();
+
+  return PutValues(CMD_I2C_ERRORS, values, 6);
+}
 
-  for (uint8_t i = 0; i < 3; i++)
+
+
+/*!
+ * @brief Handles an I2C Bus packet - reports how busy the bus is and how one device is getting on
+ *
+ * Parameter1 = 1 for GET, 2 for GET and clear the counters of every device
+ * Parameter2 = the device, numbered from 0 in the order they were added, Parameter3 = 0
+ * Reply: an extended frame of 32-bit values, LSB first - the number of devices, the time the bus was held by
+ *        any device, then the device's address, priority, transactions finished, time it held the bus, and the
+ *        mean and longest time its transactions waited to go on the bus. Times held are in hundredths of a
+ *        percent of the time since the counters were last cleared, waits are in CPU cycles.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleBusPacket(const TPacket* const packet)
+{
+  if (((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02)) ||
+      (Packet_Parameter2(packet) >= NbDevices))
+    return false;
+
+  TI2CDevice* device = Devices[Packet_Parameter2(packet)];
+  uint64_t elapsed = (uint64_t)(OS_TimeGet() - BusStatsStart) * (CPU_CORE_CLK_HZ / 1000000) * OS_TICK_US;
+  uint64_t busy = 0;
+  uint32_t values[8];
+
+  if (elapsed == 0)
+    elapsed = 1;
+
+  EnterCritical(); // the I2C interrupt updates the counters
+
+  for (uint8_t i = 0; i < NbDevices; i++)
+    busy += Devices[i]->busyCycles;
+
+  values[0] = NbDevices;
+  values[1] = (uint32_t)((busy * 10000) / elapsed);
+  values[2] = device->slaveAddress;
+  values[3] = device->priority;
+  values[4] = device->nbDone;
+  values[5] = (uint32_t)((device->busyCycles * 10000) / elapsed);
+  values[6] = device->nbDone ? (uint32_t)(device->waitCycles / device->nbDone) : 0;
+  values[7] = device->maxWait;
+
+  if (Packet_Parameter1(packet) == 0x02)
   {
-    switch (i)
+    for (uint8_t i = 0; i < NbDevices; i++)
     {
-      case 0:
-        I2C0_D = SlaveAddressWrite; // send accelerometer address with R/W bit set to Write
-        break;
-      case 1:
-        I2C0_D = registerAddress; // send address of register to be written
-        break;
-      case 2:
-        I2C0_D = data; // send data to write into register
-        break;
+      Devices[i]->nbDone = Devices[i]->maxWait = 0;
+      Devices[i]->busyCycles = Devices[i]->waitCycles = 0;
     }
 
-  	// Wait for AK (IICIF also sets from a transfer complete)
-    while (!(I2C0_S & I2C_S_IICIF_MASK));
-    I2C0_S |= I2C_S_IICIF_MASK;
+    BusStatsStart = OS_TimeGet();
+  }
 
-    if (I2C0_S & I2C_S_RXAK_MASK) // if no AK received, end the communication
-      break;
+  ExitCritical();
+
+  return PutValues(CMD_I2C_BUS, values, 8);
+}
+
+
+
+#if I2C_RX_DMA
+/*! @brief DMA completion callback - hands the last two bytes of the read back to the I2C interrupt
+ *
+ *  @param arguments Unused
+ *  @note IICIF is still set from the bytes the DMA moved, so the I2C interrupt is taken straight away,
+ *        whether or not the byte after them has come in yet.
+ */
+static void RxDMAComplete(void* arguments)
+{
+  uint32_t start = DWT_CYCCNT;
+  I2C0_C1 &= ~I2C_C1_DMAEN_MASK;
+  I2C0_C1 |= I2C_C1_IICIE_MASK; // enable I2C interrupts
+
+  NbBytes    += Current->nbBytes - 2;
+  NbDMABytes += Current->nbBytes - 2;
+  Moved = DWT_CYCCNT;
+  CPUCycles[1] += (uint32_t)(DWT_CYCCNT - start);
+}
+#endif
+
+
+
+/*! @brief Gets how long a transaction may take on the bus
+ *
+ *  @param transaction The transaction
+ *  @return uint32_t - its time limit in core clock cycles
+ */
+static uint32_t Limit(const TI2CTransaction* const transaction)
+{
+  // Up to three address and register bytes, a repeated START and the data, nine SCL periods each
+  uint32_t wire = (transaction->nbBytes + 4) * 9 * transaction->device->bitCycles;
+
+  return (I2C_TIMEOUT_FACTOR * wire) + (I2C_TIMEOUT_SLACK_US * (CPU_CORE_CLK_HZ / 1000000));
+}
+
+
+
+/*! @brief Converts a time in core clock cycles to RTOS ticks
+ *
+ *  @param cycles The time
+ *  @return uint32_t - the ticks to wait for at least that long
+ */
+static uint32_t Ticks(const uint32_t cycles)
+{
+  return (cycles / (CPU_CORE_CLK_HZ / 1000000) / OS_TICK_US) + 1;
+}
+
+
+
+/*! @brief Busy-waits for a number of core clock cycles
+ *
+ *  @param cycles How long to wait
+ *  @note Each pass takes at least a cycle, so the count only ends the wait where the cycle counter stands
+ *        still - as it does in the host build's virtual time.
+ */
+static void Delay(const uint32_t cycles)
+{
+  uint32_t start = DWT_CYCCNT;
+
+  for (uint32_t i = 0; (i < cycles) && ((uint32_t)(DWT_CYCCNT - start) < cycles); i++)
+  {
   }
-  
-  I2C0_C1 &= ~I2C_C1_MST_MASK; // STOP signal
 }
 
 
 
-// follows pg. 19 of accelerometer manual - multi-byte read
-void I2C_PollRead(const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes)
+/*! @brief Waits a bounded time for the bus to be free
+ *
+ *  @return bool - TRUE if BUSY cleared within BUS_FREE_BITS SCL periods
+ */
+static bool WaitForBus(void)
+{
+  uint32_t start = DWT_CYCCNT;
+  uint32_t limit = BUS_FREE_BITS * BitCycles;
+
+  // As in Delay, each poll takes at least a cycle
+  for (uint32_t i = 0; (i < limit) && ((uint32_t)(DWT_CYCCNT - start) < limit); i++)
+    if (!(I2C0_S & I2C_S_BUSY_MASK))
+      return true;
+
+  return !(I2C0_S & I2C_S_BUSY_MASK);
+}
+
+
+
+/*! @brief Frees a bus a slave is holding - SCL is clocked by hand until the slave lets go of SDA, then a STOP is sent
+ *
+ *  @note I2C0 is disabled while the pins are GPIO, which also takes it out of master mode and drops any transfer.
+ */
+static void ClearBus(void)
+{
+  uint32_t halfBit = BitCycles / 2;
+
+  NbBusClears++;
+
+#if I2C_RX_DMA
+  DMA_Cancel(RX_DMA_CHANNEL);
+#endif
+
+  I2C0_C1 = 0; // I2C disabled
+
+  // Both lines as open drain GPIO, let go high - PDIR still reads the level on the line
+  GPIOE_PSOR = (1 << SDA_PIN) | (1 << SCL_PIN);
+  GPIOE_PDDR |= (1 << SDA_PIN) | (1 << SCL_PIN);
+  PORTE_PCR18 = PORT_PCR_MUX(1) | PORT_PCR_ODE_MASK; // ALT1 in the pin MUX -> PTE18
+  PORTE_PCR19 = PORT_PCR_MUX(1) | PORT_PCR_ODE_MASK; // ALT1 in the pin MUX -> PTE19
+
+  // The slave sees each clock as a bit of the byte it thinks it is sending, and the missing ACK at the end
+  for (uint8_t i = 0; (i < CLEAR_BUS_CLOCKS) && !(GPIOE_PDIR & (1 << SDA_PIN)); i++)
+  {
+    GPIOE_PCOR = (1 << SCL_PIN);
+    Delay(halfBit);
+    GPIOE_PSOR = (1 << SCL_PIN);
+    Delay(halfBit);
+  }
+
+  // STOP - SDA rising while SCL is high
+  GPIOE_PCOR = (1 << SCL_PIN);
+  Delay(halfBit);
+  GPIOE_PCOR = (1 << SDA_PIN);
+  Delay(halfBit);
+  GPIOE_PSOR = (1 << SCL_PIN);
+  Delay(halfBit);
+  GPIOE_PSOR = (1 << SDA_PIN);
+  Delay(halfBit);
+
+  if (!(GPIOE_PDIR & (1 << SDA_PIN)))
+    NbBusClearFailures++;
+
+  // Back to I2C0
+  GPIOE_PDDR &= ~((1 << SDA_PIN) | (1 << SCL_PIN));
+  PORTE_PCR18 = PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK; // ALT4 in the pin MUX -> I2C0_SDA
+  PORTE_PCR19 = PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK; // ALT4 in the pin MUX -> I2C0_SCL
+
+  I2C0_S = I2C_S_IICIF_MASK | I2C_S_ARBL_MASK; // w1c any flags left over
+  I2C0_C1 = I2C_C1_IICEN_MASK; // I2C enabled
+}
+
+
+
+/*! @brief Sends the slave address of the current transaction, once its START or repeated START is on the bus
+ */
+static void SendAddress(void)
 {
-  while (I2C0_S & I2C_S_BUSY_MASK)
+  TI2CTransaction* transaction = Current;
+  TI2CDevice* device = transaction->device;
+
+  Index = 0;
+  OnBus = Moved = DWT_CYCCNT;
+
+  if (transaction->type == I2C_READ)
   {
-  } // wait until bus is idle
+    State = STATE_ADDRESS_READ;
+    I2C0_D = (device->slaveAddress << 1) | 0x1; // read mode address has first bit set
+  }
+  else
+  {
+    State = STATE_ADDRESS;
+    I2C0_D = (device->slaveAddress << 1); // write mode address has first bit cleared
+  }
+}
+
+
+
+/*! @brief Sends a START at the current transaction's speed, and its slave address
+ *
+ *  @note The bus must be free.
+ */
+static void Begin(void)
+{
+  TI2CDevice* device = Current->device;
+
+  I2C0_F = device->frequencyDivider;
+  BitCycles = device->bitCycles;
 
   I2C0_C1 |= I2C_C1_MST_MASK; // START signal
   I2C0_C1 |= I2C_C1_TX_MASK; // I2C is in Tx mode (write)
-  
-  for (uint8_t i = 0; i < (nbBytes + 3); i++)
+  I2C0_C1 |= I2C_C1_IICIE_MASK; // enable I2C interrupts
+
+  SendAddress();
+}
+
+
+
+/*! @brief Sends the START the current transaction was left waiting for, once the bus is free
+ *
+ *  @note Called from the watchdog thread. It waits with interrupts enabled, as nothing else touches I2C0
+ *        while a START is deferred.
+ */
+static void DeferredStart(void)
+{
+  // The STOP at the end of the last transaction takes one SCL period - a bus still busy well after that is held
+  // by a slave or another master
+  if (!WaitForBus())
+    ClearBus();
+
+  EnterCritical();
+  StartDeferred = false;
+  Begin();
+  ExitCritical();
+}
+
+
+
+/*! @brief Thread finding transactions that hang while no caller is waiting on them, such as an I2C_IntRead
+ *         whose slave holds SCL low - it sleeps while the bus is idle, and looks once per time limit otherwise.
+ *         It also sends the START of a transaction that has to wait for the bus to go free first.
+ */
+static void WatchdogThread(void* pData)
+{
+  for (;;)
   {
-    switch (i)
+    (void)OS_SemaphoreWait(WatchdogSemaphore, 0);
+
+    for (;;)
     {
-      case 0:
-        I2C0_D = SlaveAddressWrite; // send accelerometer address with R/W bit set to Write
-        break;
-      case 1:
-        I2C0_D = registerAddress; // send address of register to be written
-        break;
-      case 2:
-        I2C0_C1 &= ~I2C_C1_TX_MASK; // I2C is in Rx mode (read)
-        I2C0_C1 |= I2C_C1_RSTA_MASK; // REPEAT START signal
-        I2C0_D   = SlaveAddressRead; // send accelerometer address with R/W bit cleared to Read
-        break;
-      default:
-      // Data is put into I2C0_D here
+      if (StartDeferred)
+        DeferredStart();
 
-      if (i == (nbBytes + 1)) // 2nd last byte to be read - different between figure 11 diagram vs flowchart?
-        I2C0_C1 |= I2C_C1_TXAK_MASK; // NAK signal
-      else if (i == (nbBytes + 2)) // last byte to be read
-        I2C0_C1 &= ~I2C_C1_MST_MASK; // STOP signal
-      else
-        I2C0_C1 &= ~I2C_C1_TXAK_MASK; // AK signal
-		
-      data[i - 3] = I2C0_D; // place data into array
+      EnterCritical();
 
-      break;
-    }
+      uint32_t limit = (Active && Current) ? Limit(Current) : 0;
 
-    // Wait for current transfer to be completed
-    while (!(I2C0_S & I2C_S_IICIF_MASK));
-    I2C0_S |= I2C_S_IICIF_MASK;
+      if (limit == 0)
+        Watching = false; // I2C_Submit wakes it again when it starts the bus
 
-    if ((i < 3) && (I2C0_S & I2C_S_RXAK_MASK)) // if no AK received during write stages, end the communication
-      break;
+      ExitCritical();
+
+      if (limit == 0)
+        break;
+
+      // Woken early if a START is left to it
+      (void)OS_SemaphoreWait(WatchdogSemaphore, Ticks(limit));
+      I2C_CheckTimeout();
+    }
   }
 }
 
 
 
-void I2C_IntRead(const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes)
+bool I2C_Init(const TI2CModule* const aI2CModule, const uint32_t moduleClk)
 {
-  while (I2C0_S & I2C_S_BUSY_MASK)
+  // System clock gate enable
+  SIM_SCGC4 |= SIM_SCGC4_IIC0_MASK;
+	
+  // I2C enable
+  I2C0_C1 |= I2C_C1_IICEN_MASK;
+
+  // AK signal - SCL is held low until this is written (ie. STOP signal can't happen)
+  I2C0_C1 &= ~I2C_C1_TXAK_MASK;
+
+  // I2C0 is on PORTE pins 18-19 via SDA and SCL (see tower schematics)
+  SIM_SCGC5 |= SIM_SCGC5_PORTE_MASK;
+  PORTE_PCR18 |= PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK; // ALT4 in the pin MUX -> I2C0_SDA
+  PORTE_PCR19 |= PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK; // ALT4 in the pin MUX -> I2C0_SCL
+	
+  // Saving semaphore into global variable
+  ReadCompleteSemaphore = aI2CModule->readCompleteSemaphore;
+  ModuleClk = moduleClk;
+
+  WatchdogSemaphore = OS_SemaphoreCreate(0);
+  if (!WatchdogSemaphore)
+    return false;
+
+  // Every queued write is free
+  for (uint8_t i = 0; i < I2C_WRITE_QUEUE_SIZE; i++)
+    Writes[i].status = I2C_OK;
+  IntRead.status = I2C_OK;
+
+  FreeReadSemaphores = OS_SemaphoreCreate(I2C_MAX_READS);
+  if (!FreeReadSemaphores)
+    return false;
+
+  for (uint8_t i = 0; i < I2C_MAX_READS; i++)
   {
-  } // wait until bus is idle
-  
-  // Save parameters to global private variables for later communication with ISR
-  IsrNbBytes = nbBytes;
-  IsrData    = data;
+    ReadSemaphores[i] = OS_SemaphoreCreate(0);
+    if (!ReadSemaphores[i])
+      return false;
+  }
   
-  I2C0_C1 |= I2C_C1_MST_MASK; // START signal
-  I2C0_C1 |= I2C_C1_TX_MASK; // I2C is in Tx mode (write)
-  I2C0_C1 |= I2C_C1_IICIE_MASK; // enable I2C interrupts
+  // Setting up NVIC for I2C0 see K70 manual pg 97
+  // Vector=40, IRQ=24
+  // NVIC non-IPR=0 IPR=6
+  // Clear any pending interrupts on I2C0
+  NVICICPR0 = (1 << 24); // 24mod32 = 24
+  // Enable interrupts from the I2C0
+  NVICISER0 = (1 << 24);
   
-  for (uint8_t i = 0; i < 3; i++)
+#if I2C_RX_DMA
+  // I2C0 requests a transfer for each byte received while DMAEN is set
+  TDMAChannel rxChannel;
+  rxChannel.channelNb         = RX_DMA_CHANNEL;
+  rxChannel.source            = DMA_SOURCE_I2C0;
+  rxChannel.callback          = RxDMAComplete;
+  rxChannel.callbackArguments = NULL;
+
+  if (!DMA_Set(&rxChannel))
+    return false;
+#endif
+
+  return ((THREADS_CREATE(WatchdogThread, NULL, WatchdogThreadStack, I2C_WATCHDOG_PRIORITY) == OS_NO_ERROR) &&
+          BENCH_REGISTER(BenchFindDivider, 4) &&
+          Packet_RegisterHandler(CMD_I2C_STATS, HandleStatsPacket, PACKET_FLAG_NO_ACK) &&
+          Packet_RegisterHandler(CMD_I2C_ERRORS, HandleErrorsPacket, PACKET_FLAG_NO_ACK) &&
+          Packet_RegisterHandler(CMD_I2C_BUS, HandleBusPacket, PACKET_FLAG_NO_ACK));
+}
+
+
+
+bool I2C_AddDevice(TI2CDevice* const device)
+{
+  if (NbDevices >= I2C_MAX_DEVICES)
+    return false;
+
+  uint8_t multSave; // saves the best value for the mult register
+  uint8_t icrSave; // saves the best value for the icr register
+
+  FindDivider(device->baudRate, ModuleClk, &multSave, &icrSave);
+
+  // Register values for the most accurate baud rate - written to I2C0_F when one of its transactions starts
+  device->frequencyDivider = I2C_F_MULT(multSave) | I2C_F_ICR(icrSave);
+
+  // Time limits are counted in SCL periods
+  device->bitCycles = (uint32_t)(((uint64_t)CPU_CORE_CLK_HZ * (1u << multSave) * SclDivider[icrSave]) / ModuleClk);
+
+  device->head = device->tail = NULL;
+  device->nbDone = device->maxWait = 0;
+  device->busyCycles = device->waitCycles = 0;
+
+  EnterCritical(); // the I2C interrupt walks the devices
+
+  // The bus starts at the first device's speed
+  if (NbDevices == 0)
   {
-    switch (i)
+    I2C0_F = device->frequencyDivider;
+    BitCycles = device->bitCycles;
+    BusStatsStart = OS_TimeGet();
+  }
+
+  Devices[NbDevices++] = device;
+
+  ExitCritical();
+
+  return true;
+}
+
+
+
+/*! @brief Chooses the transaction to go on the bus next
+ *
+ *  @return TI2CTransaction* - the head of the queue of the first device with one, taking the high priority devices
+ *          first and starting after the device that went last, or NULL if every queue is empty
+ */
+static TI2CTransaction* Next(void)
+{
+  for (TI2CPriority priority = I2C_PRIORITY_HIGH; priority < I2C_NB_PRIORITIES; priority++)
+    for (uint8_t i = 1; i <= NbDevices; i++)
     {
-      case 0:
-        I2C0_D = SlaveAddressWrite; // send accelerometer address with R/W bit set to Write
-        break;
-      case 1:
-        I2C0_D = registerAddress; // send address of register to be written
-        break;
-      case 2:
-        I2C0_C1 &= ~I2C_C1_TX_MASK; // I2C is in Rx mode (read)
-        I2C0_C1 |= I2C_C1_RSTA_MASK; // REPEAT START signal
-        I2C0_D   = SlaveAddressRead; // send accelerometer address with R/W bit cleared to Read
-        break;
+      uint8_t turn = (LastDevice + i) % NbDevices;
+
+      if ((Devices[turn]->priority == priority) && Devices[turn]->head)
+      {
+        LastDevice = turn;
+        return Devices[turn]->head;
+      }
     }
-	
-    // Wait for current transfer to be completed - once completed the ISR should trigger
-    while (!(I2C0_S & I2C_S_IICIF_MASK));
 
-    if (I2C0_S & I2C_S_RXAK_MASK) // if no AK received end the communication
+  return NULL;
+}
+
+
+
+/*! @brief Puts the current transaction on the bus
+ *
+ *  @note Called with the bus idle, or from the I2C interrupt still holding it after the last transaction,
+ *        in which case a repeated START is sent instead of a STOP and START - unless the device runs at
+ *        another speed, which can only be changed with the bus free. Nothing waits for the bus here: while a
+ *        STOP is still freeing it, the START is left to the watchdog thread.
+ */
+static void Start(void)
+{
+  TI2CTransaction* transaction = Current;
+  TI2CDevice* device = transaction->device;
+
+  TRACE_EVENT(TRACE_I2C_START, (transaction->type != I2C_WRITE), transaction->registerAddress);
+
+  if ((I2C0_C1 & I2C_C1_MST_MASK) && (I2C0_F == device->frequencyDivider))
+  {
+    I2C0_C1 |= I2C_C1_TX_MASK | I2C_C1_RSTA_MASK; // REPEAT START signal - in Tx mode to send the address
+    SendAddress();
+    return;
+  }
+
+  // BUSY stays set for an SCL period after a STOP, so the bus is only started here if it was already idle
+  if (!(I2C0_C1 & I2C_C1_MST_MASK) && !(I2C0_S & I2C_S_BUSY_MASK))
+  {
+    Begin();
+    return;
+  }
+
+  I2C0_C1 &= ~(I2C_C1_MST_MASK | I2C_C1_IICIE_MASK); // STOP signal, and disable I2C interrupts
+  StartDeferred = true;
+  (void)OS_SemaphoreSignal(WatchdogSemaphore);
+}
+
+
+
+/*! @brief Ends the transaction on the bus and starts the next one, or sends a STOP if there are none
+ *
+ *  @param status How it went
+ *  @note I2C0 must be in Tx mode, so nothing more is clocked in until the next START or STOP.
+ */
+static void Finish(const TI2CStatus status)
+{
+  TI2CTransaction* transaction = Current;
+  TI2CDevice* device = transaction->device;
+
+  device->head = transaction->next;
+  if (!device->head)
+    device->tail = NULL;
+
+  I2C0_C1 &= ~I2C_C1_TXAK_MASK; // AK signal
+
+  NbDone[transaction->type != I2C_WRITE]++;
+  if (status == I2C_NAK)
+    NbNAKs++;
+
+  uint32_t now = DWT_CYCCNT;
+  uint32_t latency = now - transaction->submitted;
+  uint32_t wait = OnBus - transaction->submitted;
+
+  if (latency > MaxLatency)
+    MaxLatency = latency;
+
+  device->nbDone++;
+  device->busyCycles += (uint32_t)(now - OnBus);
+  device->waitCycles += wait;
+  if (wait > device->maxWait)
+    device->maxWait = wait;
+
+  // The callback may queue another transaction, which then follows on without a STOP
+  transaction->status = status;
+
+  if (transaction->callback)
+    (*transaction->callback)(transaction);
+
+  if (transaction->semaphore)
+    (void)OS_SemaphoreSignal(transaction->semaphore);
+
+  Current = Next();
+
+  if (Current)
+    Start();
+  else
+  {
+    I2C0_C1 &= ~I2C_C1_MST_MASK; // STOP signal
+    I2C0_C1 &= ~I2C_C1_IICIE_MASK; // disable I2C interrupts
+    TRACE_EVENT(TRACE_I2C_STOP, (transaction->type != I2C_WRITE), 0);
+    Active = false;
+  }
+}
+
+
+
+bool I2C_Submit(TI2CDevice* const device, TI2CTransaction* const transaction)
+{
+  uint32_t start = DWT_CYCCNT;
+
+  if ((transaction->type != I2C_WRITE) && (transaction->nbBytes == 0))
+    return false;
+
+  transaction->device    = device;
+  transaction->status    = I2C_PENDING;
+  transaction->next      = NULL;
+  transaction->submitted = start;
+
+  EnterCritical(); // the I2C interrupt takes transactions off the queues
+
+  if (device->tail)
+    device->tail->next = transaction;
+  else
+    device->head = transaction;
+  device->tail = transaction;
+
+  // The interrupt starts each transaction after the last one, so only an idle bus is started here
+  if (!Active)
+  {
+    Active = true;
+    Current = Next();
+    Start();
+  }
+
+  // The watchdog is only woken here when it is asleep, rather than once for every transaction
+  bool wake = !Watching;
+  Watching = true;
+
+  CPUCycles[transaction->type != I2C_WRITE] += (uint32_t)(DWT_CYCCNT - start);
+
+  ExitCritical();
+
+  if (wake)
+    (void)OS_SemaphoreSignal(WatchdogSemaphore);
+
+  return true;
+}
+
+
+
+void I2C_CheckTimeout(void)
+{
+  EnterCritical(); // the I2C interrupt runs the queues
+
+  // The time is counted from the last byte rather than the START, as the interrupt may have been held off by a long
+  // critical section - and with TCF set it still is, as the byte is done and the bus is waiting on the CPU. A START
+  // left to the watchdog is its own bounded wait for the bus.
+  if (Active && Current && !StartDeferred && ((uint32_t)(DWT_CYCCNT - Moved) > Limit(Current)) &&
+      !(I2C0_S & I2C_S_TCF_MASK))
+  {
+    NbTimeouts++;
+    ClearBus();
+    Finish(I2C_TIMEOUT);
+  }
+
+  ExitCritical();
+}
+
+
+
+// follows pg. 19 of accelerometer manual - single-byte write
+bool I2C_Write(TI2CDevice* const device, const uint8_t registerAddress, const uint8_t data)
+{
+  TI2CTransaction* transaction = NULL;
+
+  // A stuck transaction would otherwise keep the writes queued behind it
+  I2C_CheckTimeout();
+
+  // Any write that has finished can be reused
+  EnterCritical();
+
+  for (uint8_t i = 0; i < I2C_WRITE_QUEUE_SIZE; i++)
+    if (Writes[i].status != I2C_PENDING)
+    {
+      transaction = &Writes[i];
+      WriteData[i] = data;
+      transaction->type            = I2C_WRITE;
+      transaction->registerAddress = registerAddress;
+      transaction->data            = &WriteData[i];
+      transaction->nbBytes         = 1;
+      transaction->semaphore       = NULL;
+      transaction->callback        = NULL;
+      transaction->status          = I2C_PENDING;
       break;
+    }
+
+  ExitCritical();
+
+  return (transaction && I2C_Submit(device, transaction));
+}
+
+
+
+bool I2C_WaitWrites(const uint8_t nbWrites)
+{
+  if (nbWrites > I2C_WRITE_QUEUE_SIZE)
+    return false;
+
+  for (;;)
+  {
+    uint8_t nbFree = 0;
+
+    // A stuck transaction would otherwise keep the writes queued behind it
+    I2C_CheckTimeout();
+
+    for (uint8_t i = 0; i < I2C_WRITE_QUEUE_SIZE; i++)
+      if (Writes[i].status != I2C_PENDING)
+        nbFree++;
+
+    if (nbFree >= nbWrites)
+      return true;
+
+    OS_TimeDelay(1);
   }
-  
-  // ISR should trigger here, following the flowchart
+}
+
+
+
+bool I2C_Read(TI2CDevice* const device, const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes)
+{
+  TI2CTransaction transaction;
+  uint8_t slot = 0;
+
+  // Every read signals its semaphore once, and its caller takes that signal, so each is left at zero for the next
+  (void)OS_SemaphoreWait(FreeReadSemaphores, 0);
+
+  EnterCritical();
+  while (ReadSemaphoreTaken[slot])
+    slot++;
+  ReadSemaphoreTaken[slot] = true;
+  ExitCritical();
+
+  transaction.type            = I2C_WRITE_READ;
+  transaction.registerAddress = registerAddress;
+  transaction.data            = data;
+  transaction.nbBytes         = nbBytes;
+  transaction.semaphore       = ReadSemaphores[slot];
+  transaction.callback        = NULL;
+
+  bool submitted = I2C_Submit(device, &transaction);
+
+  // Each time the wait runs out the transaction on the bus is abandoned if it has stopped moving, which may be
+  // this one - so the wait is bounded by the time limits of the transactions ahead of it and its own
+  if (submitted)
+  {
+    uint32_t ticks = Ticks(Limit(&transaction));
+
+    while (OS_SemaphoreWait(ReadSemaphores[slot], ticks) == OS_TIMEOUT)
+      I2C_CheckTimeout();
+  }
+
+  ReadSemaphoreTaken[slot] = false;
+  (void)OS_SemaphoreSignal(FreeReadSemaphores);
+
+  return (submitted && (transaction.status == I2C_OK));
+}
+
+
+
+/*! @brief Lets I2CHandler run once an I2C_IntRead is over, whether or not it succeeded
+ *
+ *  @param transaction The read
+ */
+static void IntReadDone(TI2CTransaction* const transaction)
+{
+  // Allow I2CHandler to run
+  DISPATCH_POST(DISPATCH_I2C, ReadCompleteSemaphore);
+  ISR_STATS_SIGNAL(ISR_STATS_I2C);
+}
+
+
+
+bool I2C_IntRead(TI2CDevice* const device, const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes)
+{
+  // A read that never finishes would otherwise stop every read after it
+  I2C_CheckTimeout();
+
+  if (IntRead.status == I2C_PENDING)
+    return false;
+
+  IntRead.type            = I2C_WRITE_READ;
+  IntRead.registerAddress = registerAddress;
+  IntRead.data            = data;
+  IntRead.nbBytes         = nbBytes;
+  IntRead.semaphore       = NULL;
+  IntRead.callback        = IntReadDone;
+
+  return I2C_Submit(device, &IntRead);
+}
+
+
+
+TI2CStatus I2C_IntReadStatus(void)
+{
+  return IntRead.status;
 }
 
 
 
 void __attribute__ ((interrupt)) I2C_ISR(void)
 {
+  ISR_STATS_ENTER(ISR_STATS_I2C);
   OS_ISREnter();
-	
-  I2C0_S |= I2C_S_IICIF_MASK; // w1c interrupt flag
-  static uint8_t dataIndex = 0; // index to data pointer
-  
-  // Flowchart 55-42 on pg 1896 of K70 manual
-  if (I2C0_C1 & I2C_C1_MST_MASK)
+
+  uint32_t start = DWT_CYCCNT;
+  TI2CTransaction* transaction = Current;
+  uint8_t status = I2C0_S;
+
+  I2C0_S = I2C_S_IICIF_MASK | (status & I2C_S_ARBL_MASK); // w1c interrupt flag, and arbitration lost
+
+  if (transaction && (status & I2C_S_ARBL_MASK)) // another master won the bus - MST has already been cleared
   {
-    if (I2C0_C1 & ~I2C_C1_TX_MASK); // ISR is only for reading
-    {
-      if (dataIndex == IsrNbBytes) //last byte to read
-      {
-        I2C0_C1 &= ~I2C_C1_MST_MASK; // STOP signal
-        I2C0_C1 &= ~I2C_C1_IICIE_MASK; // disable I2C interrupts
-      }
-      else if (dataIndex == (IsrNbBytes - 1)) //2nd last byte to read
-        I2C0_C1 |= I2C_C1_TXAK_MASK;
-      
-	  
-      IsrData[dataIndex] = I2C0_D; // Read from data reg and store
-	  
-      // If last byte to read, reset index and callback
-      if (dataIndex == IsrNbBytes)
+    NbArbitrationLost++;
+    Finish(I2C_ARBITRATION_LOST);
+  }
+  // In Rx mode only a finished byte counts - IICIF may have been left set by the bytes the DMA moved
+  else if (transaction && ((State != STATE_READ) || (I2C0_S & I2C_S_TCF_MASK)))
+  {
+    NbBytes++;
+    Moved = start;
+
+    // Flowchart 55-42 on pg 1896 of K70 manual
+    if ((State != STATE_READ) && (status & I2C_S_RXAK_MASK)) // if no AK received, end the transaction
+      Finish(I2C_NAK);
+    else
+      switch (State)
       {
-        dataIndex = 0;
+        case STATE_ADDRESS:
+          State = STATE_REGISTER;
+          I2C0_D = transaction->registerAddress; // send address of register to be written or read
+          break;
+
+        case STATE_REGISTER:
+          if (transaction->type == I2C_WRITE_READ)
+          {
+            State = STATE_ADDRESS_READ;
+            I2C0_C1 |= I2C_C1_RSTA_MASK; // REPEAT START signal - still in Tx mode to send the address
+            I2C0_D = (transaction->device->slaveAddress << 1) | 0x1; // read mode address has first bit set
+            break;
+          }
+
+          State = STATE_WRITE;
+          // fall through
+
+        case STATE_WRITE:
+          if (Index < transaction->nbBytes)
+            I2C0_D = transaction->data[Index++]; // send data to write into register
+          else
+            Finish(I2C_OK);
+          break;
 
-        // Allow I2CThread to run
-        OS_SemaphoreSignal(ReadCompleteSemaphore);
+        case STATE_ADDRESS_READ:
+          State = STATE_READ;
+          I2C0_C1 &= ~I2C_C1_TX_MASK; // I2C is in Rx mode (read)
+
+          if (transaction->nbBytes == 1) // a single byte is NAKed straight away
+            I2C0_C1 |= I2C_C1_TXAK_MASK;
+          else
+            I2C0_C1 &= ~I2C_C1_TXAK_MASK;
+
+#if I2C_RX_DMA
+          // The DMA takes each byte as it comes in, up to the 2nd last, with the I2C interrupt off until it is done
+          if ((transaction->nbBytes >= I2C_DMA_MIN_BYTES) &&
+              DMA_StartTransfer(RX_DMA_CHANNEL, &I2C0_D, 0, transaction->data, 1, transaction->nbBytes - 2))
+          {
+            Index = transaction->nbBytes - 2;
+            I2C0_C1 &= ~I2C_C1_IICIE_MASK; // disable I2C interrupts
+            I2C0_C1 |= I2C_C1_DMAEN_MASK;
+          }
+#endif
+
+          (void)I2C0_D; // dummy read starts receiving the first byte
+          break;
+
+        case STATE_READ:
+          if (Index == (transaction->nbBytes - 1)) // last byte - back to Tx mode before reading it so no more are clocked in
+            I2C0_C1 |= I2C_C1_TX_MASK;
+          else if (Index == (transaction->nbBytes - 2)) // 2nd last byte - the byte after it is NAKed
+            I2C0_C1 |= I2C_C1_TXAK_MASK; // NAK signal
+
+          transaction->data[Index++] = I2C0_D; // place data into array, which starts receiving the next byte
+
+          if (Index == transaction->nbBytes)
+            Finish(I2C_OK);
+          break;
       }
-      // else, increment index and the ISR should reoccur
-      else
-        dataIndex++;
-    }
+
+    CPUCycles[transaction->type != I2C_WRITE] += (uint32_t)(DWT_CYCCNT - start);
   }
-  
+
   OS_ISRExit();
+  ISR_STATS_EXIT(ISR_STATS_I2C);
 }
-
-
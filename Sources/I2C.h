@@ -3,6 +3,8 @@
  *  @brief I/O routines for the K70 I2C interface.
  *
  *  This contains the functions for operating the I2C (inter-integrated circuit) module.
+ *  Each slave on the bus is a device with its own address, speed and queue of transactions. The I2C
+ *  interrupt runs the transactions one after another, taking the devices in turn, latency-critical ones first.
  *
  *  @author PMcL
  *  @date 2015-09-17
@@ -19,59 +21,190 @@
 #include "types.h"
 #include "OS.h"
 
+// Register writes I2C_Write can have queued at once, for all devices
+#define I2C_WRITE_QUEUE_SIZE 16
+
+// Devices I2C_AddDevice can take
+#define I2C_MAX_DEVICES 4
+
+// I2C_Read calls that can wait at once, for all devices and threads - each waits on a semaphore of its own
+#define I2C_MAX_READS 4
+
+// Set to 1 to have the eDMA engine move the bytes of longer reads instead of one I2C interrupt per byte
+#ifndef I2C_RX_DMA
+#define I2C_RX_DMA 1
+#endif
+
+// Longest the transaction on the bus may go without moving on a byte, as a multiple of the time all its bytes take
+// on the wire, before it is abandoned and the bus cleared - plus I2C_TIMEOUT_SLACK_US for clock stretching
+#define I2C_TIMEOUT_FACTOR   4
+#define I2C_TIMEOUT_SLACK_US 2000
+
+// Priority of the thread that finds transactions that hang while no caller is waiting on them
+#define I2C_WATCHDOG_PRIORITY 6
+
+// Shortest read handed to the eDMA engine - it moves all but the last two bytes, which the I2C interrupt
+// takes so it can NAK the last one and send the STOP
+#define I2C_DMA_MIN_BYTES 6
+
 typedef struct
 {
-  uint8_t primarySlaveAddress;
-  uint32_t baudRate;
-  ECB* readCompleteSemaphore;
+  OS_ECB* readCompleteSemaphore; /*!< Signalled when an I2C_IntRead is over. */
 } TI2CModule;
 
+typedef enum
+{
+  I2C_PRIORITY_HIGH,    /*!< Latency-critical - goes before every normal device with a transaction waiting. */
+  I2C_PRIORITY_NORMAL,
+  I2C_NB_PRIORITIES
+} TI2CPriority;
+
+typedef enum
+{
+  I2C_WRITE,      /*!< START, slave address, register address, then the data is written. */
+  I2C_READ,       /*!< START, slave address, then the data is read from wherever the slave's register pointer is. */
+  I2C_WRITE_READ  /*!< START, slave address, register address, repeated START, slave address, then the data is read. */
+} TI2CType;
+
+typedef enum
+{
+  I2C_PENDING,    /*!< Queued or on the bus. */
+  I2C_OK,
+  I2C_NAK,              /*!< The slave did not acknowledge a byte. */
+  I2C_ARBITRATION_LOST, /*!< Another master took the bus. */
+  I2C_TIMEOUT           /*!< The transaction did not finish in time, and the bus was cleared. */
+} TI2CStatus;
+
+typedef struct I2CTransaction
+{
+  TI2CType type;
+  uint8_t registerAddress;
+  uint8_t* data;                /*!< The bytes to write, or where to put the bytes read. */
+  uint8_t nbBytes;
+  OS_ECB* semaphore;            /*!< Signalled when the transaction is over, or NULL. */
+  void (*callback)(struct I2CTransaction* const transaction); /*!< Called from the I2C interrupt when the transaction is over, or NULL. */
+  volatile TI2CStatus status;
+  struct I2CDevice* device;     /*!< Set by I2C_Submit. */
+  uint32_t submitted;           /*!< Cycle counter when it was queued - set by I2C_Submit. */
+  struct I2CTransaction* next;  /*!< Used by the queue. */
+} TI2CTransaction;
+
+typedef struct I2CDevice
+{
+  uint8_t slaveAddress;         /*!< 7-bit address. */
+  uint32_t baudRate;            /*!< SCL rate in bits/sec. */
+  TI2CPriority priority;
+  uint8_t frequencyDivider;     /*!< I2C0_F for the baud rate - set by I2C_AddDevice. */
+  uint32_t bitCycles;           /*!< Core clock cycles per SCL period - set by I2C_AddDevice. */
+  TI2CTransaction* head;        /*!< Its queue - the head is the next to go on the bus. */
+  TI2CTransaction* tail;
+  uint32_t nbDone;              /*!< Counters reported by CMD_I2C_BUS. */
+  uint64_t busyCycles;          /*!< Time its transactions held the bus. */
+  uint64_t waitCycles;          /*!< Time its transactions waited for the bus. */
+  uint32_t maxWait;
+} TI2CDevice;
+
 /*! @brief Sets up the I2C before first use.
  *
+ *  Also creates the watchdog thread and registers the handlers for the I2C statistics, errors and bus commands.
  *  @param aI2CModule is a structure containing the operating conditions for the module.
  *  @param moduleClk The module clock in Hz.
  *  @return BOOL - TRUE if the I2C module was successfully initialized.
  */
 bool I2C_Init(const TI2CModule* const aI2CModule, const uint32_t moduleClk);
 
-/*! @brief Selects the current slave device
+/*! @brief Adds a slave device to the bus.
+ *
+ * @param device The device - slaveAddress, baudRate and priority must be set. It must stay in place for as long
+ *        as the program runs.
+ * @return bool - TRUE if the device was added, FALSE if I2C_MAX_DEVICES already have been.
+ * @note Devices are numbered for CMD_I2C_BUS in the order they are added. Assumes the I2C module has been initialized.
+ */
+bool I2C_AddDevice(TI2CDevice* const device);
+
+/*! @brief Queues a transaction with a device.
+ *
+ * Each device's transactions go on the bus in the order they were queued. Between devices, the high priority
+ * ones go first, and devices of the same priority take turns a transaction at a time.
+ * The transaction must not be changed or reused until its status is no longer I2C_PENDING.
+ * @param device The device.
+ * @param transaction The transaction - type, registerAddress, data, nbBytes, semaphore and callback must be set.
+ * @return bool - TRUE if the transaction was queued, FALSE if a read has no bytes to read.
+ * @note May be called from any thread, or from the callback of another transaction.
+ */
+bool I2C_Submit(TI2CDevice* const device, TI2CTransaction* const transaction);
+
+/*! @brief Abandons the transaction on the bus if it has gone its time limit without moving on a byte, and clears the bus
  *
- * @param slaveAddress The slave device address.
+ * I2C_Write, I2C_Read and I2C_IntRead check first, and the module's watchdog thread checks once per time limit
+ * while the bus is running, so a transaction that hangs is found even when nothing else uses the bus.
+ * @note The other transactions carry on after it.
  */
-void I2C_SelectSlaveDevice(const uint8_t slaveAddress);
+void I2C_CheckTimeout(void);
 
 /*! @brief Write a byte of data to a specified register
  *
+ * The write is queued and this returns straight away - a device's writes and reads happen in the order they
+ * were queued.
+ * @param device The device.
  * @param registerAddress The register address.
  * @param data The 8-bit data to write.
+ * @return bool - TRUE if the write was queued, FALSE if I2C_WRITE_QUEUE_SIZE writes are already waiting - I2C_WaitWrites
+ *         waits for room first.
  */
-void I2C_Write(const uint8_t registerAddress, const uint8_t data);
+bool I2C_Write(TI2CDevice* const device, const uint8_t registerAddress, const uint8_t data);
+
+/*! @brief Waits until a number of writes can be queued with I2C_Write
+ *
+ * Lets a thread queue a group of writes in a critical section without any of them being refused.
+ * @param nbWrites The number of writes.
+ * @return bool - TRUE once they can be queued, FALSE if nbWrites is more than I2C_WRITE_QUEUE_SIZE.
+ * @note Must be called from a thread, with interrupts enabled - the writes ahead finish, or are abandoned once they
+ *       go their time limit.
+ */
+bool I2C_WaitWrites(const uint8_t nbWrites);
 
 /*! @brief Reads data of a specified length starting from a specified register
  *
- * Uses polling as the method of data reception.
+ * The calling thread waits on a semaphore of its own until the data is in, for no longer than the time limits
+ * of the transactions ahead of it and its own. Any number of threads may read any device - once I2C_MAX_READS
+ * are waiting, the next waits for one of them to finish first.
+ * @param device The device.
  * @param registerAddress The register address.
  * @param data A pointer to store the bytes that are read.
  * @param nbBytes The number of bytes to read.
+ * @return bool - TRUE if the data was read, FALSE if the slave did not acknowledge, the bus was lost or the read
+ *         timed out.
+ * @note Must be called from a thread.
  */
-void I2C_PollRead(const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes);
+bool I2C_Read(TI2CDevice* const device, const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes);
 
 /*! @brief Reads data of a specified length starting from a specified register
  *
- * Uses interrupts as the method of data reception.
+ * Uses interrupts as the method of data reception - returns straight away, and the read complete semaphore
+ * is signalled once the read is over, whether or not it succeeded. There is one such read for the whole bus -
+ * other devices can use I2C_Submit with a callback.
+ * @param device The device.
  * @param registerAddress The register address.
  * @param data A pointer to store the bytes that are read.
  * @param nbBytes The number of bytes to read.
+ * @return bool - TRUE if the read was queued, FALSE if the last one has not finished.
  */
-void I2C_IntRead(const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes);
+bool I2C_IntRead(TI2CDevice* const device, const uint8_t registerAddress, uint8_t* const data, const uint8_t nbBytes);
+
+/*! @brief Gets how the last I2C_IntRead went
+ *
+ * @return TI2CStatus - I2C_OK if the data is in.
+ */
+TI2CStatus I2C_IntReadStatus(void);
 
 /*! @brief Interrupt service routine for the I2C.
  *
- *  Only used for reading data.
- *  At the end of reception, the user callback function will be called.
+ *  Runs the queued transactions a byte at a time, apart from the bytes of a read the eDMA engine moves.
+ *  Each finished transaction's callback is called and its semaphore signalled, and the next starts with a
+ *  repeated START rather than a STOP - unless its device runs at another speed.
  *  @note Assumes the I2C module has been initialized.
  */
 void __attribute__ ((interrupt)) I2C_ISR(void);
 
 #endif
-
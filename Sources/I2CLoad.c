@@ -0,0 +1,152 @@
+/*!
+**  @file I2CLoad.c
+**
+**  @brief Second I2C0 device traffic, for exercising the bus scheduler.
+**         Each thread reads the EEPROM once a tick, at an address of its own that moves on with every read.
+**         The EEPROM holds each byte's own address, so every byte read can be checked. Reads by different
+**         threads are in the queue together, so a read that woke the wrong thread shows up as wrong data.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE I2CLoad */
+
+#include "I2CLoad.h"
+#include "I2C.h"
+#include "packet.h"
+#include "OS.h"
+#include "Threads.h"
+#include "PE_Types.h"
+
+#if I2C_LOAD
+
+#define THREAD_STACK_SIZE 256
+
+// Values in the CMD_I2C_LOAD reply for each thread
+#define NB_VALUES 3
+
+OS_THREAD_STACK(LoadThreadStack0, THREAD_STACK_SIZE);
+OS_THREAD_STACK(LoadThreadStack1, THREAD_STACK_SIZE);
+
+static uint32_t* const Stacks[I2C_LOAD_NB_THREADS] = {LoadThreadStack0, LoadThreadStack1};
+static const char* const Names[I2C_LOAD_NB_THREADS] = {"LoadThread0", "LoadThread1"};
+
+static TI2CDevice EEPROM;
+
+// Counters reported by CMD_I2C_LOAD, for each thread
+static uint32_t NbReads[I2C_LOAD_NB_THREADS];
+static uint32_t NbFailed[I2C_LOAD_NB_THREADS];  // I2C_Read returned FALSE
+static uint32_t NbWrong[I2C_LOAD_NB_THREADS];   // I2C_Read returned TRUE, but not with the bytes asked for
+
+
+
+/*! @brief Reads the EEPROM once a tick and checks the bytes
+ *
+ *  @param pData The thread's number
+ */
+static void LoadThread(void* pData)
+{
+  uint8_t thread = (uint8_t)(uint32_t)pData;
+  uint8_t address = thread * (256 / I2C_LOAD_NB_THREADS);
+
+  for (;;)
+  {
+    uint8_t data[I2C_LOAD_NB_BYTES] = {0};
+
+    OS_TimeDelay(1);
+
+    bool read = I2C_Read(&EEPROM, address, data, I2C_LOAD_NB_BYTES);
+    bool right = true;
+
+    for (uint8_t i = 0; i < I2C_LOAD_NB_BYTES; i++)
+      if (data[i] != (uint8_t)(address + i))
+        right = false;
+
+    EnterCritical(); // the packet thread reads and clears the counters
+
+    NbReads[thread]++;
+    if (!read)
+      NbFailed[thread]++;
+    else if (!right)
+      NbWrong[thread]++;
+
+    ExitCritical();
+
+    address += I2C_LOAD_NB_BYTES;
+  }
+}
+
+
+
+/*!
+ * @brief Handles an I2C Load packet - reports how the reads of the second device went
+ *
+ * Parameter1 = 1 for GET, 2 for GET and clear the counters
+ * Parameter2 = 0, Parameter3 = 0
+ * Reply: an extended frame of 32-bit values, LSB first - for each thread in turn, its reads, the reads that
+ *        failed, and the reads that returned the wrong bytes.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleLoadPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  uint8_t payload[4 * NB_VALUES * I2C_LOAD_NB_THREADS];
+  uint8_t* next = payload;
+
+  EnterCritical();
+
+  for (uint8_t thread = 0; thread < I2C_LOAD_NB_THREADS; thread++)
+  {
+    const uint32_t values[NB_VALUES] = {NbReads[thread], NbFailed[thread], NbWrong[thread]};
+
+    for (uint8_t i = 0; i < NB_VALUES; i++)
+      for (uint8_t j = 0; j < 4; j++)
+        *next++ = (uint8_t)(values[i] >> (8 * j));
+
+    if (Packet_Parameter1(packet) == 0x02)
+      NbReads[thread] = NbFailed[thread] = NbWrong[thread] = 0;
+  }
+
+  ExitCritical();
+
+  return Packet_PutFrame(CMD_I2C_LOAD, payload, sizeof(payload));
+}
+
+#endif
+
+
+
+bool I2CLoad_Init(void)
+{
+#if I2C_LOAD
+  EEPROM.slaveAddress = I2C_LOAD_ADDRESS;
+  EEPROM.baudRate     = I2C_LOAD_BAUD_RATE;
+  EEPROM.priority     = I2C_PRIORITY_NORMAL;
+
+  if (!I2C_AddDevice(&EEPROM))
+    return false;
+
+  for (uint8_t thread = 0; thread < I2C_LOAD_NB_THREADS; thread++)
+    if (Threads_Create(Names[thread], LoadThread, (void*)(uint32_t)thread, Stacks[thread], THREAD_STACK_SIZE,
+                       I2C_LOAD_PRIORITY + thread) != OS_NO_ERROR)
+      return false;
+
+  return Packet_RegisterHandler(CMD_I2C_LOAD, HandleLoadPacket, PACKET_FLAG_NO_ACK);
+#else
+  return true;
+#endif
+}
+
+
+
+/* END I2CLoad */
+/*!
+** @}
+*/
@@ -0,0 +1,42 @@
+/*! @file
+ *
+ *  @brief Second I2C0 device traffic, for exercising the bus scheduler.
+ *
+ *  This contains the functions for adding an AT24C02 EEPROM as a normal priority I2C0 device at 400 kbit/s,
+ *  and threads that all read it every tick and check what comes back. The tower has no such device, so it is
+ *  only built with I2C_LOAD 1 - the host build's I2C0 model has one when SIM_I2C_EEPROM is set.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-20
+ */
+
+#ifndef I2CLOAD_H
+#define I2CLOAD_H
+
+// new types
+#include "types.h"
+
+// Set to 1 to add the device and its threads
+#ifndef I2C_LOAD
+#define I2C_LOAD 0
+#endif
+
+// 7-bit slave address of the EEPROM, with A0-A2 low, and its speed
+#define I2C_LOAD_ADDRESS   0x50
+#define I2C_LOAD_BAUD_RATE 400000
+
+// Threads reading the EEPROM, each a priority below the last, starting just below the packet thread
+#define I2C_LOAD_NB_THREADS 2
+#define I2C_LOAD_PRIORITY   9
+
+// Bytes each read takes
+#define I2C_LOAD_NB_BYTES 4
+
+/*! @brief Adds the EEPROM as an I2C0 device, creates the threads reading it and registers the CMD_I2C_LOAD handler.
+ *
+ *  @return bool - TRUE if it was successfully initialized, or if it is not built.
+ *  @note Must be called after I2C_Init.
+ */
+bool I2CLoad_Init(void);
+
+#endif
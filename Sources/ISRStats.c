@@ -0,0 +1,169 @@
+/*!
+**  @file ISRStats.c
+**
+**  @brief Per-ISR latency histograms.
+**         Each instrumented ISR reads the DWT cycle counter as it is entered and counts its duration
+**         as it exits. When it signals its thread it notes the cycle counter, and the thread counts the
+**         time from then until it runs. Counts go into log2 buckets so a histogram is a handful of words
+**         and adding to one is a count-leading-zeros and an increment.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE ISRStats */
+
+#include "ISRStats.h"
+#include "packet.h"
+#include "OS.h"
+#include "Cpu.h"
+
+#include <string.h>
+
+// Histogram kinds in the reply
+#define KIND_DURATION 0
+#define KIND_WAKEUP   1
+#define NB_KINDS      2
+
+// Bytes of the reply frame - source, kind, then a 16-bit count per bucket
+#define ISR_STATS_FRAME_SIZE (2 + (2 * ISR_STATS_NB_BUCKETS))
+
+#if ISR_STATS
+
+typedef struct
+{
+  uint32_t counts[NB_KINDS][ISR_STATS_NB_BUCKETS];
+  uint32_t signalled;  /*!< Cycle counter when the ISR last signalled its thread. */
+  bool pending;        /*!< TRUE if the thread has not run since. */
+} TISRStats;
+
+static TISRStats Stats[ISR_STATS_NB_SOURCES];
+
+
+
+/*! @brief Finds the bucket a time goes in
+ *
+ *  @param cycles The time
+ *  @return uint8_t - the bucket
+ */
+static uint8_t Bucket(const uint32_t cycles)
+{
+  if (cycles < 16)
+    return 0;
+
+  // Bits in cycles, less the four covered by bucket 0
+  uint8_t bucket = 28 - __builtin_clz(cycles);
+
+  return (bucket < ISR_STATS_NB_BUCKETS) ? bucket : (ISR_STATS_NB_BUCKETS - 1);
+}
+
+
+
+/*!
+ * @brief Handles an ISR Statistics packet - sends every histogram, optionally resetting them
+ *
+ * Parameter1 = 1 (get) or 2 (get and reset), Parameter2 = 0, Parameter3 = 0
+ * Reply: one extended frame per ISR and kind (0 = duration, 1 = thread wakeup latency) - the ISR,
+ *        the kind, then the count in each bucket, 16-bit LSB first and saturated at 0xFFFF
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully.
+ */
+static bool HandleISRStatsPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  bool reset = (Packet_Parameter1(packet) == 0x02);
+
+  for (uint8_t source = 0; source < ISR_STATS_NB_SOURCES; source++)
+  {
+    for (uint8_t kind = 0; kind < NB_KINDS; kind++)
+    {
+      uint32_t counts[ISR_STATS_NB_BUCKETS];
+      uint8_t payload[ISR_STATS_FRAME_SIZE];
+
+      EnterCritical(); // The ISRs add to the counts
+
+      memcpy(counts, Stats[source].counts[kind], sizeof(counts));
+      if (reset)
+        memset(Stats[source].counts[kind], 0, sizeof(counts));
+
+      ExitCritical();
+
+      payload[0] = source;
+      payload[1] = kind;
+      for (uint8_t bucket = 0; bucket < ISR_STATS_NB_BUCKETS; bucket++)
+      {
+        uint16_t count = (counts[bucket] > UINT16_MAX) ? UINT16_MAX : (uint16_t)counts[bucket];
+
+        payload[2 + (2 * bucket)] = (uint8_t)count;
+        payload[3 + (2 * bucket)] = (uint8_t)(count >> 8);
+      }
+
+      // A frame per source and kind is more than the transmit ring holds, so wait for room rather than drop the rest
+      while (!Packet_PutFrame(CMD_ISRSTATS, payload, ISR_STATS_FRAME_SIZE))
+        OS_TimeDelay(1);
+    }
+  }
+
+  return true;
+}
+
+#endif
+
+
+
+bool ISRStats_Init(void)
+{
+#if ISR_STATS
+  memset(Stats, 0, sizeof(Stats));
+
+  return Packet_RegisterHandler(CMD_ISRSTATS, HandleISRStatsPacket, PACKET_FLAG_NO_ACK);
+#else
+  return true;
+#endif
+}
+
+
+
+#if ISR_STATS
+
+void ISRStats_Exit(const TISRStatsSource source, const uint32_t start)
+{
+  Stats[source].counts[KIND_DURATION][Bucket(DWT_CYCCNT - start)]++;
+}
+
+
+
+void ISRStats_Signal(const TISRStatsSource source)
+{
+  Stats[source].signalled = DWT_CYCCNT;
+  Stats[source].pending = true;
+}
+
+
+
+void ISRStats_Woken(const TISRStatsSource source)
+{
+  EnterCritical(); // The ISR could signal again part way through
+
+  if (Stats[source].pending)
+  {
+    Stats[source].pending = false;
+    Stats[source].counts[KIND_WAKEUP][Bucket(DWT_CYCCNT - Stats[source].signalled)]++;
+  }
+
+  ExitCritical();
+}
+
+#endif
+
+
+
+/* END ISRStats */
+/*!
+** @}
+*/
@@ -0,0 +1,99 @@
+/*! @file
+ *
+ *  @brief Per-ISR latency histograms.
+ *
+ *  This contains the macros for timing each ISR and how long the thread it signals takes to run,
+ *  using the DWT cycle counter. Each time is counted in a log2 bucket, and the histograms are read
+ *  and reset over the serial port with CMD_ISRSTATS. Building with ISR_STATS 0 compiles it all out.
+ *  The same points are recorded as events in the trace (Trace.h).
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-07
+ */
+
+#ifndef ISRSTATS_H
+#define ISRSTATS_H
+
+// new types
+#include "types.h"
+#include "MK70F12.h"
+#include "Trace.h"
+
+// Set to 0 to compile the instrumentation out
+#ifndef ISR_STATS
+#define ISR_STATS 1
+#endif
+
+// Buckets in each histogram - bucket 0 is under 16 cycles, bucket n is 2^(n+3) to 2^(n+4) - 1 cycles,
+// and the last bucket also counts everything longer
+#define ISR_STATS_NB_BUCKETS 15
+
+/*! @brief The instrumented ISRs.
+ */
+typedef enum
+{
+  ISR_STATS_UART,
+  ISR_STATS_PIT,
+  ISR_STATS_FTM0,
+  ISR_STATS_RTC,
+  ISR_STATS_I2C,
+  ISR_STATS_ACCEL,
+  ISR_STATS_NB_SOURCES
+} TISRStatsSource;
+
+#if ISR_STATS
+
+/*! @brief Starts timing an ISR - must be the first statement in it.
+ */
+#define ISR_STATS_ENTER(source) uint32_t isrStatsStart = DWT_CYCCNT; TRACE_EVENT(TRACE_ISR_ENTER, (source), 0)
+
+/*! @brief Counts the ISR's duration - must be the last statement in it.
+ */
+#define ISR_STATS_EXIT(source) do { ISRStats_Exit((source), isrStatsStart); TRACE_EVENT(TRACE_ISR_EXIT, (source), 0); } while (0)
+
+/*! @brief Notes when the ISR signalled its thread - put next to OS_SemaphoreSignal.
+ */
+#define ISR_STATS_SIGNAL(source) do { ISRStats_Signal(source); TRACE_EVENT(TRACE_SEM_SIGNAL, (source), 0); } while (0)
+
+/*! @brief Counts the time since the ISR signalled - put straight after the thread's OS_SemaphoreWait.
+ */
+#define ISR_STATS_WOKEN(source) do { ISRStats_Woken(source); TRACE_EVENT(TRACE_SEM_WAKE, (source), 0); } while (0)
+
+#else
+
+// The same points are still traced
+#define ISR_STATS_ENTER(source)  TRACE_EVENT(TRACE_ISR_ENTER, (source), 0)
+#define ISR_STATS_EXIT(source)   TRACE_EVENT(TRACE_ISR_EXIT, (source), 0)
+#define ISR_STATS_SIGNAL(source) TRACE_EVENT(TRACE_SEM_SIGNAL, (source), 0)
+#define ISR_STATS_WOKEN(source)  TRACE_EVENT(TRACE_SEM_WAKE, (source), 0)
+
+#endif
+
+/*! @brief Clears the histograms and registers the CMD_ISRSTATS handler.
+ *
+ *  @return bool - TRUE if the statistics were successfully initialized.
+ *  @note The cycle counter is started by Idle_Init.
+ */
+bool ISRStats_Init(void);
+
+/*! @brief Counts an ISR's duration - use ISR_STATS_EXIT.
+ *
+ *  @param source The ISR.
+ *  @param start The cycle counter when it was entered.
+ */
+void ISRStats_Exit(const TISRStatsSource source, const uint32_t start);
+
+/*! @brief Notes when an ISR signalled its thread - use ISR_STATS_SIGNAL.
+ *
+ *  @param source The ISR.
+ */
+void ISRStats_Signal(const TISRStatsSource source);
+
+/*! @brief Counts the time from the ISR's last signal to its thread running - use ISR_STATS_WOKEN.
+ *
+ *  @param source The ISR.
+ *  @note Only the first wake after each signal is counted.
+ */
+void ISRStats_Woken(const TISRStatsSource source);
+
+#endif
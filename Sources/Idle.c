@@ -0,0 +1,118 @@
+/*!
+**  @file Idle.c
+**
+**  @brief Idle thread and CPU idle-time measurement.
+**         When every other thread is blocked the idle thread puts the CPU to sleep with WFI,
+**         and uses the DWT cycle counter to add up how long it slept for.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Idle */
+
+#include "Idle.h"
+#include "MK70F12.h"
+#include "Cpu.h"
+#include "OS.h"
+#include "Threads.h"
+
+#define THREAD_STACK_SIZE 256
+
+// Debug Exception and Monitor Control Register trace enable - needed for the DWT to run
+#define DEMCR_TRCENA_MASK 0x01000000u
+// DWT cycle counter enable
+#define DWT_CTRL_CYCCNTENA_MASK 0x1u
+
+OS_THREAD_STACK(IdleThreadStack, THREAD_STACK_SIZE);
+
+static uint64_t IdleCycles;  // Cycles spent asleep in the current window
+static uint64_t TotalCycles; // Cycles elapsed in the current window
+static uint32_t LastCycles;  // Cycle counter value when TotalCycles was last brought up to date
+
+
+
+/*! @brief Brings TotalCycles up to date with the cycle counter
+ *
+ *  @note Must be called with interrupts disabled
+ */
+static void UpdateTotal(void)
+{
+  uint32_t now = DWT_CYCCNT;
+
+  TotalCycles += (uint32_t)(now - LastCycles);
+  LastCycles = now;
+}
+
+
+
+/*! @brief Thread that sleeps the CPU until the next interrupt whenever nothing else is ready to run
+ */
+static void IdleThread(void* pData)
+{
+  for (;;)
+  {
+    // Interrupts are disabled around WFI so the time spent in the waking ISR is not counted as idle
+    // A pending interrupt still wakes the CPU, and is taken as soon as they are enabled again
+    OS_DisableInterrupts();
+
+    uint32_t start = DWT_CYCCNT;
+    PE_WFI();
+    IdleCycles += (uint32_t)(DWT_CYCCNT - start);
+    UpdateTotal();
+
+    OS_EnableInterrupts();
+  }
+}
+
+
+
+bool Idle_Init(void)
+{
+  // Start the cycle counter
+  CoreDebug_base_DEMCR_REG(CoreDebug_BASE_PTR) |= DEMCR_TRCENA_MASK;
+  DWT_CYCCNT = 0;
+  DWT_CTRL  |= DWT_CTRL_CYCCNTENA_MASK;
+
+  IdleCycles  = 0;
+  TotalCycles = 0;
+  LastCycles  = DWT_CYCCNT;
+
+  return (THREADS_CREATE(IdleThread,
+          NULL,
+          IdleThreadStack,
+          IDLE_THREAD_PRIORITY) == OS_NO_ERROR);
+}
+
+
+
+uint16_t Idle_GetPercent(const bool reset)
+{
+  uint16_t percent = 0;
+
+  EnterCritical(); // The idle thread updates the counters
+
+  UpdateTotal();
+
+  if (TotalCycles > 0)
+    percent = (uint16_t)((IdleCycles * 10000) / TotalCycles);
+
+  if (reset)
+  {
+    IdleCycles  = 0;
+    TotalCycles = 0;
+  }
+
+  ExitCritical();
+
+  return percent;
+}
+
+
+
+/* END Idle */
+/*!
+** @}
+*/
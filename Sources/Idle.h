@@ -0,0 +1,36 @@
+/*! @file
+ *
+ *  @brief Idle thread and CPU idle-time measurement.
+ *
+ *  This contains the functions for sleeping the CPU when no thread has work to do
+ *  and for measuring how much of the time it spends asleep.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-05-24
+ */
+
+#ifndef IDLE_H
+#define IDLE_H
+
+// new types
+#include "types.h"
+
+// Priority of the idle thread - just above the RTOS's own idle thread
+#define IDLE_THREAD_PRIORITY 30
+
+/*! @brief Creates the idle thread and starts the cycle counter used to measure idle time.
+ *
+ *  @return bool - TRUE if the idle thread was successfully created.
+ *  @note Must be called before OS_Start().
+ */
+bool Idle_Init(void);
+
+/*! @brief Gets the proportion of time the CPU has spent asleep.
+ *
+ *  @param reset TRUE if a new measurement window is to be started after reading.
+ *  @return uint16_t - Idle time since the start of the window, in hundredths of a percent (0-10000).
+ *  @note The window must be read or the CPU must sleep at least once every 2^32 core clock cycles.
+ */
+uint16_t Idle_GetPercent(const bool reset);
+
+#endif
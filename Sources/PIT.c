@@ -15,13 +15,15 @@
 #include "PIT.h"
 #include "MK70F12.h"
 #include "OS.h"
+#include "ISRStats.h"
+#include "Dispatch.h"
 
 // Private global variable for the PIT thread semaphore
-static ECB* PITSemaphore;
+static OS_ECB* PITSemaphore;
 
 
 
-bool PIT_Init(const uint32_t moduleClk, ECB* semaphore)
+bool PIT_Init(const uint32_t moduleClk, OS_ECB* semaphore)
 {
   // saving semaphore for use in the ISR
   PITSemaphore = semaphore;
@@ -90,15 +92,18 @@ void PIT_Enable(const bool enable)
 
 void __attribute__ ((interrupt)) PIT_ISR(void)
 {
+  ISR_STATS_ENTER(ISR_STATS_PIT);
   OS_ISREnter();
 	
   // Clear the interrupt flag
   PIT_TFLG0 |= PIT_TFLG_TIF_MASK;
 
-  // Signal the semaphore, allowing PITThread to run
-  OS_SemaphoreSignal(PITSemaphore);
+  // Post the event, allowing PITHandler to run
+  DISPATCH_POST(DISPATCH_PIT, PITSemaphore);
+  ISR_STATS_SIGNAL(ISR_STATS_PIT);
   
   OS_ISRExit();
+  ISR_STATS_EXIT(ISR_STATS_PIT);
 }
 
 
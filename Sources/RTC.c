@@ -15,19 +15,21 @@
 #include "RTC.h"
 #include "MK70F12.h"
 #include "OS.h"
+#include "ISRStats.h"
+#include "Dispatch.h"
 
 // Private global variable for the RTC thread semaphore
-static ECB* RTCSemaphore;
+static OS_ECB* RTCSemaphore;
 
 
 
-bool RTC_Init(ECB* semaphore)
+bool RTC_Init(OS_ECB* semaphore)
 {
   // saving semaphore into global variable
   RTCSemaphore = semaphore;
 
   // Enabling clock gate for RTC
-  SIM_SCGC5 |= SIM_SCGC6_RTC_MASK;
+  SIM_SCGC6 |= SIM_SCGC6_RTC_MASK;
 
   // Enabling 18pF capacitance load on crystal
   RTC_CR |= RTC_CR_SC16P_MASK;
@@ -37,7 +39,7 @@ bool RTC_Init(ECB* semaphore)
   // time before enabling the time counter to allow the 32.768 kHz clock time to stabilize.
   RTC_CR |= RTC_CR_OSCE_MASK;
 	
-  for (uint32_t i; i < 50000000; i++){;}
+  for (uint32_t i = 0; i < 50000000; i++){;}
   
   // Time Seconds Interrupt Enable (allows interrupts every second using the time seconds register)
   RTC_IER |= RTC_IER_TSIE_MASK;
@@ -86,8 +88,13 @@ void RTC_Set(const uint8_t hours, const uint8_t minutes, const uint8_t seconds)
 void RTC_Get(uint8_t* const hours, uint8_t* const minutes, uint8_t* const seconds)
 {
   // Time Seconds Register needs to be broken down back into hours, minutes and seconds
-  uint32_t secondsTotal = (uint32_t)RTC_TSR;
-	
+  RTC_Split((uint32_t)RTC_TSR, hours, minutes, seconds);
+}
+
+
+
+void RTC_Split(uint32_t secondsTotal, uint8_t* const hours, uint8_t* const minutes, uint8_t* const seconds)
+{
   *hours = (secondsTotal/3600); // Should always round down
   secondsTotal -= (*hours*3600);
   
@@ -101,15 +108,18 @@ void RTC_Get(uint8_t* const hours, uint8_t* const minutes, uint8_t* const second
 
 void __attribute__ ((interrupt)) RTC_ISR(void)
 {
+  ISR_STATS_ENTER(ISR_STATS_RTC);
   OS_ISREnter();
 	
   // Every second an interrupt should happen when the clock increments by 1 second
   // According to the TSIE register bit, there is no corresponding flag to clear
 
-  // Allow RTCThread to run
-  OS_SemaphoreSignal(RTCSemaphore);
+  // Allow RTCHandler to run
+  DISPATCH_POST(DISPATCH_RTC, RTCSemaphore);
+  ISR_STATS_SIGNAL(ISR_STATS_RTC);
   
   OS_ISRExit();
+  ISR_STATS_EXIT(ISR_STATS_RTC);
 }
 
 
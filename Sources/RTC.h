@@ -13,6 +13,7 @@
 
 // new types
 #include "types.h"
+#include "OS.h"
 
 /*! @brief Initializes the RTC before first use.
  *
@@ -21,7 +22,7 @@
  *  @param pointer to a semaphore for signaling in the ISR
  *  @return bool - TRUE if the RTC was successfully initialized.
  */
-bool RTC_Init(ECB* semaphore);
+bool RTC_Init(OS_ECB* semaphore);
 
 /*! @brief Sets the value of the real time clock.
  *
@@ -41,6 +42,16 @@ void RTC_Set(const uint8_t hours, const uint8_t minutes, const uint8_t seconds);
  */
 void RTC_Get(uint8_t* const hours, uint8_t* const minutes, uint8_t* const seconds);
 
+/*! @brief Splits a time in seconds into hours, minutes and seconds, as RTC_Get does with the RTC's count.
+ *
+ *  @param secondsTotal The time in seconds.
+ *  @param hours The address of a variable to store the hours.
+ *  @param minutes The address of a variable to store the minutes.
+ *  @param seconds The address of a variable to store the seconds.
+ *  @note Does not touch the RTC.
+ */
+void RTC_Split(uint32_t secondsTotal, uint8_t* const hours, uint8_t* const minutes, uint8_t* const seconds);
+
 /*! @brief Interrupt service routine for the RTC.
  *
  *  The RTC has incremented one second.
@@ -0,0 +1,211 @@
+/*!
+**  @file Threads.c
+**
+**  @brief Thread creation with stack and CPU time measurement.
+**         Each stack is filled with THREADS_STACK_FILL before its thread is created. Stacks grow down,
+**         so the words still holding the fill at the bottom are the ones never used. On every context
+**         switch the DWT cycles since the previous one are charged to the thread being switched out,
+**         found from its stack pointer - the RTOS's own thread control blocks are not visible.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Threads */
+
+#include "Threads.h"
+#include "packet.h"
+#include "OS.h"
+#include "MK70F12.h"
+#include "Cpu.h"
+
+#include <string.h>
+
+// Bytes of the reply frame before the name
+#define THREADS_FRAME_HEADER 7
+
+typedef struct
+{
+  const char* name;
+  uint32_t* stack;
+  uint16_t nbWords;
+  uint8_t priority;
+  uint64_t cycles;    /*!< Cycles charged to the thread in the current window. */
+} TThreadEntry;
+
+static TThreadEntry Threads[THREADS_MAX];
+static uint8_t NbThreads;
+
+static uint64_t TotalCycles; // Cycles elapsed in the current window
+static uint32_t LastSwitch;  // Cycle counter at the last context switch
+
+
+
+/*! @brief Finds how much of a thread's stack has ever been used
+ *
+ *  @param entry The thread
+ *  @return uint16_t - the deepest the stack has been, in words
+ */
+static uint16_t StackUsed(const TThreadEntry* const entry)
+{
+  uint16_t unused = 0;
+
+  while ((unused < entry->nbWords) && (entry->stack[unused] == THREADS_STACK_FILL))
+    unused++;
+
+  return entry->nbWords - unused;
+}
+
+
+
+/*!
+ * @brief Handles a Threads packet - sends each thread's stack use and share of the CPU
+ *
+ * Parameter1 = 1 (get) or 2 (get and start a new CPU time window), Parameter2 = 0, Parameter3 = 0
+ * Reply: one extended frame per thread - its priority, stack size and the most of it ever used in words,
+ *        its CPU time in hundredths of a percent of the window (all 16-bit LSB first), then its name
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully.
+ */
+static bool HandleThreadsPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  uint64_t cycles[THREADS_MAX];
+  uint64_t total;
+
+  EnterCritical(); // Context switches update the counts
+
+  total = TotalCycles;
+  for (uint8_t i = 0; i < NbThreads; i++)
+  {
+    cycles[i] = Threads[i].cycles;
+    if (Packet_Parameter1(packet) == 0x02)
+      Threads[i].cycles = 0;
+  }
+
+  if (Packet_Parameter1(packet) == 0x02)
+    TotalCycles = 0;
+
+  ExitCritical();
+
+  for (uint8_t i = 0; i < NbThreads; i++)
+  {
+    uint8_t payload[PACKET_FRAME_MAX_PAYLOAD];
+    uint8_t nbName = strlen(Threads[i].name);
+    uint16_t used = StackUsed(&Threads[i]);
+    uint16_t percent = (total > 0) ? (uint16_t)((cycles[i] * 10000) / total) : 0;
+
+    if (nbName > PACKET_FRAME_MAX_PAYLOAD - THREADS_FRAME_HEADER)
+      nbName = PACKET_FRAME_MAX_PAYLOAD - THREADS_FRAME_HEADER;
+
+    payload[0] = Threads[i].priority;
+    payload[1] = (uint8_t)Threads[i].nbWords;
+    payload[2] = (uint8_t)(Threads[i].nbWords >> 8);
+    payload[3] = (uint8_t)used;
+    payload[4] = (uint8_t)(used >> 8);
+    payload[5] = (uint8_t)percent;
+    payload[6] = (uint8_t)(percent >> 8);
+    memcpy(&payload[THREADS_FRAME_HEADER], Threads[i].name, nbName);
+
+    // Wait for room in the transmit ring rather than leave out the remaining threads
+    while (!Packet_PutFrame(CMD_THREADS, payload, THREADS_FRAME_HEADER + nbName))
+      OS_TimeDelay(1);
+  }
+
+  return true;
+}
+
+
+
+bool Threads_Init(void)
+{
+  return Packet_RegisterHandler(CMD_THREADS, HandleThreadsPacket, PACKET_FLAG_NO_ACK);
+}
+
+
+
+OS_ERROR Threads_Create(const char* const name, void (*thread)(void* pd), void* pData,
+                        uint32_t* const stack, const uint16_t nbWords, const uint8_t priority)
+{
+  if (NbThreads == THREADS_MAX)
+    return OS_NO_MORE_TCBS;
+
+  for (uint16_t i = 0; i < nbWords; i++)
+    stack[i] = THREADS_STACK_FILL;
+
+  OS_ERROR error = OS_ThreadCreate(thread, pData, &stack[nbWords - 1], priority);
+
+  if (error == OS_NO_ERROR)
+  {
+    Threads[NbThreads].name     = name;
+    Threads[NbThreads].stack    = stack;
+    Threads[NbThreads].nbWords  = nbWords;
+    Threads[NbThreads].priority = priority;
+    Threads[NbThreads].cycles   = 0;
+    NbThreads++;
+  }
+
+  return error;
+}
+
+
+
+void Threads_Account(const void* const stackPointer)
+{
+  uint32_t now = DWT_CYCCNT;
+  uint32_t cycles = now - LastSwitch;
+
+  LastSwitch = now;
+  TotalCycles += cycles;
+
+  for (uint8_t i = 0; i < NbThreads; i++)
+  {
+    if (((const uint32_t*)stackPointer >= Threads[i].stack) &&
+        ((const uint32_t*)stackPointer < Threads[i].stack + Threads[i].nbWords))
+    {
+      Threads[i].cycles += cycles;
+      return;
+    }
+  }
+}
+
+
+
+#if defined(__linux__)
+
+void Threads_ContextSwitchISR(void)
+{
+  // The host scheduler switches threads itself, and calls Threads_Account as it does
+  OS_ContextSwitchISR();
+}
+
+#else
+
+void __attribute__ ((naked)) Threads_ContextSwitchISR(void)
+{
+  // Pass the interrupted thread's stack pointer - bit 2 of EXC_RETURN is set if it was on the process stack -
+  // then carry on into the RTOS's own handler, which returns from the exception
+  __asm volatile (
+    "tst   lr, #4                \n"
+    "ite   eq                    \n"
+    "mrseq r0, msp               \n"
+    "mrsne r0, psp               \n"
+    "push  {r4, lr}              \n" // r4 keeps the stack 8-byte aligned
+    "bl    Threads_Account       \n"
+    "pop   {r4, lr}              \n"
+    "b     OS_ContextSwitchISR   \n");
+}
+
+#endif
+
+
+
+/* END Threads */
+/*!
+** @}
+*/
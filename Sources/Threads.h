@@ -0,0 +1,67 @@
+/*! @file
+ *
+ *  @brief Thread creation with stack and CPU time measurement.
+ *
+ *  This contains the functions for creating RTOS threads with painted stacks, so the deepest each
+ *  stack has been used can be found later, and for adding up the CPU time each thread gets from the
+ *  context switches. Both are reported over the serial port with CMD_THREADS.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-08
+ */
+
+#ifndef THREADS_H
+#define THREADS_H
+
+// new types
+#include "types.h"
+#include "OS.h"
+
+// Most threads that can be created through this module
+#define THREADS_MAX 16
+
+// Word every stack is filled with before its thread is created
+#define THREADS_STACK_FILL 0xDEADBEEFu
+
+/*! @brief Creates a thread on a stack declared with OS_THREAD_STACK, under its function's name.
+ *
+ *  @param thread The thread's code.
+ *  @param pData The thread's argument.
+ *  @param stack The stack array - the whole array is painted and measured.
+ *  @param priority The thread's priority.
+ */
+#define THREADS_CREATE(thread, pData, stack, priority) \
+  Threads_Create(#thread, (thread), (pData), (stack), sizeof(stack) / sizeof((stack)[0]), (priority))
+
+/*! @brief Registers the CMD_THREADS handler.
+ *
+ *  @return bool - TRUE if the thread measurements were successfully initialized.
+ */
+bool Threads_Init(void);
+
+/*! @brief Paints a stack and creates a thread on it - use THREADS_CREATE.
+ *
+ *  @param name The thread's name, reported with its measurements.
+ *  @param thread The thread's code.
+ *  @param pData The thread's argument.
+ *  @param stack The bottom of the stack.
+ *  @param nbWords The size of the stack in 32-bit words.
+ *  @param priority The thread's priority.
+ *  @return OS_ERROR - as OS_ThreadCreate, or OS_NO_MORE_TCBS if there is no room to measure the thread.
+ */
+OS_ERROR Threads_Create(const char* const name, void (*thread)(void* pd), void* pData,
+                        uint32_t* const stack, const uint16_t nbWords, const uint8_t priority);
+
+/*! @brief Charges the time since the last context switch to the thread being switched out.
+ *
+ *  @param stackPointer Where that thread's stack pointer is - any address within its stack will do.
+ *  @note Called on every context switch - by Threads_ContextSwitchISR on the tower, and by the scheduler
+ *  in the host build. Time spent in ISRs is charged to the thread they interrupted.
+ */
+void Threads_Account(const void* const stackPointer);
+
+/*! @brief PendSV handler in the vector table - charges the thread being switched out, then runs OS_ContextSwitchISR.
+ */
+void Threads_ContextSwitchISR(void);
+
+#endif
@@ -0,0 +1,235 @@
+/*!
+**  @file Trace.c
+**
+**  @brief Binary event trace.
+**         Each event takes the next slot of the ring with an atomic increment, so threads and ISRs can
+**         record events without a critical section, and its type is written last to mark it complete.
+**         The trace thread sends completed events in extended frames and marks their slots empty again.
+**         If the ring is lapped before the events are sent the oldest are lost, and a TRACE_LOST event
+**         says how many.
+*/
+/*!
+**  @addtogroup main_module main module documentation
+**
+**  @author Thanit Tangson
+**  @{
+*/
+/* MODULE Trace */
+
+#include "Trace.h"
+#include "Threads.h"
+#include "packet.h"
+#include "MK70F12.h"
+#include "Cpu.h"
+#include "OS.h"
+
+#define THREAD_STACK_SIZE 256
+
+// Events sent in each extended frame
+#define EVENTS_PER_FRAME (PACKET_FRAME_MAX_PAYLOAD / TRACE_EVENT_NB_BYTES)
+
+// Parameter1 of a CMD_TRACE packet
+#define TRACE_STREAM_OFF 0x00
+#define TRACE_DUMP       0x01
+#define TRACE_STREAM_ON  0x02
+
+typedef struct
+{
+  uint32_t cycles;
+  uint8_t type;       /*!< 0 while the slot is empty or being written. */
+  uint8_t id;
+  uint16_t arg;
+} TTraceEntry;
+
+OS_THREAD_STACK(TraceThreadStack, THREAD_STACK_SIZE);
+
+static TTraceEntry Ring[TRACE_NB_EVENTS];
+static uint32_t Head;  // Free-running index of the next slot to be written
+static uint32_t Tail;  // Free-running index of the next event to be sent - only used by the trace thread
+
+static OS_ECB* TraceSemaphore;  // Signalled when a dump is asked for or streaming is turned on or off
+static volatile bool DumpPending;
+static volatile bool Streaming;
+
+
+
+/*! @brief Puts an event into a frame payload
+ *
+ *  @param payload Where to put it
+ *  @param cycles The cycle counter when it happened
+ *  @param type What happened
+ *  @param id Which one
+ *  @param arg A detail of it
+ */
+static void Pack(uint8_t* const payload, const uint32_t cycles, const uint8_t type, const uint8_t id, const uint16_t arg)
+{
+  for (uint8_t i = 0; i < 4; i++)
+    payload[i] = (uint8_t)(cycles >> (8 * i));
+
+  payload[4] = type;
+  payload[5] = id;
+  payload[6] = (uint8_t)arg;
+  payload[7] = (uint8_t)(arg >> 8);
+}
+
+
+
+/*! @brief Sends an event that did not come from the ring, stamped with the time now
+ *
+ *  @param type What happened
+ *  @param arg A detail of it
+ *  @return bool - TRUE if it was sent
+ */
+static bool SendMarker(const uint8_t type, const uint16_t arg)
+{
+  uint8_t payload[TRACE_EVENT_NB_BYTES];
+
+  Pack(payload, DWT_CYCCNT, type, 0, arg);
+  return Packet_PutFrame(CMD_TRACE, payload, TRACE_EVENT_NB_BYTES);
+}
+
+
+
+/*! @brief Sends completed events from the ring
+ *
+ *  @param end The index to stop at
+ *  @return bool - TRUE if every event up to end was sent, FALSE if the UART was full or an event is still being written
+ */
+static bool Drain(const uint32_t end)
+{
+  uint32_t head = __atomic_load_n(&Head, __ATOMIC_ACQUIRE);
+
+  if (head - Tail > TRACE_NB_EVENTS)
+  {
+    uint32_t lost = head - Tail - TRACE_NB_EVENTS;
+
+    if (!SendMarker(TRACE_LOST, (lost > UINT16_MAX) ? UINT16_MAX : (uint16_t)lost))
+      return false;
+
+    Tail = head - TRACE_NB_EVENTS;
+  }
+
+  while ((int32_t)(end - Tail) > 0)
+  {
+    uint8_t payload[EVENTS_PER_FRAME * TRACE_EVENT_NB_BYTES];
+    uint32_t index = Tail;
+    uint8_t nbEvents = 0;
+
+    while ((nbEvents < EVENTS_PER_FRAME) && (index != end))
+    {
+      TTraceEntry* entry = &Ring[index & (TRACE_NB_EVENTS - 1)];
+      uint8_t type = __atomic_load_n(&entry->type, __ATOMIC_ACQUIRE);
+
+      if (type == 0)
+        break;
+
+      Pack(&payload[nbEvents * TRACE_EVENT_NB_BYTES], entry->cycles, type, entry->id, entry->arg);
+      index++;
+      nbEvents++;
+    }
+
+    if ((nbEvents == 0) || !Packet_PutFrame(CMD_TRACE, payload, nbEvents * TRACE_EVENT_NB_BYTES))
+      return false;
+
+    for (; Tail != index; Tail++)
+      __atomic_store_n(&Ring[Tail & (TRACE_NB_EVENTS - 1)].type, 0, __ATOMIC_RELAXED);
+  }
+
+  return true;
+}
+
+
+
+/*! @brief Thread that sends the events - every tick while streaming, otherwise when a dump is asked for
+ */
+static void TraceThread(void* pData)
+{
+  for (;;)
+  {
+    (void)OS_SemaphoreWait(TraceSemaphore, Streaming ? 1 : 0);
+
+    if (DumpPending)
+    {
+      DumpPending = false;
+
+      // Everything recorded up to now is sent, waiting for the UART to catch up when it is full
+      uint32_t end = __atomic_load_n(&Head, __ATOMIC_ACQUIRE);
+
+      while (!SendMarker(TRACE_CLOCK, CPU_CORE_CLK_HZ / 1000000))
+        OS_TimeDelay(1);
+
+      while (!Drain(end))
+        OS_TimeDelay(1);
+    }
+    else if (Streaming)
+      (void)Drain(__atomic_load_n(&Head, __ATOMIC_ACQUIRE));
+  }
+}
+
+
+
+/*!
+ * @brief Handles a Trace packet - sends the events recorded so far, or turns streaming on or off
+ *
+ * Parameter1 = 1 (dump), 2 (stream from now on) or 0 (stop streaming), Parameter2 = 0, Parameter3 = 0
+ * Reply: extended frames of up to four events - the cycle counter (32-bit), type, id, then arg (16-bit),
+ *        LSB first. Each dump and the start of streaming begin with a TRACE_CLOCK event.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully.
+ */
+static bool HandleTracePacket(const TPacket* const packet)
+{
+  switch (Packet_Parameter1(packet))
+  {
+    case TRACE_STREAM_OFF:
+      Streaming = false;
+      break;
+
+    case TRACE_DUMP:
+      DumpPending = true;
+      break;
+
+    case TRACE_STREAM_ON:
+      DumpPending = true; // Starts with the clock rate and the backlog
+      Streaming = true;
+      break;
+
+    default:
+      return false;
+  }
+
+  return (OS_SemaphoreSignal(TraceSemaphore) == OS_NO_ERROR);
+}
+
+
+
+bool Trace_Init(void)
+{
+  TraceSemaphore = OS_SemaphoreCreate(0);
+
+  return (TraceSemaphore &&
+          (THREADS_CREATE(TraceThread, NULL, TraceThreadStack, TRACE_THREAD_PRIORITY) == OS_NO_ERROR) &&
+          Packet_RegisterHandler(CMD_TRACE, HandleTracePacket, PACKET_FLAG_NONE));
+}
+
+
+
+void Trace_Event(const TTraceType type, const uint8_t id, const uint16_t arg)
+{
+  uint32_t cycles = DWT_CYCCNT;
+  TTraceEntry* entry = &Ring[__atomic_fetch_add(&Head, 1, __ATOMIC_RELAXED) & (TRACE_NB_EVENTS - 1)];
+
+  __atomic_store_n(&entry->type, 0, __ATOMIC_RELAXED); // Not complete until the new type is written
+  entry->cycles = cycles;
+  entry->id     = id;
+  entry->arg    = arg;
+  __atomic_store_n(&entry->type, (uint8_t)type, __ATOMIC_RELEASE);
+}
+
+
+
+/* END Trace */
+/*!
+** @}
+*/
@@ -0,0 +1,74 @@
+/*! @file
+ *
+ *  @brief Binary event trace.
+ *
+ *  This contains the functions for recording timestamped events in a RAM ring and sending them over the
+ *  serial port with CMD_TRACE, either once on demand or continuously from a low priority thread.
+ *  Host/TraceDecode.cpp turns a capture of the serial port into a Chrome trace / Perfetto timeline.
+ *  Building with TRACE 0 compiles every event out.
+ *
+ *  @author Thanit Tangson
+ *  @date 2017-06-09
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// new types
+#include "types.h"
+
+// Set to 0 to compile the events out
+#ifndef TRACE
+#define TRACE 1
+#endif
+
+// Events held in the ring - must be a power of 2. The oldest are overwritten when it is full.
+#define TRACE_NB_EVENTS 512
+
+// Bytes in each event sent - the cycle counter, type, id, then arg, LSB first
+#define TRACE_EVENT_NB_BYTES 8
+
+// Priority of the thread sending the events - just above the idle thread
+#define TRACE_THREAD_PRIORITY 29
+
+/*! @brief Event types - the meaning of id and arg depends on the type.
+ */
+typedef enum
+{
+  TRACE_CLOCK = 1,        /*!< Sent at the start of a dump - arg is the cycle counter rate in MHz. */
+  TRACE_LOST,             /*!< Events were overwritten before they were sent - arg is how many. */
+  TRACE_ISR_ENTER,        /*!< id is the TISRStatsSource. */
+  TRACE_ISR_EXIT,         /*!< id is the TISRStatsSource. */
+  TRACE_SEM_SIGNAL,       /*!< An ISR signalled its thread - id is the TISRStatsSource. */
+  TRACE_SEM_WAKE,         /*!< The thread returned from its wait - id is the TISRStatsSource. */
+  TRACE_PACKET_RX,        /*!< id is the command, arg is the parameters 1 and 2. */
+  TRACE_PACKET_TX,        /*!< id is the command, arg is the number of bytes. */
+  TRACE_I2C_START,        /*!< id is 0 for a write, 1 for a read - arg is the register address. */
+  TRACE_I2C_STOP,         /*!< id is 0 for a write, 1 for a read. */
+  TRACE_FLASH_LAUNCH,     /*!< id is the FTFE command, arg is the low 16 bits of the address. */
+  TRACE_FLASH_COMPLETE    /*!< id is the FTFE command, arg is FSTAT. */
+} TTraceType;
+
+#if TRACE
+#define TRACE_EVENT(type, id, arg) Trace_Event((type), (id), (arg))
+#else
+#define TRACE_EVENT(type, id, arg) ((void)0)
+#endif
+
+/*! @brief Creates the thread that sends the events and registers the CMD_TRACE handler.
+ *
+ *  @return bool - TRUE if the trace was successfully initialized.
+ *  @note The cycle counter is started by Idle_Init.
+ */
+bool Trace_Init(void);
+
+/*! @brief Records an event - use TRACE_EVENT.
+ *
+ *  @param type What happened.
+ *  @param id Which one.
+ *  @param arg A detail of it.
+ *  @note Lock-free, so it may be called from threads and ISRs alike.
+ */
+void Trace_Event(const TTraceType type, const uint8_t id, const uint16_t arg);
+
+#endif
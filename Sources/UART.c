@@ -15,46 +15,77 @@
 
 #include "UART.h"
 #include "FIFO.h"
+#include "DMA.h"
 #include "MK70F12.h"
 #include "Cpu.h"
 #include "OS.h"
-
-#define THREAD_STACK_SIZE 1024
+#include "ISRStats.h"
+#include <string.h>
 
 static TFIFO TxFIFO, RxFIFO; // Transfer & Receiver FIFO declaration
 
-// Stacks for FIFO threads
-OS_THREAD_STACK(FIFOPutThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(FIFOGetThreadStack, THREAD_STACK_SIZE);
+// Most bytes the hardware receive FIFO can hold - RXFIFOSIZE describes up to 128
+#define RX_FIFO_MAX_DEPTH 128
+
+// Private global function the ISR hands received bytes to, or NULL to put them in RxFIFO
+static TUARTRxCallback RxCallback;
+
+static uint8_t RxFIFODepth = 1; // Depth of the UART2 hardware receive FIFO, read from PFIFO
+
+static TUARTStats Stats; // Receive statistics, only written by UART_ISR
+
+#if UART_TX_DMA
+// eDMA channel used to feed UART2_D
+#define TX_DMA_CHANNEL 0
+
+// Number of frame descriptors in the transmit ring - must be a power of two
+// With two largest extended frames in each, the ring holds the 12 frames of an ISR statistics reply
+// or a frame per thread with room to spare
+#define TX_DESCRIPTOR_NB   16
+#define TX_DESCRIPTOR_MASK (TX_DESCRIPTOR_NB - 1)
+
+// Largest number of bytes that can be coalesced into one descriptor (one DMA kick) - two 36-byte frames
+#define TX_DESCRIPTOR_NB_BYTES 72
+
+typedef struct
+{
+  uint8_t nbBytes;				/*!< The number of bytes queued in this descriptor */
+  uint8_t data[TX_DESCRIPTOR_NB_BYTES];	/*!< The bytes to be sent */
+} TTxDescriptor;
 
-// Semaphores for FIFO threads
-static ECB* FIFOPutSemaphore = OS_SemaphoreCreate(0);
-static ECB* FIFOGetSemaphore = OS_SemaphoreCreate(0);
+static TTxDescriptor TxDescriptor[TX_DESCRIPTOR_NB]; // Ring of frame descriptors waiting for the DMA
+static volatile uint8_t TxHead = 0;  // Free-running index of the oldest queued descriptor (the one being sent while TxBusy)
+static volatile uint8_t TxTail = 0;  // Free-running index of the next free descriptor
+static volatile bool TxBusy = false; // TRUE while the DMA is moving the descriptor at TxHead
 
 
 
-/*! @brief Thread to put data into the FIFO
+/*! @brief Kicks the DMA on the oldest queued descriptor, if there is one
+ *
+ *  @note Must be called with interrupts disabled or from the DMA ISR
  */
-static void FIFOPutThread(void* pData)
+static void TxStartNext(void)
 {
-  for (;;)
-  {
-    OS_SemaphoreWait(FIFOPutSemaphore,0);
-    FIFO_Put(&RxFIFO, UART2_D); // Put a character into the receive FIFO
-  }
+  TTxDescriptor* descriptor = &TxDescriptor[TxHead & TX_DESCRIPTOR_MASK];
+
+  TxBusy = (TxHead != TxTail) &&
+           DMA_StartTransfer(TX_DMA_CHANNEL, descriptor->data, 1, &UART2_D, 0, descriptor->nbBytes);
 }
 
 
-/*! @brief Thread to take data out of the FIFO
+
+/*! @brief DMA completion callback - recycles the descriptor that has just been sent
+ *
+ *  @param arguments Unused
  */
-static void FIFOGetThread(void* pData)
+static void TxComplete(void* arguments)
 {
-  for (;;)
-  {
-    OS_SemaphoreWait(FIFOGetSemaphore,0);
-    FIFO_Get(&TxFIFO, (uint8_t *)&UART2_D); // Get a character from the transfer FIFO
-  }
+  TxDescriptor[TxHead & TX_DESCRIPTOR_MASK].nbBytes = 0;
+  TxHead++;
+
+  TxStartNext();
 }
+#endif
 
 
 
@@ -62,23 +93,13 @@ static void FIFOGetThread(void* pData)
  * Initializing the UART
  * send parameters: baudRate = 115200, moduleClk = CPU_BUS_CLK_HZ (20,971,520 Hz)
  */
-bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk, const TUARTRxCallback rxCallback)
 {
   FIFO_Init(&TxFIFO); //Initialization of Transfer FIFO
   FIFO_Init(&RxFIFO); //Initialization of Receiver FIFO
 
-  OS_ERROR error; // error object for RTOS
-
-  // creating FIFO threads
-  error = OS_ThreadCreate(FIFOPutThread,
-          NULL,
-          &FIFOPutThreadStack[THREAD_STACK_SIZE - 1],
-	  2);
-
-  error = OS_ThreadCreate(FIFOGetThread,
-          NULL,
-          &FIFOGetThreadStack[THREAD_STACK_SIZE - 1],
-	  3);
+  // Saving the receive callback for use in the ISR
+  RxCallback = rxCallback;
 
   // UART2 Clock Gate - Enabled to turn on the UART2 module.
   SIM_SCGC4 |= SIM_SCGC4_UART2_MASK;
@@ -120,12 +141,41 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
   // Setting Baud Rate Fine Adjust value
   UART2_C4 |= UART_C4_BRFA(brfa);
 	
+  // Enable the hardware receive FIFO - RXFE may only be changed while the transmitter and receiver are off
+  // RXFIFOSIZE encodes the depth as 1 for 0, otherwise 2^(RXFIFOSIZE + 1)
+  uint8_t rxFIFOSize = (UART2_PFIFO & UART_PFIFO_RXFIFOSIZE_MASK) >> UART_PFIFO_RXFIFOSIZE_SHIFT;
+  RxFIFODepth = (rxFIFOSize == 0) ? 1 : (1 << (rxFIFOSize + 1));
+
+  UART2_PFIFO |= UART_PFIFO_RXFE_MASK;
+  UART2_CFIFO |= UART_CFIFO_RXFLUSH_MASK;
+  UART_SetRxWatermark(UART_RX_WATERMARK_DEFAULT);
+
+  // Idle is only counted after a stop bit, so a long run of 1s in a data byte does not look like an idle line
+  UART2_C1 |= UART_C1_ILT_MASK;
+
   // Setting transfer and receive bits
   UART2_C2 |= UART_C2_TE_MASK;
   UART2_C2 |= UART_C2_RE_MASK;
 
-  // Allowing RDRF flag to generate interrupts
+  // Allowing RDRF (watermark reached), IDLE (flush a partial batch) and OR flags to generate interrupts
   UART2_C2 |= UART_C2_RIE_MASK;
+  UART2_C2 |= UART_C2_ILIE_MASK;
+  UART2_C3 |= UART_C3_ORIE_MASK;
+
+#if UART_TX_DMA
+  // Route TDRE to the DMA rather than the ISR - TIE then enables DMA requests
+  TDMAChannel txChannel;
+  txChannel.channelNb         = TX_DMA_CHANNEL;
+  txChannel.source            = DMA_SOURCE_UART2_TX;
+  txChannel.callback          = TxComplete;
+  txChannel.callbackArguments = NULL;
+
+  if (!DMA_Set(&txChannel))
+    return false;
+
+  UART2_C5 |= UART_C5_TDMAS_MASK;
+  UART2_C2 |= UART_C2_TIE_MASK;
+#endif
 
   // Setting up NVIC for UART2 see K70 manual pg 97
   // Vector=66, IRQ=49
@@ -149,14 +199,114 @@ bool UART_InChar(uint8_t * const dataPtr)
 
 bool UART_OutChar(const uint8_t data)
 {
-  if (FIFO_Put(&TxFIFO, data)) // Attempts to put a character into the transfer FIFO
-  {
-    EnterCritical(); // Nesting-compatible Interrupt Disable
+#if UART_TX_DMA
+  return UART_Write(&data, 1);
+#else
+  bool success;
+
+  // Any thread may transmit, so the critical section keeps the TxFIFO single-producer
+  EnterCritical(); // Nesting-compatible Interrupt Disable
+  success = FIFO_Put(&TxFIFO, data); // Attempts to put a character into the transfer FIFO
+  if (success)
     UART2_C2 |= UART_C2_TIE_MASK; // Sets the TIE flag to indicate there's a character in the TxFIFO
-    ExitCritical(); // Nesting-compatible Interrupt Enable
+  ExitCritical(); // Nesting-compatible Interrupt Enable
+
+  return success; // Returns false if there was a problem putting a char into TxFIFO
+#endif
+}
+
+
+
+bool UART_Write(const uint8_t * const data, const uint16_t nbBytes)
+{
+  bool success;
+
+  // An empty block would be a 0-byte descriptor, which the DMA never completes
+  if (nbBytes == 0)
     return true;
+
+#if UART_TX_DMA
+  if (nbBytes > TX_DESCRIPTOR_NB_BYTES)
+    return false;
+
+  EnterCritical(); // Nesting-compatible Interrupt Disable
+
+  uint8_t nbQueued = TxTail - TxHead;
+  TTxDescriptor* descriptor = &TxDescriptor[(TxTail - 1) & TX_DESCRIPTOR_MASK];
+
+  // Coalesce into the newest descriptor if the DMA has not started on it yet and it has room,
+  // so a burst of packets costs one DMA kick
+  if ((nbQueued > (TxBusy ? 1 : 0)) && ((descriptor->nbBytes + nbBytes) <= TX_DESCRIPTOR_NB_BYTES))
+  {
+    memcpy(&descriptor->data[descriptor->nbBytes], data, nbBytes);
+    descriptor->nbBytes += nbBytes;
+    success = true;
+  }
+  else if (nbQueued < TX_DESCRIPTOR_NB) // Otherwise take a fresh descriptor from the ring
+  {
+    descriptor = &TxDescriptor[TxTail & TX_DESCRIPTOR_MASK];
+    memcpy(descriptor->data, data, nbBytes);
+    descriptor->nbBytes = nbBytes;
+    TxTail++;
+    success = true;
   }
-  return false; // Returns false if there was a problem putting a char into TxFIFO
+  else
+    success = false; // Every descriptor is waiting to be sent
+
+  if (success && !TxBusy)
+    TxStartNext();
+
+  ExitCritical(); // Nesting-compatible Interrupt Enable
+#else
+  // Any thread may transmit, so the critical section keeps the TxFIFO single-producer
+  // and stops blocks from different threads interleaving
+  EnterCritical(); // Nesting-compatible Interrupt Disable
+  success = FIFO_PutBlock(&TxFIFO, data, nbBytes); // Attempts to put the whole block into the transfer FIFO
+  if (success)
+    UART2_C2 |= UART_C2_TIE_MASK; // Sets the TIE flag once for the whole block
+  ExitCritical(); // Nesting-compatible Interrupt Enable
+#endif
+
+  return success; // Returns false if there was not enough room to queue the block
+}
+
+
+
+uint16_t UART_Read(uint8_t * const data, const uint16_t nbBytes)
+{
+  return FIFO_GetBlock(&RxFIFO, data, nbBytes); // Gets as many characters as are available, up to nbBytes
+}
+
+
+
+uint8_t UART_SetRxWatermark(const uint8_t watermark)
+{
+  uint8_t rwfifo = watermark;
+
+  if (rwfifo < 1)
+    rwfifo = 1;
+  else if (rwfifo > RxFIFODepth)
+    rwfifo = RxFIFODepth;
+
+  UART2_RWFIFO = rwfifo;
+
+  return rwfifo;
+}
+
+
+
+void UART_GetStats(TUARTStats* const stats, const bool reset)
+{
+  EnterCritical(); // The ISR updates the statistics
+  *stats = Stats;
+  if (reset)
+  {
+    Stats.rxInterrupts = 0;
+    Stats.rxBytes      = 0;
+    Stats.rxOverruns   = 0;
+    Stats.rxDropped    = 0;
+  }
+  ExitCritical();
 }
 
 
@@ -165,29 +315,81 @@ void UART_Poll(void)
 {
   if (UART2_S1 & UART_S1_RDRF_MASK) // If PC->Tower data is waiting to be read, put a character into the receive FIFO
     FIFO_Put(&RxFIFO, UART2_D);
-  if (UART2_S1 & UART_S1_TDRE_MASK) // If Tower->PC data is waiting to be read, get a character out of the transfer FIFO
-    FIFO_Get(&TxFIFO, (uint8_t *)&UART2_D);
+#if !UART_TX_DMA
+  if (UART2_S1 & UART_S1_TDRE_MASK)
+  {
+    uint8_t txData;
+    if (FIFO_Get(&TxFIFO, &txData)) // If Tower->PC data is waiting to be sent, get a character out of the transfer FIFO
+      UART2_D = txData;
+  }
+#endif
 }
 
 
 
 void __attribute__ ((interrupt)) UART_ISR(void)
 {
+  ISR_STATS_ENTER(ISR_STATS_UART);
   OS_ISREnter();
+
+  uint8_t status = UART2_S1; // Reading S1 is the first half of clearing RDRF, IDLE and OR
 	
-  if (UART2_C2 & UART_C2_RIE_MASK) // If the interrupt was due to receiving a character
+  if (status & (UART_S1_RDRF_MASK | UART_S1_IDLE_MASK | UART_S1_OR_MASK))
   {
-    if (UART2_S1 & UART_S1_RDRF_MASK) // If PC->Tower data is waiting to be read, put a character into the receive FIFO
-      OS_SemaphoreSignal(FIFOPutSemaphore);
+    Stats.rxInterrupts++;
+
+    if (status & UART_S1_OR_MASK) // The hardware FIFO filled up before it was serviced
+      Stats.rxOverruns++;
+
+    // Drain the whole hardware FIFO, not just the watermark - reading D is the second half of clearing the flags
+    uint8_t data[RX_FIFO_MAX_DEPTH];
+    uint8_t nbBytes = UART2_RCFIFO;
+    uint8_t nbReceived = 0;
+
+    if (nbBytes > RX_FIFO_MAX_DEPTH)
+      nbBytes = RX_FIFO_MAX_DEPTH;
+
+    if (nbBytes == 0)
+    {
+      // Idle line or overrun with nothing left to read - a dummy read clears the flag, then flush the underflow it causes
+      (void)UART2_D;
+      UART2_CFIFO |= UART_CFIFO_RXFLUSH_MASK;
+      UART2_SFIFO = UART_SFIFO_RXUF_MASK;
+    }
+
+    while (nbBytes--)
+    {
+      uint8_t byte = UART2_D;
+
+      Stats.rxBytes++;
+
+      if (RxCallback)
+        data[nbReceived++] = byte;
+      else if (!FIFO_Put(&RxFIFO, byte))
+        Stats.rxDropped++;
+    }
+
+    // Hand over the whole batch, whether the watermark or an idle line ended it
+    if (nbReceived > 0)
+      (*RxCallback)(data, nbReceived);
   }
 
+#if !UART_TX_DMA
   if (UART2_C2 & UART_C2_TIE_MASK) // If the interrupt was due to transmitting a character
   {
-    if (UART2_S1 & UART_S1_TDRE_MASK) // If Tower->PC data is waiting to be read, get a character out of the transfer FIFO
-      OS_SemaphoreSignal(FIFOGetSemaphore);
+    if (UART2_S1 & UART_S1_TDRE_MASK) // Refill the transmit data register straight from the transfer FIFO
+    {
+      uint8_t txData;
+      if (FIFO_Get(&TxFIFO, &txData))
+        UART2_D = txData;
+      else
+        UART2_C2 &= ~UART_C2_TIE_MASK; // Nothing left to send, so stop TDRE interrupts until UART_OutChar rearms them
+    }
   }
+#endif
   
   OS_ISRExit();
+  ISR_STATS_EXIT(ISR_STATS_UART);
 }
 
 
@@ -13,15 +13,45 @@
 
 // new types
 #include "types.h"
+#include "OS.h"
+
+// Set to 1 to have the eDMA engine feed the transmitter instead of one TDRE interrupt per byte
+#ifndef UART_TX_DMA
+#define UART_TX_DMA 1
+#endif
+
+// Default receive FIFO watermark - one packet, clamped to the depth of the hardware FIFO
+#define UART_RX_WATERMARK_DEFAULT 5
+
+/*! @brief A function called from UART_ISR with each batch of bytes taken from the receiver.
+ *
+ *  @param data The received bytes, oldest first.
+ *  @param nbBytes The number of bytes in data.
+ *  @note Runs in interrupt context.
+ */
+typedef void (*TUARTRxCallback)(const uint8_t* const data, const uint8_t nbBytes);
+
+/*!
+ * @struct TUARTStats
+ */
+typedef struct
+{
+  uint32_t rxInterrupts;	/*!< Number of times UART_ISR has run to service the receiver */
+  uint32_t rxBytes;		/*!< Number of bytes taken from the receiver */
+  uint32_t rxOverruns;		/*!< Number of receiver overruns (bytes lost in hardware) */
+  uint32_t rxDropped;		/*!< Number of bytes lost because the receive FIFO was full (without a receive callback) */
+} TUARTStats;
 
 
 /*! @brief Sets up the UART interface before first use.
  *
  *  @param baudRate The desired baud rate in bits/sec.
  *  @param moduleClk The module clock rate in Hz.
+ *  @param rxCallback Called from the ISR with each batch of received bytes, or NULL to keep them in the receive FIFO
+ *                    for UART_InChar and UART_Read.
  *  @return bool - TRUE if the UART was successfully initialized.
  */
-bool UART_Init(const uint32_t baudRate, const uint32_t moduleCl);
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk, const TUARTRxCallback rxCallback);
 
 /*! @brief Get a character from the receive FIFO if it is not empty.
  *
@@ -39,6 +69,42 @@ bool UART_InChar(uint8_t* const dataPtr);
  */
 bool UART_OutChar(const uint8_t data);
 
+/*! @brief Put a block of bytes in the transmit FIFO if there is room for all of them.
+ *
+ *  The transmitter is armed once for the whole block.
+ *  @param data A pointer to the bytes to be placed in the transmit FIFO.
+ *  @param nbBytes The number of bytes to send.
+ *  @return bool - TRUE if the whole block was placed in the transmit FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+bool UART_Write(const uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Get up to a block of bytes from the receive FIFO.
+ *
+ *  @param data A pointer to memory to store the retrieved bytes.
+ *  @param nbBytes The maximum number of bytes to retrieve.
+ *  @return uint16_t - The number of bytes retrieved from the receive FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint16_t UART_Read(uint8_t* const data, const uint16_t nbBytes);
+
+/*! @brief Sets how many bytes the hardware receive FIFO collects before raising an interrupt.
+ *
+ *  Partially filled FIFOs are still flushed by the idle-line interrupt once the line goes quiet.
+ *  @param watermark The number of bytes, clamped to between 1 and the depth of the hardware FIFO.
+ *  @return uint8_t - The watermark that was actually set.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint8_t UART_SetRxWatermark(const uint8_t watermark);
+
+/*! @brief Gets a copy of the receive statistics.
+ *
+ *  Interrupts per kilobyte received is (1024 * rxInterrupts) / rxBytes.
+ *  @param stats A pointer to memory to store the statistics.
+ *  @param reset TRUE if the statistics are to be cleared after they are read.
+ */
+void UART_GetStats(TUARTStats* const stats, const bool reset);
+
 /*! @brief Poll the UART status register to try and receive and/or transmit one character.
  *
  *  @return void
@@ -48,6 +114,8 @@ void UART_Poll(void);
 
 /*! @brief Interrupt service routine for the UART.
  *
+ *  Hands received bytes straight to the receive callback, or the receive FIFO without one, and refills the transmitter
+ *  straight from the transmit FIFO.
  *  @note Assumes the transmit and receive FIFOs have been initialized.
  */
 void __attribute__ ((interrupt)) UART_ISR(void);
@@ -23,17 +23,80 @@
 // Median filter
 #include "median.h"
 
+// Packet handling and the PIT which paces polling mode
+#include "packet.h"
+#include "PIT.h"
+
 // K70 module registers
 #include "MK70F12.h"
 
 // CPU and PE_types are needed for critical section variables and the defintion of NULL pointer
-#include "CPU.h"
-#include "PE_types.h"
+#include "Cpu.h"
+#include "PE_Types.h"
 #include "OS.h"
+#include "ISRStats.h"
+#include "Dispatch.h"
+#include <string.h>
 
 // Accelerometer registers
+#define ADDRESS_STATUS 0x00
+
+static union
+{
+  uint8_t byte;			/*!< The STATUS bits accessed as a byte. */
+  struct
+  {
+    uint8_t XDR   : 1;	/*!< X-axis new data available. */
+    uint8_t YDR   : 1;	/*!< Y-axis new data available. */
+    uint8_t ZDR   : 1;	/*!< Z-axis new data available. */
+    uint8_t ZYXDR : 1;	/*!< X, Y or Z-axis new data ready. */
+    uint8_t XOW   : 1;	/*!< X-axis data overwrite. */
+    uint8_t YOW   : 1;	/*!< Y-axis data overwrite. */
+    uint8_t ZOW   : 1;	/*!< Z-axis data overwrite. */
+    uint8_t ZYXOW : 1;	/*!< X, Y or Z-axis data overwrite. */
+  } bits;			/*!< The STATUS bits accessed individually. */
+} STATUS_Union;
+
+#define STATUS     		STATUS_Union.byte
+#define STATUS_ZYXDR		STATUS_Union.bits.ZYXDR
+#define STATUS_ZYXOW		STATUS_Union.bits.ZYXOW
+
+#define ADDRESS_F_STATUS 0x00 // STATUS while the FIFO is on
+
+static union
+{
+  uint8_t byte;			/*!< The F_STATUS bits accessed as a byte. */
+  struct
+  {
+    uint8_t F_CNT       : 6;	/*!< Number of samples in the FIFO. */
+    uint8_t F_WMRK_FLAG : 1;	/*!< FIFO watermark reached. */
+    uint8_t F_OVF       : 1;	/*!< FIFO overflowed. */
+  } bits;			/*!< The F_STATUS bits accessed individually. */
+} F_STATUS_Union;
+
+#define F_STATUS     		F_STATUS_Union.byte
+#define F_STATUS_F_CNT		F_STATUS_Union.bits.F_CNT
+#define F_STATUS_F_WMRK_FLAG	F_STATUS_Union.bits.F_WMRK_FLAG
+#define F_STATUS_F_OVF		F_STATUS_Union.bits.F_OVF
+
 #define ADDRESS_OUT_X_MSB 0x01
 
+#define ADDRESS_F_SETUP 0x09
+
+static union
+{
+  uint8_t byte;			/*!< The F_SETUP bits accessed as a byte. */
+  struct
+  {
+    uint8_t F_WMRK : 6;	/*!< FIFO watermark - the FIFO interrupt fires at this many samples. */
+    uint8_t F_MODE : 2;	/*!< FIFO off, circular, fill or trigger mode. */
+  } bits;			/*!< The F_SETUP bits accessed individually. */
+} F_SETUP_Union;
+
+#define F_SETUP     		F_SETUP_Union.byte
+#define F_SETUP_F_WMRK		F_SETUP_Union.bits.F_WMRK
+#define F_SETUP_F_MODE		F_SETUP_Union.bits.F_MODE
+
 #define ADDRESS_INT_SOURCE 0x0C
 
 static union
@@ -63,18 +126,6 @@ static union
 
 #define ADDRESS_CTRL_REG1 0x2A
 
-typedef enum
-{
-  DATE_RATE_800_HZ,
-  DATE_RATE_400_HZ,
-  DATE_RATE_200_HZ,
-  DATE_RATE_100_HZ,
-  DATE_RATE_50_HZ,
-  DATE_RATE_12_5_HZ,
-  DATE_RATE_6_25_HZ,
-  DATE_RATE_1_56_HZ
-} TOutputDataRate;
-
 typedef enum
 {
   SLEEP_MODE_RATE_50_HZ,
@@ -189,11 +240,267 @@ static union
  * @}
 */
 
+// I2C_Write calls Accel_SetMode and Accel_SetConfig each queue together, at most
+#define MODE_NB_WRITES   5
+#define CONFIG_NB_WRITES 3
+
 
 // Private global variable for the Accel thread semaphore
-ECB* DataReadySemaphore;
+OS_ECB* DataReadySemaphore;
+
+static TAccelMode Mode = ACCEL_POLL; // private global to track whether we are in polling, interrupt or FIFO mode
+static uint8_t FIFOWatermark = ACCEL_FIFO_WATERMARK; // samples in the FIFO that raise its interrupt in FIFO mode
+static uint8_t SampleSize = ACCEL_SAMPLE_BYTES_8BIT; // bytes per sample at the current resolution
+static volatile bool ReadPending; // a data ready interrupt has not been followed by a read yet - interrupt mode only
+
+static TI2CDevice Accelerometer; // the MMA8451Q on I2C0
+
+// Output data rate for each DR setting in hundredths of a Hz - 800 Hz down to 1.56 Hz
+static const uint32_t DataRateCentiHz[8] = {80000, 40000, 20000, 10000, 5000, 1250, 625, 156};
+
+static uint32_t I2CBaudRate;  // Baud rates of the I2C bus and the serial link, for the highest sample rate each can carry
+static uint32_t LinkBaudRate;
+
+// Counters reported by CMD_ACCEL_STATS
+static uint32_t NbStreamed;    // samples passed to Accel_Stream
+static uint32_t NbSensorDrops; // samples the accelerometer replaced before they were read
+static uint32_t NbLinkDrops;   // samples lost because the UART could not take them
+
+// Samples waiting to be sent in the next stream frame
+static uint8_t BatchSize = 1; // Number of samples per frame - 1 sends plain CMD_ACCEL packets
+static bool BatchDelta;       // 8-bit samples are delta encoded
+static uint8_t BatchCount;
+static uint8_t BatchSequence;
+static uint8_t BatchCommand;    // Command of the frame being collected
+static uint8_t BatchLength;     // Bytes of BatchPayload used, or nibbles after the first sample in a delta frame
+static uint32_t BatchStart;     // Tick the frame's first sample was added
+static uint8_t BatchLast[ACCEL_SAMPLE_BYTES_8BIT]; // Last sample added to a delta frame
+static uint8_t BatchPayload[PACKET_FRAME_MAX_PAYLOAD];
+
+
 
-static bool SynchronousMode = false; // private global to track whether we are in polling or interrupt mode
+/*!
+ * @brief Handles a Protocol - Mode packet as per the Tower Serial Communication Protocol document
+ * - either getting or setting the mode of operation for the accelerometer module (polling vs interrupts)
+ *
+ * Parameter1 = 1 for GET, 2 for SET
+ * Parameter2 = 0 for asynchronous (polling)
+ *              1 for synchronous (interrupts)
+ *              2 for FIFO bursts
+ * Parameter3 = the FIFO watermark (1 to ACCEL_FIFO_SIZE - 1) in FIFO mode, or 0 to keep the current one
+ * Reply to GET: Parameter2 = the mode, Parameter3 = the FIFO watermark in FIFO mode, otherwise 0
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleModePacket(const TPacket* const packet)
+{
+  if (Packet_Parameter1(packet) == 0x02) // If the packet is for SET change the mode using Accel_SetMode()
+  {
+    switch (Packet_Parameter2(packet))
+    {
+      case 0:
+        if (!Accel_SetMode(ACCEL_POLL))
+          return false;
+	PIT_Enable(true);
+        return true;
+      case 1:
+        if (!Accel_SetMode(ACCEL_INT))
+          return false;
+        PIT_Enable(false);
+	return true;
+      case 2:
+        if (Packet_Parameter3(packet) >= ACCEL_FIFO_SIZE)
+          return false;
+        if (Packet_Parameter3(packet) != 0)
+          FIFOWatermark = Packet_Parameter3(packet);
+        if (!Accel_SetMode(ACCEL_FIFO))
+          return false;
+        PIT_Enable(false);
+        return true;
+      default:
+	return false;
+    }
+  }
+  
+  else if (Packet_Parameter1(packet) == 0x01) // If the packet is for GET, just return the current mode
+    return (Packet_Put(CMD_MODE, 1, Mode, (Mode == ACCEL_FIFO) ? FIFOWatermark : 0));
+
+  // If the packet is not in either SET or GET mode, return false
+  return false;
+}
+
+
+
+/*!
+ * @brief Handles an Accelerometer Batch packet - either getting or setting the number of samples sent per stream frame
+ *
+ * Parameter1 = 1 for GET, 2 for SET
+ * Parameter2 = number of samples per frame (1 to ACCEL_BATCH_MAX, or ACCEL_BATCH_MAX_DELTA with delta encoding)
+ *              - 1 sends a CMD_ACCEL packet per sample
+ * Parameter3 = 1 to delta encode 8-bit samples in CMD_ACCEL_DELTA frames, otherwise 0
+ * Reply: Parameter1 = 1, Parameter2 = the batch size, Parameter3 = the largest batch size with the current encoding
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleBatchPacket(const TPacket* const packet)
+{
+  if (Packet_Parameter1(packet) == 0x02) // If the packet is for SET change the batch size
+  {
+    if ((Packet_Parameter3(packet) > 1) || (Packet_Parameter2(packet) < 1) ||
+        (Packet_Parameter2(packet) > (Packet_Parameter3(packet) ? ACCEL_BATCH_MAX_DELTA : ACCEL_BATCH_MAX)))
+      return false;
+
+    // The streaming thread sends any partial batch once it reaches the new size, or in the new encoding
+    BatchSize  = Packet_Parameter2(packet);
+    BatchDelta = Packet_Parameter3(packet);
+  }
+  else if (Packet_Parameter1(packet) != 0x01) // If the packet is not in either SET or GET mode, return false
+    return false;
+
+  return Packet_Put(CMD_ACCEL_BATCH, 0x01, BatchSize, BatchDelta ? ACCEL_BATCH_MAX_DELTA : ACCEL_BATCH_MAX);
+}
+
+
+
+/*!
+ * @brief Handles an Accelerometer Configuration packet - either getting or setting the output data rate,
+ * noise mode and resolution
+ *
+ * Parameter1 = 1 for GET, 2 for SET
+ * Parameter2 = the output data rate - 0 (800 Hz) to 7 (1.56 Hz), as DR in CTRL_REG1
+ * Parameter3 = bit 0 set for reduced noise mode, bit 1 set for 14-bit output
+ * Reply: Parameter1 = 1, Parameter2 = the output data rate, Parameter3 = the mode bits
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleConfigPacket(const TPacket* const packet)
+{
+  TAccelConfig config;
+
+  if (Packet_Parameter1(packet) == 0x02) // If the packet is for SET change the configuration
+  {
+    if (Packet_Parameter3(packet) & ~0x03)
+      return false;
+
+    config.dataRate       = (TOutputDataRate)Packet_Parameter2(packet);
+    config.lowNoise       = (Packet_Parameter3(packet) & 0x01);
+    config.fullResolution = (Packet_Parameter3(packet) & 0x02);
+
+    if (!Accel_SetConfig(&config))
+      return false;
+  }
+  else if (Packet_Parameter1(packet) != 0x01) // If the packet is not in either SET or GET mode, return false
+    return false;
+
+  Accel_GetConfig(&config);
+
+  return Packet_Put(CMD_ACCEL_CONFIG, 0x01, config.dataRate, (config.lowNoise ? 0x01 : 0) | (config.fullResolution ? 0x02 : 0));
+}
+
+
+
+/*! @brief Works out the highest sample rates the I2C bus and the serial link can carry in the current mode
+ *
+ *  Only the bytes themselves are counted - nine SCL periods each on the bus, ten bit times each on the link.
+ *  Delta encoded frames are counted as if every delta fits in a nibble.
+ *  @param i2cRate Where to put the bus's rate in hundredths of a Hz
+ *  @param linkRate Where to put the link's rate in hundredths of a Hz
+ */
+static void GetMaxRates(uint32_t* const i2cRate, uint32_t* const linkRate)
+{
+  uint8_t size = SampleSize;
+  uint32_t nbSamples = 1; // Samples per read
+  uint32_t nbBytes;       // Bytes on the bus per read - two address bytes and the register address, then the data
+
+  switch (Mode)
+  {
+    case ACCEL_POLL: // STATUS is read with each sample
+      nbBytes = 3 + 1 + size;
+      break;
+
+    case ACCEL_INT:
+      nbBytes = 3 + size;
+      break;
+
+    default: // F_STATUS, then the burst
+      nbSamples = FIFOWatermark;
+      nbBytes   = (3 + 1) + 3 + (nbSamples * size);
+      break;
+  }
+
+  *i2cRate = (uint32_t)(((uint64_t)I2CBaudRate * 100 * nbSamples) / (9 * nbBytes));
+
+  uint8_t batchSize = BatchSize;
+  uint32_t frameBytes;
+
+  if ((size == ACCEL_SAMPLE_BYTES_14BIT) && (batchSize > ACCEL_BATCH_MAX_14BIT))
+    batchSize = ACCEL_BATCH_MAX_14BIT;
+
+  if ((size == ACCEL_SAMPLE_BYTES_8BIT) && (batchSize == 1))
+    frameBytes = PACKET_NB_BYTES;
+  else if ((size == ACCEL_SAMPLE_BYTES_8BIT) && BatchDelta)
+    frameBytes = PACKET_FRAME_NB_BYTES(3 + size + (((3 * (batchSize - 1)) + 1) / 2));
+  else
+    frameBytes = PACKET_FRAME_NB_BYTES(3 + (batchSize * size));
+
+  *linkRate = (uint32_t)(((uint64_t)LinkBaudRate * 10 * batchSize) / frameBytes);
+}
+
+
+
+/*!
+ * @brief Handles an Accelerometer Statistics packet - reports whether the sample path can keep up
+ *
+ * Parameter1 = 1 for GET, 2 for GET and clear the counters
+ * Parameter2 = 0, Parameter3 = 0
+ * Reply: an extended frame of 32-bit values, LSB first - the output data rate, then the highest sample rates the
+ *        I2C bus and the serial link can carry in the current mode and configuration, all in hundredths of a Hz,
+ *        then the samples streamed, the samples the accelerometer replaced before they were read, and the samples
+ *        lost because the serial link was full, all since the counters were last cleared.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleStatsPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  uint32_t values[6];
+
+  values[0] = DataRateCentiHz[CTRL_REG1_DR];
+  GetMaxRates(&values[1], &values[2]);
+  values[3] = NbStreamed;
+  values[4] = NbSensorDrops;
+  values[5] = NbLinkDrops;
+
+  if (Packet_Parameter1(packet) == 0x02)
+    NbStreamed = NbSensorDrops = NbLinkDrops = 0;
+
+  uint8_t payload[sizeof(values)];
+
+  for (uint8_t i = 0; i < 6; i++)
+    for (uint8_t j = 0; j < 4; j++)
+      payload[(4 * i) + j] = (uint8_t)(values[i] >> (8 * j));
+
+  return Packet_PutFrame(CMD_ACCEL_STATS, payload, sizeof(payload));
+}
+
+
+
+/*! @brief Puts the accelerometer into or out of standby, keeping the rest of CTRL_REG1
+ *
+ *  @param active TRUE to start sampling, FALSE for standby.
+ *  @return bool - TRUE if the write was queued.
+ */
+static bool SetActive(const bool active)
+{
+  CTRL_REG1_ACTIVE = active;
+  return I2C_Write(&Accelerometer, ADDRESS_CTRL_REG1, CTRL_REG1);
+}
 
 
 
@@ -201,41 +508,43 @@ bool Accel_Init(const TAccelSetup* const accelSetup)
 {
   // Accelerometer is connected to PORTB pin 4 via INT1 (see tower schematics)
   SIM_SCGC5 |= SIM_SCGC5_PORTB_MASK;
-  // Accelerometer is connected to PORTE pins 18-19 via SDA and SCL (see tower schematics)
-  SIM_SCGC5 |= SIM_SCGC5_PORTE_MASK;
-  PORTE_PCR18 |= PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK; // ALT4 in the pin MUX -> I2C0_SDA
-  PORTE_PCR19 |= PORT_PCR_MUX(4) | PORT_PCR_ODE_MASK; // ALT4 in the pin MUX -> I2C0_SCL
-
-  // Initialising I2C which controls the accelerometer
-  // Using a TI2CModule struct defined in I2C.h
-  TI2CModule aI2CModule;
-  aI2CModule.primarySlaveAddress   = 0x1D; // address 0011101 (see accelerometer manual pg. 17) - requires pin 7 (SA0) to be high logic level
-  aI2CModule.baudRate              = 100000;
-  aI2CModule.readCompleteSemaphore = accelSetup->readCompleteSemaphore;
-
-  if(!I2C_Init(&aI2CModule, accelSetup->moduleClk))
+  PORTB_PCR4 = PORT_PCR_MUX(1) | PORT_PCR_IRQC(0x0A); // GPIO, interrupt on falling edge - INT1 is active low
+  // Accelerometer is on I2C0, and its samples are the latency-critical traffic on the bus
+  Accelerometer.slaveAddress = 0x1D; // address 0011101 (see accelerometer manual pg. 17) - requires pin 7 (SA0) to be high logic level
+  Accelerometer.baudRate     = 100000;
+  Accelerometer.priority     = I2C_PRIORITY_HIGH;
+
+  I2CBaudRate  = Accelerometer.baudRate;
+  LinkBaudRate = accelSetup->linkBaudRate;
+
+  if (!I2C_AddDevice(&Accelerometer))
     return false;
 	
   //uint8_t blank;
-  //I2C_PollRead(0x0D, &blank, 1);
+  //I2C_Read(0x0D, &blank, 1);
   
   
   // Setting fast-read bit for 8-bit data resolution - set F_READ
   // Set sampling frequency to 1.56Hz - set DR[2:0] to 1:1:1
   // Standby mode during initialisation - clear ACTIVE
-  I2C_Write(ADDRESS_CTRL_REG1, 0x3A); // writing 00111010
+  CTRL_REG1_F_READ = 1;
+  CTRL_REG1_DR     = DATE_RATE_1_56_HZ;
+  bool success = SetActive(false); // writing 00111010
   
   // Allow data ready interrupts - set INT_EN_DRDY - done in main via Accel_SetMode()
-  I2C_Write(ADDRESS_CTRL_REG4, 0x1);
+  success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG4, 0x1) && success;
   // Route Data Ready interrupts through the INT1 pin (tied to PTB4) - set INT_CFG_DRDY
-  I2C_Write(ADDRESS_CTRL_REG5, 0x1);
+  success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG5, 0x1) && success;
 
   // Same as first step but taking accelerometer out of standby
-  I2C_Write(ADDRESS_CTRL_REG1, 0x3B); // writing 00111011
+  success = SetActive(true) && success; // writing 00111011
+
+  if (!success)
+    return false;
 
 
   // Saving semaphore
-  DataReadySemaphore  = accelSetup->dataReadySemaphore
+  DataReadySemaphore  = accelSetup->dataReadySemaphore;
   
   // Setting up NVIC for PORTB see K70 manual pg 97
   // Vector=104, IRQ=88
@@ -245,74 +554,375 @@ bool Accel_Init(const TAccelSetup* const accelSetup)
   // Enable interrupts from PORTB
   NVICISER2 = (1 << 24);
   
-  return true;
+  // Accelerometer owns the protocol mode and batch size commands
+  return (Packet_RegisterHandler(CMD_MODE, HandleModePacket, PACKET_FLAG_NONE) &&
+          Packet_RegisterHandler(CMD_ACCEL_BATCH, HandleBatchPacket, PACKET_FLAG_NONE) &&
+          Packet_RegisterHandler(CMD_ACCEL_CONFIG, HandleConfigPacket, PACKET_FLAG_NONE) &&
+          Packet_RegisterHandler(CMD_ACCEL_STATS, HandleStatsPacket, PACKET_FLAG_NO_ACK));
 }
 
 
 
-void Accel_ReadXYZ(uint8_t data[3])
+void Accel_ReadXYZ(uint8_t data[ACCEL_SAMPLE_BYTES_14BIT])
 {
-  // array of 3 unions and to save data from the 3 most recent Accel_ReadXYZ calls
-  static TAccelData accelData[3] = {{0,0,0},{0,0,0}};
+  uint8_t size = SampleSize;
 
-  // shifts data in the array unions back (index [0] is most recent data, [2] is oldest data)
-  for (uint8_t i = 0; i < 3; i++)
+  // call IntRead or Read based on current mode to populate the newest data array
+  // IntRead fills the caller's array, which I2CHandler filters once the ISR has finished
+  if (Mode != ACCEL_POLL)
   {
-    accelData[2].bytes[i] = accelData[1].bytes[i];
-    accelData[1].bytes[i] = accelData[0].bytes[i];
+    // If the last read has not finished this sample is left to be replaced by the next
+    if (I2C_IntRead(&Accelerometer, ADDRESS_OUT_X_MSB, data, size))
+      ReadPending = false;
   }
-
-  // call Int or PollRead based on current mode to populate the newest data array
-  if (SynchronousMode)
-    I2C_IntRead(ADDRESS_OUT_X_MSB, accelData[0].bytes, 3);
   else
   {
-    I2C_PollRead(ADDRESS_OUT_X_MSB, accelData[0].bytes, 3);
-    // Median filters the last 3 sets of XYZ data - median filtering for IntRead is done in I2CCallback
+    // STATUS is read first in the same burst, to find out whether a sample was overwritten since the last read
+    uint8_t bytes[1 + ACCEL_SAMPLE_BYTES_14BIT];
+
+    if (!I2C_Read(&Accelerometer, ADDRESS_STATUS, bytes, 1 + size))
+      return;
+
+    STATUS = bytes[0];
+    if (STATUS_ZYXOW)
+      NbSensorDrops++;
+
+    memcpy(data, &bytes[1], size);
+
+    // Median filters the last 3 sets of XYZ data - median filtering for IntRead is done in I2CHandler
+    Accel_Filter((TAccelData*)data);
+  }
+}
+
+
+
+void Accel_Filter(TAccelData* const data)
+{
+  // array of 3 unions and to save data from the 3 most recent samples (index [0] is most recent data, [2] is oldest data)
+  static TAccelData accelData[3];
+  static uint8_t historySize = ACCEL_SAMPLE_BYTES_8BIT;
+
+  uint8_t size = SampleSize;
+
+  // Samples from before the resolution changed are not comparable, so the history starts again
+  if (size != historySize)
+  {
+    accelData[1] = accelData[2] = *data;
+    historySize = size;
+  }
+
+  accelData[2] = accelData[1];
+  accelData[1] = accelData[0];
+  accelData[0] = *data;
+
+  if (size == ACCEL_SAMPLE_BYTES_8BIT)
+  {
     for (uint8_t i = 0; i < 3; i++)
-      data[i] = Median_Filter3(accelData[0].bytes[i], accelData[1].bytes[i], accelData[2].bytes[i]);
+      data->bytes[i] = Median_Filter3(accelData[0].bytes[i], accelData[1].bytes[i], accelData[2].bytes[i]);
+    return;
+  }
+
+  // 14-bit data is left justified in 16 bits, MSB first
+  for (uint8_t i = 0; i < ACCEL_SAMPLE_BYTES_14BIT; i += 2)
+  {
+    int16_t n[3];
+
+    for (uint8_t j = 0; j < 3; j++)
+      n[j] = (int16_t)((accelData[j].bytes[i] << 8) | accelData[j].bytes[i + 1]);
+
+    uint16_t median = (uint16_t)Median_Filter3Int16(n[0], n[1], n[2]);
+
+    data->bytes[i]     = (uint8_t)(median >> 8);
+    data->bytes[i + 1] = (uint8_t)median;
   }
 }
 
 
 
-void Accel_SetMode(const TAccelMode mode)
+bool Accel_SetMode(const TAccelMode mode)
 {
-  EnterCritical(); // critical section as PIT could trigger in the middle of changing
+  bool success;
+
+  // The writes below all have to be queued - there is room for them once those ahead have gone
+  if (!I2C_WaitWrites(MODE_NB_WRITES))
+    return false;
+
+  EnterCritical(); // critical section so the writes are queued together, with no read from the PIT in the middle
 	
   // Starting standby mode (while preserving init bits)
-  I2C_Write(ADDRESS_CTRL_REG1, 0x3A); // writing 00111010
+  success = SetActive(false);
+
+  // The FIFO is only on in FIFO mode, keeping the newest samples if it fills - turning it off also empties it
+  F_SETUP_F_MODE = (mode == ACCEL_FIFO) ? 1 : 0;
+  F_SETUP_F_WMRK = (mode == ACCEL_FIFO) ? FIFOWatermark : 0;
+  success = I2C_Write(&Accelerometer, ADDRESS_F_SETUP, F_SETUP) && success;
 
   switch (mode)
   {
     case ACCEL_POLL: // disable data ready interrupts
-      I2C_Write(ADDRESS_CTRL_REG4, 0x0);
-      SynchronousMode = false;
+      success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG4, 0x0) && success;
       break;
 	
-    case ACCEL_INT: // enable data ready interrupts
-      I2C_Write(ADDRESS_CTRL_REG4, 0x1);
-      SynchronousMode = true;
+    case ACCEL_INT: // enable data ready interrupts, routed through INT1
+      success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG4, 0x1) && success;
+      success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG5, 0x1) && success;
+      break;
+
+    case ACCEL_FIFO: // enable FIFO watermark interrupts instead, routed through INT1 - set INT_EN_FIFO and INT_CFG_FIFO
+      success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG4, 0x40) && success;
+      success = I2C_Write(&Accelerometer, ADDRESS_CTRL_REG5, 0x40) && success;
       break;
   }
 
+  Mode = mode;
+  ReadPending = false;
+
   // Ending standby mode
-  I2C_Write(ADDRESS_CTRL_REG1, 0x3B); // writing 00111011
+  success = SetActive(true) && success;
   
   ExitCritical();
+
+  return success;
+}
+
+
+
+/*! @brief Sends the samples collected so far in one stream frame
+ *
+ *  @return bool - TRUE if the frame was sent.
+ */
+static bool SendBatch(void)
+{
+  uint8_t nbBytes = BatchLength;
+
+  // A delta frame's length is counted in nibbles after its first sample, and ends on a whole byte
+  if (BatchCommand == CMD_ACCEL_DELTA)
+    nbBytes = 3 + ACCEL_SAMPLE_BYTES_8BIT + ((BatchLength + 1) / 2);
+
+  bool success = Packet_PutFrame(BatchCommand, BatchPayload, nbBytes);
+
+  if (!success)
+    NbLinkDrops += BatchCount;
+
+  BatchCount = 0;
+  BatchSequence++; // The PC can spot lost frames from gaps in the sequence
+
+  return success;
+}
+
+
+
+/*! @brief Adds a sample to a delta frame as the change from the last one, if each axis fits in a nibble
+ *
+ *  @param sample The sample's X, Y and Z bytes.
+ *  @return bool - TRUE if it was added, FALSE if it moved too far and needs a frame of its own.
+ */
+static bool AddDelta(const uint8_t sample[ACCEL_SAMPLE_BYTES_8BIT])
+{
+  int8_t delta[ACCEL_SAMPLE_BYTES_8BIT];
+
+  for (uint8_t i = 0; i < ACCEL_SAMPLE_BYTES_8BIT; i++)
+  {
+    delta[i] = (int8_t)(sample[i] - BatchLast[i]);
+
+    if ((delta[i] < -8) || (delta[i] > 7))
+      return false;
+  }
+
+  for (uint8_t i = 0; i < ACCEL_SAMPLE_BYTES_8BIT; i++)
+  {
+    uint8_t* byte = &BatchPayload[3 + ACCEL_SAMPLE_BYTES_8BIT + (BatchLength / 2)];
+    uint8_t nibble = (uint8_t)delta[i] & 0x0F;
+
+    // High nibble first
+    if (BatchLength & 1)
+      *byte |= nibble;
+    else
+      *byte = nibble << 4;
+
+    BatchLength++;
+  }
+
+  memcpy(BatchLast, sample, ACCEL_SAMPLE_BYTES_8BIT);
+  return true;
+}
+
+
+
+bool Accel_Stream(const TAccelData* const data)
+{
+  uint8_t size = SampleSize;
+  uint8_t batchSize = BatchSize;
+  bool delta = BatchDelta && (size == ACCEL_SAMPLE_BYTES_8BIT);
+  uint8_t command = delta ? CMD_ACCEL_DELTA : ((size == ACCEL_SAMPLE_BYTES_8BIT) ? CMD_ACCEL_STREAM : CMD_ACCEL_STREAM14);
+  bool success = true;
+
+  if ((size == ACCEL_SAMPLE_BYTES_14BIT) && (batchSize > ACCEL_BATCH_MAX_14BIT))
+    batchSize = ACCEL_BATCH_MAX_14BIT;
+  else if (!delta && (batchSize > ACCEL_BATCH_MAX))
+    batchSize = ACCEL_BATCH_MAX;
+
+  NbStreamed++;
+
+  // A frame started at the other resolution or encoding is sent as it is
+  if ((BatchCount > 0) && (BatchCommand != command))
+    success = SendBatch();
+
+  if ((size == ACCEL_SAMPLE_BYTES_8BIT) && (batchSize == 1) && (BatchCount == 0))
+  {
+    if (!Packet_Put(CMD_ACCEL, data->bytes[0], data->bytes[1], data->bytes[2]))
+    {
+      NbLinkDrops++;
+      return false;
+    }
+
+    return success;
+  }
+
+  if (BatchCount > 0)
+  {
+    if (!delta)
+    {
+      memcpy(&BatchPayload[BatchLength], data->bytes, size);
+      BatchLength += size;
+      BatchCount++;
+    }
+    else if (AddDelta(data->bytes))
+      BatchCount++;
+    else
+      success = SendBatch() && success; // A sample too far from the last one for a delta starts the next frame
+  }
+
+  // The frame is timestamped with its first sample, which a delta frame holds in full
+  if (BatchCount == 0)
+  {
+    uint16union_t time;
+    BatchStart = OS_TimeGet();
+    time.l = (uint16_t)BatchStart;
+
+    BatchPayload[0] = BatchSequence;
+    BatchPayload[1] = time.s.Lo;
+    BatchPayload[2] = time.s.Hi;
+    memcpy(&BatchPayload[3], data->bytes, size);
+    memcpy(BatchLast, data->bytes, ACCEL_SAMPLE_BYTES_8BIT);
+    BatchCommand    = command;
+    BatchLength     = delta ? 0 : (3 + size);
+    BatchCount      = 1;
+  }
+
+  if ((BatchCount < batchSize) && ((uint32_t)(OS_TimeGet() - BatchStart) < ACCEL_BATCH_TIMEOUT_MS))
+    return success;
+
+  return (SendBatch() && success);
+}
+
+
+
+bool Accel_StreamCheck(void)
+{
+  if ((BatchCount == 0) || ((uint32_t)(OS_TimeGet() - BatchStart) < ACCEL_BATCH_TIMEOUT_MS))
+    return true;
+
+  return SendBatch();
+}
+
+
+
+uint8_t Accel_ReadFIFO(uint8_t data[ACCEL_FIFO_SIZE * ACCEL_SAMPLE_BYTES_14BIT])
+{
+  // Reading F_STATUS also clears the watermark interrupt, so INT1 falls again at the next watermark - it is tried
+  // once more if the read failed, as the bus may have just been cleared and INT1 stays asserted until it is read
+  if (!I2C_Read(&Accelerometer, ADDRESS_F_STATUS, &F_STATUS, 1) && !I2C_Read(&Accelerometer, ADDRESS_F_STATUS, &F_STATUS, 1))
+    return 0;
+
+  // An overflow loses at least one sample - the FIFO keeps the newest
+  if (F_STATUS_F_OVF)
+    NbSensorDrops++;
+
+  uint8_t nbSamples = F_STATUS_F_CNT;
+
+  // X, Y and Z of every sample in one burst - in FIFO mode the register address wraps from Z back to X
+  // and the FIFO moves on to the next sample
+  if ((nbSamples == 0) || !I2C_IntRead(&Accelerometer, ADDRESS_OUT_X_MSB, data, nbSamples * SampleSize))
+    return 0;
+
+  return nbSamples;
+}
+
+
+
+bool Accel_SetConfig(const TAccelConfig* const config)
+{
+  if (config->dataRate > DATE_RATE_1_56_HZ)
+    return false;
+
+  if (!I2C_WaitWrites(CONFIG_NB_WRITES))
+    return false;
+
+  EnterCritical(); // critical section so the writes are queued together, with no read from a handler in the middle
+
+  // CTRL_REG1 can only be changed in standby
+  bool success = SetActive(false);
+
+  CTRL_REG1_DR     = config->dataRate;
+  CTRL_REG1_LNOISE = config->lowNoise;
+  CTRL_REG1_F_READ = !config->fullResolution; // fast read skips the LSB registers
+  success = SetActive(false) && success;
+
+  SampleSize = config->fullResolution ? ACCEL_SAMPLE_BYTES_14BIT : ACCEL_SAMPLE_BYTES_8BIT;
+
+  success = SetActive(true) && success;
+
+  ExitCritical();
+
+  return success;
+}
+
+
+
+void Accel_GetConfig(TAccelConfig* const config)
+{
+  config->dataRate       = (TOutputDataRate)CTRL_REG1_DR;
+  config->lowNoise       = CTRL_REG1_LNOISE;
+  config->fullResolution = !CTRL_REG1_F_READ;
+}
+
+
+
+uint8_t Accel_SampleSize(void)
+{
+  return SampleSize;
+}
+
+
+
+TAccelMode Accel_GetMode(void)
+{
+  return Mode;
 }
 
 
 
 void __attribute__ ((interrupt)) AccelDataReady_ISR(void)
 {
+  ISR_STATS_ENTER(ISR_STATS_ACCEL);
   OS_ISREnter();
 	
   // clear interrupt flag for INT1 (PTB4)
-  PORTB_PCR4 &= ~PORT_PCR_ISF_MASK;
+  PORTB_PCR4 |= PORT_PCR_ISF_MASK; // w1c
+
+  // In interrupt mode a new sample replaces any that has not started being read
+  if (Mode == ACCEL_INT)
+  {
+    if (ReadPending)
+      NbSensorDrops++;
+    ReadPending = true;
+  }
 
-  // Allow AccelThread to run
-  OS_SemaphoreSignal(DataReadySemaphore);
+  // Allow AccelHandler to run
+  DISPATCH_POST(DISPATCH_ACCEL, DataReadySemaphore);
+  ISR_STATS_SIGNAL(ISR_STATS_ACCEL);
   
   OS_ISRExit();
+  ISR_STATS_EXIT(ISR_STATS_ACCEL);
 }
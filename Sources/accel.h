@@ -18,29 +18,69 @@
 // New types
 #include "types.h"
 #include "OS.h"
+#include "packet.h"
 
 typedef enum
 {
   ACCEL_POLL,
-  ACCEL_INT
+  ACCEL_INT,
+  ACCEL_FIFO
 } TAccelMode;
 
+// Samples the MMA8451Q's FIFO holds
+#define ACCEL_FIFO_SIZE 32
+
+// Default FIFO watermark - half full leaves as long again for the burst read to start before samples are lost
+#define ACCEL_FIFO_WATERMARK 16
+
+// Bytes in a sample - the MSB of each axis with 8-bit output, or the MSB then LSB of each with 14-bit output
+#define ACCEL_SAMPLE_BYTES_8BIT  3
+#define ACCEL_SAMPLE_BYTES_14BIT 6
+
+// Largest number of samples in one stream frame - the sequence number and timestamp take 3 bytes of the payload
+#define ACCEL_BATCH_MAX ((PACKET_FRAME_MAX_PAYLOAD - 3) / ACCEL_SAMPLE_BYTES_8BIT)
+#define ACCEL_BATCH_MAX_14BIT ((PACKET_FRAME_MAX_PAYLOAD - 3) / ACCEL_SAMPLE_BYTES_14BIT)
+
+// Largest number of 8-bit samples in one delta encoded frame - the first sample in full, then 4-bit deltas
+#define ACCEL_BATCH_MAX_DELTA (1 + (((PACKET_FRAME_MAX_PAYLOAD - 3 - ACCEL_SAMPLE_BYTES_8BIT) * 2) / 3))
+
+// Longest a partial stream frame waits for more samples, in OS ticks (ms)
+#define ACCEL_BATCH_TIMEOUT_MS 50
+
+typedef enum
+{
+  DATE_RATE_800_HZ,
+  DATE_RATE_400_HZ,
+  DATE_RATE_200_HZ,
+  DATE_RATE_100_HZ,
+  DATE_RATE_50_HZ,
+  DATE_RATE_12_5_HZ,
+  DATE_RATE_6_25_HZ,
+  DATE_RATE_1_56_HZ
+} TOutputDataRate;
+
 typedef struct
 {
-  uint32_t moduleClk;	/*!< The module clock rate in Hz. */
-  ECB* dataReadySemaphore;
-  ECB* readCompleteSemaphore;
+  uint32_t linkBaudRate;	/*!< The baud rate of the serial link to the PC, for the highest rate it can stream. */
+  OS_ECB* dataReadySemaphore;
 } TAccelSetup;
 
+typedef struct
+{
+  TOutputDataRate dataRate;	/*!< The output data rate. */
+  bool lowNoise;		/*!< Reduced noise mode - limits the range to +/-4g. */
+  bool fullResolution;		/*!< 14-bit output rather than the 8-bit fast read. */
+} TAccelConfig;
+
 #pragma pack(push)
 #pragma pack(1)
 
 typedef union
 {
-  uint8_t bytes[3];	/*!< The accelerometer data accessed as an array. */
+  uint8_t bytes[ACCEL_SAMPLE_BYTES_14BIT];	/*!< The accelerometer data accessed as an array - Accel_SampleSize() bytes are used. */
   struct
   {
-    uint8_t x, y, z;	/*!< The accelerometer data accessed as individual axes. */
+    uint8_t x, y, z;	/*!< The accelerometer data accessed as individual axes, with 8-bit output. */
   } axes;
 } TAccelData;
 
@@ -49,20 +89,87 @@ typedef union
 
 /*! @brief Initializes the accelerometer by calling the initialization routines of the supporting software modules.
  *
+ *  The accelerometer starts at 1.56 Hz with 8-bit output.
+ *  Also registers the handlers for the protocol mode, accelerometer batch size, configuration and statistics commands.
  *  @param accelSetup is a pointer to an accelerometer setup structure.
  *  @return bool - TRUE if the accelerometer module was successfully initialized.
+ *  @note Assumes the I2C module has been initialized, as the accelerometer is added to its bus.
  */
 bool Accel_Init(const TAccelSetup* const accelSetup);
 
 /*! @brief Reads X, Y and Z accelerations.
- *  @param data is a an array of 3 bytes where the X, Y and Z data are stored.
+ *  @param data is a an array of Accel_SampleSize() bytes where the X, Y and Z data are stored.
  */
-void Accel_ReadXYZ(uint8_t data[3]);
+void Accel_ReadXYZ(uint8_t data[ACCEL_SAMPLE_BYTES_14BIT]);
 
 /*! @brief Set the mode of the accelerometer.
- *  @param mode specifies either polled or interrupt driven operation.
+ *  @param mode specifies either polled, interrupt driven or FIFO burst operation.
+ *  @return bool - TRUE if the register writes for the mode were all queued.
+ *  @note Must be called from a thread, as it waits for room to queue the writes.
+ */
+bool Accel_SetMode(const TAccelMode mode);
+
+/*! @brief Starts reading every sample in the FIFO with one burst read.
+ *
+ *  The samples are read by the I2C interrupt, which signals the read complete semaphore when they are all in.
+ *  @param data is where the samples are stored, Accel_SampleSize() bytes each.
+ *  @return uint8_t - the number of samples being read - 0 if the FIFO was empty, and nothing is read.
+ *  @note Only used in FIFO mode, when the accelerometer interrupt says the watermark has been reached.
+ */
+uint8_t Accel_ReadFIFO(uint8_t data[ACCEL_FIFO_SIZE * ACCEL_SAMPLE_BYTES_14BIT]);
+
+/*! @brief Median filters a sample with the two before it.
+ *  @param data is the latest sample, which is replaced by the filtered one.
+ *  @note Polling mode reads are already filtered by Accel_ReadXYZ.
+ */
+void Accel_Filter(TAccelData* const data);
+
+/*! @brief Sets the output data rate, noise mode and resolution.
+ *  @param config is the configuration.
+ *  @return bool - TRUE if the configuration is valid and its register writes were all queued.
+ *  @note Must be called from a thread, as it waits for room to queue the writes.
+ */
+bool Accel_SetConfig(const TAccelConfig* const config);
+
+/*! @brief Gets the output data rate, noise mode and resolution.
+ *  @param config is where the configuration is stored.
+ */
+void Accel_GetConfig(TAccelConfig* const config);
+
+/*! @brief Gets the size of a sample at the current resolution.
+ *  @return uint8_t - ACCEL_SAMPLE_BYTES_8BIT or ACCEL_SAMPLE_BYTES_14BIT.
+ */
+uint8_t Accel_SampleSize(void);
+
+/*! @brief Gets the current mode of the accelerometer.
+ *  @return TAccelMode - either polled, interrupt driven or FIFO burst operation.
+ */
+TAccelMode Accel_GetMode(void);
+
+/*! @brief Sends a sample to the PC.
+ *
+ *  With 8-bit output and a batch size of 1 each sample is sent in its own CMD_ACCEL packet.
+ *  Otherwise samples are collected and sent together in a CMD_ACCEL_STREAM frame whose payload is
+ *  a sequence number, the OS time of the first sample (LSB first) and then the X, Y and Z bytes of each sample.
+ *  With delta encoding, 8-bit samples are sent in CMD_ACCEL_DELTA frames instead: the sequence number and time,
+ *  the first sample in full, then the change in X, Y and Z from each sample to the next as signed 4-bit values,
+ *  high nibble first. A sample that moves further than a nibble can hold starts a new frame.
+ *  14-bit samples are sent the same way in CMD_ACCEL_STREAM14 frames of up to ACCEL_BATCH_MAX_14BIT samples,
+ *  with each axis left justified in 16 bits, MSB first.
+ *  A frame is sent once it is full, or once its first sample is ACCEL_BATCH_TIMEOUT_MS old.
+ *  @param data is the sample to send.
+ *  @return bool - TRUE if the sample was sent or stored for the next frame.
+ *  @note Must only be called from one thread at a time.
+ */
+bool Accel_Stream(const TAccelData* const data);
+
+/*! @brief Sends the samples waiting in a partial stream frame if the first of them is ACCEL_BATCH_TIMEOUT_MS old.
+ *
+ *  Called as each sample is read, so a frame is not held back while samples that did not change go unsent.
+ *  @return bool - TRUE unless a frame could not be sent.
+ *  @note Must only be called from the thread that calls Accel_Stream.
  */
-void Accel_SetMode(const TAccelMode mode);
+bool Accel_StreamCheck(void);
 
 /*! @brief Interrupt service routine for the accelerometer.
  *
@@ -36,6 +36,7 @@
 #include "Cpu.h"
 #include "packet.h"
 #include "UART.h"
+#include "DMA.h"
 #include "Flash.h"
 #include "LEDs.h"
 #include "RTC.h"
@@ -43,53 +44,46 @@
 #include "FTM.h"
 #include "accel.h"
 #include "I2C.h"
+#include "I2CLoad.h"
 #include "median.h"
+#include "Idle.h"
+#include "Bench.h"
+#include "ISRStats.h"
+#include "Threads.h"
+#include "Trace.h"
+#include "Dispatch.h"
 #include "OS.h"
 #include "PE_Types.h"
 #include "PE_Error.h"
 #include "PE_Const.h"
 #include "IO_Map.h"
+#include <string.h>
 
 
-// Tower Protocols based on the command byte of each packet
-#define CMD_STARTUP   0x04
-#define CMD_VERSION   0x09
-#define CMD_NUMBER    0x0B
-#define CMD_TOWERMODE 0x0D
-#define CMD_PROGBYTE  0x07
-#define CMD_READBYTE  0x08
-#define CMD_SETTIME   0x0C
-#define CMD_MODE      0x0A
-#define CMD_ACCEL     0x10
-
 #define THREAD_STACK_SIZE 1024
 
 
 volatile uint16union_t *towerNumber = NULL; // Currently set tower number and mode
 volatile uint16union_t *towerMode   = NULL;
 
-static TAccelData accelDataOld; // oldest XYZ accelerometer data - only used in asynchronous polling mode
-static TAccelData accelDataNew; // latest XYZ accelerometer data
+static TAccelData accelDataOld;                         // oldest XYZ accelerometer data - only used in asynchronous polling mode
+static TAccelData accelDataNew;                         // latest XYZ accelerometer data
+static uint8_t accelDataSize = ACCEL_SAMPLE_BYTES_8BIT; // bytes of accelDataNew used - the sample size when it was read
+
+static uint8_t FIFOData[ACCEL_FIFO_SIZE * ACCEL_SAMPLE_BYTES_14BIT]; // samples from the FIFO burst being read - only used in FIFO mode
+static uint8_t FIFOCount;                       // number of samples in the burst being read, 0 if none
+static uint8_t FIFOSampleSize;                  // bytes per sample in the burst being read, as it was started
+static bool FIFOAgain;                          // the watermark was reached again before the burst was handled
 
-static bool synchronousMode = false; // variable to track current I2C mode (synchronous by default)
 
 // RTOS Threads stacks - macro declares a variable with name of the first argument
 OS_THREAD_STACK(InitThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(RTCThreadStack, THREAD_STACK_SIZE);
 OS_THREAD_STACK(PacketThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(FTM0ThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(PITThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(AccelThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(I2CThreadStack, THREAD_STACK_SIZE);
 
 
-// RTOS Semaphores - all initialised as 0 (ie. threads can't run before being signaled)
-OS_ECB* RTCSemaphore    = OS_SemaphoreCreate(0);
-OS_ECB* PacketSemaphore = OS_SemaphoreCreate(0);
-OS_ECB* FTM0Semaphore   = OS_SemaphoreCreate(0);
-OS_ECB* PITSemaphore    = OS_SemaphoreCreate(0);
-OS_ECB* AccelSemaphore  = OS_SemaphoreCreate(0);
-OS_ECB* I2CSemaphore    = OS_SemaphoreCreate(0);
+// RTOS Semaphore - initialised as 0 (ie. the packet thread can't run before being signaled)
+// Created in main() once the RTOS has been initialised - the peripheral ISRs post events to the dispatcher instead
+static OS_ECB* PacketSemaphore;
 
 
 // Function Initializations
@@ -101,9 +95,10 @@ OS_ECB* I2CSemaphore    = OS_SemaphoreCreate(0);
  *
  * Parameter1 = 0, Parameter2 = 0, Parameter3 = 0
  *
+ * @param packet The received packet.
  * @return bool - TRUE if all of the packets were handled successfully.
  */
-bool HandleStartupPacket(void)
+bool HandleStartupPacket(const TPacket* const packet)
 {
   bool success;
 
@@ -139,7 +134,7 @@ bool HandleStartupPacket(void)
 	  (Packet_Put(CMD_VERSION, 'v', 0x01, 0x00)) &&
 	  (Packet_Put(CMD_NUMBER, 0x01, towerNumber->s.Lo, towerNumber->s.Hi)) &&
 	  (Packet_Put(CMD_TOWERMODE, 0x01, towerMode->s.Lo, towerMode->s.Hi)) &&
-	  (Packet_Put(CMD_MODE, 0x01, synchronousMode, 0x00)));
+	  (Packet_Put(CMD_MODE, 0x01, Accel_GetMode(), 0x00)));
 }
 
 
@@ -148,9 +143,10 @@ bool HandleStartupPacket(void)
  * @brief Handles the tower version packet in accordance with the Tower Serial Communication Protocol document
  *
  * Parameter1 = 'v', Parameter2 = 1, Parameter3 = 0 (V1.0)
+ * @param packet The received packet.
  * @return bool - TRUE if the packet was handled successfully.
  */
-bool HandleVersionPacket(void)
+bool HandleVersionPacket(const TPacket* const packet)
 {
   return Packet_Put(CMD_VERSION, 'v', 0x01, 0x00);
 }
@@ -163,17 +159,18 @@ bool HandleVersionPacket(void)
  * Parameter1 = 0x01, Parameter2 = LSB, Parameter3 = MSB
  * If Parameter1 is 0x02, you are able to set LSB and MSB by passing these in through Parameter2 and Parameter3
  *
+ * @param packet The received packet.
  * @return bool - TRUE if the packet was handled successfully.
  */
-bool HandleNumberPacket(void)
+bool HandleNumberPacket(const TPacket* const packet)
 {
-  if (Packet_Parameter1 == 0x02) // If the packet is in SET mode, set the tower number by storing it in flash before returning the packet
+  if (Packet_Parameter1(packet) == 0x02) // If the packet is in SET mode, set the tower number by storing it in flash before returning the packet
   {
-    bool success = Flash_Write16((uint16_t*)towerNumber, Packet_Parameter23);
+    bool success = Flash_Write16((uint16_t*)towerNumber, Packet_Parameter23(packet));
 
     return Packet_Put(CMD_NUMBER, 0x01, towerNumber->s.Lo, towerNumber->s.Hi) && success;
   }
-  else if (Packet_Parameter1 == 0x01) // If the packet is in GET mode, just return the current tower number
+  else if (Packet_Parameter1(packet) == 0x01) // If the packet is in GET mode, just return the current tower number
   {
     return Packet_Put(CMD_NUMBER, 0x01, towerNumber->s.Lo, towerNumber->s.Hi);
   }
@@ -190,16 +187,17 @@ bool HandleNumberPacket(void)
  * Parameter1 = 0x01, Parameter2 = LSB, Parameter3 = MSB
  * If Parameter1 is 0x02, you are able to set LSB and MSB by passing these in through Parameter2 and Parameter3
  *
+ * @param packet The received packet.
  * @return bool - TRUE if the packet was handled successfully.
  */
-bool HandleTowerModePacket(void)
+bool HandleTowerModePacket(const TPacket* const packet)
 {
-  if (Packet_Parameter1 == 0x02) // If the packet is in SET mode, set the tower mode by storing it in flash before returning the packet
+  if (Packet_Parameter1(packet) == 0x02) // If the packet is in SET mode, set the tower mode by storing it in flash before returning the packet
   {
-    bool success = Flash_Write16((uint16_t*)towerMode, Packet_Parameter23);
+    bool success = Flash_Write16((uint16_t*)towerMode, Packet_Parameter23(packet));
     return Packet_Put(CMD_TOWERMODE, 0x01, towerMode->s.Lo, towerMode->s.Hi) && success;
   }
-  else if (Packet_Parameter1 == 0x01) // If the packet is in GET mode, just return the current tower mode
+  else if (Packet_Parameter1(packet) == 0x01) // If the packet is in GET mode, just return the current tower mode
     return Packet_Put(CMD_TOWERMODE, 0x01, towerMode->s.Lo, towerMode->s.Hi);
 
   // If the packet is not in either SET or GET mode, return false
@@ -208,66 +206,24 @@ bool HandleTowerModePacket(void)
 
 
 
-/*!
- * @brief Handles a Flash Program Byte packet as per the Tower Serial Communication Protocol document
- * by writing the data in parameter3 to the address given in parameter1
- *
- * Parameter1 = address offset (0-7), Parameter2 = 0, Parameter3 = data
- *
- * @return bool - TRUE if the packet was handled successfully.
- */
-bool HandleProgBytePacket(void)
-{
-  // Return false if the address is out of range
-  if ((Packet_Parameter1 < 0) || (Packet_Parameter1 > 8))
-    return false;
-	  
-  if (Packet_Parameter1 == 0x08) // 0x08 erases the flash
-    return Flash_Erase();
-	  
-  // Writes the data in parameter3 to the given address starting at FLASH_DATA_START and offsetted according to Parameter1
-  return Flash_Write8((uint8_t *)(FLASH_DATA_START + Packet_Parameter1), Packet_Parameter3);
-}
-
-
-
-/*!
- * @brief Handles a Flash Read Byte packet as per the Tower Serial Communication Protocol document
- * by putting in a packet with the address of the flash byte read and the data contained in that address.
- *
- * Parameter1 = address offset (0-7), Parameter2 = 0, Parameter3 = 0
- *
- * @return bool - TRUE if the packet was handled successfully.
- */
-bool HandleReadBytePacket(void)
-{
-  // Return false if the address is out of range
-  if ((Packet_Parameter1 < 0) || (Packet_Parameter1 > 7))
-    return false;
-
-  // Data is accessed using a Flash.h macro by starting at address FLASH_DATA_START and offsetting according to Parameter1
-  return (Packet_Put(CMD_READBYTE, Packet_Parameter1, 0x00, _FB(FLASH_DATA_START + Packet_Parameter1)));
-}
-
-  
-  
 /*!
  * @brief Handles a Set Time packet as per the Tower Serial Communication Protocol document
  * by setting sending the parameters of the packet to the RTC module to be set.
  *
  * Parameter1 = hours(0-23), Parameter2 = minutes(0-59), Parameter3 = seconds (0-59)
  *
+ * @param packet The received packet.
  * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
  */
-bool HandleSetTimePacket(void)
+bool HandleSetTimePacket(const TPacket* const packet)
 {
   // Return false if any time values are out of range
-  if ((Packet_Parameter1 < 0) || (Packet_Parameter1 > 23) ||
-      (Packet_Parameter2 < 0) || (Packet_Parameter2 > 59) ||
-      (Packet_Parameter3 < 0) || (Packet_Parameter3 > 59))
+  if ((Packet_Parameter1(packet) < 0) || (Packet_Parameter1(packet) > 23) ||
+      (Packet_Parameter2(packet) < 0) || (Packet_Parameter2(packet) > 59) ||
+      (Packet_Parameter3(packet) < 0) || (Packet_Parameter3(packet) > 59))
     return false;
     
-  RTC_Set(Packet_Parameter1, Packet_Parameter2, Packet_Parameter3);
+  RTC_Set(Packet_Parameter1(packet), Packet_Parameter2(packet), Packet_Parameter3(packet));
   
   uint8_t seconds, minutes, hours;
   RTC_Get(&seconds, &minutes, &hours);
@@ -278,111 +234,26 @@ bool HandleSetTimePacket(void)
 
 
 /*!
- * @brief Handles a Protocol - Mode packet as per the Tower Serial Communication Protocol document
- * - either getting or setting the mode of operation for the accelerometer module (polling vs interrupts)
+ * @brief Handles an Idle Time packet - reports the proportion of time the CPU has spent asleep
+ * since the measurement window was last reset
  *
- * Parameter1 = 1 for GET, 2 for SET
- * Parameter2 = 0 for asynchronous (polling)
- *              1 for synchronous (interrupts)
- * Parameter3 = 0
+ * Parameter1 = 1 for GET, 2 for GET and start a new window
+ * Parameter2 = 0, Parameter3 = 0
+ * Reply: Parameter1 = 1, Parameter2 = LSB, Parameter3 = MSB of the idle time in hundredths of a percent
  *
+ * @param packet The received packet.
  * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
  */
-bool HandleModePacket(void)
+bool HandleIdlePacket(const TPacket* const packet)
 {
-  if (Packet_Parameter1 == 0x02) // If the packet is for SET change the mode using Accel_SetMode()
-  {
-    switch (Packet_Parameter2)
-    {
-      case 0:
-        synchronousMode = false;
-        Accel_SetMode(ACCEL_POLL);
-	PIT_Enable(true);
-        return true;
-      case 1:
-        synchronousMode = true;
-        Accel_SetMode(ACCEL_INT);
-        PIT_Enable(false);
-	return true;
-      default:
-	return false;
-    }
-  }
-  
-  else if (Packet_Parameter1 == 0x01) // If the packet is for GET, just return the current mode
-    return (Packet_Put(CMD_MODE, 1, synchronousMode, 0));
-
-  // If the packet is not in either SET or GET mode, return false
-  return false;
-}
-
-
-  
-/*!
- * @brief Handles the packet by first checking to see what type of packet it is and processing it
- * as per the Tower Serial Communication Protocol document.
- */
-void HandlePacket(void)
-{
-  bool success = false; // Holds the success or failure of the packet handlers
-  bool ackReq  = false; // Holds whether an Acknowledgment is required
-
-  if (Packet_Command & PACKET_ACK_MASK) // Check if ACK bit is set
-  {
-    ackReq = true;
-    Packet_Command &= 0x7F; //Strips the top bit of the Command Byte to ignore ACK bit
-  }
-
-  switch (Packet_Command)
-  {
-    case CMD_STARTUP:
-      success = HandleStartupPacket();
-      break;
-    case CMD_VERSION:
-      success = HandleVersionPacket();
-      break;
-    case CMD_NUMBER:
-      success = HandleNumberPacket();
-      break;
-    case CMD_TOWERMODE:
-      success = HandleTowerModePacket();
-      break;
-    case CMD_PROGBYTE:
-      success = HandleProgBytePacket();
-      break;
-    case CMD_READBYTE:
-      success = HandleReadBytePacket();
-      break;
-    case CMD_SETTIME:
-      success = HandleSetTimePacket();
-      break;
-    case CMD_MODE:
-      success = HandleModePacket();
-      break;
-    default:
-      success = false;
-      break;
-  }
-
-  /*!
-   * Check if the handling of the packet was a success and an ACK packet was requested
-   * If that checks out, set the ACK bit to 1
-   * Else, if the handling of the packet failed and an ACK packet was requested
-   * Clear the ACK bit in order to indicate a NAK (command could not be carried out)
-   * Finally, return the ACK packet to the Tower
-   */
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
 
-  if (ackReq)
-  {
-    if (success)
-      Packet_Command |= PACKET_ACK_MASK; // Set the ACK bit
-    else
-      Packet_Command &= ~PACKET_ACK_MASK; // Clear the ACK bit
+  uint16union_t idle;
+  idle.l = Idle_GetPercent(Packet_Parameter1(packet) == 0x02);
 
-    Packet_Put(Packet_Command, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3); // Send the ACK/NAK packet back out
-  }
+  return Packet_Put(CMD_IDLE, 0x01, idle.s.Lo, idle.s.Hi);
 }
-  
 
 
 
@@ -407,31 +278,49 @@ static void InitThread(void* pData)
   FTM0Channel0.channelNb           = 0;
   FTM0Channel0.timerFunction       = TIMER_FUNCTION_OUTPUT_COMPARE;
   FTM0Channel0.ioType.outputAction = TIMER_OUTPUT_LOW;
-  FTM0Channel0.semaphore           = FTM0Semaphore;
+  FTM0Channel0.semaphore           = Dispatch_Semaphore(DISPATCH_FTM0);
 
-  TAccelSetup accelSetup; // Struct to set up the accelerometer via I2C0
-  accelSetup.moduleClk             = CPU_BUS_CLK_HZ;
-  accelSetup.dataReadySemaphore    = AccelSemaphore;
-  accelSetup.readCompleteSemaphore = I2CSemaphore;
+  TI2CModule i2cModule; // Struct to set up I2C0, shared by the devices on it
+  i2cModule.readCompleteSemaphore = Dispatch_Semaphore(DISPATCH_I2C);
 
+  TAccelSetup accelSetup; // Struct to set up the accelerometer on I2C0
+  accelSetup.linkBaudRate          = BAUDRATE;
+  accelSetup.dataReadySemaphore    = Dispatch_Semaphore(DISPATCH_ACCEL);
+
+  DMA_Init();
   Packet_Init(BAUDRATE, CPU_BUS_CLK_HZ, PacketSemaphore);
+
+  // Tower-level commands - other modules register their own commands in their Init functions
+  Packet_RegisterHandler(CMD_STARTUP, HandleStartupPacket, PACKET_FLAG_NONE);
+  Packet_RegisterHandler(CMD_VERSION, HandleVersionPacket, PACKET_FLAG_NONE);
+  Packet_RegisterHandler(CMD_NUMBER, HandleNumberPacket, PACKET_FLAG_NONE);
+  Packet_RegisterHandler(CMD_TOWERMODE, HandleTowerModePacket, PACKET_FLAG_NONE);
+  Packet_RegisterHandler(CMD_SETTIME, HandleSetTimePacket, PACKET_FLAG_NONE);
+  Packet_RegisterHandler(CMD_IDLE, HandleIdlePacket, PACKET_FLAG_NONE);
+
+  Bench_Init();
+  ISRStats_Init();
+  Threads_Init();
+  Trace_Init();
   Flash_Init();
   LEDs_Init();
   FTM_Init();
   FTM_Set(&FTM0Channel0);
-  PIT_Init(CPU_BUS_CLK_HZ, FTM0Semaphore);
-  // RTC_Init(RTCSemaphore);
-  Accel_Init(&accelSetup));
+  PIT_Init(CPU_BUS_CLK_HZ, Dispatch_Semaphore(DISPATCH_PIT));
+  // RTC_Init(Dispatch_Semaphore(DISPATCH_RTC));
+  SIM_SCGC6 |= SIM_SCGC6_RTC_MASK; // Set time still reaches the RTC registers, which fault with its clock gate off
+  I2C_Init(&i2cModule, CPU_BUS_CLK_HZ);
+  Accel_Init(&accelSetup);
+  I2CLoad_Init();
 
   // Polling mode by default for accelerometer
   PIT_Set(1000000000, true);
   PIT_Enable(true);
-  synchronousMode = false;
   Accel_SetMode(ACCEL_POLL);
 
   // Startup protocol
   LEDs_On(LED_ORANGE);
-  HandleStartupPacket();
+  HandleStartupPacket(NULL); // The startup reply does not depend on any parameters
 
   __EI(); // Enable interrupts
 
@@ -439,128 +328,170 @@ static void InitThread(void* pData)
 }
 
 
-/*! @brief Thread to send the time from the RTC back to the PC
- *  set as high priority to avoid clock desyncing
+/*! @brief Handler to send the time from the RTC back to the PC
+ *  the highest priority event to avoid clock desyncing
  */
-static void RTCThread(void* pData)
+static void RTCHandler(void)
 {
-  for (;;)
-  {
-    // wait for RTC_ISR to signal
-    OS_SemaphoreWait(RTCSemaphore,0);
+  ISR_STATS_WOKEN(ISR_STATS_RTC);
 
-    // Get and send time back to PC, just as in HandleSetTimePacket
-    uint8_t seconds, minutes, hours;
-    RTC_Get(&seconds, &minutes, &hours);
+  // Get and send time back to PC, just as in HandleSetTimePacket
+  uint8_t seconds, minutes, hours;
+  RTC_Get(&seconds, &minutes, &hours);
 
-    LEDs_Toggle(LED_YELLOW);
-    Packet_Put(CMD_SETTIME, seconds, minutes, hours);
-  }
+  LEDs_Toggle(LED_YELLOW);
+  Packet_Put(CMD_SETTIME, seconds, minutes, hours);
 }
 
 
-/*! @brief Thread to do something once the FTM0 timer expires
+/*! @brief Handler to do something once the FTM0 timer expires
  */
-static void FTM0Thread(void* pData)
+static void FTM0Handler(void)
 {
-  for (;;)
-  {
-    // wait for FTM0_ISR to signal
-    OS_SemaphoreWait(FTM0Semaphore,0);
+  ISR_STATS_WOKEN(ISR_STATS_FTM0);
 
-    LEDs_Off(LED_BLUE);
-  }
+  LEDs_Off(LED_BLUE);
 }
 
-/*! @brief Thread to do something periodically according to the PIT period setting
+/*! @brief Handler to do something periodically according to the PIT period setting
  * currently used for Lab 4 polling mode readings (asynchronous mode)
  */
-static void PITThread(void* pData)
+static void PITHandler(void)
 {
-  for (;;)
-  {
-    // wait for PIT_ISR to signal
-    OS_SemaphoreWait(PITSemaphore,0);
+  ISR_STATS_WOKEN(ISR_STATS_PIT);
 
-    // shift new data into old before getting new data
-    accelDataOld.bytes[0] = accelDataNew.bytes[0];
-    accelDataOld.bytes[1] = accelDataNew.bytes[1];
-    accelDataOld.bytes[2] = accelDataNew.bytes[2];
+  uint8_t size = Accel_SampleSize();
+  uint8_t sizeOld = accelDataSize;
 
-    Accel_ReadXYZ(accelDataNew.bytes);
+  // shift new data into old before getting new data
+  accelDataOld = accelDataNew;
 
-   // If any axes are new, send the packet and toggle green LED
-     if((accelDataOld.bytes[0] != accelDataNew.bytes[0]) ||
-        (accelDataOld.bytes[1] != accelDataNew.bytes[1]) ||
-        (accelDataOld.bytes[2] != accelDataNew.bytes[2]))
-    {
-      Packet_Put(CMD_ACCEL, accelDataNew.bytes[0], accelDataNew.bytes[1], accelDataNew.bytes[2]);
-      LEDs_Toggle(LED_GREEN);
-    }
+  Accel_ReadXYZ(accelDataNew.bytes);
+  accelDataSize = size;
+
+  // If any axes are new, or the resolution changed, send the packet and toggle green LED
+  if ((size != sizeOld) || memcmp(accelDataOld.bytes, accelDataNew.bytes, size))
+  {
+    Accel_Stream(&accelDataNew);
+    LEDs_Toggle(LED_GREEN);
   }
+  else
+    Accel_StreamCheck(); // Samples already waiting in a frame are not held back for long
 }
 
-/*! @brief Thread to read accelerometer data via Accel_ISR signaling
+/*! @brief Starts reading a burst from the accelerometer FIFO into FIFOData, noting the sample size it is read at
  */
-static void AccelThread(void* pData)
+static void StartBurst(void)
 {
-  for (;;)
-  {
-    // wait for FIFO or UART to signal
-    OS_SemaphoreWait(AccelSemaphore,0);
+  FIFOSampleSize = Accel_SampleSize();
+  FIFOCount = Accel_ReadFIFO(FIFOData);
+}
 
+/*! @brief Handler to read accelerometer data when AccelDataReady_ISR posts DISPATCH_ACCEL
+ */
+static void AccelHandler(void)
+{
+  ISR_STATS_WOKEN(ISR_STATS_ACCEL);
+
+  if (Accel_GetMode() != ACCEL_FIFO)
+  {
+    accelDataSize = Accel_SampleSize();
     Accel_ReadXYZ(accelDataNew.bytes);
   }
+  else if (FIFOCount == 0)
+    StartBurst();
+  else
+    FIFOAgain = true; // FIFOData is still in use - I2CHandler starts the next burst once it is done with it
 }
 
 
-/*! @brief Thread to median filter and send data back to PC via I2C_ISR signaling
+/*! @brief Handler to median filter and send data back to PC when I2C_ISR posts DISPATCH_I2C
  */
-static void I2CThread(void* pData)
+static void I2CHandler(void)
 {
-  for (;;)
-  {
-    // wait for FIFO or UART to signal
-    OS_SemaphoreWait(I2CSemaphore,0);
+  ISR_STATS_WOKEN(ISR_STATS_I2C);
 
-    // This thread copies some code from Accel_ReadXYZ due to order problems with synchronous mode
+  TI2CStatus status = I2C_IntReadStatus();
 
-    // array of 3 unions and to save data from the 3 most recent Accel_ReadXYZ calls
-    static TAccelData accelData[3] = {{0,0,0},{0,0,0}};
+  // A read that failed is dropped. After a timeout or lost arbitration INT1 is still asserted and will not fall
+  // again, so the read is started over - not after a NAK, which would only fail again
+  if (status != I2C_OK)
+  {
+    FIFOCount = 0;
 
-    // shifts data in the array unions back (index 0 is most recent data, 2 is oldest data)
-    for (uint8_t i = 0; i < 3; i++)
+    if (status != I2C_NAK)
     {
-      accelData[2].bytes[i] = accelData[1].bytes[i];
-      accelData[1].bytes[i] = accelData[0].bytes[i];
+      if (Accel_GetMode() == ACCEL_INT)
+      {
+        accelDataSize = Accel_SampleSize();
+        Accel_ReadXYZ(accelDataNew.bytes);
+      }
+      else if (Accel_GetMode() == ACCEL_FIFO)
+        FIFOAgain = true;
     }
+  }
+  else if (FIFOCount == 0)
+  {
+    // A sample read just before the resolution changed is dropped, as a burst is below
+    if (accelDataSize != Accel_SampleSize())
+      return;
 
-    // Populate newest array
-    accelData[0].bytes[0] = accelDataNew.bytes[0];
-    accelData[0].bytes[1] = accelDataNew.bytes[1];
-    accelData[0].bytes[2] = accelDataNew.bytes[2];
-
-    // Median filters the last 3 sets of XYZ data
-    for (uint8_t i = 0; i < 3; i++)
-      accelDataNew.bytes[i] = Median_Filter3(accelData[0].bytes[i], accelData[1].bytes[i], accelData[2].bytes[i]);
+    Accel_Filter(&accelDataNew);
 
     // Send data back to PC
-    Packet_Put(CMD_ACCEL, accelDataNew.bytes[0], accelDataNew.bytes[1], accelDataNew.bytes[2]);
+    Accel_Stream(&accelDataNew);
     LEDs_Toggle(LED_GREEN);
+    return;
+  }
+
+  // A FIFO burst - each sample is filtered, and sent only if it changed as in polling mode. A burst started before
+  // the resolution changed is laid out at the old sample size, which the filter and stream no longer expect, so it is dropped
+  uint8_t size = FIFOSampleSize;
+  uint8_t nbSamples = (size == Accel_SampleSize()) ? FIFOCount : 0;
+
+  for (uint8_t i = 0; i < nbSamples; i++)
+  {
+    uint8_t sizeOld = accelDataSize;
+
+    accelDataOld = accelDataNew;
+    memcpy(accelDataNew.bytes, &FIFOData[i * size], size);
+    accelDataSize = size;
+    Accel_Filter(&accelDataNew);
+
+    if ((size != sizeOld) || memcmp(accelDataOld.bytes, accelDataNew.bytes, size))
+    {
+      Accel_Stream(&accelDataNew);
+      LEDs_Toggle(LED_GREEN);
+    }
+  }
+
+  Accel_StreamCheck();
+  FIFOCount = 0;
+
+  if (FIFOAgain)
+  {
+    FIFOAgain = false;
+    StartBurst();
   }
 }
 
 
-/*! @brief Thread to handle packets taken from the FIFO
- *  does not wait for any semaphore (ie. would run forever), but has lowest priority
- *  and so can be interrupted by any ISR and be placed on waiting for any other thread
+/*! @brief Thread to handle packets taken from the queue
+ *  waits for UART_ISR to signal that it has queued a packet,
+ *  so when there is no traffic the CPU falls through to the idle thread and sleeps
  */
 static void PacketThread(void* pData)
 {
+  TPacket packet; // The packet being handled - received packets keep queueing behind it
+
   for (;;)
   {
-    if (Packet_Get()) // If a packet is received.
-      HandlePacket(); // Handle the packet appropriately.
+    // wait for UART_ISR to signal - once per packet it has parsed into the queue
+    OS_SemaphoreWait(PacketSemaphore,0);
+    ISR_STATS_WOKEN(ISR_STATS_UART);
+
+    if (Packet_Get(&packet)) // If a packet is received.
+      Packet_Handle(&packet); // Handle the packet through its registered handler.
   }
 }
 
@@ -581,52 +512,37 @@ int main(void)
   // Initialize the RTOS - without flashing the orange LED "heartbeat"
   OS_Init(CPU_CORE_CLK_HZ, false);
 
+  // RTOS Semaphore - initialised as 0 (ie. the packet thread can't run before being signaled)
+  PacketSemaphore = OS_SemaphoreCreate(0);
+
+  // Peripheral events in priority order - one worker thread runs them all, or each gets a thread with DISPATCH_THREADS
+  Dispatch_Init();
+  DISPATCH_REGISTER(DISPATCH_RTC, RTCHandler);
+  DISPATCH_REGISTER(DISPATCH_FTM0, FTM0Handler);
+  DISPATCH_REGISTER(DISPATCH_PIT, PITHandler);
+  DISPATCH_REGISTER(DISPATCH_ACCEL, AccelHandler);
+  DISPATCH_REGISTER(DISPATCH_I2C, I2CHandler);
+
 
   /*  Creating all threads; parameters are:
    *  1. Thread name (address)
    *  2. Arguments (which are all of type void* pData)
-   *  3. Pointer to thread stack with [STACK_SIZE]
+   *  3. Thread stack array - painted so its high-water mark can be read with CMD_THREADS
    *  4. Priority (0 is highest)
    */
-  error = OS_ThreadCreate(InitThread,
+  error = THREADS_CREATE(InitThread,
           NULL,
-          &InitThreadStack[THREAD_STACK_SIZE - 1],
+          InitThreadStack,
 	  0);
 
-  error = OS_ThreadCreate(RTCThread,
+  error = THREADS_CREATE(PacketThread,
           NULL,
-          &RTCThreadStack[THREAD_STACK_SIZE - 1],
-	  1);
-
-	  
-  // threads 2 & 3 are inside UART.c
-  
-
-  error = OS_ThreadCreate(FTM0Thread,
-          NULL,
-          &FTM0ThreadStack[THREAD_STACK_SIZE - 1],
-	  4);
-
-  error = OS_ThreadCreate(PITThread,
-          NULL,
-          &PITThreadStack[THREAD_STACK_SIZE - 1],
-	  5);
-
-  error = OS_ThreadCreate(AccelThread,
-          NULL,
-          &AccelThreadStack[THREAD_STACK_SIZE - 1],
-	  6);
-
-  error = OS_ThreadCreate(I2CThread,
-          NULL,
-          &I2CThreadStack[THREAD_STACK_SIZE - 1],
-	  7);
-	  
-  error = OS_ThreadCreate(PacketThread,
-          NULL,
-          &PacketThreadStack[THREAD_STACK_SIZE - 1],
+          PacketThreadStack,
 	  8);
 	  
+  // Lowest priority thread - sleeps the CPU whenever every other thread is blocked
+  Idle_Init();
+
   // Start multithreading - never returns!
   // NOTE that this still runs threads that are created in lower levels inside modules
   OS_Start();
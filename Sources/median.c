@@ -41,4 +41,24 @@ uint8_t Median_Filter3(const uint8_t n1, const uint8_t n2, const uint8_t n3)
 		return n3;
 	}
   }
-}
\ No newline at end of file
+}
+
+
+
+int16_t Median_Filter3Int16(const int16_t n1, const int16_t n2, const int16_t n3)
+{
+  if (n1 > n2)
+  {
+    if (n2 > n3)
+      return n2;
+    else
+      return (n1 > n3) ? n3 : n1;
+  }
+  else
+  {
+    if (n3 > n2)
+      return n2;
+    else
+      return (n1 > n3) ? n1 : n3;
+  }
+}
@@ -27,4 +27,12 @@
  */
 uint8_t Median_Filter3(const uint8_t n1, const uint8_t n2, const uint8_t n3);
 
+/*! @brief Median filters 3 signed 16-bit values.
+ *
+ *  @param n1 is the first  of 3 values for which the median is sought.
+ *  @param n2 is the second of 3 values for which the median is sought.
+ *  @param n3 is the third  of 3 values for which the median is sought.
+ */
+int16_t Median_Filter3Int16(const int16_t n1, const int16_t n2, const int16_t n3);
+
 #endif
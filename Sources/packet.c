@@ -18,86 +18,337 @@
 #include "FTM.h"
 #include "LEDs.h"
 #include "OS.h"
+#include "ISRStats.h"
+#include "Trace.h"
+#include "Cpu.h"
+#include <string.h>
+
+// Stops the compiler from moving queue accesses across an index update
+// A single-core Cortex-M4 needs no hardware barrier for this
+#define QUEUE_BARRIER() __asm volatile ("" ::: "memory")
 
 
-TPacket Packet; // Declaration of new packet structure as of lab 2
 const uint8_t PACKET_ACK_MASK = 0x80; // Acknowledgment Bit Mask in Hex
 
+static TPacketParser Parser; // Parser for the bytes received by the UART, only used by UART_ISR
+
+// Semaphore signalled from UART_ISR once per packet queued
+static OS_ECB* PacketSemaphore;
 
+// Received packets waiting to be handled - free-running indices, masked on access
+// UART_ISR is the only producer and the packet thread the only consumer
+static TPacket Queue[PACKET_QUEUE_SIZE];
+static volatile uint16_t QueueStart;
+static volatile uint16_t QueueEnd;
 
-bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk, ECB* semaphore)
+// Counters reported by CMD_UART_STATS, only written by UART_ISR
+static uint32_t NbDropped;  // packets completed while the queue was full
+static uint16_t MaxWaiting; // most packets ever waiting in the queue
+
+// Handler table indexed by the command byte with the ACK bit stripped
+static struct
 {
-  return UART_Init(baudRate, moduleClk, semaphore); // Simply send parameters along to UART_Init
-}
+  TPacketHandler handler;
+  uint8_t flags;
+} Handlers[PACKET_NB_COMMANDS];
 
 
-// Might not be able to use a while loop for lab 5?
 
-bool Packet_Get(void)
+/*! @brief Receive callback - parses each batch of bytes straight into the queue from UART_ISR
+ *
+ *  @param data The received bytes.
+ *  @param nbBytes The number of bytes in data.
+ *  @note A packet completed while the queue is full is dropped and counted, as the bytes behind it keep arriving.
+ */
+static void ReceiveBytes(const uint8_t* const data, const uint8_t nbBytes)
 {
-  static uint8_t packetArray[5] = {0}; // Array to temporarily hold packet parameters before they form a full packet
-  static uint8_t packetIndex    = 0; // Index to the packet array
+  TPacket dropped; // Where a packet goes when there is no room for it
+  uint8_t nbDone = 0;
 
-  // As long as there are parameters in the FIFO, keep taking them out
-  while (UART_InChar(&packetArray[packetIndex]))
+  while (nbDone < nbBytes)
   {
+    uint16_t end = QueueEnd;
+    uint16_t nbWaiting = end - QueueStart;
+    bool full = (nbWaiting >= PACKET_QUEUE_SIZE);
+    uint32_t nbPackets = Parser.nbPackets;
 
-    // Once we have all 5 elements of a packet we can begin testing for validity and using it
-    if (packetIndex == 4)
+    // Parse straight into the next free slot of the queue, stopping at the end of each packet
+    nbDone += Packet_ParserPutSpan(&Parser, &data[nbDone], nbBytes - nbDone,
+                                   full ? &dropped : &Queue[end & (PACKET_QUEUE_SIZE - 1)]);
+
+    if ((Parser.nbPackets != nbPackets) && full)
+      NbDropped++;
+    else if (Parser.nbPackets != nbPackets)
     {
-      // XOR of all previous parameters is the valid checksum
-      uint8_t validChecksum = (packetArray[0] ^ packetArray[1]) ^ (packetArray[2] ^ packetArray[3]);
-
-      if (packetArray[4] == validChecksum) // If the checksum is valid copy the packet across
-      {
-        Packet_Command    = packetArray[0];
-        Packet_Parameter1 = packetArray[1];
-        Packet_Parameter2 = packetArray[2];
-        Packet_Parameter3 = packetArray[3];
-        Packet_Checksum   = packetArray[4];
-
-        // Concatenated parameters
-        Packet_Parameter12 = (((uint16_t)(Packet_Parameter1 << 8)) || ((uint16_t)(Packet_Parameter2)));
-        Packet_Parameter23 = (((uint16_t)(Packet_Parameter2 << 8)) || ((uint16_t)(Packet_Parameter3)));
-
-	packetIndex = 0; // Reset packetIndex to allow a new packet to be built
-
-	// Upon receiving a valid packet from the PC, turn on the Blue LED for 1s
-	TFTMChannel FTM0Channel0; // Struct to start a timer in Channel 0
-	FTM0Channel0.channelNb  = 0;
-	FTM0Channel0.delayCount = 1;
-
-	LEDs_On(LED_BLUE);
-	FTM_StartTimer(&FTM0Channel0);
-
-	return true;
-      }
-      else // If the checksum fails to validate shift the packet along so it can eventually re-sync
-      {
-        for (uint8_t i = 0 ; i < 4 ; i++)
-          packetArray[i] = packetArray[i+1];
-      }
+      // Publish the packet to the packet thread, then wake it
+      QUEUE_BARRIER();
+      QueueEnd = end + 1;
+
+      if (nbWaiting >= MaxWaiting)
+        MaxWaiting = nbWaiting + 1;
+
+      OS_SemaphoreSignal(PacketSemaphore);
+      ISR_STATS_SIGNAL(ISR_STATS_UART);
     }
-    else // Increment the index so that we can get the next byte in the packet from the FIFO
-      packetIndex++;
   }
+}
+
+
+
+/*!
+ * @brief Handles a UART Statistics packet - reports what the link received, and what was lost on the way in
+ *
+ * Parameter1 = 1 for GET, 2 for GET and clear the counters
+ * Parameter2 = 0, Parameter3 = 0
+ * Reply: an extended frame of 32-bit values, LSB first - receive interrupts, bytes received, receiver overruns,
+ *        packets queued, bytes discarded while re-synchronizing, packets dropped because the queue was full,
+ *        and the most packets that have waited in the queue at once.
+ *
+ * @param packet The received packet.
+ * @return bool - TRUE if the packet was handled successfully, FALSE if parameters out of range.
+ */
+static bool HandleUARTStatsPacket(const TPacket* const packet)
+{
+  if ((Packet_Parameter1(packet) != 0x01) && (Packet_Parameter1(packet) != 0x02))
+    return false;
+
+  bool reset = (Packet_Parameter1(packet) == 0x02);
+  TUARTStats stats;
+  uint32_t values[7];
+  uint8_t payload[4 * 7];
+
+  UART_GetStats(&stats, reset);
+
+  EnterCritical(); // UART_ISR updates the counters
+
+  values[0] = stats.rxInterrupts;
+  values[1] = stats.rxBytes;
+  values[2] = stats.rxOverruns;
+  values[3] = Parser.nbPackets - NbDropped;
+  values[4] = Parser.nbDiscarded;
+  values[5] = NbDropped;
+  values[6] = MaxWaiting;
+
+  if (reset)
+  {
+    Parser.nbPackets   = 0;
+    Parser.nbDiscarded = 0;
+    NbDropped  = 0;
+    MaxWaiting = 0;
+  }
+
+  ExitCritical();
+
+  for (uint8_t i = 0; i < 7; i++)
+    for (uint8_t j = 0; j < 4; j++)
+      payload[(4 * i) + j] = (uint8_t)(values[i] >> (8 * j));
+
+  return Packet_PutFrame(CMD_UART_STATS, payload, sizeof(payload));
+}
+
+
+
+bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk, OS_ECB* semaphore)
+{
+  Packet_ParserInit(&Parser);
+  PacketSemaphore = semaphore;
 
-  return false; // If there is nothing in the FIFO, return false
+  return (UART_Init(baudRate, moduleClk, ReceiveBytes) && // Packets are parsed as UART_ISR receives them
+          Packet_RegisterHandler(CMD_UART_STATS, HandleUARTStatsPacket, PACKET_FLAG_NO_ACK));
+}
+
+
+
+void Packet_ParserInit(TPacketParser* const parser)
+{
+  parser->oldest      = 0;
+  parser->count       = 0;
+  parser->sum         = 0;
+  parser->nbPackets   = 0;
+  parser->nbDiscarded = 0;
+}
+
+
+
+bool Packet_ParserPutByte(TPacketParser* const parser, const uint8_t data, TPacket* const packet)
+{
+  // Slot after the newest byte in the circular window
+  uint8_t index = parser->oldest + parser->count;
+
+  if (index >= PACKET_NB_BYTES)
+    index -= PACKET_NB_BYTES;
+
+  parser->window[index] = data;
+  parser->sum ^= data;
+
+  if (++parser->count < PACKET_NB_BYTES)
+    return false; // Not a whole packet yet
+
+  // The checksum is the XOR of the other four bytes, so a valid packet XORs to 0
+  if (parser->sum == 0)
+  {
+    // Unroll the window into the packet starting from its oldest byte
+    uint8_t nbTail = PACKET_NB_BYTES - parser->oldest;
+
+    memcpy(&packet->bytes[0], &parser->window[parser->oldest], nbTail);
+    memcpy(&packet->bytes[nbTail], &parser->window[0], parser->oldest);
+
+    parser->oldest = 0;
+    parser->count  = 0;
+    parser->nbPackets++;
+
+    return true;
+  }
+
+  // Re-sync by dropping the oldest byte - it is removed from the running XOR rather than shifting the window
+  parser->sum ^= parser->window[parser->oldest];
+
+  if (++parser->oldest == PACKET_NB_BYTES)
+    parser->oldest = 0;
+
+  parser->count--;
+  parser->nbDiscarded++;
+
+  return false;
+}
+
+
+
+uint16_t Packet_ParserPutSpan(TPacketParser* const parser, const uint8_t* const data, const uint16_t nbBytes, TPacket* const packet)
+{
+  uint16_t i;
+
+  for (i = 0; i < nbBytes; i++)
+  {
+    if (Packet_ParserPutByte(parser, data[i], packet))
+      return i + 1; // Stop at the packet so the caller can deal with it before feeding the rest
+  }
+
+  return nbBytes;
+}
+
+
+
+uint8_t Packet_ParserNeeded(const TPacketParser* const parser)
+{
+  return PACKET_NB_BYTES - parser->count;
+}
+
+
+
+bool Packet_Get(TPacket* const packet)
+{
+  uint16_t start = QueueStart;
+
+  if (start == QueueEnd)
+    return false; // No packet is waiting
+
+  // Take the packet out, then hand the slot back to UART_ISR
+  *packet = Queue[start & (PACKET_QUEUE_SIZE - 1)];
+  QUEUE_BARRIER();
+  QueueStart = start + 1;
+
+  TRACE_EVENT(TRACE_PACKET_RX, Packet_Command(packet), Packet_Parameter12(packet));
+
+  // Upon receiving a valid packet from the PC, turn on the Blue LED for 1s
+  TFTMChannel FTM0Channel0; // Struct to start a timer in Channel 0
+  FTM0Channel0.channelNb  = 0;
+  FTM0Channel0.delayCount = 1;
+
+  LEDs_On(LED_BLUE);
+  FTM_StartTimer(&FTM0Channel0);
+
+  return true;
 }
 
 
 
 bool Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
 {
+  uint8_t packetArray[PACKET_NB_BYTES];
+
+  packetArray[0] = command;
+  packetArray[1] = parameter1;
+  packetArray[2] = parameter2;
+  packetArray[3] = parameter3;
+
   // Creating the checksum, which is the XOR of all previous parameters
-  uint8_t checksum = (command ^ parameter1) ^ (parameter2 ^ parameter3);
-
-  // Return the entire packet, one parameter at a time
-  return ((UART_OutChar(command)) &&
-          (UART_OutChar(parameter1)) &&
-          (UART_OutChar(parameter2)) &&
-          (UART_OutChar(parameter3)) &&
-          (UART_OutChar(checksum)));
+  packetArray[4] = (command ^ parameter1) ^ (parameter2 ^ parameter3);
+
+  TRACE_EVENT(TRACE_PACKET_TX, command, PACKET_NB_BYTES);
+
+  // Send the entire packet as one block so the transmitter is only armed once
+  return UART_Write(packetArray, PACKET_NB_BYTES);
+}
+
+
+
+bool Packet_PutFrame(const uint8_t command, const uint8_t* const payload, const uint8_t nbPayload)
+{
+  uint8_t frame[PACKET_FRAME_NB_BYTES(PACKET_FRAME_MAX_PAYLOAD)];
+  uint8_t checksum;
+
+  if (nbPayload > PACKET_FRAME_MAX_PAYLOAD)
+    return false;
+
+  frame[0] = command;
+  frame[1] = nbPayload;
+  memcpy(&frame[2], payload, nbPayload);
+
+  // The checksum is the XOR of every preceding byte in the frame
+  checksum = command ^ nbPayload;
+  for (uint8_t i = 0; i < nbPayload; i++)
+    checksum ^= payload[i];
+
+  frame[nbPayload + 2] = checksum;
+
+  // The trace's own frames are left out, or streaming it would keep adding to it
+  if (command != CMD_TRACE)
+    TRACE_EVENT(TRACE_PACKET_TX, command, PACKET_FRAME_NB_BYTES(nbPayload));
+
+  // Send the entire frame as one block so the transmitter is only armed once
+  return UART_Write(frame, PACKET_FRAME_NB_BYTES(nbPayload));
+}
+
+
+
+bool Packet_RegisterHandler(const uint8_t command, const TPacketHandler handler, const uint8_t flags)
+{
+  uint8_t index = command & ~PACKET_ACK_MASK;
+
+  Handlers[index].handler = handler;
+  Handlers[index].flags   = flags;
+
+  return true;
+}
+
+
+
+void Packet_Handle(const TPacket* const packet)
+{
+  bool ackReq = (Packet_Command(packet) & PACKET_ACK_MASK); // Holds whether an Acknowledgment is required
+  uint8_t command = Packet_Command(packet) & ~PACKET_ACK_MASK; // Strips the top bit of the Command Byte to ignore ACK bit
+
+  // A single indexed call - unregistered commands fail
+  TPacketHandler handler = Handlers[command].handler;
+  bool success = handler && (*handler)(packet);
+
+  /*!
+   * Check if the handling of the packet was a success and an ACK packet was requested
+   * If that checks out, set the ACK bit to 1
+   * Else, if the handling of the packet failed and an ACK packet was requested
+   * Leave the ACK bit clear in order to indicate a NAK (command could not be carried out)
+   * Finally, return the ACK packet to the Tower
+   */
+
+  if (ackReq && !(Handlers[command].flags & PACKET_FLAG_NO_ACK))
+  {
+    if (success)
+      command |= PACKET_ACK_MASK; // Set the ACK bit
+
+    // Send the ACK/NAK packet back out
+    Packet_Put(command, Packet_Parameter1(packet), Packet_Parameter2(packet), Packet_Parameter3(packet));
+  }
 }
 
 
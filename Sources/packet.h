@@ -13,6 +13,7 @@
 
 // New types
 #include "types.h"
+#include "OS.h"
 
 // Packet structure
 #define PACKET_NB_BYTES 5
@@ -51,32 +52,152 @@ typedef union
 
 #pragma pack(pop)
 
-#define Packet_Command     Packet.packetStruct.command
-#define Packet_Parameter1  Packet.packetStruct.parameters.separate.parameter1
-#define Packet_Parameter2  Packet.packetStruct.parameters.separate.parameter2
-#define Packet_Parameter3  Packet.packetStruct.parameters.separate.parameter3
-#define Packet_Parameter12 Packet.packetStruct.parameters.combined12.parameter12
-#define Packet_Parameter23 Packet.packetStruct.parameters.combined23.parameter23
-#define Packet_Checksum    Packet.packetStruct.checksum
+// Accessors for the fields of a received packet
+#define Packet_Command(packet)     ((packet)->packetStruct.command)
+#define Packet_Parameter1(packet)  ((packet)->packetStruct.parameters.separate.parameter1)
+#define Packet_Parameter2(packet)  ((packet)->packetStruct.parameters.separate.parameter2)
+#define Packet_Parameter3(packet)  ((packet)->packetStruct.parameters.separate.parameter3)
+#define Packet_Parameter12(packet) ((packet)->packetStruct.parameters.combined12.parameter12)
+#define Packet_Parameter23(packet) ((packet)->packetStruct.parameters.combined23.parameter23)
+#define Packet_Checksum(packet)    ((packet)->packetStruct.checksum)
 
-extern TPacket Packet;
+// Extended frames - command, payload length, payload, then the XOR of all of the preceding bytes
+#define PACKET_FRAME_MAX_PAYLOAD 33
+#define PACKET_FRAME_NB_BYTES(nbPayload) ((nbPayload) + 3)
+
+// Number of received packets that can wait to be handled - must be a power of 2. A handler erasing a flash sector
+// holds the packet thread for up to 113 ms (the K70 datasheet's maximum, 13 ms typical), in which 261 packets can
+// arrive at 115200 baud, so a burst sent during an erase is only lost at more than one erase per packet
+#define PACKET_QUEUE_SIZE 512
+
+/*! @brief State of an incremental packet parser.
+ *
+ *  The last PACKET_NB_BYTES received bytes are held in a circular window along with their running XOR,
+ *  so a failed checksum only drops the oldest byte rather than shifting the window along.
+ *  Each parser holds all of its own state, so separate byte streams can be parsed independently.
+ */
+typedef struct
+{
+  uint8_t window[PACKET_NB_BYTES]; /*!< Circular window of the most recently received bytes. */
+  uint8_t oldest;                  /*!< Index in the window of the oldest byte. */
+  uint8_t count;                   /*!< Number of bytes currently held in the window. */
+  uint8_t sum;                     /*!< XOR of the bytes in the window - 0 when a full window is a valid packet. */
+  uint32_t nbPackets;              /*!< Number of valid packets emitted. */
+  uint32_t nbDiscarded;            /*!< Number of bytes dropped while re-synchronizing. */
+} TPacketParser;
 
 // Acknowledgment bit mask
 extern const uint8_t PACKET_ACK_MASK;
 
+// Tower Protocols based on the command byte of each packet
+#define CMD_STARTUP   0x04
+#define CMD_PROGBYTE  0x07
+#define CMD_READBYTE  0x08
+#define CMD_VERSION   0x09
+#define CMD_MODE      0x0A
+#define CMD_NUMBER    0x0B
+#define CMD_SETTIME   0x0C
+#define CMD_TOWERMODE 0x0D
+#define CMD_ACCEL     0x10
+#define CMD_ACCEL_BATCH  0x11
+#define CMD_ACCEL_STREAM 0x12
+#define CMD_ACCEL_STREAM14 0x13
+#define CMD_ACCEL_CONFIG 0x14
+#define CMD_ACCEL_STATS  0x15
+#define CMD_I2C_STATS    0x16
+#define CMD_I2C_ERRORS   0x17
+#define CMD_I2C_BUS      0x18
+#define CMD_ACCEL_DELTA  0x19
+#define CMD_I2C_LOAD     0x1A
+#define CMD_IDLE      0x30
+#define CMD_BENCH     0x31
+#define CMD_ISRSTATS  0x32
+#define CMD_THREADS   0x33
+#define CMD_TRACE     0x34
+#define CMD_UART_STATS 0x35
+
+// Number of distinct commands - the command byte with the ACK bit stripped
+#define PACKET_NB_COMMANDS 128
+
+// Packet handler flags
+#define PACKET_FLAG_NONE   0x00 /*!< ACK/NAK is sent whenever the PC asks for one */
+#define PACKET_FLAG_NO_ACK 0x01 /*!< Never send an ACK/NAK - the handler's own reply already reports the result */
+
+/*! @brief A function that carries out the command in the received packet.
+ *
+ *  @param packet The received packet - replies are built in the handler's own buffer via Packet_Put.
+ *  @return bool - TRUE if the command was carried out successfully.
+ */
+typedef bool (*TPacketHandler)(const TPacket* const packet);
+
 /*! @brief Initializes the packets by calling the initialization routines of the supporting software modules.
  *
+ *  Received bytes are parsed in UART_ISR, straight into the queue of packets waiting to be handled.
  *  @param baudRate The desired baud rate in bits/sec.
  *  @param moduleClk The module clock rate in Hz.
+ *  @param semaphore A semaphore signalled from UART_ISR once for each packet queued.
  *  @return bool - TRUE if the packet module was successfully initialized.
  */
-bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk, ECB* semaphore);
+bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk, OS_ECB* semaphore);
+
+/*! @brief Resets a packet parser to an empty window and clears its counters.
+ *
+ *  @param parser The parser to reset.
+ */
+void Packet_ParserInit(TPacketParser* const parser);
+
+/*! @brief Feeds one received byte to a packet parser.
+ *
+ *  @param parser The parser to feed.
+ *  @param data The received byte.
+ *  @param packet Where to copy the packet if this byte completes a valid one.
+ *  @return bool - TRUE if a valid packet was completed and copied to packet.
+ *  @note Constant time - a failed checksum drops the oldest byte of the window without copying.
+ */
+bool Packet_ParserPutByte(TPacketParser* const parser, const uint8_t data, TPacket* const packet);
+
+/*! @brief Feeds a span of received bytes to a packet parser, stopping at the first valid packet.
+ *
+ *  @param parser The parser to feed.
+ *  @param data The received bytes.
+ *  @param nbBytes The number of bytes in data.
+ *  @param packet Where to copy the packet if one is completed.
+ *  @return uint16_t - the number of bytes consumed. If a packet was completed it ends at the last consumed byte,
+ *                     so any remaining bytes should be fed once the packet has been dealt with.
+ */
+uint16_t Packet_ParserPutSpan(TPacketParser* const parser, const uint8_t* const data, const uint16_t nbBytes, TPacket* const packet);
+
+/*! @brief Gets the number of bytes a packet parser needs before it can next complete a packet.
+ *
+ *  @param parser The parser to query.
+ *  @return uint8_t - between 1 and PACKET_NB_BYTES.
+ */
+uint8_t Packet_ParserNeeded(const TPacketParser* const parser);
 
 /*! @brief Attempts to get a packet from the received data.
  *
+ *  Takes the oldest packet from the queue UART_ISR parses into.
+ *  @param packet Where to copy the packet.
  *  @return bool - TRUE if a valid packet was received.
+ *  @note Only the packet thread may call it.
+ */
+bool Packet_Get(TPacket* const packet);
+
+/*! @brief Registers the function that handles a command.
+ *
+ *  @param command The command byte (the ACK bit is ignored).
+ *  @param handler The function to call when a packet with this command is received, or NULL to remove it.
+ *  @param flags A combination of PACKET_FLAG_* values.
+ *  @return bool - TRUE if the handler was registered.
+ */
+bool Packet_RegisterHandler(const uint8_t command, const TPacketHandler handler, const uint8_t flags);
+
+/*! @brief Handles a received packet by calling its registered handler, then sends an ACK/NAK if one was requested.
+ *
+ *  @param packet The packet returned by Packet_Get - it is not modified.
+ *  @note Unregistered commands are NAKed.
  */
-bool Packet_Get(void);
+void Packet_Handle(const TPacket* const packet);
 
 /*! @brief Builds a packet and places it in the transmit FIFO buffer.
  *
@@ -84,4 +205,13 @@ bool Packet_Get(void);
  */
 bool Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
 
+/*! @brief Builds an extended frame with a variable length payload and sends it in one block.
+ *
+ *  @param command The frame's command.
+ *  @param payload The bytes to carry in the frame.
+ *  @param nbPayload The number of bytes in payload, at most PACKET_FRAME_MAX_PAYLOAD.
+ *  @return bool - TRUE if the frame was sent.
+ */
+bool Packet_PutFrame(const uint8_t command, const uint8_t* const payload, const uint8_t nbPayload);
+
 #endif